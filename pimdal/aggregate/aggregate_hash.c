@@ -23,10 +23,37 @@
 #define NR_BUCKETS 16
 #define BUCKET_SIZE (AGG_TABLE_SIZE/NR_BUCKETS)
 
+// Radix partition the input in MRAM and aggregate every partition in WRAM
+// 0: off, 1: on
+#ifndef AGG_PARTITION
+#define AGG_PARTITION 0
+#endif
+
+#if AGG_PARTITION == 1
+// Fanout of a partitioning pass
+#define PART_FANOUT 16
+// Elements a tasklet buffers per bucket, all buffers use as much WRAM as the table
+#define PART_WC (AGG_TABLE_SIZE/(NR_TASKLETS*PART_FANOUT) > 0 ? AGG_TABLE_SIZE/(NR_TASKLETS*PART_FANOUT) : 1)
+// Table of every tasklet, the tasklets share the WRAM of the table
+#define PART_TABLE (AGG_TABLE_SIZE/NR_TASKLETS)
+// Input elements per partition, half of the table of a tasklet
+#define PART_FILL (PART_TABLE/2 > 0 ? PART_TABLE/2 : 1)
+// Most partitions, bounded by the MRAM of the partition offsets
+#define MAX_PART 16384
+#endif
+
 key_ptr_t* table;
 uint32_t out_pos = 0;
 uint32_t wb_pos;
 
+#if AGG_PARTITION == 1
+// Offsets of the partitions and of the elements of each tasklet in them
+uint32_t agg_hist[PART_FANOUT+1];
+uint32_t agg_tasklet_hist[NR_TASKLETS][PART_FANOUT];
+// Offsets of the partitions in MRAM
+__mram_noinit uint64_t agg_part_sizes[MAX_PART+1];
+#endif
+
 extern struct mutex_pool mutexes;
 extern const mutex_id_t mutex;
 
@@ -84,13 +111,14 @@ uint32_t hash_insert(key_ptr_t* in, uint32_t n,
 /*
     @param in_cache WRAM cache to write aggregated elements to output
     @param in_table hash table where elements where aggregated
+    @param n number of entries of the table
     @param out the output array in MRAM
 
     Write the aggreated elements in the shared table to the output
 */
-void output(key_ptr_t* in_cache, key_ptr_t* in_table, key_ptr_t* out) {
+void output(key_ptr_t* in_cache, key_ptr_t* in_table, uint32_t n, key_ptr_t* out) {
     uint32_t out_i = 0;
-    for (uint32_t i = 0; i < BUCKET_SIZE; i++) {
+    for (uint32_t i = 0; i < n; i++) {
         if (!empty(in_table[i])) {
             in_cache[out_i] = in_table[i];
             out_i++;
@@ -117,6 +145,292 @@ void output(key_ptr_t* in_cache, key_ptr_t* in_table, key_ptr_t* out) {
     }
 }
 
+#if AGG_PARTITION == 1
+/*
+    @param element element to partition
+
+    Hash selecting the partition of the element. The upper bits of hash0
+    multiplied by a large odd constant depend on all its bits, while the
+    tables use the lower bits of hash0.
+*/
+static inline uint32_t part_hash(key_ptr_t element) {
+    return hash0(element) * 0x9e3779b1;
+}
+
+/*
+    @param tasklet_id id of the calling tasklet
+    @param cache WRAM cache used for the input elements
+    @param in input elements in MRAM
+    @param n number of input elements
+    @param nr_buckets number of buckets used in this pass
+    @param shift which bits of the hash value to use in this pass
+
+    Count the elements of every bucket in the blocks of the tasklet.
+*/
+static void part_histogram(uint32_t tasklet_id, key_ptr_t* cache, key_ptr_t* in,
+                           uint32_t n, uint32_t nr_buckets, uint32_t shift) {
+
+    uint32_t *hist_loc = agg_tasklet_hist[tasklet_id];
+    for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
+        hist_loc[bucket] = 0;
+    }
+
+    for (uint32_t base = tasklet_id*BLOCK_SIZE; base < n; base += NR_TASKLETS*BLOCK_SIZE) {
+        uint32_t size = base + BLOCK_SIZE < n ? BLOCK_SIZE : n - base;
+        mram_read((__mram_ptr void*) (in + base), cache, size*sizeof(key_ptr_t));
+
+        for (uint32_t i = 0; i < size; i++) {
+            hist_loc[(part_hash(cache[i]) >> shift) & (nr_buckets-1)]++;
+        }
+    }
+}
+
+/*
+    @param tasklet_id id of the calling tasklet
+    @param nr_buckets number of buckets used in this pass
+
+    Turn the histograms of the tasklets into the offset of every bucket and
+    the offset of the elements of every tasklet in each bucket.
+*/
+static void part_prefix_sum(uint32_t tasklet_id, uint32_t nr_buckets) {
+    if (tasklet_id == 0) {
+        uint32_t offset = 0;
+        agg_hist[0] = 0;
+        for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
+            for (uint32_t tasklet = 0; tasklet < NR_TASKLETS; tasklet++) {
+                uint32_t count = agg_tasklet_hist[tasklet][bucket];
+                agg_tasklet_hist[tasklet][bucket] = offset;
+                offset += count;
+            }
+            agg_hist[bucket+1] = offset;
+        }
+    }
+}
+
+/*
+    @param tasklet_id id of the calling tasklet
+    @param cache WRAM cache used for the input elements
+    @param in input elements in MRAM
+    @param wc WRAM buffers of the calling tasklet, PART_WC elements per bucket
+    @param out partitions output in MRAM
+    @param n number of input elements
+    @param nr_buckets number of buckets used in this pass
+    @param shift which bits of the hash value to use in this pass
+
+    Write the blocks of the tasklet to its own range of every bucket, so no
+    locks are needed.
+*/
+static void part_write(uint32_t tasklet_id, key_ptr_t* cache, key_ptr_t* in, key_ptr_t* wc,
+                       key_ptr_t* out, uint32_t n, uint32_t nr_buckets, uint32_t shift) {
+
+    uint32_t *offset = agg_tasklet_hist[tasklet_id];
+    uint32_t fill[PART_FANOUT];
+    for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
+        fill[bucket] = 0;
+    }
+
+    for (uint32_t base = tasklet_id*BLOCK_SIZE; base < n; base += NR_TASKLETS*BLOCK_SIZE) {
+        uint32_t size = base + BLOCK_SIZE < n ? BLOCK_SIZE : n - base;
+        mram_read((__mram_ptr void*) (in + base), cache, size*sizeof(key_ptr_t));
+
+        for (uint32_t i = 0; i < size; i++) {
+            uint32_t bucket = (part_hash(cache[i]) >> shift) & (nr_buckets-1);
+            key_ptr_t *buffer = wc + bucket*PART_WC;
+
+            buffer[fill[bucket]] = cache[i];
+            fill[bucket]++;
+            if (fill[bucket] == PART_WC) {
+                mram_write(buffer, (__mram_ptr void*) (out + offset[bucket]), PART_WC*sizeof(key_ptr_t));
+                offset[bucket] += PART_WC;
+                fill[bucket] = 0;
+            }
+        }
+    }
+
+    for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
+        if (fill[bucket] > 0) {
+            mram_write(wc + bucket*PART_WC, (__mram_ptr void*) (out + offset[bucket]),
+                       fill[bucket]*sizeof(key_ptr_t));
+        }
+    }
+}
+
+/*
+    @param in WRAM cache of elements to aggregate
+    @param n number of elements
+    @param local_table hash table of the tasklet in WRAM
+    @param aggr aggregation function
+
+    Aggregate the elements into the table of the tasklet with linear probing.
+    The elements of new groups that do not fit into the full table are moved
+    to the front of the cache, returns their number.
+*/
+static uint32_t local_insert(key_ptr_t* in, uint32_t n, key_ptr_t* local_table,
+                             key_ptr_t (*aggr)(key_ptr_t curr_val, key_ptr_t element)) {
+
+    uint32_t wb_i = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t pos = hash0(in[i]) % PART_TABLE;
+
+        bool success = false;
+        for (uint32_t k = 0; k < PART_TABLE; k++) {
+            if (empty(local_table[pos])) {
+                local_table[pos] = in[i];
+                success = true;
+                break;
+            }
+            else if (duplicate(in[i], local_table[pos])) {
+                local_table[pos] = aggr(local_table[pos], in[i]);
+                success = true;
+                break;
+            }
+
+            pos = pos + 1 == PART_TABLE ? 0 : pos + 1;
+        }
+
+        if (!success) {
+            in[wb_i] = in[i];
+            wb_i++;
+        }
+    }
+
+    return wb_i;
+}
+
+/*
+    @param in elements of the partition in MRAM
+    @param n number of elements
+    @param cache WRAM cache of BLOCK_SIZE elements
+    @param local_table hash table of the tasklet in WRAM, all entries empty
+    @param out the output array in MRAM
+    @param aggr aggregation function
+
+    Aggregate a partition in the table of the tasklet and write its groups to
+    the output. If the partition has more groups than fit into the table, the
+    remaining elements are written back to the partition and aggregated again.
+*/
+static void aggregate_partition(key_ptr_t* in, uint32_t n, key_ptr_t* cache, key_ptr_t* local_table,
+                                key_ptr_t* out, key_ptr_t (*aggr)(key_ptr_t curr_val, key_ptr_t element)) {
+
+    while (n > 0) {
+        uint32_t wb_n = 0;
+        for (uint32_t base = 0; base < n; base += BLOCK_SIZE) {
+            uint32_t size = base + BLOCK_SIZE < n ? BLOCK_SIZE : n - base;
+            mram_read((__mram_ptr void*) (in + base), cache, size*sizeof(key_ptr_t));
+
+            uint32_t n_failed = local_insert(cache, size, local_table, aggr);
+            if (n_failed > 0) {
+                mram_write(cache, (__mram_ptr void*) (in + wb_n), n_failed*sizeof(key_ptr_t));
+                wb_n += n_failed;
+            }
+        }
+
+        output(cache, local_table, PART_TABLE, out);
+        memset(local_table, 0xff, PART_TABLE*sizeof(key_ptr_t));
+        n = wb_n;
+    }
+}
+
+/*
+    Main kernel for performing hash aggregation. The input is radix
+    partitioned in MRAM until a partition fills about half of a table, then
+    every tasklet aggregates whole partitions in its own table in WRAM. Every
+    element is read once per partitioning pass and once for aggregating,
+    however many groups there are. The input is overwritten.
+*/
+int group_kernel(aggr_arguments_t *input_args, aggr_results_t *result) {
+    uint32_t tasklet_id = me();
+    uint32_t n = input_args->size;
+    key_ptr_t* in = (key_ptr_t*) input_args->in;
+    key_ptr_t* out = (key_ptr_t*) input_args->out;
+
+    uint32_t part_n = 1;
+    while (part_n < MAX_PART && part_n * PART_FILL < n) {
+        part_n *= 2;
+    }
+
+    if (tasklet_id == 0) {
+        mem_reset(); // Reset the heap
+        // The program can be launched again without being reloaded
+        out_pos = 0;
+        uint64_t bounds = 0;
+        mram_write(&bounds, (__mram_ptr void*) agg_part_sizes, sizeof(uint64_t));
+        bounds = n;
+        mram_write(&bounds, (__mram_ptr void*) (agg_part_sizes + part_n), sizeof(uint64_t));
+    }
+    barrier_wait(&barrier);
+
+    key_ptr_t* cache = (key_ptr_t*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr_t));
+    key_ptr_t* wc = (key_ptr_t*) mem_alloc(PART_FANOUT*PART_WC*sizeof(key_ptr_t));
+
+    // Every pass splits the partitions with the next bits below the shift
+    uint32_t shift = 32;
+    key_ptr_t* src = in;
+    key_ptr_t* dst = out;
+    for (uint32_t partition_size = part_n, nr_buckets; partition_size > 1; partition_size /= nr_buckets) {
+        nr_buckets = partition_size >= PART_FANOUT ? PART_FANOUT : partition_size;
+        shift -= __builtin_ctz(nr_buckets);
+
+        for (uint32_t partition = 0; partition < part_n; partition += partition_size) {
+            uint64_t start, end;
+            mram_read((__mram_ptr void*) (agg_part_sizes + partition), &start, sizeof(uint64_t));
+            mram_read((__mram_ptr void*) (agg_part_sizes + partition + partition_size), &end, sizeof(uint64_t));
+            barrier_wait(&barrier);
+
+            part_histogram(tasklet_id, cache, src + start, end - start, nr_buckets, shift);
+            barrier_wait(&barrier);
+
+            part_prefix_sum(tasklet_id, nr_buckets);
+            barrier_wait(&barrier);
+
+            for (uint32_t bucket = tasklet_id; bucket < nr_buckets - 1; bucket += NR_TASKLETS) {
+                uint64_t bound = start + agg_hist[bucket+1];
+                uint32_t index = partition + (bucket+1)*(partition_size/nr_buckets);
+                mram_write(&bound, (__mram_ptr void*) (agg_part_sizes + index), sizeof(uint64_t));
+            }
+            barrier_wait(&barrier);
+
+            part_write(tasklet_id, cache, src + start, wc, dst + start, end - start, nr_buckets, shift);
+        }
+
+        key_ptr_t* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    barrier_wait(&barrier);
+    if (tasklet_id == 0) {
+        mem_reset();
+    }
+    barrier_wait(&barrier);
+
+    // The groups go to the buffer not holding the partitions
+    cache = (key_ptr_t*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr_t));
+    key_ptr_t* local_table = (key_ptr_t*) mem_alloc(PART_TABLE*sizeof(key_ptr_t));
+    memset(local_table, 0xff, PART_TABLE*sizeof(key_ptr_t));
+
+    for (uint32_t partition = tasklet_id; partition < part_n; partition += NR_TASKLETS) {
+        __dma_aligned uint64_t bounds[2];
+        mram_read((__mram_ptr void*) (agg_part_sizes + partition), bounds, 2*sizeof(uint64_t));
+
+        aggregate_partition(src + bounds[0], bounds[1] - bounds[0], cache, local_table, dst, input_args->aggr);
+    }
+    barrier_wait(&barrier);
+
+    if (dst != out) {
+        for (uint32_t base = tasklet_id*BLOCK_SIZE; base < out_pos; base += NR_TASKLETS*BLOCK_SIZE) {
+            uint32_t size = base + BLOCK_SIZE < out_pos ? BLOCK_SIZE : out_pos - base;
+            mram_read((__mram_ptr void*) (dst + base), cache, size*sizeof(key_ptr_t));
+            mram_write(cache, (__mram_ptr void*) (out + base), size*sizeof(key_ptr_t));
+        }
+        barrier_wait(&barrier);
+    }
+
+    result->t_count = out_pos;
+
+    return 0;
+}
+#else
 /*
     Main kernel for performing hash aggregation
 */
@@ -127,6 +441,9 @@ int group_kernel(aggr_arguments_t *input_args, aggr_results_t *result) {
         mem_reset(); // Reset the heap
         table = mem_alloc(AGG_TABLE_SIZE*sizeof(key_ptr_t));
         memset(table, 0xff, AGG_TABLE_SIZE*sizeof(key_ptr_t));
+        // The program can be launched again without being reloaded
+        out_pos = 0;
+        wb_pos = 0;
     }
     // Barrier
     barrier_wait(&barrier);
@@ -174,7 +491,7 @@ int group_kernel(aggr_arguments_t *input_args, aggr_results_t *result) {
 
         // Write the inserted elements to the output
         for (uint32_t bucket = tasklet_id; bucket < NR_BUCKETS; bucket += NR_TASKLETS) {
-            output(cache_proj, table + bucket*BUCKET_SIZE, mram_base_addr_B);
+            output(cache_proj, table + bucket*BUCKET_SIZE, BUCKET_SIZE, mram_base_addr_B);
         }
 
         rem_size = wb_pos;
@@ -191,4 +508,5 @@ int group_kernel(aggr_arguments_t *input_args, aggr_results_t *result) {
     result->t_count = out_pos;
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
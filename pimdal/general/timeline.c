@@ -0,0 +1,93 @@
+/*
+* Per-tasklet timelines of the kernel phases
+*
+*/
+#include <stdint.h>
+#include <defs.h>
+#include <mram.h>
+#include <perfcounter.h>
+#include <barrier.h>
+
+#include "timeline.h"
+
+#if TRACE > 0
+
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 16
+#endif
+
+// Ring of the recorded events of each tasklet, read by the host
+__mram_noinit timeline_event_t timeline_events[NR_TASKLETS][TIMELINE_EVENTS];
+// Number of events recorded by each tasklet, can exceed the size of the ring
+__host uint64_t timeline_count[NR_TASKLETS];
+// Number of events not recorded because of TIMELINE_PHASE_EVENTS
+__host uint64_t timeline_dropped[NR_TASKLETS];
+
+// Open phases of each tasklet
+__dma_aligned timeline_event_t timeline_open[NR_TASKLETS][TIMELINE_DEPTH];
+uint32_t timeline_depth[NR_TASKLETS];
+// Events of each phase in the current launch
+uint32_t timeline_phase_count[NR_TASKLETS][NR_PHASES];
+
+// Barrier defined in calling code
+extern barrier_t barrier;
+
+void timeline_start(void) {
+    uint32_t tasklet_id = me();
+
+    if (tasklet_id == 0) {
+        perfcounter_config(COUNT_CYCLES, true);
+    }
+
+    timeline_count[tasklet_id] = 0;
+    timeline_dropped[tasklet_id] = 0;
+    timeline_depth[tasklet_id] = 0;
+    for (uint32_t phase = 0; phase < NR_PHASES; phase++) {
+        timeline_phase_count[tasklet_id][phase] = 0;
+    }
+    barrier_wait(&barrier);
+}
+
+void timeline_begin(uint32_t phase) {
+    uint32_t tasklet_id = me();
+
+    uint32_t depth = timeline_depth[tasklet_id]++;
+    // Phases nested deeper are not recorded
+    if (depth >= TIMELINE_DEPTH) {
+        return;
+    }
+
+    timeline_event_t *event = &timeline_open[tasklet_id][depth];
+    event->phase = phase;
+    event->depth = depth;
+    event->begin = perfcounter_get();
+}
+
+void timeline_end(void) {
+    uint64_t end = perfcounter_get();
+    uint32_t tasklet_id = me();
+
+    uint32_t depth = --timeline_depth[tasklet_id];
+    if (depth >= TIMELINE_DEPTH) {
+        return;
+    }
+
+    timeline_event_t *event = &timeline_open[tasklet_id][depth];
+    // Phases repeated in a loop would overwrite the rest of the launch
+    if (timeline_phase_count[tasklet_id][event->phase]++ >= TIMELINE_PHASE_EVENTS) {
+        timeline_dropped[tasklet_id]++;
+        return;
+    }
+
+    event->end = end;
+    uint32_t slot = timeline_count[tasklet_id]++ % TIMELINE_EVENTS;
+    mram_write(event, (__mram_ptr void*) &timeline_events[tasklet_id][slot], sizeof(timeline_event_t));
+}
+
+void timeline_barrier(barrier_t *wait_barrier) {
+    timeline_begin(PHASE_BARRIER);
+    barrier_wait(wait_barrier);
+    timeline_end();
+}
+
+#endif
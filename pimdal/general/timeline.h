@@ -0,0 +1,54 @@
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include <barrier.h>
+
+#include "timeline_event.h"
+
+// Record per-tasklet timelines of the phases, 0: off, 1: on
+#ifndef TRACE
+#define TRACE 0
+#endif
+
+#if TRACE > 0
+
+#if defined(PERF) && PERF > 0
+#error "TRACE and PERF both use the performance counter"
+#endif
+
+/*
+    Start the cycle counter and clear the events of the previous launch.
+    Called by all tasklets at the start of a launch.
+*/
+void timeline_start(void);
+
+/*
+    Open a phase of the calling tasklet.
+*/
+void timeline_begin(uint32_t phase);
+
+/*
+    Close the innermost open phase of the calling tasklet and record it.
+*/
+void timeline_end(void);
+
+/*
+    Wait at a barrier and record the waiting time as a phase.
+*/
+void timeline_barrier(barrier_t *barrier);
+
+#define TIMELINE_START() timeline_start()
+#define TIMELINE_BEGIN(phase) timeline_begin(phase)
+#define TIMELINE_END() timeline_end()
+#define TIMELINE_BARRIER(barrier) timeline_barrier(barrier)
+
+#else
+
+#define TIMELINE_START()
+#define TIMELINE_BEGIN(phase)
+#define TIMELINE_END()
+#define TIMELINE_BARRIER(barrier) barrier_wait(barrier)
+
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+#include <mram.h>
+#include <mutex_pool.h>
+
+#include "datatype.h"
+#include "hash_func.h"
+
+// Words cleared by a tasklet at once
+#define BLOOM_CLEAR 256
+
+/*
+    Register-blocked bloom filter in MRAM. Every key sets and tests its k = 4
+    bits in a single 64-bit word, so a probe costs one 8-byte read. hash0
+    selects the word, 6 bits each of the lower 12 bits of hash1 and hash2 the
+    bits inside it. The filter has a power of two number of words, so the
+    filters of all DPUs built with the same size can be ORed.
+*/
+
+// Mutexes defined in calling code
+extern struct mutex_pool mutexes;
+
+static inline uint32_t bloom_word(uint32_t key, uint32_t words) {
+    return hash0(key) & (words-1);
+}
+
+static inline uint64_t bloom_mask(uint32_t key) {
+    uint32_t one = hash1(key);
+    uint32_t two = hash2(key);
+    return ((uint64_t) 1 << (one & 63)) | ((uint64_t) 1 << ((one >> 6) & 63)) |
+           ((uint64_t) 1 << (two & 63)) | ((uint64_t) 1 << ((two >> 6) & 63));
+}
+
+/*
+    @param filter bloom filter in MRAM
+    @param words number of words of the filter
+    @param tasklet_id id of the calling tasklet
+    @param zero WRAM cache of BLOOM_CLEAR words
+
+    Clear the part of the filter of the tasklet. All tasklets have to clear
+    their part before inserting.
+*/
+void clear_blocked_bloom(uint64_t *filter, uint32_t words, uint32_t tasklet_id, uint64_t *zero) {
+    for (uint32_t i = 0; i < BLOOM_CLEAR; i++) {
+        zero[i] = 0;
+    }
+
+    for (uint32_t base = tasklet_id*BLOOM_CLEAR; base < words; base += NR_TASKLETS*BLOOM_CLEAR) {
+        uint32_t n = words - base < BLOOM_CLEAR ? words - base : BLOOM_CLEAR;
+        mram_write(zero, (__mram_ptr void*) (filter + base), n*sizeof(uint64_t));
+    }
+}
+
+/*
+    @param in WRAM cache of input elements
+    @param n number of elements
+    @param filter bloom filter in MRAM
+    @param words number of words of the filter
+
+    Set the bits of the input elements in the filter.
+*/
+void insert_blocked_bloom(key_ptr32 *in, uint32_t n, uint64_t *filter, uint32_t words) {
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t word = bloom_word(in[i].key, words);
+        uint64_t mask = bloom_mask(in[i].key);
+        __dma_aligned uint64_t bits;
+
+        mutex_pool_lock(&mutexes, word);
+        mram_read((__mram_ptr void*) (filter + word), &bits, sizeof(uint64_t));
+        if ((bits & mask) != mask) {
+            bits |= mask;
+            mram_write(&bits, (__mram_ptr void*) (filter + word), sizeof(uint64_t));
+        }
+        mutex_pool_unlock(&mutexes, word);
+    }
+}
+
+/*
+    @param in WRAM cache of input elements
+    @param out elements that hit in the filter, may be the input
+    @param n number of input elements
+    @param filter bloom filter in MRAM
+    @param words number of words of the filter
+
+    Probe the filter with the input elements and keep the ones that may have a
+    match. Returns the number of kept elements.
+*/
+uint32_t probe_blocked_bloom(key_ptr32 *in, key_ptr32 *out, uint32_t n, uint64_t *filter, uint32_t words) {
+    uint32_t selected = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t mask = bloom_mask(in[i].key);
+        __dma_aligned uint64_t bits;
+        mram_read((__mram_ptr void*) (filter + bloom_word(in[i].key, words)), &bits, sizeof(uint64_t));
+
+        if ((bits & mask) == mask) {
+            out[selected] = in[i];
+            selected++;
+        }
+    }
+
+    return selected;
+}
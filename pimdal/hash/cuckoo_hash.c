@@ -1,96 +1,138 @@
 #include "datatype.h"
-#include "hash_func.c"
+#include "hash_func.h"
 
-#define TABLE_2_SIZE 64
-#define NR_SUBTABLES 4
+#define TABLE_SIZE 256
+// Slots of a bucket, a probe compares all slots of a bucket
+#define BUCKET_SLOTS 4
+// Buckets of a table, a power of two so that a mask selects them. They fill
+// the table, elements that find no slot go to the overflow chain
+#define TABLE_BUCKETS (TABLE_SIZE/BUCKET_SLOTS)
+// Evictions before an element is moved to the overflow chain
+#define MAX_KICKS 64
+#define EMPTY_KEY 0xffffffff
+
+static inline uint32_t bucket_one(uint32_t key) {
+    return hash1(key) & (TABLE_BUCKETS-1);
+}
+
+static inline uint32_t bucket_two(uint32_t key) {
+    return hash2(key) & (TABLE_BUCKETS-1);
+}
 
 /*
-    @param element element to insert into table
-    @param local_table hash table in WRAM
-    @param sel which hash function to use
+    @param table hash table in WRAM
+    @param bucket bucket to insert into
+    @param element element to insert
 
-    Tries to insert the element into the hash table.
+    Insert the element into a free slot of the bucket. Returns 1 if there was
+    a free slot.
 */
-key_ptr32 insert_table(key_ptr32 element, key_ptr32 *local_table, uint32_t sel) {
+static inline uint32_t bucket_insert(key_ptr32 *table, uint32_t bucket, key_ptr32 element) {
+    key_ptr32 *slots = table + bucket*BUCKET_SLOTS;
+    for (uint32_t slot = 0; slot < BUCKET_SLOTS; slot++) {
+        if (slots[slot].key == EMPTY_KEY) {
+            slots[slot] = element;
+            return 1;
+        }
+    }
 
-    uint32_t hash = hash_func[sel](element.key);
-    hash = hash % TABLE_2_SIZE;
+    return 0;
+}
 
-    if (local_table[sel*TABLE_2_SIZE + hash].key == 0) {
-        local_table[sel*TABLE_2_SIZE + hash] = element;
-        return (key_ptr32) {.key = 0, .ptr = 0};
+/*
+    @param table hash table in WRAM
+    @param bucket bucket to search
+    @param probe probed element
+    @param stream output of the matches
+
+    Compare the key with all slots of the bucket and emit the matching ones.
+*/
+static inline void bucket_probe(key_ptr32 *table, uint32_t bucket, key_ptr32 probe, match_stream_t *stream) {
+    key_ptr32 *slots = table + bucket*BUCKET_SLOTS;
+    for (uint32_t slot = 0; slot < BUCKET_SLOTS; slot++) {
+        if (slots[slot].key == probe.key) {
+            key_ptr32 joined = {.key = probe.ptr, .ptr = slots[slot].ptr};
+            stream_emit(stream, joined);
+        }
     }
-    else if (local_table[sel*TABLE_2_SIZE + hash].key == element.key) {
-        return (key_ptr32) {.key = 0, .ptr = 0};
+}
+
+/*
+    @param table hash table in WRAM
+    @param element element to insert
+
+    Insert the element into one of its two buckets, evicting elements to their
+    other bucket if both are full. Returns the element left without a slot
+    after MAX_KICKS evictions, or an element with EMPTY_KEY.
+*/
+static key_ptr32 cuckoo_insert(key_ptr32 *table, key_ptr32 element) {
+    uint32_t bucket = bucket_one(element.key);
+    if (bucket_insert(table, bucket, element)) {
+        return (key_ptr32) {.key = EMPTY_KEY, .ptr = 0};
     }
 
-    key_ptr32 evicted = local_table[sel*TABLE_2_SIZE + hash];
-    local_table[sel*TABLE_2_SIZE + hash] = element;
+    bucket = bucket_two(element.key);
+    for (uint32_t kick = 0; kick < MAX_KICKS; kick++) {
+        if (bucket_insert(table, bucket, element)) {
+            return (key_ptr32) {.key = EMPTY_KEY, .ptr = 0};
+        }
+
+        // Evict a slot depending on the key, so that the evictions do not cycle
+        uint32_t slot = bucket*BUCKET_SLOTS + ((element.key + kick) & (BUCKET_SLOTS-1));
+        key_ptr32 evicted = table[slot];
+        table[slot] = element;
+        element = evicted;
+
+        uint32_t other = bucket_one(element.key);
+        bucket = other == bucket ? bucket_two(element.key) : other;
+    }
 
-    return evicted;
+    return element;
 }
 
 /*
     @param in WRAM cache of input elements
     @param n number of elements
-    @param table hash tables used
+    @param table hash table in WRAM, all keys set to EMPTY_KEY
+    @param table_id index of the table
 
-    Insert elements into the hash table using cuckoo hashing scheme.
+    Insert elements into the hash table using bucketized cuckoo hashing with
+    two buckets per element. Elements that find no slot go to the overflow
+    chain of the table in MRAM, so no element is lost.
 */
-void hash_phase_two(key_ptr32* in, uint32_t n, key_ptr32 *table) {
+void hash_phase_two(key_ptr32* in, uint32_t n, key_ptr32 *table, uint32_t table_id) {
     for (uint32_t i = 0; i < n; i++) {
-        key_ptr32 el = in[i];
-        uint32_t sel = 0;
-        //uint32_t success = 0;
-        for (uint32_t iter = 0; iter < 256; iter++) {
-            el = insert_table(el, table, sel);
-            sel = (sel + 1) % NR_SUBTABLES;
-            if (el.key == 0) {
-                //success = 1;
-                break;
-            }
+        key_ptr32 el = cuckoo_insert(table, in[i]);
+        if (el.key != EMPTY_KEY) {
+            chain_append(table_id, el);
         }
-        //if (!success) {
-            //printf("Miss %u size: %u\n", el.key, n);
-        //}
     }
 }
 
 /*
     @param in WRAM cache of elements to probe
-    @param out WRAM cache output of elements found
-    @param table hash table in WRAM
     @param n number of input elements
+    @param table hash table in WRAM
+    @param table_id index of the table
+    @param stream output of the matches
 
-    Probes the table with the input elements using cuckoo hashing and writes ones that
-    hit to the output.
+    Probes the table with the input elements and emits every element of both
+    buckets and the overflow chain with the same key. The pointer
+    of the outer relation element becomes the new key.
 */
-uint32_t probe_table(key_ptr32 *in, key_ptr32 *out, key_ptr32 *table, uint32_t n) {
-    uint32_t out_i = 0;
+void probe_table(key_ptr32 *in, uint32_t n, key_ptr32 *table, uint32_t table_id, match_stream_t *stream) {
+    key_ptr32 head = chain_head(table_id);
 
     for (uint32_t i = 0; i < n; i++) {
-        //uint32_t hit = 0;
-        //uint32_t probed[4];
-        for (uint32_t subtable = 0; subtable < NR_SUBTABLES; subtable++) {
-            uint32_t h2 = hash_func[subtable](in[i].key);
-            h2 = h2 % TABLE_2_SIZE;
-
-            if (table[subtable*TABLE_2_SIZE + h2].key == in[i].key) {
-                //printf("El: %u Id: %u\n", in[i].identifier, table[subtable*TABLE_2_SIZE + h2].identifier);
-                key_ptr32 joined = {.key = in[i].key, .ptr = table[subtable*TABLE_2_SIZE + h2].key};
-                out[out_i] = joined;
-                out_i++;
-                //hit = 1;
-                break;
-            }
-            //probed[subtable] = table[subtable*TABLE_2_SIZE + h2].key;
+        uint32_t one = bucket_one(in[i].key);
+        uint32_t two = bucket_two(in[i].key);
+        bucket_probe(table, one, in[i], stream);
+        if (two != one) {
+            bucket_probe(table, two, in[i], stream);
         }
-        //if (!hit) {
-            //printf("%u not found: %u\n", i, in[i].key);
-            //printf("El:%u cmp: %u %u %u %u\n", in[i].identifier, probed[0], probed[1],
-            //       probed[2], probed[3]);
-        //}
-    }
 
-    return out_i;
-}
\ No newline at end of file
+        if (head.key != CHAIN_END) {
+            chain_probe(head, in[i], stream);
+        }
+    }
+}
@@ -2,6 +2,19 @@
 #define _HASHFUNC_H_
 #include <stdint.h>
 
+// Hash functions of the kernels, 0: shift/add mixers, 1: tabulation hashing
+#ifndef HASH_TABULATION
+#define HASH_TABULATION 0
+#endif
+
+#if HASH_TABULATION == 0
+
+/*
+    The mixers need no state.
+*/
+static void hash_init(void) {
+}
+
 static uint32_t hash0 (uint32_t key) {
     key += 272333;
     key += ~(key << 5);
@@ -57,5 +70,67 @@ static uint32_t hash4 (uint32_t key) {
   return key;
 }
 
+#else
+
+/*
+    Simple tabulation hashing: each byte of the key selects a random word from
+    its own table in WRAM and the words are XOR-combined, without any
+    multiplication. Functions using different tables are independent of each
+    other. hash0 uses all bits of the first set of tables, as partitioning
+    selects its buckets from the upper bits. hash1 to hash4 share the other
+    two sets and return 16 bits, enough for the hash tables and bloom filters
+    using them.
+*/
+uint32_t tabulation[3][4][256];
+uint32_t tabulation_ready = 0;
+
+/*
+    Fill the tables once per loaded program. Called by one tasklet before
+    any hashing. All DPUs use the same seed, so they partition alike.
+*/
+static void hash_init(void) {
+    if (tabulation_ready) {
+        return;
+    }
+
+    // xorshift32
+    uint32_t state = 2463534242;
+    uint32_t *words = (uint32_t*) tabulation;
+    for (uint32_t i = 0; i < 3*4*256; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        words[i] = state;
+    }
+    tabulation_ready = 1;
+}
+
+static inline uint32_t tabulate(uint32_t set, uint32_t key) {
+    return tabulation[set][0][key & 0xff] ^ tabulation[set][1][(key >> 8) & 0xff]
+         ^ tabulation[set][2][(key >> 16) & 0xff] ^ tabulation[set][3][key >> 24];
+}
+
+static uint32_t hash0 (uint32_t key) {
+    return tabulate(0, key);
+}
+
+static uint32_t hash1 (uint32_t key) {
+    return tabulate(1, key) & 0xffff;
+}
+
+static uint32_t hash2 (uint32_t key) {
+    return tabulate(1, key) >> 16;
+}
+
+static uint32_t hash3 (uint32_t key) {
+    return tabulate(2, key) & 0xffff;
+}
+
+static uint32_t hash4 (uint32_t key) {
+    return tabulate(2, key) >> 16;
+}
+
+#endif
+
 uint32_t (*hash_func[4])(uint32_t key) = {hash1, hash2, hash3, hash4};
 #endif
\ No newline at end of file
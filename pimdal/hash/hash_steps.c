@@ -2,7 +2,19 @@
 #include <mutex_pool.h>
 
 #include "datatype.h"
+#include "match_stream.c"
+#include "overflow_chain.c"
+
+// Hash tables of the partitions, 0: linear probing, 1: bucketized cuckoo hashing
+#ifndef HASH_TABLE
+#define HASH_TABLE 0
+#endif
+
+#if HASH_TABLE == 1
+#include "cuckoo_hash.c"
+#else
 #include "linear_hash.c"
+#endif
 
 #ifndef BLOCK_SIZE
 #define BLOCK_SIZE 256
@@ -15,62 +27,59 @@
 #define FILTER_SIZE 16384
 #define FILTER_BYTES (FILTER_SIZE/8)
 
-extern uint32_t out_index[NR_BUCKETS];
-extern uint32_t size[NR_BUCKETS];
-extern uint32_t indices[NR_BUCKETS];
+#include "blocked_bloom.c"
+
+// Elements a tasklet buffers per bucket before writing them to MRAM, all
+// tasklets together use as much WRAM as one cache of CACHE_SIZE per bucket
+#define WC_SIZE (CACHE_SIZE/NR_TASKLETS > 0 ? CACHE_SIZE/NR_TASKLETS : 1)
+
 extern uint32_t hist[NR_BUCKETS+1];
+extern uint32_t tasklet_hist[NR_TASKLETS][NR_BUCKETS];
 
 extern const mutex_id_t mutex;
 extern barrier_t barrier;
 extern struct mutex_pool mutexes;
 
-/*
-    @param out the cache to write to MRAM
-    @param n the number of elements to write
-    @param glob_table MRAM pointer to write to
-    @param bucket which bucket to write
-
-Writes a bucket in the shared cache to MRAM
-*/
-void insert_bucket(key_ptr32 out[NR_BUCKETS][CACHE_SIZE], uint32_t n,
-                   key_ptr32 **glob_table, uint32_t bucket) {
-
-    uint32_t offset = indices[bucket];
-    indices[bucket] += n;
-    mram_write(out[bucket], (__mram_ptr void*) (glob_table[bucket] + offset), n*sizeof(key_ptr32));
-    //printf("%u Out: %u Size: %u\n", bucket, offset, n);
-}
+void build_histogram(uint32_t tasklet_id, key_ptr32 *input_cache,
+                     key_ptr32 *input, uint32_t n, uint32_t nr_buckets, uint32_t shift);
+void prefix_sum(uint32_t tasklet_id, uint32_t *histogram, uint32_t n);
 
 /*
-    @param in the input data
-    @param n number of input elements
-    @param output_cache the shared WRAM cache
-    @param size how many elements are in each bucket
+    @param in WRAM cache of input elements
+    @param n number of elements
+    @param wc WRAM buffers of the calling tasklet
+    @param fill number of elements in the buffers
+    @param offset next free slot of the tasklet in each bucket
     @param glob_table the MRAM location to store the partitions to
     @param nr_buckets the number of buckets used in a partitioning step
     @param shift shift used in hash function in the current step
+    @param capacity number of elements fitting into a bucket
+
+    Write the elements to the slots the tasklet reserved in their buckets,
+    through its own WRAM buffers and without locks. Elements beyond the
+    capacity of their bucket go directly to the overflow chain of their
+    table, where they are counted as dropped if the chains have no room.
 */
-void hash_phase_one(key_ptr32* in, uint32_t n, key_ptr32 output_cache[NR_BUCKETS][CACHE_SIZE], uint32_t *size,
-                    key_ptr32 **glob_table, uint32_t nr_buckets, uint32_t shift) {
+void hash_phase_one(key_ptr32* in, uint32_t n, key_ptr32 wc[NR_BUCKETS][WC_SIZE], uint32_t *fill, uint32_t *offset,
+                    key_ptr32 **glob_table, uint32_t nr_buckets, uint32_t shift, uint32_t capacity) {
 
     for (uint32_t i = 0; i < n; i++) {
         uint32_t hash = hash0(in[i].key);
         hash = (hash >> shift) & (nr_buckets-1);
-        //if (i == 0)
-        //    printf("Key: %x Hash: %u shift: %u\n", in[i].key, hash, shift);
-
-        mutex_pool_lock(&mutexes, hash);
-        //printf("Hash: %u Offset: %u\n", hash, size[hash]);
-        output_cache[hash][size[hash]] = in[i];
-        // Copy bucket in cache to MRAM if full
-        if (size[hash] == CACHE_SIZE - 1) {
-            insert_bucket(output_cache, CACHE_SIZE, glob_table, hash);
-            size[hash] = 0;
+
+        if (offset[hash] + fill[hash] >= capacity) {
+            chain_append(chain_table(hash0(in[i].key)), in[i]);
+            continue;
         }
-        else {
-            size[hash]++;
+
+        wc[hash][fill[hash]] = in[i];
+        fill[hash]++;
+        // Copy the buffer of the bucket to MRAM if full
+        if (fill[hash] == WC_SIZE) {
+            mram_write(wc[hash], (__mram_ptr void*) (glob_table[hash] + offset[hash]), WC_SIZE*sizeof(key_ptr32));
+            offset[hash] += WC_SIZE;
+            fill[hash] = 0;
         }
-        mutex_pool_unlock(&mutexes, hash);
     }
 }
 
@@ -80,21 +89,36 @@ void hash_phase_one(key_ptr32* in, uint32_t n, key_ptr32 output_cache[NR_BUCKETS
     @param out output in MRAM
     @param table_size total size of the table in the current step
     @param local_cache WRAM cache used execution
-    @param output_cache shared WRAM cache used for writing elements to the output
+    @param wc WRAM buffers of the calling tasklet, WC_SIZE elements per bucket
     @param nr_buckets number of buckets used in this iteration
     @param tasklet_id id of the calling tasklet
     @param shift which bits of the hash value to use in this iteration
 
-    One iteration of partitioning the input into nr_buckets partitions.
+    One iteration of partitioning the input into nr_buckets partitions. The
+    histogram of every tasklet gives it its own range of slots in each
+    bucket, so the elements are written without locks.
 */
 void hash_step(key_ptr32* in, uint32_t in_size, key_ptr32* out, uint32_t table_size,
-               key_ptr32* local_cache, key_ptr32 output_cache[NR_BUCKETS][CACHE_SIZE],
+               key_ptr32* local_cache, key_ptr32 wc[NR_BUCKETS][WC_SIZE],
                uint32_t nr_buckets, uint32_t tasklet_id, uint32_t shift) {
 
+    uint32_t capacity = table_size/nr_buckets - 1;
+
+    build_histogram(tasklet_id, local_cache, in, in_size, nr_buckets, shift);
+    barrier_wait(&barrier);
+
+    prefix_sum(tasklet_id, hist, nr_buckets);
+    barrier_wait(&barrier);
+
     // Store the indices of the buckets in array to save calculations
     key_ptr32 *table_split[NR_BUCKETS];
+    uint32_t fill[NR_BUCKETS];
+    // Offsets of the tasklet relative to the start of each bucket
+    uint32_t *offset = tasklet_hist[tasklet_id];
     for (uint32_t bucket_offset = 0; bucket_offset < nr_buckets; bucket_offset++) {
         table_split[bucket_offset] = (key_ptr32*) (out + bucket_offset * (table_size/nr_buckets));
+        offset[bucket_offset] -= hist[bucket_offset];
+        fill[bucket_offset] = 0;
     }
 
     // Perform partitioning step
@@ -104,30 +128,26 @@ void hash_step(key_ptr32* in, uint32_t in_size, key_ptr32* out, uint32_t table_s
 
         mram_read((__mram_ptr void*) (in+base), local_cache, batch_size*sizeof(key_ptr32));
 
-        hash_phase_one(local_cache, batch_size, output_cache, size,
-                       table_split, nr_buckets, shift);
+        hash_phase_one(local_cache, batch_size, wc, fill, offset,
+                       table_split, nr_buckets, shift, capacity);
     }
 
-    barrier_wait(&barrier);
-
-    // Write remaining buckets to MRAM
+    // Write remaining buffers to MRAM
     for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
-        if (bucket % NR_TASKLETS == tasklet_id) {
-            if (size[bucket] > 0) {
-                insert_bucket(output_cache, size[bucket], table_split, bucket);
-            }
+        if (fill[bucket] > 0) {
+            mram_write(wc[bucket], (__mram_ptr void*) (table_split[bucket] + offset[bucket]),
+                       fill[bucket]*sizeof(key_ptr32));
         }
     }
 
-    barrier_wait(&barrier);
-
     // Store size of bucket at the end of its location
     for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
         if (bucket % NR_TASKLETS == tasklet_id) {
-            uint64_t len = indices[bucket];
+            // Elements beyond the capacity went to the chains or were counted as dropped
+            uint64_t len = hist[bucket+1] - hist[bucket];
+            len = len < capacity ? len : capacity;
             mram_write(&len, (__mram_ptr void*) (out + (bucket+1)*(table_size/nr_buckets) - 1),
                        sizeof(uint64_t));
-            indices[bucket] = 0;
             //printf("Bucket size: %lu\n", len);
         }
     }
@@ -185,25 +205,28 @@ uint32_t probe_bloom_filter(key_ptr32* in, key_ptr32* out, uint32_t n, uint8_t*
 
 /*
     @param tasklet_id id of the calling tasklet
-    @param histogram histogram counting the number of elements in each bucket
     @param input_cache WRAM cache used for the input elements
     @param input input elements in MRAM
     @param n number of input elements
     @param nr_buckets number of buckets used in this iteration
     @param shift which bits of the hash value to use in this iteration
 
-    Build a histogram of the hash values for this iteration to calculate the output
-    offset of the partitions.
+    Build the histogram of the hash values of the blocks the tasklet handles
+    in this iteration, to calculate its output offsets.
 */
-void build_histogram(uint32_t tasklet_id, uint32_t* histogram, key_ptr32 *input_cache,
+void build_histogram(uint32_t tasklet_id, key_ptr32 *input_cache,
                      key_ptr32 *input, uint32_t n, uint32_t nr_buckets, uint32_t shift) {
 
-    uint32_t hist_loc[NR_BUCKETS] = {0};
+    uint32_t *hist_loc = tasklet_hist[tasklet_id];
+    for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
+        hist_loc[bucket] = 0;
+    }
+
     for (unsigned int block_offset = tasklet_id * BLOCK_SIZE;
         block_offset < n; block_offset += BLOCK_SIZE * NR_TASKLETS) {
-        mram_read((__mram_ptr void*) (input + block_offset), input_cache, BLOCK_SIZE*sizeof(key_ptr32));
-
         uint32_t size = block_offset + BLOCK_SIZE < n ? BLOCK_SIZE : n - block_offset;
+        mram_read((__mram_ptr void*) (input + block_offset), input_cache, size*sizeof(key_ptr32));
+
         for (unsigned int i = 0; i < size; ++i) {
             key_ptr32 item = input_cache[i];
             uint32_t bucket = hash0(item.key);
@@ -211,84 +234,80 @@ void build_histogram(uint32_t tasklet_id, uint32_t* histogram, key_ptr32 *input_
             hist_loc[bucket]++;
         }
     }
-
-    for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
-        mutex_pool_lock(&mutexes, bucket);
-        histogram[bucket+1] += hist_loc[bucket];
-        mutex_pool_unlock(&mutexes, bucket);
-    }
 }
 
 /*
     @param tasklet_id id of the calling tasklet
-    @param created histogram of the hash values
+    @param histogram offsets of the partitions
     @param n number of partitions shown in the histogram
 
-    Calculate a prefix sum of the histogram to get partition offsets.
+    Calculate a prefix sum over the histograms of all tasklets. The histogram
+    gets the offset of every partition and the histogram of every tasklet the
+    offset of its elements in each partition, with the elements of lower
+    tasklets first.
 */
 void prefix_sum(uint32_t tasklet_id, uint32_t *histogram, uint32_t n) {
     if (tasklet_id == 0) {
+        uint32_t offset = 0;
+        histogram[0] = 0;
         for (uint32_t i = 0; i < n; i++) {
-            histogram[i+1] += histogram[i];
+            for (uint32_t tasklet = 0; tasklet < NR_TASKLETS; tasklet++) {
+                uint32_t count = tasklet_hist[tasklet][i];
+                tasklet_hist[tasklet][i] = offset;
+                offset += count;
+            }
+            histogram[i+1] = offset;
         }
     }
 }
 
 /*
     @param tasklet_id id of the calling tasklet
-    @param histogram offsets of the partitions calculated from histogram
     @param input_cache WRAM cache used for the input elements
     @param input input elements in MRAM
-    @param output_cache shared WRAM cache to write elements to output
+    @param wc WRAM buffers of the calling tasklet, WC_SIZE elements per bucket
     @param output partitions output in MRAM
     @param n number of input elements
     @param nr_buckets number of buckets used in this iteration
     @param shift which bits of the hash value to use in this iteration
 
-    Partition the elements using the offsets previously calculated with the histogram.
+    Partition the elements using the offsets previously calculated with the
+    histograms. Every tasklet handles the blocks it counted and writes them
+    to its own range of each partition, so no locks are needed.
 */
-void write_output(uint32_t tasklet_id, uint32_t* histogram, key_ptr32 *input_cache,
-                  key_ptr32 *input, key_ptr32 output_cache[NR_BUCKETS][CACHE_SIZE], key_ptr32* output,
-                 uint32_t n, uint32_t nr_buckets, uint32_t shift) {
+void write_output(uint32_t tasklet_id, key_ptr32 *input_cache,
+                  key_ptr32 *input, key_ptr32 wc[NR_BUCKETS][WC_SIZE], key_ptr32* output,
+                  uint32_t n, uint32_t nr_buckets, uint32_t shift) {
+
+    uint32_t *offset = tasklet_hist[tasklet_id];
+    uint32_t fill[NR_BUCKETS];
+    for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
+        fill[bucket] = 0;
+    }
 
     for (uint32_t block_offset = tasklet_id * BLOCK_SIZE;
         block_offset < n; block_offset += BLOCK_SIZE * NR_TASKLETS) {
-        mram_read((__mram_ptr void*) (input + block_offset), input_cache, BLOCK_SIZE*sizeof(key_ptr32));
-
         uint32_t size = block_offset + BLOCK_SIZE < n ? BLOCK_SIZE : n - block_offset;
+        mram_read((__mram_ptr void*) (input + block_offset), input_cache, size*sizeof(key_ptr32));
+
         for (unsigned int i = 0; i < size; ++i) {
             key_ptr32 item = input_cache[i];
             uint32_t bucket = hash0(item.key);
             bucket = (bucket >> shift) & (nr_buckets-1);
-            //uint32_t bucket = (item.identifier >> shift) % NR_BUCKETS;
-
-            mutex_pool_lock(&mutexes, bucket);
-            output_cache[bucket][out_index[bucket]] = item;
-            if (out_index[bucket] == CACHE_SIZE-1) {
-                uint32_t out_offset = histogram[bucket];
-                //printf("write %u: %p size: %u\n", bucket, output+out_offset, BLOCK_SIZE);
-                mram_write(&output_cache[bucket][0], (__mram_ptr void*) (output+out_offset),
-                           CACHE_SIZE*sizeof(key_ptr32));
-                histogram[bucket] += CACHE_SIZE;
-                out_index[bucket] = 0;
-            }
-            else {
-                out_index[bucket]++;
+
+            wc[bucket][fill[bucket]] = item;
+            fill[bucket]++;
+            if (fill[bucket] == WC_SIZE) {
+                mram_write(wc[bucket], (__mram_ptr void*) (output+offset[bucket]), WC_SIZE*sizeof(key_ptr32));
+                offset[bucket] += WC_SIZE;
+                fill[bucket] = 0;
             }
-            mutex_pool_unlock(&mutexes, bucket);
         }
     }
 
-    barrier_wait(&barrier);
-
     for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
-        if (bucket % NR_TASKLETS == tasklet_id && out_index[bucket] > 0) {
-            uint32_t out_offset = histogram[bucket];
-            //printf("write %u: %p size: %u\n", tasklet_id, output+out_offset, out_index[tasklet_id]);
-            mram_write(&output_cache[bucket][0], (__mram_ptr void*) (output+out_offset),
-                       out_index[bucket]*sizeof(key_ptr32));
-
-            out_index[bucket] = 0;
+        if (fill[bucket] > 0) {
+            mram_write(wc[bucket], (__mram_ptr void*) (output+offset[bucket]), fill[bucket]*sizeof(key_ptr32));
         }
     }
 }
@@ -4,50 +4,59 @@
 #define TABLE_SIZE 256
 
 /*
-    @param element element to insert into table
-    @param local_table hash table in WRAM
-    @param sel which hash function to use
+    @param in WRAM cache of input elements
+    @param n number of elements
+    @param table hash table in WRAM
+    @param table_id index of the table
 
     Inserts elements into hash table using linear hashing probing scheme.
+    Elements with the same key are all inserted, elements not fitting into
+    the table go to its overflow chain.
 */
-void hash_phase_two(key_ptr32* in, uint32_t n, key_ptr32 *table) {
+void hash_phase_two(key_ptr32* in, uint32_t n, key_ptr32 *table, uint32_t table_id) {
     for (uint32_t i = 0; i < n; i++) {
         uint32_t pos = hash1(in[i].key);
+        uint32_t inserted = 0;
         for (uint32_t k = 0; k < TABLE_SIZE; k++) {
             if (table[(pos + k) % TABLE_SIZE].key == 0xffffffff) {
                 table[(pos + k) % TABLE_SIZE] = in[i];
+                inserted = 1;
                 break;
             }
         }
+        if (!inserted) {
+            chain_append(table_id, in[i]);
+        }
     }
 }
 
 /*
     @param in WRAM cache of elements to probe
-    @param out WRAM cache output of elements found
-    @param table hash table in WRAM
     @param n number of input elements
+    @param table hash table in WRAM
+    @param table_id index of the table
+    @param stream output of the matches
 
-    Probes the table with the input elements using linear probing and writes ones that
-    hit to the output. The pointer of the outer relation element becomes the new key.
+    Probes the table with the input elements using linear probing and emits
+    every element of the table and its overflow chain with the same key. The
+    pointer of the outer relation element becomes the new key.
 */
-uint32_t probe_table(key_ptr32 *in, key_ptr32 *out, key_ptr32 *table, uint32_t n) {
-    uint32_t out_i = 0;
+void probe_table(key_ptr32 *in, uint32_t n, key_ptr32 *table, uint32_t table_id, match_stream_t *stream) {
+    key_ptr32 head = chain_head(table_id);
 
     for (uint32_t i = 0; i < n; i++) {
         uint32_t pos = hash1(in[i].key);
         for (uint32_t k = 0; k < TABLE_SIZE; k++) {
             if (table[(pos + k) % TABLE_SIZE].key == in[i].key) {
                 key_ptr32 joined = {.key = in[i].ptr, .ptr = table[(pos + k) % TABLE_SIZE].ptr};
-                out[out_i] = joined;
-                out_i++;
-                break;
+                stream_emit(stream, joined);
             }
             else if (table[(pos + k) % TABLE_SIZE].key == 0xffffffff) {
                 break;
             }
         }
+        if (head.key != CHAIN_END) {
+            chain_probe(head, in[i], stream);
+        }
     }
-
-    return out_i;
-}
\ No newline at end of file
+}
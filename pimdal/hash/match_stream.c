@@ -0,0 +1,86 @@
+#include <mram.h>
+#include <mutex.h>
+
+#include "datatype.h"
+
+// Matches buffered by a tasklet before they are written to MRAM
+#define STREAM_SIZE 32
+
+/*
+    Output of the matches of a probe. Every tasklet buffers its matches in
+    WRAM and writes them to the next free range of the output when the buffer
+    is full, so any number of matches per probed element fits into a fixed
+    buffer. The output is bounded by its capacity, matches beyond it are only
+    counted.
+*/
+typedef struct {
+    key_ptr32 *cache; // WRAM buffer of STREAM_SIZE matches
+    uint32_t n; // Number of buffered matches
+} match_stream_t;
+
+// Output of all tasklets in MRAM
+key_ptr32 *stream_out;
+// Capacity of the output in elements, 0 if unbounded
+uint32_t stream_capacity;
+// Matches of all tasklets, including the ones beyond the capacity
+uint32_t stream_total;
+
+// Mutex defined in calling code
+extern const mutex_id_t mutex;
+
+/*
+    @param out MRAM location of the output
+    @param capacity number of elements fitting into the output, 0 if unbounded
+
+    Start a new output. Called by one tasklet.
+*/
+static void stream_init(uint32_t out, uint32_t capacity) {
+    stream_out = (key_ptr32*) out;
+    stream_capacity = capacity;
+    stream_total = 0;
+}
+
+/*
+    @param stream buffer of the calling tasklet
+
+    Write the buffered matches to the output.
+*/
+static void stream_flush(match_stream_t *stream) {
+    if (stream->n == 0) {
+        return;
+    }
+
+    mutex_lock(mutex);
+    uint32_t offset = stream_total;
+    stream_total += stream->n;
+    mutex_unlock(mutex);
+
+    uint32_t n = stream->n;
+    if (stream_capacity > 0) {
+        n = offset >= stream_capacity ? 0 : (stream_capacity - offset < n ? stream_capacity - offset : n);
+    }
+    if (n > 0) {
+        mram_write(stream->cache, (__mram_ptr void*) (stream_out + offset), n*sizeof(key_ptr32));
+    }
+    stream->n = 0;
+}
+
+static inline void stream_emit(match_stream_t *stream, key_ptr32 match) {
+    stream->cache[stream->n] = match;
+    stream->n++;
+    if (stream->n == STREAM_SIZE) {
+        stream_flush(stream);
+    }
+}
+
+/*
+    Returns the number of matches written to the output, after all tasklets
+    flushed their buffers.
+*/
+static uint32_t stream_written(void) {
+    if (stream_capacity > 0 && stream_total > stream_capacity) {
+        return stream_capacity;
+    }
+
+    return stream_total;
+}
@@ -0,0 +1,168 @@
+#include <stddef.h>
+#include <string.h>
+#include <mram.h>
+#include <mutex.h>
+
+#include "datatype.h"
+
+// Entries of a chain block, the first one links to the previous block
+#define CHAIN_BLOCK 32
+// Entries read at once when scanning a chain
+#define CHAIN_READ 8
+#define CHAIN_END 0xffffffff
+
+/*
+    Overflow chains of the hash tables in MRAM. Elements that do not fit into
+    their partition or table are appended to the chain of their table. The
+    overflow area starts with the head of the chain of every table, the last
+    block and its number of elements, followed by the blocks. Every block
+    holds a link to the previous block of its chain and CHAIN_BLOCK-1
+    elements, only the last block of a chain is not full. Elements that find
+    no room in the area are dropped and counted, the callers report them to
+    the host.
+*/
+// Heads of the chains, NULL if the caller provides no overflow area
+key_ptr32 *chain_heads;
+key_ptr32 *chain_blocks;
+// Number of allocated blocks and blocks fitting into the overflow area
+uint32_t chain_blocks_n;
+uint32_t chain_capacity;
+// Number of elements lost since the last chain_clear
+uint32_t chain_dropped;
+// Number of tables and the shift selecting the table of a hash value
+uint32_t chain_tables;
+uint32_t chain_shift;
+
+// Mutex defined in calling code
+extern const mutex_id_t mutex;
+
+/*
+    @param overflow MRAM location of the overflow area, 0 to disable the chains
+    @param size size of the overflow area in bytes
+    @param nr_tables number of tables
+    @param shift shift selecting the table from the hash value
+
+    Set the overflow area of the tables built or probed next. The chains are
+    disabled if the area cannot hold the heads of all tables. Called by one
+    tasklet.
+*/
+static void chain_init(uint32_t overflow, uint32_t size, uint32_t nr_tables, uint32_t shift) {
+    uint32_t heads_size = nr_tables*sizeof(key_ptr32);
+    chain_heads = overflow == 0 || size < heads_size ? NULL : (key_ptr32*) overflow;
+    chain_blocks = chain_heads + nr_tables;
+    chain_capacity = chain_heads == NULL ? 0 : (size - heads_size) / (CHAIN_BLOCK*sizeof(key_ptr32));
+    chain_tables = nr_tables;
+    chain_shift = shift;
+}
+
+/*
+    Remove all elements from the chains before building new tables. Called by
+    one tasklet after chain_init.
+*/
+static void chain_clear(void) {
+    chain_blocks_n = 0;
+    chain_dropped = 0;
+    if (chain_heads != NULL) {
+        memset((__mram_ptr void*) chain_heads, 0xff, chain_tables*sizeof(key_ptr32));
+    }
+}
+
+static inline uint32_t chain_enabled(void) {
+    return chain_heads != NULL;
+}
+
+/*
+    @param hash value of hash0 of the key
+
+    Returns the table the partitioning assigns the element to.
+*/
+static inline uint32_t chain_table(uint32_t hash) {
+    return (hash >> chain_shift) & (chain_tables-1);
+}
+
+/*
+    @param table table of the element
+    @param element element to append
+
+    Append an element to the chain of its table. The element is dropped and
+    counted in chain_dropped if the chains are disabled or the overflow area
+    is full.
+*/
+void chain_append(uint32_t table, key_ptr32 element) {
+    __dma_aligned key_ptr32 head;
+    __dma_aligned key_ptr32 entry = element;
+
+    mutex_lock(mutex);
+    if (!chain_enabled()) {
+        chain_dropped++;
+        mutex_unlock(mutex);
+        return;
+    }
+
+    mram_read((__mram_ptr void*) (chain_heads + table), &head, sizeof(key_ptr32));
+    if (head.key == CHAIN_END || head.ptr == CHAIN_BLOCK-1) {
+        if (chain_blocks_n == chain_capacity) {
+            chain_dropped++;
+            mutex_unlock(mutex);
+            return;
+        }
+        __dma_aligned key_ptr32 link = {.key = head.key, .ptr = 0};
+        head.key = chain_blocks_n;
+        head.ptr = 0;
+        chain_blocks_n++;
+        mram_write(&link, (__mram_ptr void*) (chain_blocks + head.key*CHAIN_BLOCK), sizeof(key_ptr32));
+    }
+    head.ptr++;
+    mram_write(&entry, (__mram_ptr void*) (chain_blocks + head.key*CHAIN_BLOCK + head.ptr), sizeof(key_ptr32));
+    mram_write(&head, (__mram_ptr void*) (chain_heads + table), sizeof(key_ptr32));
+    mutex_unlock(mutex);
+}
+
+/*
+    @param table table to read the head of
+
+    Returns the head of the chain of a table, with CHAIN_END as block if the
+    chain is empty.
+*/
+static key_ptr32 chain_head(uint32_t table) {
+    __dma_aligned key_ptr32 head = {.key = CHAIN_END, .ptr = 0};
+    if (chain_enabled()) {
+        mram_read((__mram_ptr void*) (chain_heads + table), &head, sizeof(key_ptr32));
+    }
+
+    return head;
+}
+
+/*
+    @param head head of the chain of the probed table
+    @param probe probed element
+    @param stream output of the matches
+
+    Emit a match for every element of the chain with the key of the probed
+    element.
+*/
+void chain_probe(key_ptr32 head, key_ptr32 probe, match_stream_t *stream) {
+    __dma_aligned key_ptr32 entries[CHAIN_READ];
+
+    uint32_t count = head.ptr;
+    for (uint32_t block = head.key; block != CHAIN_END; count = CHAIN_BLOCK-1) {
+        key_ptr32 *base = chain_blocks + block*CHAIN_BLOCK;
+        uint32_t prev = CHAIN_END;
+
+        // Entry 0 is the link, the elements follow it
+        for (uint32_t start = 0; start <= count; start += CHAIN_READ) {
+            uint32_t n = count + 1 - start < CHAIN_READ ? count + 1 - start : CHAIN_READ;
+            mram_read((__mram_ptr void*) (base + start), entries, n*sizeof(key_ptr32));
+            for (uint32_t i = 0; i < n; i++) {
+                if (start + i == 0) {
+                    prev = entries[i].key;
+                }
+                else if (entries[i].key == probe.key) {
+                    key_ptr32 joined = {.key = probe.ptr, .ptr = entries[i].ptr};
+                    stream_emit(stream, joined);
+                }
+            }
+        }
+        block = prev;
+    }
+}
@@ -16,6 +16,7 @@
 
 #include "hash_join.h"
 #include "../hash/hash_steps.c"
+#include "../general/timeline.h"
 
 // Number of elements in the table
 uint32_t size_table;
@@ -24,12 +25,9 @@ uint32_t size_filter;
 // Size of partitions
 uint32_t size_part;
 
-// Multi tasklet cache to store data to MRAM
-key_ptr32 *out_cache;
-uint32_t out_index[NR_BUCKETS] = {0};
-uint32_t size[NR_BUCKETS] = {0};
-uint32_t indices[NR_BUCKETS] = {0};
+// Offsets of the partitions and of the elements of each tasklet in them
 uint32_t hist[NR_BUCKETS+1] = {0};
+uint32_t tasklet_hist[NR_TASKLETS][NR_BUCKETS];
 
 // Barrier defined in calling code
 extern barrier_t barrier;
@@ -37,6 +35,19 @@ extern barrier_t barrier;
 // Mutex defined in calling code
 extern const mutex_id_t mutex;
 
+/*
+    @param hash_args arguments of the hash kernel
+
+    Shift of the first partitioning pass. A shift of 0 selects the lowest bits
+    of the hash value, as many as needed for the number of tables.
+*/
+static inline uint32_t table_shift(hash_arguments_t *hash_args) {
+    if (hash_args->shift > 0) {
+        return hash_args->shift;
+    }
+    return __builtin_ctz(hash_args->table_size / BLOCK_SIZE);
+}
+
 int hash_kernel(hash_arguments_t *hash_args) {
     uint32_t tasklet_id = me();
 
@@ -46,16 +57,21 @@ int hash_kernel(hash_arguments_t *hash_args) {
 
     if (tasklet_id == 0) {
         mem_reset();
-        // Allocate shared cache
-        out_cache = (key_ptr32*) mem_alloc(NR_BUCKETS * CACHE_SIZE * sizeof(key_ptr32));
+        hash_init();
+        // The partitioning passes select the tables with the bits below the shift
+        uint32_t nr_tables = size_table / BLOCK_SIZE;
+        chain_init(hash_args->overflow_ptr, hash_args->overflow_size, nr_tables,
+                   table_shift(hash_args) - __builtin_ctz(nr_tables));
+        chain_clear();
         // Store partition size at the end of the region
         uint64_t nr_elements = hash_args->size;
         mram_write(&nr_elements, (__mram_ptr void*) (buffer + size_table - 1), sizeof(uint64_t));
     }
     barrier_wait(&barrier);
     key_ptr32* local_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
+    key_ptr32* wc = (key_ptr32*) mem_alloc(NR_BUCKETS*WC_SIZE*sizeof(key_ptr32));
 
-    uint32_t shift = hash_args->shift;
+    uint32_t shift = table_shift(hash_args);
     key_ptr32* in = buffer;
     key_ptr32* out = table;
     for (uint32_t table_size = size_table; table_size > 256; table_size /= NR_BUCKETS) {
@@ -67,13 +83,7 @@ int hash_kernel(hash_arguments_t *hash_args) {
             uint64_t in_size;
             mram_read((__mram_ptr void*) (in+subtable+table_size-1), &in_size, sizeof(uint64_t));
             hash_step(in+subtable, in_size, out+subtable, table_size, local_cache,
-                      (key_ptr32 (*)[CACHE_SIZE]) out_cache, nr_buckets, tasklet_id, shift);
-
-            for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
-                if (bucket % NR_TASKLETS == tasklet_id) {
-                    size[bucket] = 0;
-                }
-            }
+                      (key_ptr32 (*)[WC_SIZE]) wc, nr_buckets, tasklet_id, shift);
         }
 
         key_ptr32* tmp_ptr = in;
@@ -104,7 +114,7 @@ int hash_kernel(hash_arguments_t *hash_args) {
         uint64_t in_size = ((uint64_t*) local_cache)[255];
         //if (in_size > 255)
         //    printf("Split: %d Size: %lu\n", base, in_size);
-        hash_phase_two(local_cache, in_size, local_table);
+        hash_phase_two(local_cache, in_size, local_table, base / BLOCK_SIZE);
 
         mram_write(local_table, (__mram_ptr void*) (table+base), BLOCK_SIZE*sizeof(key_ptr32));
 
@@ -118,6 +128,7 @@ int filter_kernel(filter_arguments_t *filter_args) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
+        hash_init();
     }
     // Barrier
     barrier_wait(&barrier);
@@ -151,6 +162,78 @@ int filter_kernel(filter_arguments_t *filter_args) {
     return 0;
 }
 
+int bloom_kernel(bloom_arguments_t *bloom_args) {
+    uint32_t tasklet_id = me();
+    if (tasklet_id == 0){
+        mem_reset(); // Reset the heap
+        hash_init();
+    }
+    // Barrier
+    barrier_wait(&barrier);
+
+    key_ptr32* input = (key_ptr32*) bloom_args->in_ptr;
+    uint64_t* filter = (uint64_t*) bloom_args->filter_ptr;
+    uint32_t words = bloom_args->filter_words;
+
+    key_ptr32* in_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
+
+    clear_blocked_bloom(filter, words, tasklet_id, (uint64_t*) in_cache);
+    barrier_wait(&barrier);
+
+    for (uint32_t base = tasklet_id*BLOCK_SIZE; base < bloom_args->size; base += NR_TASKLETS*BLOCK_SIZE) {
+        uint32_t n = bloom_args->size - base < BLOCK_SIZE ? bloom_args->size - base : BLOCK_SIZE;
+        mram_read((__mram_ptr void*) (input + base), in_cache, n*sizeof(key_ptr32));
+
+        insert_blocked_bloom(in_cache, n, filter, words);
+    }
+
+    return 0;
+}
+
+// Number of elements kept by the semi join
+uint32_t size_semi;
+
+int semi_kernel(bloom_arguments_t *bloom_args, merge_results_t *semi_res) {
+    uint32_t tasklet_id = me();
+    if (tasklet_id == 0){
+        mem_reset(); // Reset the heap
+        hash_init();
+        size_semi = 0;
+    }
+    // Barrier
+    barrier_wait(&barrier);
+
+    key_ptr32* input = (key_ptr32*) bloom_args->in_ptr;
+    key_ptr32* output = (key_ptr32*) bloom_args->out_ptr;
+    uint64_t* filter = (uint64_t*) bloom_args->filter_ptr;
+
+    key_ptr32* in_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
+
+    for (uint32_t base = tasklet_id*BLOCK_SIZE; base < bloom_args->size; base += NR_TASKLETS*BLOCK_SIZE) {
+        uint32_t n = bloom_args->size - base < BLOCK_SIZE ? bloom_args->size - base : BLOCK_SIZE;
+        mram_read((__mram_ptr void*) (input + base), in_cache, n*sizeof(key_ptr32));
+
+        uint32_t hits = probe_blocked_bloom(in_cache, in_cache, n, filter, bloom_args->filter_words);
+
+        mutex_lock(mutex);
+        uint32_t offset = size_semi;
+        size_semi += hits;
+        mutex_unlock(mutex);
+
+        if (hits > 0) {
+            mram_write(in_cache, (__mram_ptr void*) (output + offset), hits*sizeof(key_ptr32));
+        }
+    }
+    barrier_wait(&barrier);
+
+    if (tasklet_id == 0) {
+        semi_res->out_n = size_semi;
+        semi_res->matches_n = size_semi;
+    }
+
+    return 0;
+}
+
 int part_kernel(part_arguments_t *part_args) {
     uint32_t tasklet_id = me();
 
@@ -160,7 +243,7 @@ int part_kernel(part_arguments_t *part_args) {
 
     if (tasklet_id == 0) {
         mem_reset();
-        out_cache = (key_ptr32*) mem_alloc(NR_BUCKETS * CACHE_SIZE * sizeof(key_ptr32));
+        hash_init();
         uint64_t start = 0;
         mram_write(&start, (__mram_ptr void*) (sizes_part), sizeof(uint64_t));
         uint64_t nr_elements = part_args->size;
@@ -169,9 +252,10 @@ int part_kernel(part_arguments_t *part_args) {
     barrier_wait(&barrier);
 
     key_ptr32* local_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
+    key_ptr32* wc = (key_ptr32*) mem_alloc(NR_BUCKETS*WC_SIZE*sizeof(key_ptr32));
     //key_ptr32* local_table = (key_ptr32*) mem_alloc(4*TABLE_2_SIZE*sizeof(key_ptr32));
 
-    uint32_t shift = part_args->shift;
+    uint32_t shift = part_args->shift > 0 ? part_args->shift : __builtin_ctz(part_args->part_n);
     key_ptr32* in = buffer;
     key_ptr32* out = partitions;
     for (uint32_t partition_size = part_args->part_n; partition_size > 1; partition_size /= NR_BUCKETS) {
@@ -180,13 +264,6 @@ int part_kernel(part_arguments_t *part_args) {
 
         for (uint32_t partition = 0; partition < part_args->part_n; partition += partition_size) {
             //printf("Part size: %u\n", partition_size);
-            // Reset histogram
-            for (uint32_t bucket = 0; bucket < nr_buckets+1; bucket++) {
-                if (bucket % NR_TASKLETS == tasklet_id) {
-                    hist[bucket] = 0;
-                }
-            }
-
             uint64_t in_start;
             mram_read((__mram_ptr void*) (sizes_part+partition), &in_start, sizeof(uint64_t));
             uint64_t in_size;
@@ -198,10 +275,12 @@ int part_kernel(part_arguments_t *part_args) {
             // }
             barrier_wait(&barrier);
             
-            build_histogram(tasklet_id, hist, local_cache, in+in_start, in_size, nr_buckets, shift);
+            TIMELINE_BEGIN(PHASE_HISTOGRAM);
+            build_histogram(tasklet_id, local_cache, in+in_start, in_size, nr_buckets, shift);
             barrier_wait(&barrier);
 
             prefix_sum(tasklet_id, hist, nr_buckets);
+            TIMELINE_END();
             barrier_wait(&barrier);
 
             for (uint32_t bucket = 0; bucket < nr_buckets; bucket++) {
@@ -214,7 +293,7 @@ int part_kernel(part_arguments_t *part_args) {
             }
             barrier_wait(&barrier);
 
-            write_output(tasklet_id, hist, local_cache, in+in_start, (key_ptr32 (*)[CACHE_SIZE]) out_cache,
+            write_output(tasklet_id, local_cache, in+in_start, (key_ptr32 (*)[WC_SIZE]) wc,
                          out+in_start, in_size, nr_buckets, shift);
         }
 
@@ -246,6 +325,7 @@ int match_kernel(match_arguments_t *match_args, merge_results_t *match_res) {
 
     if (tasklet_id == 0) {
         mem_reset();
+        hash_init();
         hist[0] = 0;
         memset((__mram_ptr void*) sizes_match, 0, (match_args->part_n + 1)*sizeof(uint64_t));
     }
@@ -346,17 +426,19 @@ int merge_kernel(merge_arguments_t *join_args, merge_results_t *join_res) {
 
     key_ptr32* table = (key_ptr32*) join_args->table_ptr;
     key_ptr32* partitions = (key_ptr32*) join_args->in_ptr;
-    key_ptr32* joined = (key_ptr32*) join_args->out_ptr;
     uint64_t* sizes_part = (uint64_t*) join_args->part_sizes;
 
     if (tasklet_id == 0) {
         mem_reset();
-        hist[0] = 0;
+        hash_init();
+        chain_init(join_args->overflow_ptr, join_args->overflow_size, join_args->part_n, 0);
+        stream_init(join_args->out_ptr, join_args->out_size);
     }
     barrier_wait(&barrier);
 
     key_ptr32* table_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
     key_ptr32* local_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
+    match_stream_t stream = {.cache = (key_ptr32*) mem_alloc(STREAM_SIZE*sizeof(key_ptr32)), .n = 0};
 
     uint32_t base_tasklet = tasklet_id * BLOCK_SIZE;
     uint32_t partition = 0;
@@ -370,15 +452,17 @@ int merge_kernel(merge_arguments_t *join_args, merge_results_t *join_res) {
         // Read the input for this iteration
         mram_read((__mram_ptr void*) (partitions + base), local_cache, BLOCK_SIZE*sizeof(key_ptr32));
 
-        uint32_t hits_iter = 0;
         uint32_t n = 0;
         for (uint32_t in_offset = 0; in_offset < BLOCK_SIZE; in_offset += n) {
-            if (partition > join_args->part_n) {
+            if (partition >= join_args->part_n) {
                 break;
             }
             if (base + in_offset >= in_end) {
                 // Find the the filter corresponding to the partition
                 partition++;
+                if (partition == join_args->part_n) {
+                    break;
+                }
                 mram_read((__mram_ptr void*) (sizes_part+partition+1), &in_end, sizeof(uint64_t));
                 //printf("%u Base: %u, end: %lu\n", tasklet_id, base+in_offset, in_end);
                 n = 0;
@@ -387,43 +471,23 @@ int merge_kernel(merge_arguments_t *join_args, merge_results_t *join_res) {
                 mram_read((__mram_ptr void*) (table+partition*BLOCK_SIZE), table_cache, BLOCK_SIZE*sizeof(key_ptr32));
                 if (BLOCK_SIZE - in_offset > in_end - base - in_offset) {
                     n = in_end - base - in_offset;
-                    uint32_t hits = probe_table(local_cache+in_offset, local_cache+hits_iter, table_cache, n);
-                    //printf("%u New hits: %u n: %u partition: %u\n", tasklet_id, hits, n, partition);
-                    // Move new hits to front
-                    //memcpy(local_cache+hits_iter, local_cache+in_offset, hits*sizeof(key_ptr32));
-                    hits_iter += hits;
                 }
                 else {
                     n = BLOCK_SIZE - in_offset;
-                    uint32_t hits = probe_table(local_cache+in_offset, local_cache+hits_iter, table_cache, n);
-                    //printf("%u New hits: %u n: %u partition: %u\n", tasklet_id, hits, n, partition);
-                    //memcpy(local_cache+hits_iter, local_cache+in_offset, hits*sizeof(key_ptr32));
-                    hits_iter += hits;
                 }
+                // Matches are streamed to the output, any number per element
+                probe_table(local_cache+in_offset, n, table_cache, partition, &stream);
             }
         }
-
-        uint32_t out_off = 0;
-        if (tasklet_id > 0) {
-            handshake_wait_for(tasklet_id-1);
-        }
-        out_off = hist[tasklet_id];
-        if (tasklet_id < NR_TASKLETS-1) {
-            hist[tasklet_id+1] = hist[tasklet_id] + hits_iter;
-            handshake_notify();
-        }
-        else {
-            hist[0] = hist[tasklet_id] + hits_iter;
-        }
-    
-        if (hits_iter > 0) {
-            mram_write(local_cache, (__mram_ptr void*) (joined+out_off), hits_iter*sizeof(key_ptr32));
-        }
-        barrier_wait(&barrier);
     }
 
-    if (tasklet_id == NR_TASKLETS-1) {
-        join_res->out_n = hist[0];
+    stream_flush(&stream);
+    barrier_wait(&barrier);
+
+    if (tasklet_id == 0) {
+        join_res->out_n = stream_written();
+        join_res->matches_n = stream_total;
+        join_res->dropped_n = chain_dropped;
     }
 
     return 0;
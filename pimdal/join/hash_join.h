@@ -3,13 +3,23 @@
 
 #include "datatype.h"
 
+// Bytes reserved for the overflow chains of the hash tables, the heads of up
+// to 8192 tables and about 120000 elements
+#define OVERFLOW_SIZE (1 << 20)
+// Entries of the hash table of a partition, one WRAM block
+#define PART_TABLE 256
+// Inner elements per partition, half of its hash table
+#define PART_FILL 128
+
 typedef struct
 {
     uint32_t in_ptr; // Input elements in MRAM
     uint32_t size; // Number of input elements
-    uint32_t shift; // Maximum shift for selecting hash bits
+    uint32_t shift; // Maximum shift for selecting hash bits, 0 for the lowest bits
     uint32_t table_ptr; // Table in MRAM
     uint32_t table_size; // Table size in number of elements
+    uint32_t overflow_ptr; // Overflow chains of the tables in MRAM, 0 if none
+    uint32_t overflow_size; // Size of the overflow area in bytes
 } hash_arguments_t;
 
 typedef struct
@@ -24,7 +34,16 @@ typedef struct
 {
     uint32_t in_ptr; // Input elements in MRAM
     uint32_t size; // Number of input elements
-    uint32_t shift; // Maximum shift for selecting hash bits
+    uint32_t out_ptr; // Elements hitting in the filter in MRAM, not overlapping the input
+    uint32_t filter_ptr; // Blocked bloom filter in MRAM
+    uint32_t filter_words; // Number of words of the filter, a power of two
+} bloom_arguments_t;
+
+typedef struct
+{
+    uint32_t in_ptr; // Input elements in MRAM
+    uint32_t size; // Number of input elements
+    uint32_t shift; // Maximum shift for selecting hash bits, 0 for the lowest bits
     uint32_t part_ptr; // Partitions output in MRAM
     uint32_t part_sizes; // Sizes of the partitions
     uint32_t part_n; // Number of partitions
@@ -47,15 +66,34 @@ typedef struct
     uint32_t size; // Size of hash table
     uint32_t in_ptr; // Input elements in MRAM
     uint32_t out_ptr; // Output of merged elements in MRAM
+    uint32_t out_size; // Capacity of the output in elements, 0 if unbounded
     uint32_t part_sizes; // Partition sizes of input
     uint32_t part_n; // Number of partitions
+    uint32_t overflow_ptr; // Overflow chains of the tables in MRAM, 0 if none
+    uint32_t overflow_size; // Size of the overflow area in bytes
 } merge_arguments_t;
 
 typedef struct
 {
-    uint32_t out_n;
+    uint32_t out_n; // Number of output elements
+    uint32_t matches_n; // Number of matches, more than out_n if the output was full
+    uint32_t dropped_n; // Elements of the hash tables lost, the overflow area was missing or full
 } merge_results_t;
 
+/*
+    Number of partitions, a power of two, so that each holds at most about
+    fill of the n input elements, but no more than max_part partitions. The
+    partitioning kernels split them with passes of up to NR_BUCKETS, so small
+    inputs take a single pass.
+*/
+static inline uint32_t plan_partitions(uint32_t n, uint32_t fill, uint32_t max_part) {
+    uint32_t part_n = 1;
+    while (part_n < max_part && part_n * fill < n) {
+        part_n *= 2;
+    }
+    return part_n;
+}
+
 /*
     Create a hash table from the input elements.
 */
@@ -66,6 +104,16 @@ int hash_kernel(hash_arguments_t *hash_args);
 */
 int filter_kernel(filter_arguments_t *filter_args);
 
+/*
+    Create a blocked bloom filter from the input elements.
+*/
+int bloom_kernel(bloom_arguments_t *bloom_args);
+
+/*
+    Keep the input elements hitting in the blocked bloom filter.
+*/
+int semi_kernel(bloom_arguments_t *bloom_args, merge_results_t *semi_res);
+
 /*
     Partition the input elements.
 */
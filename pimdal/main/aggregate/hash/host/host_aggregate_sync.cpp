@@ -13,7 +13,7 @@ void populate_mram(dpu_set_t &system) {
 }
 
 std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
-    std::vector<std::vector<groupby_results_t>> gb_res (NR_DPU, std::vector<groupby_results_t>(1));
+    std::vector<std::vector<groupby_results_t>> gb_res (nr_dpus, std::vector<groupby_results_t>(1));
     arrow::ArrayVector key_chunks;
     arrow::ArrayVector val_chunks;
 
@@ -33,12 +33,12 @@ std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
     }
 
     uint32_t offset = BUFFER_SIZE + (BUFFER_SIZE & 1);
-    arrow::BufferVector buffers_key = alloc_buf_vec(max_gb_size*sizeof(uint32_t), NR_DPU);
+    arrow::BufferVector buffers_key = alloc_buf_vec(system, max_gb_size*sizeof(uint32_t));
     get_buf(system, buffers_key, offset*2*sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
     arrow::BufferVector buffers_val;
     if (aggr_type > 0) {
-        buffers_val = alloc_buf_vec(max_gb_size*sizeof(uint32_t), NR_DPU);
+        buffers_val = alloc_buf_vec(system, max_gb_size*sizeof(uint32_t));
         get_buf(system, buffers_val, offset*3*sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
     }
 
@@ -96,40 +96,20 @@ std::shared_ptr<arrow::Table> aggr_host(std::shared_ptr<arrow::Table> results) {
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     init_buffer();
     try {
-        DPU_ASSERT(dpu_load(system, "kernel_haggregate", NULL));
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
-        std::chrono::steady_clock::time_point begin_init = std::chrono::steady_clock::now();
-        populate_mram(system);
-        std::chrono::steady_clock::time_point end_init = std::chrono::steady_clock::now();
-        std::cout << "Initial transfer elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_init - begin_init).count()
-              << " millisecs." << std::endl;
-
-        std::chrono::steady_clock::time_point begin_aggr = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-        std::chrono::steady_clock::time_point end_aggr = std::chrono::steady_clock::now();
-                std::cout << "GroupBy elapsed time: "
-                << std::chrono::duration_cast<std::chrono::milliseconds>(end_aggr - begin_aggr).count()
-                << " millisecs." << std::endl;
-
-        std::chrono::steady_clock::time_point begin_fin = std::chrono::steady_clock::now();
-        std::shared_ptr<arrow::Table> results = get_results(system);
-        results = aggr_host(results);
-        std::chrono::steady_clock::time_point end_fin = std::chrono::steady_clock::now();
-        std::cout << "Final transfer elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_fin - begin_fin).count()
-              << " millisecs." << std::endl;
-        //output_int(results);
+        trace.begin("aggregate_hash_sync", nr_dpus);
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_haggregate", NULL)); });
+
+        traced("to_dpu", [&]() { populate_mram(system); });
+        traced("dpu_launch", [&]() { DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS)); });
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        std::shared_ptr<arrow::Table> results = traced("from_dpu", [&]() { return get_results(system); });
+        results = traced("host", [&]() { return aggr_host(results); });
+        //output_int(results);
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         validate(results);
         //output_dpu(system);
@@ -139,7 +119,7 @@ int main(void) {
 #endif
 
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
@@ -21,6 +21,8 @@ void populate_mram(dpu_set_t &system) {
 dpu_error_t groupby_callback(struct dpu_set_t rank, 
     __attribute((unused)) uint32_t rank_id, void * args) {
 
+    trace_scope scope("from_dpu");
+
     std::vector<std::vector<groupby_results_t>> gb_res (64, std::vector<groupby_results_t>(1));
 
     struct dpu_set_t dpu;
@@ -29,6 +31,7 @@ dpu_error_t groupby_callback(struct dpu_set_t rank,
         DPU_ASSERT(dpu_prepare_xfer(dpu, (void*) gb_res[each_dpu].data()));
     }
     DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "dpu_results", 0, gb_res[0].size()*sizeof(groupby_results_t), DPU_XFER_DEFAULT));
+    scope.add_bytes(get_nr_dpus(rank)*sizeof(groupby_results_t));
 
     uint32_t max_gb_size = 0;
     DPU_FOREACH(rank, dpu, each_dpu) {
@@ -49,6 +52,7 @@ dpu_error_t groupby_callback(struct dpu_set_t rank,
         DPU_ASSERT(dpu_prepare_xfer(dpu, buffers_key[each_dpu]->mutable_data()));
     }
     DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0, max_gb_size*sizeof(int32_t), DPU_XFER_DEFAULT));
+    scope.add_bytes((uint64_t) buffers_key.size()*max_gb_size*sizeof(int32_t));
 
     DPU_FOREACH(rank, dpu, each_dpu) {
         uint32_t dpu_size = gb_res[each_dpu][0].count;
@@ -72,6 +76,7 @@ dpu_error_t groupby_callback(struct dpu_set_t rank,
             DPU_ASSERT(dpu_prepare_xfer(dpu, buffers_val[each_dpu]->mutable_data()));
         }
         DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, BUFFER_SIZE*sizeof(uint32_t), max_gb_size*sizeof(int32_t), DPU_XFER_DEFAULT));
+        scope.add_bytes((uint64_t) buffers_val.size()*max_gb_size*sizeof(int32_t));
 
         DPU_FOREACH(rank, dpu, each_dpu) {
             uint32_t dpu_size = gb_res[each_dpu][0].count;
@@ -128,30 +133,26 @@ std::shared_ptr<arrow::Table> concat() {
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     init_buffer();
     try {
-        DPU_ASSERT(dpu_load(system, "kernel_saggregate", NULL));
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        trace.begin("aggregate_sort", nr_dpus);
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_saggregate", NULL)); });
 
-        populate_mram(system);
+        traced("to_dpu", [&]() { populate_mram(system); });
         DPU_ASSERT(dpu_launch(system, DPU_ASYNCHRONOUS));
 
         DPU_ASSERT(dpu_callback(system, groupby_callback, NULL, DPU_CALLBACK_ASYNC));
 
-        dpu_sync(system);
-        auto results = concat();
-
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        traced("dpu_launch", [&]() { dpu_sync(system); });
+        auto results = traced("host", [&]() { return concat(); });
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         validate(results);
 
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
@@ -0,0 +1,105 @@
+#include <defs.h>
+#include <barrier.h>
+#include <stdint.h>
+#include <mutex.h>
+#include <perfcounter.h>
+
+#include "hash_bench.h"
+#include "hash_func.h"
+
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 4
+#endif
+
+__host hash_bench_args_t bench_args;
+__host hash_bench_results_t bench_res;
+__host uint32_t bench_hist[HIST_BUCKETS];
+
+// Keeps the hash values of each tasklet alive
+uint32_t sink[NR_TASKLETS];
+
+BARRIER_INIT(barrier, NR_TASKLETS);
+
+MUTEX_INIT(mutex);
+
+/*
+    @param i index of the key on the DPU
+
+    Sequential keys count up from the first key, uniform keys scramble them
+    with a xorshift step, which keeps them distinct.
+*/
+static inline uint32_t bench_key(uint32_t i) {
+    uint32_t key = bench_args.first_key + i;
+    if (bench_args.uniform) {
+        key ^= key << 13;
+        key ^= key >> 17;
+        key ^= key << 5;
+    }
+    return key;
+}
+
+static uint32_t identity(uint32_t key) {
+    return key;
+}
+
+// Hash the keys of the tasklet into acc
+#define HASH_LOOP(func) \
+    for (uint32_t i = tasklet_id; i < bench_args.n; i += NR_TASKLETS) { \
+        acc ^= func(bench_key(i)); \
+    }
+
+int main() {
+    uint32_t tasklet_id = me();
+    uint32_t acc = 0;
+
+    if (tasklet_id == 0) {
+        hash_init();
+        for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+            bench_hist[b] = 0;
+        }
+        perfcounter_config(COUNT_INSTRUCTIONS, true);
+    }
+    barrier_wait(&barrier);
+
+    // Generating the keys alone is subtracted from the hashing
+    HASH_LOOP(identity);
+    barrier_wait(&barrier);
+
+    if (tasklet_id == 0) {
+        bench_res.baseline = perfcounter_get();
+        perfcounter_config(COUNT_INSTRUCTIONS, true);
+    }
+    barrier_wait(&barrier);
+
+    switch (bench_args.func) {
+        case 0: HASH_LOOP(hash0); break;
+        case 1: HASH_LOOP(hash1); break;
+        case 2: HASH_LOOP(hash2); break;
+        case 3: HASH_LOOP(hash3); break;
+        default: HASH_LOOP(hash4); break;
+    }
+    barrier_wait(&barrier);
+
+    if (tasklet_id == 0) {
+        bench_res.instructions = perfcounter_get();
+    }
+    sink[tasklet_id] = acc;
+
+    // Histogram of the buckets the keys fall into, not measured
+    uint32_t (*func)(uint32_t) = bench_args.func == 0 ? hash0 : hash_func[bench_args.func - 1];
+    uint32_t local_hist[HIST_BUCKETS];
+    for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+        local_hist[b] = 0;
+    }
+    for (uint32_t i = tasklet_id; i < bench_args.n; i += NR_TASKLETS) {
+        local_hist[(func(bench_key(i)) >> bench_args.shift) & (HIST_BUCKETS - 1)]++;
+    }
+
+    mutex_lock(mutex);
+    for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+        bench_hist[b] += local_hist[b];
+    }
+    mutex_unlock(mutex);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hash_bench.h"
+#include "transfer_helper.h"
+#include "skew.h"
+
+/*
+Cost and balance of the DPU hash functions, the shift/add mixers against
+tabulation hashing, on sequential and uniform keys.
+
+    host_hash [--json] [--keys 65536]
+
+For each function the instructions per hash are measured on the DPUs, minus
+the instructions generating the keys. The balance is the distribution of the
+keys of all DPUs over 32 buckets, taken from the bits the kernels use: the
+upper bits of hash0 as in the radix partitioning, the lower bits of hash1 to
+hash4 as in the hash tables. The results are printed as CSV, or as one JSON
+object per line with --json.
+*/
+
+// Programs with the two hash families
+const std::vector<std::pair<std::string, std::string>> families = {
+    {"mixer", "kernel_hash_mix"},
+    {"tabulation", "kernel_hash_tab"}
+};
+
+uint32_t keys_dpu = 65536;
+bool json = false;
+
+/*
+Hash the keys with one function on all DPUs and print the results
+
+@param system allocated dpus with the kernel loaded
+@param family name of the hash family
+@param uniform use uniform instead of sequential keys
+@param func index of the hash function
+*/
+void measure(dpu_set_t &system, const std::string &family, bool uniform, uint32_t func) {
+    // Partitioning uses the upper bits of hash0
+    uint32_t shift = func == 0 ? 27 : 0;
+
+    std::vector<std::vector<hash_bench_args_t>> args(nr_dpus, std::vector<hash_bench_args_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        args[dpu][0] = {.n = keys_dpu, .first_key = dpu*keys_dpu, .uniform = uniform,
+                        .func = func, .shift = shift, .padding = 0};
+    }
+    dist_vec(system, args, 0, "bench_args", DPU_XFER_DEFAULT);
+
+    DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
+
+    std::vector<std::vector<hash_bench_results_t>> res(nr_dpus, std::vector<hash_bench_results_t>(1));
+    get_vec(system, res, 0, "bench_res", DPU_XFER_DEFAULT);
+    std::vector<std::vector<uint32_t>> hist(nr_dpus, std::vector<uint32_t>(HIST_BUCKETS));
+    get_vec(system, hist, 0, "bench_hist", DPU_XFER_DEFAULT);
+
+    double instructions = 0;
+    std::vector<uint64_t> buckets(HIST_BUCKETS, 0);
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        instructions += (double) (res[dpu][0].instructions - res[dpu][0].baseline) / keys_dpu;
+        for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+            buckets[b] += hist[dpu][b];
+        }
+    }
+    instructions /= nr_dpus;
+
+    size_stats stats = compute_size_stats(buckets);
+    double max_mean = stats.max / stats.mean;
+    double rel_stddev = stats.stddev / stats.mean;
+    std::string keys = uniform ? "uniform" : "sequential";
+
+    if (json) {
+        std::cout << "{\"family\": \"" << family << "\", \"keys\": \"" << keys << "\", \"function\": \"hash"
+                  << func << "\", \"shift\": " << shift << ", \"nr_dpus\": " << nr_dpus
+                  << ", \"keys_dpu\": " << keys_dpu << ", \"instr_hash\": " << instructions
+                  << ", \"max_mean\": " << max_mean << ", \"rel_stddev\": " << rel_stddev << "}" << std::endl;
+    } else {
+        std::cout << family << "," << keys << ",hash" << func << "," << shift << "," << nr_dpus << ","
+                  << keys_dpu << "," << instructions << "," << max_mean << "," << rel_stddev << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int arg = 1; arg < argc; arg++) {
+        std::string name = argv[arg];
+        if (name == "--json") {
+            json = true;
+        } else if (name == "--keys" && arg + 1 < argc) {
+            keys_dpu = std::stoul(argv[++arg]);
+        } else {
+            std::cout << "Usage: host_hash [--json] [--keys 65536]" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        dpu_set_t system;
+        alloc_dpus(system, false);
+
+        if (!json) {
+            std::cout << "family,keys,function,shift,nr_dpus,keys_dpu,instr_hash,max_mean,rel_stddev" << std::endl;
+        }
+
+        for (auto const &family : families) {
+            DPU_ASSERT(dpu_load(system, family.second.c_str(), NULL));
+
+            for (bool uniform : {false, true}) {
+                for (uint32_t func = 0; func < 5; func++) {
+                    measure(system, family.first, uniform, func);
+                }
+            }
+        }
+
+        DPU_ASSERT(dpu_free(system));
+    }
+    catch (const std::runtime_error & e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    return 0;
+}
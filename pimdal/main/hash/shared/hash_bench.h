@@ -0,0 +1,30 @@
+#ifndef _HASH_BENCH_H_
+#define _HASH_BENCH_H_
+
+#include <stdint.h>
+
+// Buckets of the balance histogram
+#define HIST_BUCKETS 32
+
+typedef struct {
+    // Keys hashed by each DPU
+    uint32_t n;
+    // Key of the first element, keys are consecutive from it
+    uint32_t first_key;
+    // 0: sequential keys, 1: uniform keys, xorshift of the sequential ones
+    uint32_t uniform;
+    // Index of the hash function, 0 to 4 for hash0 to hash4
+    uint32_t func;
+    // Hash bits below the bucket bits of the histogram
+    uint32_t shift;
+    uint32_t padding;
+} hash_bench_args_t;
+
+typedef struct {
+    // Instructions to generate the keys
+    uint64_t baseline;
+    // Instructions to generate and hash the keys
+    uint64_t instructions;
+} hash_bench_results_t;
+
+#endif
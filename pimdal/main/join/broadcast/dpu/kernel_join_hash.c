@@ -14,9 +14,6 @@
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 
 #ifndef INNER_SIZE
 #define INNER_SIZE 100000
@@ -126,6 +123,7 @@ int main_kernel2() {
     uint32_t inner_in = outer_in + OUTER_SIZE*sizeof(key_ptr32);
     uint32_t table = inner_in + TABLE_SIZE*sizeof(key_ptr32);
     uint32_t part_sizes = table + TABLE_SIZE*sizeof(key_ptr32);
+    uint32_t overflow = part_sizes + (NR_PART+1)*sizeof(uint64_t);
 
     if (tasklet_id == 0) {
         hash_args.in_ptr = inner_in;
@@ -133,6 +131,8 @@ int main_kernel2() {
         hash_args.shift = 13;
         hash_args.table_ptr = table;
         hash_args.table_size = TABLE_SIZE;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -159,6 +159,8 @@ int main_kernel2() {
         merge_args.out_ptr = outer_in;
         merge_args.part_sizes = part_sizes;
         merge_args.part_n = NR_PART;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -167,6 +169,7 @@ int main_kernel2() {
 
     if (tasklet_id == 0) {
         join_res.count = merge_res.out_n;
+        join_res.dropped = merge_res.dropped_n;
     }
  
     return 0;
@@ -4,8 +4,8 @@ std::shared_ptr<arrow::Buffer> map;
 
 void populate_mram(dpu_set_t &system) {
 
-    std::vector<std::vector<join_arguments_t>> join_args(NR_DPU, std::vector<join_arguments_t>(1));
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    std::vector<std::vector<join_arguments_t>> join_args(nr_dpus, std::vector<join_arguments_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
         join_args[dpu][0].kernel_sel = 0;
         join_args[dpu][0].ptr_inner = dpu*INNER_SIZE;
         join_args[dpu][0].ptr_outer = dpu*OUTER_SIZE;
@@ -18,6 +18,8 @@ void populate_mram(dpu_set_t &system) {
 
 dpu_error_t join_callback(struct dpu_set_t rank, uint32_t rank_id, void * args) {
 
+    trace_scope scope("from_dpu");
+
     std::vector<std::vector<join_results_t>> join_res (64, std::vector<join_results_t>(1));
 
     struct dpu_set_t dpu;
@@ -26,6 +28,8 @@ dpu_error_t join_callback(struct dpu_set_t rank, uint32_t rank_id, void * args)
         DPU_ASSERT(dpu_prepare_xfer(dpu, (void*) join_res[each_dpu].data()));
     }
     DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "join_res", 0, join_res[0].size()*sizeof(join_results_t), DPU_XFER_DEFAULT));
+    scope.add_bytes(get_nr_dpus(rank)*sizeof(join_results_t));
+    check_join_output(join_res);
 
     uint32_t max_join_size = 0;
     DPU_FOREACH(rank, dpu, each_dpu) {
@@ -46,6 +50,7 @@ dpu_error_t join_callback(struct dpu_set_t rank, uint32_t rank_id, void * args)
         DPU_ASSERT(dpu_prepare_xfer(dpu, buffers[each_dpu]->mutable_data()));
     }
     DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0, max_join_size*sizeof(key_ptr32), DPU_XFER_DEFAULT));
+    scope.add_bytes((uint64_t) buffers.size()*max_join_size*sizeof(key_ptr32));
 
     // uint32_t* map_data = (uint32_t*) map->mutable_data();
 
@@ -63,25 +68,32 @@ std::vector<std::vector<join_arguments_t>> redistribute(dpu_set_t &system, uint3
                                                         uint32_t outer_off, uint32_t inner_size_off,
                                                         uint32_t outer_size_off) {
 
-    std::vector<std::vector<join_arguments_t>> join_args (NR_DPU, std::vector<join_arguments_t>(1));
+    std::vector<std::vector<join_arguments_t>> join_args (nr_dpus, std::vector<join_arguments_t>(1));
+
+    arrow::BufferVector part_inner = alloc_buf_vec(system, INNER_SIZE*sizeof(key_ptr32));
+    arrow::BufferVector part_outer = alloc_buf_vec(system, OUTER_SIZE*sizeof(key_ptr32));
 
-    arrow::BufferVector part_inner = alloc_buf_vec(INNER_SIZE*sizeof(key_ptr32), NR_DPU);
-    arrow::BufferVector part_outer = alloc_buf_vec(OUTER_SIZE*sizeof(key_ptr32), NR_DPU);
+    // Wait for the partitioning apart from the transfers
+    traced("dpu_launch", [&]() { DPU_ASSERT(dpu_sync(system)); });
 
-    get_buf(system, part_inner, inner_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_ASYNC);
-    get_buf(system, part_outer, outer_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_ASYNC);
+    traced("shuffle", [&]() {
+        get_buf(system, part_inner, inner_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_ASYNC);
+        get_buf(system, part_outer, outer_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_ASYNC);
+    });
 
     // Copy the sizes of the partitoned tables
-    std::vector<std::vector<uint64_t>> inner_sizes(NR_DPU, std::vector<uint64_t>(NR_BUCKETS+1));
-    std::vector<std::vector<uint64_t>> outer_sizes(NR_DPU, std::vector<uint64_t>(NR_BUCKETS+1));
+    std::vector<std::vector<uint64_t>> inner_sizes(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+    std::vector<std::vector<uint64_t>> outer_sizes(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
 
-    get_vec(system, inner_sizes, inner_size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_ASYNC);
-    get_vec(system, outer_sizes, outer_size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+    traced("shuffle", [&]() {
+        get_vec(system, inner_sizes, inner_size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_ASYNC);
+        get_vec(system, outer_sizes, outer_size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+    });
 
     uint32_t max_inner_size = 0;
     uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        for (uint32_t src = 0; src < nr_dpus; src++) {
             join_args[dpu][0].n_el_inner += inner_sizes[src][dpu+1] - inner_sizes[src][dpu];
             join_args[dpu][0].n_el_outer += outer_sizes[src][dpu+1] - outer_sizes[src][dpu];
         }
@@ -95,12 +107,12 @@ std::vector<std::vector<join_arguments_t>> redistribute(dpu_set_t &system, uint3
         }
     }
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
         join_args[dpu][0].offset_outer = max_inner_size;
         join_args[dpu][0].offset_inner = max_outer_size;
         join_args[dpu][0].kernel_sel = 1;
 
-        for (uint32_t i = 0; i < NR_BUCKETS+1; i++) {
+        for (uint32_t i = 0; i < nr_dpus+1; i++) {
             inner_sizes[dpu][i] *= sizeof(key_ptr32);
             outer_sizes[dpu][i] *= sizeof(key_ptr32);
         }
@@ -119,30 +131,34 @@ std::vector<std::vector<join_arguments_t>> redistribute(dpu_set_t &system, uint3
 
     DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
                                 max_outer_size*sizeof(key_ptr32), &get_block_info_outer, flag));
+    for (uint32_t src = 0; src < nr_dpus; src++) {
+        trace_bytes("shuffle", inner_sizes[src][nr_dpus] - inner_sizes[src][0]);
+        trace_bytes("shuffle", outer_sizes[src][nr_dpus] - outer_sizes[src][0]);
+    }
 
     dist_vec(system, join_args, 0, "join_args", DPU_XFER_ASYNC);
 
     DPU_ASSERT(dpu_launch(system, DPU_ASYNCHRONOUS));
     DPU_ASSERT(dpu_callback(system, join_callback, NULL, DPU_CALLBACK_ASYNC));
 
-    dpu_sync(system);
+    traced("dpu_launch", [&]() { dpu_sync(system); });
 
     return join_args;
 }
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     init_buffer();
     try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        trace.begin("broadcast_join", nr_dpus);
 
-        DPU_ASSERT(dpu_load(system, "kernel_bjoin", NULL));
-        populate_mram(system);
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_bjoin", NULL)); });
+        traced("to_dpu", [&]() { populate_mram(system); });
 
         DPU_ASSERT(dpu_launch(system, DPU_ASYNCHRONOUS));
 
-        // arrow::Result<std::unique_ptr<arrow::Buffer>> map_try = arrow::AllocateBuffer(NR_DPU*OUTER_SIZE*sizeof(uint32_t));
+        // arrow::Result<std::unique_ptr<arrow::Buffer>> map_try = arrow::AllocateBuffer(nr_dpus*OUTER_SIZE*sizeof(uint32_t));
         // if (!map_try.ok()) {
         //    std::cout << "Could not allocate map" << std::endl;
         // }
@@ -151,21 +167,17 @@ int main(void) {
         uint32_t part_off = 0;
         uint32_t match_off = part_off + INNER_SIZE*sizeof(key_ptr32);
         uint32_t part_size_off = match_off + OUTER_SIZE*sizeof(key_ptr32);
-        uint32_t match_size_off = part_size_off + (NR_BUCKETS+1)*sizeof(uint64_t);
+        uint32_t match_size_off = part_size_off + (nr_dpus+1)*sizeof(uint64_t);
 
         auto join_args = redistribute(system, part_off, match_off, part_size_off, match_size_off);
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         //validate(map);
 
         //output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
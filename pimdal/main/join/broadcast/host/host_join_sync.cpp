@@ -2,8 +2,8 @@
 
 void populate_mram(dpu_set_t &system) {
 
-    std::vector<std::vector<join_arguments_t>> join_args(NR_DPU, std::vector<join_arguments_t>(1));
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    std::vector<std::vector<join_arguments_t>> join_args(nr_dpus, std::vector<join_arguments_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
         join_args[dpu][0].kernel_sel = 0;
         join_args[dpu][0].ptr_inner = dpu*INNER_SIZE;
         join_args[dpu][0].ptr_outer = dpu*OUTER_SIZE;
@@ -17,22 +17,22 @@ void populate_mram(dpu_set_t &system) {
 
 std::vector<std::vector<join_arguments_t>> redistribute(dpu_set_t &system, uint32_t inner_off) {
 
-    std::vector<std::vector<join_arguments_t>> join_args (NR_DPU, std::vector<join_arguments_t>(1));
+    std::vector<std::vector<join_arguments_t>> join_args (nr_dpus, std::vector<join_arguments_t>(1));
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer(NR_DPU*INNER_SIZE*sizeof(key_ptr32));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer(nr_dpus*INNER_SIZE*sizeof(key_ptr32));
         if (!inner_try.ok()) {
             std::cout << "Could not allocate buffer!" << std::endl;
         }
     std::shared_ptr<arrow::Buffer> inner = *std::move(inner_try);
 
-    std::vector<uint64_t> offset (NR_DPU+1, 0);
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    std::vector<uint64_t> offset (nr_dpus+1, 0);
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
         offset[dpu + 1] = offset[dpu] + INNER_SIZE*sizeof(key_ptr32);
 
         join_args[dpu][0].kernel_sel = 1;
-        join_args[dpu][0].n_el_inner = NR_DPU*INNER_SIZE;
+        join_args[dpu][0].n_el_inner = nr_dpus*INNER_SIZE;
         join_args[dpu][0].n_el_outer = OUTER_SIZE;
-        join_args[dpu][0].range = NR_DPU*INNER_SIZE;
+        join_args[dpu][0].range = nr_dpus*INNER_SIZE;
         join_args[dpu][0].start = 0;
     }
 
@@ -46,10 +46,11 @@ std::vector<std::vector<join_arguments_t>> redistribute(dpu_set_t &system, uint3
 }
 
 std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
-    std::vector<std::vector<join_results_t>> join_res (NR_DPU, std::vector<join_results_t>(1));
+    std::vector<std::vector<join_results_t>> join_res (nr_dpus, std::vector<join_results_t>(1));
     arrow::ArrayVector results_chunks;
 
     get_vec(system, join_res, 0, "join_res", DPU_XFER_DEFAULT);
+    check_join_output(join_res);
 
     struct dpu_set_t dpu;
     uint32_t each_dpu;
@@ -62,10 +63,10 @@ std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
         }
     }
 
-    arrow::BufferVector buffers = alloc_buf_vec(max_join_size*sizeof(key_ptr32), NR_DPU);
+    arrow::BufferVector buffers = alloc_buf_vec(system, max_join_size*sizeof(key_ptr32));
     get_buf(system, buffers, 0, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> map_try = arrow::AllocateBuffer(NR_DPU*OUTER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> map_try = arrow::AllocateBuffer(nr_dpus*OUTER_SIZE*sizeof(uint32_t));
     if (!map_try.ok()) {
         std::cout << "Could not allocate map" << std::endl;
     }
@@ -73,7 +74,7 @@ std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
     uint32_t* map_data = (uint32_t*) map->mutable_data();
 
     #pragma omp parallel for
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
         key_ptr32* buffer_data = (key_ptr32*) buffers[dpu]->data();
         for (uint32_t i = 0; i < join_res[dpu][0].count; i++) {
             map_data[buffer_data[i].key] = buffer_data[i].ptr;
@@ -85,61 +86,31 @@ std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     init_buffer();
     try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
-        std::chrono::steady_clock::time_point begin_init = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_load(system, "kernel_bjoin", NULL));
-        populate_mram(system);
-        std::chrono::steady_clock::time_point end_init = std::chrono::steady_clock::now();
-        std::cout << "Initial transfer elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_init - begin_init).count()
-              << " millisecs." << std::endl;
-        
-        std::chrono::steady_clock::time_point begin_part = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-        std::chrono::steady_clock::time_point end_part = std::chrono::steady_clock::now();
-        std::cout << "Partition elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_part - begin_part).count()
-              << " millisecs." << std::endl;
-
-        std::chrono::steady_clock::time_point begin_dist = std::chrono::steady_clock::now();
-        uint32_t inner_off = 2*OUTER_SIZE*sizeof(key_ptr32);
+        trace.begin("broadcast_join_sync", nr_dpus);
 
-        auto join_args = redistribute(system, inner_off);
-        std::chrono::steady_clock::time_point end_dist = std::chrono::steady_clock::now();
-        std::cout << "Redistribution elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_dist - begin_dist).count()
-              << " millisecs." << std::endl;
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_bjoin", NULL)); });
+        traced("to_dpu", [&]() { populate_mram(system); });
         
-        std::chrono::steady_clock::time_point begin_join = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-        std::chrono::steady_clock::time_point end_join = std::chrono::steady_clock::now();
-                std::cout << "Join elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_join - begin_join).count()
-              << " millisecs." << std::endl;
+        traced("dpu_launch", [&]() { DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS)); });
 
-        std::chrono::steady_clock::time_point begin_gather = std::chrono::steady_clock::now();
-        auto results = get_results(system);
-        std::chrono::steady_clock::time_point end_gather = std::chrono::steady_clock::now();
-        std::cout << "Gather elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_gather - begin_gather).count()
-              << " millisecs." << std::endl;
+        uint32_t inner_off = 2*OUTER_SIZE*sizeof(key_ptr32);
 
+        auto join_args = traced("shuffle", [&]() { return redistribute(system, inner_off); });
+        
+        traced("dpu_launch", [&]() { DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS)); });
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        auto results = traced("from_dpu", [&]() { return get_results(system); });
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         validate(results);
 
         output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
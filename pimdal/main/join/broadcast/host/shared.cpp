@@ -13,9 +13,6 @@
 #include "join.h"
 #include "transfer_helper.h"
 
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 #ifndef INNER_SIZE
 #define INNER_SIZE 200000
 #endif
@@ -26,14 +23,13 @@
 #define OUTER_RANGE 1
 #endif
 
-static constexpr uint32_t NR_BUCKETS = NR_DPU;
 static constexpr uint32_t TABLE_SIZE = 4096*256;
 
 std::shared_ptr<arrow::Table> inner_table;
 std::shared_ptr<arrow::Table> outer_table;
 
 void init_buffer() {
-    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer((uint64_t) NR_DPU*INNER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer((uint64_t) nr_dpus*INNER_SIZE*sizeof(uint32_t));
     if (!inner_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -43,14 +39,14 @@ void init_buffer() {
     uint64_t inner_size = inner->size() / sizeof(uint32_t);
 
     #pragma omp parallel for
-    for (uint64_t i = 0; i < (uint64_t) NR_DPU*INNER_SIZE; i++) {
+    for (uint64_t i = 0; i < (uint64_t) nr_dpus*INNER_SIZE; i++) {
             inner_data[i] = i+1;
     }
 
     //std::default_random_engine gen(0);
     __gnu_parallel::random_shuffle(inner_data, inner_data+inner_size);
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> outer_try = arrow::AllocateBuffer((uint64_t) NR_DPU*OUTER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> outer_try = arrow::AllocateBuffer((uint64_t) nr_dpus*OUTER_SIZE*sizeof(uint32_t));
     if (!outer_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -65,17 +61,17 @@ void init_buffer() {
         seed += omp_get_thread_num();
     #endif
         std::default_random_engine gen(seed);
-        std::uniform_int_distribution<uint32_t> dist(1, NR_DPU*OUTER_RANGE*INNER_SIZE);
+        std::uniform_int_distribution<uint32_t> dist(1, nr_dpus*OUTER_RANGE*INNER_SIZE);
 
     #pragma omp for schedule(static)
-    for (uint64_t i = 0; i < (uint64_t) NR_DPU*OUTER_SIZE; i++) {
+    for (uint64_t i = 0; i < (uint64_t) nr_dpus*OUTER_SIZE; i++) {
             outer_data[i] = dist(gen);
         }
     }
 
     // Create the inner table
     auto schema = arrow::schema({arrow::field("key", arrow::uint32(), false)});
-    auto inner_key_data = arrow::ArrayData::Make(arrow::uint32(), NR_DPU*INNER_SIZE, {nullptr, inner});
+    auto inner_key_data = arrow::ArrayData::Make(arrow::uint32(), nr_dpus*INNER_SIZE, {nullptr, inner});
     auto inner_key_array = arrow::MakeArray(inner_key_data);
 
     arrow::ArrayVector inner_data_vec;
@@ -83,7 +79,7 @@ void init_buffer() {
     inner_table = arrow::Table::Make(schema, inner_data_vec);
 
     // Create the outer table
-    auto outer_key_data = arrow::ArrayData::Make(arrow::uint32(), NR_DPU*OUTER_SIZE, {nullptr, outer});
+    auto outer_key_data = arrow::ArrayData::Make(arrow::uint32(), nr_dpus*OUTER_SIZE, {nullptr, outer});
     auto outer_key_array = arrow::MakeArray(outer_key_data);
 
     arrow::ArrayVector outer_data_vec;
@@ -91,6 +87,21 @@ void init_buffer() {
     outer_table = arrow::Table::Make(schema, outer_data_vec);
 }
 
+/*
+Warn about DPUs whose hash tables lost inner elements because their overflow
+area was full
+
+@param join_res results of the join kernel of each DPU
+*/
+void check_join_output(const std::vector<std::vector<join_results_t>> &join_res) {
+    for (uint32_t dpu = 0; dpu < join_res.size(); dpu++) {
+        if (join_res[dpu][0].dropped > 0) {
+            std::cout << "Hash tables of DPU " << dpu << " full: " << join_res[dpu][0].dropped
+                      << " inner elements dropped" << std::endl;
+        }
+    }
+}
+
 void validate(std::shared_ptr<arrow::Buffer> map) {
 
     bool error = false;
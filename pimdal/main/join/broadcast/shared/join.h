@@ -19,6 +19,7 @@ typedef struct
 typedef struct
 {
     uint32_t count;
+    uint32_t dropped; // Inner elements lost because the overflow area of the tables was full
 } join_results_t;
 
 #endif
\ No newline at end of file
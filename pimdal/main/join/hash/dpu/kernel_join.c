@@ -10,14 +10,12 @@
 #include "datatype.h"
 #include "join.h"
 #include "hash_join.h"
+#include "timeline.h"
 
 #define BLOCK_SIZE 256
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 
 #ifndef INNER_SIZE
 #define INNER_SIZE 100000
@@ -25,9 +23,12 @@
 #ifndef OUTER_SIZE
 #define OUTER_SIZE 1000000
 #endif
-#define NR_PART 8192
 #define FILTER 512
-#define TABLE_SIZE (NR_PART*256)
+
+// Filter the outer relation with a bloom filter of the inner relation before the shuffle
+#ifndef BLOOM_FILTER
+#define BLOOM_FILTER 0
+#endif
 
 hash_arguments_t hash_args;
 filter_arguments_t filter_args;
@@ -35,6 +36,8 @@ part_arguments_t part_args;
 match_arguments_t match_args;
 merge_arguments_t merge_args;
 merge_results_t merge_res;
+bloom_arguments_t bloom_args;
+merge_results_t semi_res;
 
 __host join_arguments_t join_args;
 __host join_results_t join_res;
@@ -63,50 +66,83 @@ void out_val(key_ptr32 *in, uint32_t *outer, uint32_t *inner) {
 
 extern int main_kernel1(void);
 extern int main_kernel2(void);
+extern int main_kernel3(void);
 
-int (*kernels[2])(void) = {main_kernel1, main_kernel2};
+// 0: partition both relations, 1: join, 2: filter and partition the outer relation
+int (*kernels[3])(void) = {main_kernel1, main_kernel2, main_kernel3};
 
 int main(void) {
+    TIMELINE_START();
     return kernels[join_args.kernel_sel]();
 }
 
-int main_kernel1() {
+/*
+    @param filter_words words of the bloom filter, 0 to keep all elements
 
+    Partition the outer relation by DPU. With a filter, the elements without
+    a match in the bloom filter of the inner relation are dropped before the
+    partitioning.
+*/
+static void partition_outer(uint32_t filter_words) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
     }
+    // Barrier
     barrier_wait(&barrier);
 
     uint32_t inner_part = (uint32_t) DPU_MRAM_HEAP_POINTER;
     uint32_t outer_part = inner_part + INNER_SIZE*sizeof(key_ptr32);
     uint32_t inner_size = outer_part + OUTER_SIZE*sizeof(key_ptr32);
-    uint32_t outer_size = inner_size + (NR_DPU+1)*sizeof(uint64_t);
-    uint32_t buffer = outer_size + (NR_DPU+1)*sizeof(uint64_t);
+    uint32_t outer_size = inner_size + (join_args.dpu_n+1)*sizeof(uint64_t);
+    uint32_t buffer = outer_size + (join_args.dpu_n+1)*sizeof(uint64_t);
 
     uint32_t* val_cache = (uint32_t*) mem_alloc(BLOCK_SIZE*sizeof(uint32_t));
     key_ptr32* ptr_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
 
     uint32_t base_tasklet = tasklet_id*BLOCK_SIZE;
-    for (uint32_t base = base_tasklet; base < INNER_SIZE; base += NR_TASKLETS*BLOCK_SIZE) {
-        mram_read((__mram_ptr void*) (inner_part + base*sizeof(uint32_t)), val_cache, BLOCK_SIZE*sizeof(uint32_t));
+    for (uint32_t base = base_tasklet; base < OUTER_SIZE; base += NR_TASKLETS*BLOCK_SIZE) {
+        mram_read((__mram_ptr void*) (outer_part + base*sizeof(uint32_t)), val_cache, BLOCK_SIZE*sizeof(uint32_t));
 
-        create_ptr(val_cache, ptr_cache, join_args.ptr_inner+base);
+        create_ptr(val_cache, ptr_cache, join_args.ptr_outer+base);
 
         mram_write(ptr_cache, (__mram_ptr void*) (buffer + base*sizeof(key_ptr32)), BLOCK_SIZE*sizeof(key_ptr32));
     }
-    barrier_wait(&barrier);
 
     if (tasklet_id == 0) {
         part_args.in_ptr = buffer;
-        part_args.size = INNER_SIZE;
+        part_args.size = OUTER_SIZE;
         part_args.shift = 27;
-        part_args.part_ptr = inner_part;
-        part_args.part_sizes = inner_size;
-        part_args.part_n = NR_DPU;
+        part_args.part_ptr = outer_part;
+        part_args.part_sizes = outer_size;
+        part_args.part_n = join_args.dpu_n;
     }
     barrier_wait(&barrier);
 
+#if BLOOM_FILTER == 1
+    if (filter_words > 0) {
+        if (tasklet_id == 0) {
+            bloom_args.in_ptr = buffer;
+            bloom_args.size = OUTER_SIZE;
+            bloom_args.out_ptr = buffer + OUTER_SIZE*sizeof(key_ptr32);
+            bloom_args.filter_ptr = (uint32_t) DPU_MRAM_HEAP_POINTER + BLOOM_OFFSET(join_args.dpu_n);
+            bloom_args.filter_words = filter_words;
+        }
+        barrier_wait(&barrier);
+
+        TIMELINE_BEGIN(PHASE_SEMI);
+        semi_kernel(&bloom_args, &semi_res);
+        TIMELINE_END();
+        TIMELINE_BARRIER(&barrier);
+
+        if (tasklet_id == 0) {
+            part_args.in_ptr = bloom_args.out_ptr;
+            part_args.size = semi_res.out_n;
+        }
+        barrier_wait(&barrier);
+    }
+#endif
+
 #if PERF == 1
     if (tasklet_id == 0) {
         perfcounter_config(COUNT_CYCLES, true);
@@ -119,41 +155,70 @@ int main_kernel1() {
     barrier_wait(&barrier);
 #endif
 
+    TIMELINE_BEGIN(PHASE_PARTITION);
     part_kernel(&part_args);
-    barrier_wait(&barrier);
+    TIMELINE_END();
+    TIMELINE_BARRIER(&barrier);
 
 #if PERF > 0
     if (tasklet_id == 0) {
-        cycles_1 = perfcounter_get();
+        cycles_2 = perfcounter_get();
     }
     barrier_wait(&barrier);
 #endif
+}
 
+int main_kernel1() {
+
+    uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
     }
-    // Barrier
     barrier_wait(&barrier);
 
-    val_cache = (uint32_t*) mem_alloc(BLOCK_SIZE*sizeof(uint32_t));
-    ptr_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
+    uint32_t inner_part = (uint32_t) DPU_MRAM_HEAP_POINTER;
+    uint32_t outer_part = inner_part + INNER_SIZE*sizeof(key_ptr32);
+    uint32_t inner_size = outer_part + OUTER_SIZE*sizeof(key_ptr32);
+    uint32_t outer_size = inner_size + (join_args.dpu_n+1)*sizeof(uint64_t);
+    uint32_t buffer = outer_size + (join_args.dpu_n+1)*sizeof(uint64_t);
 
-    base_tasklet = tasklet_id*BLOCK_SIZE;
-    for (uint32_t base = base_tasklet; base < OUTER_SIZE; base += NR_TASKLETS*BLOCK_SIZE) {
-        mram_read((__mram_ptr void*) (outer_part + base*sizeof(uint32_t)), val_cache, BLOCK_SIZE*sizeof(uint32_t));
+    uint32_t* val_cache = (uint32_t*) mem_alloc(BLOCK_SIZE*sizeof(uint32_t));
+    key_ptr32* ptr_cache = (key_ptr32*) mem_alloc(BLOCK_SIZE*sizeof(key_ptr32));
 
-        create_ptr(val_cache, ptr_cache, join_args.ptr_outer+base);
+    uint32_t base_tasklet = tasklet_id*BLOCK_SIZE;
+    for (uint32_t base = base_tasklet; base < INNER_SIZE; base += NR_TASKLETS*BLOCK_SIZE) {
+        mram_read((__mram_ptr void*) (inner_part + base*sizeof(uint32_t)), val_cache, BLOCK_SIZE*sizeof(uint32_t));
+
+        create_ptr(val_cache, ptr_cache, join_args.ptr_inner+base);
 
         mram_write(ptr_cache, (__mram_ptr void*) (buffer + base*sizeof(key_ptr32)), BLOCK_SIZE*sizeof(key_ptr32));
     }
+    barrier_wait(&barrier);
+
+#if BLOOM_FILTER == 1
+    if (join_args.filter_words > 0) {
+        if (tasklet_id == 0) {
+            bloom_args.in_ptr = buffer;
+            bloom_args.size = INNER_SIZE;
+            bloom_args.filter_ptr = (uint32_t) DPU_MRAM_HEAP_POINTER + BLOOM_OFFSET(join_args.dpu_n);
+            bloom_args.filter_words = join_args.filter_words;
+        }
+        barrier_wait(&barrier);
+
+        TIMELINE_BEGIN(PHASE_BLOOM);
+        bloom_kernel(&bloom_args);
+        TIMELINE_END();
+        TIMELINE_BARRIER(&barrier);
+    }
+#endif
 
     if (tasklet_id == 0) {
         part_args.in_ptr = buffer;
-        part_args.size = OUTER_SIZE;
+        part_args.size = INNER_SIZE;
         part_args.shift = 27;
-        part_args.part_ptr = outer_part;
-        part_args.part_sizes = outer_size;
-        part_args.part_n = NR_DPU;
+        part_args.part_ptr = inner_part;
+        part_args.part_sizes = inner_size;
+        part_args.part_n = join_args.dpu_n;
     }
     barrier_wait(&barrier);
 
@@ -169,16 +234,30 @@ int main_kernel1() {
     barrier_wait(&barrier);
 #endif
 
+    TIMELINE_BEGIN(PHASE_PARTITION);
     part_kernel(&part_args);
-    barrier_wait(&barrier);
+    TIMELINE_END();
+    TIMELINE_BARRIER(&barrier);
 
 #if PERF > 0
     if (tasklet_id == 0) {
-        cycles_2 = perfcounter_get();
+        cycles_1 = perfcounter_get();
     }
     barrier_wait(&barrier);
 #endif
 
+    // With a filter, the outer relation is partitioned by kernel 3 after the
+    // host merged the filters of all DPUs
+    if (join_args.filter_words == 0) {
+        partition_outer(0);
+    }
+
+    return 0;
+}
+
+int main_kernel3() {
+    partition_outer(join_args.filter_words);
+
     return 0;
 }
 
@@ -189,17 +268,26 @@ int main_kernel2() {
     }
     barrier_wait(&barrier);
 
+    // The tables and partitions grow with the inner relation, the region of the
+    // inner relation also holds the partitioned outer relation
+    uint32_t part_n = plan_partitions(join_args.n_el_inner, PART_FILL, MAX_PART);
+    uint32_t table_size = part_n*BLOCK_SIZE;
+    uint32_t region_size = table_size > join_args.n_el_outer ? table_size : join_args.n_el_outer;
+
     uint32_t outer_in = (uint32_t) DPU_MRAM_HEAP_POINTER;
     uint32_t inner_in = outer_in + join_args.offset_inner*sizeof(key_ptr32);
-    uint32_t table = inner_in + TABLE_SIZE*sizeof(key_ptr32);
-    uint32_t part_sizes = table + TABLE_SIZE*sizeof(key_ptr32);
+    uint32_t table = inner_in + region_size*sizeof(key_ptr32);
+    uint32_t part_sizes = table + table_size*sizeof(key_ptr32);
+    uint32_t overflow = part_sizes + (part_n+1)*sizeof(uint64_t);
 
     if (tasklet_id == 0) {
         hash_args.in_ptr = inner_in;
         hash_args.size = join_args.n_el_inner;
-        hash_args.shift = 13;
+        hash_args.shift = 0;
         hash_args.table_ptr = table;
-        hash_args.table_size = TABLE_SIZE;
+        hash_args.table_size = table_size;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -215,8 +303,10 @@ int main_kernel2() {
     barrier_wait(&barrier);
 #endif
 
+    TIMELINE_BEGIN(PHASE_BUILD);
     hash_kernel(&hash_args);
-    barrier_wait(&barrier);
+    TIMELINE_END();
+    TIMELINE_BARRIER(&barrier);
 
 #if PERF > 0
     if (tasklet_id == 0) {
@@ -228,10 +318,10 @@ int main_kernel2() {
     if (tasklet_id == 0) {
         part_args.in_ptr = outer_in;
         part_args.part_ptr = inner_in;
-        part_args.shift = 13;
+        part_args.shift = 0;
         part_args.part_sizes = part_sizes;
         part_args.size = join_args.n_el_outer;
-        part_args.part_n = NR_PART;
+        part_args.part_n = part_n;
     }
     barrier_wait(&barrier);
 
@@ -247,8 +337,10 @@ int main_kernel2() {
     barrier_wait(&barrier);
 #endif
 
+    TIMELINE_BEGIN(PHASE_PARTITION);
     part_kernel(&part_args);
-    barrier_wait(&barrier);
+    TIMELINE_END();
+    TIMELINE_BARRIER(&barrier);
 
 #if PERF > 0
     if (tasklet_id == 0) {
@@ -262,8 +354,11 @@ int main_kernel2() {
         merge_args.size = join_args.n_el_outer;
         merge_args.in_ptr = inner_in;
         merge_args.out_ptr = outer_in;
+        merge_args.out_size = join_args.offset_inner;
         merge_args.part_sizes = part_sizes;
-        merge_args.part_n = NR_PART;
+        merge_args.part_n = part_n;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -279,8 +374,10 @@ int main_kernel2() {
     barrier_wait(&barrier);
 #endif
 
+    TIMELINE_BEGIN(PHASE_PROBE);
     merge_kernel(&merge_args, &merge_res);
-    barrier_wait(&barrier);
+    TIMELINE_END();
+    TIMELINE_BARRIER(&barrier);
 
 #if PERF > 0
     if (tasklet_id == 0) {
@@ -291,6 +388,9 @@ int main_kernel2() {
 
     if (tasklet_id == 0) {
         join_res.count = merge_res.out_n;
+        join_res.hash_shift = __builtin_ctz(part_n);
+        join_res.matches = merge_res.matches_n;
+        join_res.dropped = merge_res.dropped_n;
     }
  
     return 0;
@@ -1,80 +1,60 @@
 #include "shared.cpp"
 
-void populate_mram(dpu_set_t &system) {
+std::vector<std::vector<join_arguments_t>> populate_mram(dpu_set_t &system, uint32_t filter_words) {
 
-    std::vector<std::vector<join_arguments_t>> join_args(NR_DPU, std::vector<join_arguments_t>(1));
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    std::vector<std::vector<join_arguments_t>> join_args(nr_dpus, std::vector<join_arguments_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
         join_args[dpu][0].kernel_sel = 0;
         join_args[dpu][0].ptr_inner = dpu*INNER_SIZE;
         join_args[dpu][0].ptr_outer = dpu*OUTER_SIZE;
+        join_args[dpu][0].dpu_n = nr_dpus;
+        join_args[dpu][0].filter_words = filter_words;
     }
     dist_vec(system, join_args, 0, "join_args", DPU_XFER_DEFAULT);
 
     dist_table<uint32_t>(system, inner_table, "key", DPU_MRAM_HEAP_POINTER_NAME, 0, DPU_XFER_DEFAULT);
 
     dist_table<uint32_t>(system, outer_table, "key", DPU_MRAM_HEAP_POINTER_NAME, INNER_SIZE*sizeof(key_ptr32), DPU_XFER_DEFAULT);
+
+    return join_args;
 }
 
 std::vector<std::vector<join_arguments_t>> redistribute(dpu_set_t &system, uint32_t inner_off,
                                                         uint32_t outer_off, uint32_t inner_size_off,
-                                                        uint32_t outer_size_off) {
-
-    std::vector<std::vector<join_arguments_t>> join_args (NR_DPU, std::vector<join_arguments_t>(1));
+                                                        uint32_t outer_size_off, bool filtered) {
 
-    arrow::BufferVector part_inner = alloc_buf_vec(INNER_SIZE*sizeof(key_ptr32), NR_DPU);
-    arrow::BufferVector part_outer = alloc_buf_vec(OUTER_SIZE*sizeof(key_ptr32), NR_DPU);
-
-    get_buf(system, part_inner, inner_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-    get_buf(system, part_outer, outer_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+    std::vector<std::vector<join_arguments_t>> join_args (nr_dpus, std::vector<join_arguments_t>(1));
 
     // Copy the sizes of the partitoned tables
-    std::vector<std::vector<uint64_t>> inner_sizes(NR_DPU, std::vector<uint64_t>(NR_BUCKETS+1));
-    std::vector<std::vector<uint64_t>> outer_sizes(NR_DPU, std::vector<uint64_t>(NR_BUCKETS+1));
+    std::vector<std::vector<uint64_t>> inner_sizes(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+    std::vector<std::vector<uint64_t>> outer_sizes(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
 
     get_vec(system, inner_sizes, inner_size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
     get_vec(system, outer_sizes, outer_size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
-    uint32_t max_inner_size = 0;
-    uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
-            join_args[dpu][0].n_el_inner += inner_sizes[src][dpu+1] - inner_sizes[src][dpu];
-            join_args[dpu][0].n_el_outer += outer_sizes[src][dpu+1] - outer_sizes[src][dpu];
-        }
-
-        if (join_args[dpu][0].n_el_inner > max_inner_size) {
-            max_inner_size = join_args[dpu][0].n_el_inner;
-        }
-
-        if (join_args[dpu][0].n_el_outer > max_outer_size) {
-            max_outer_size = join_args[dpu][0].n_el_outer;
-        }
+    if (filtered) {
+        report_bloom_filter(outer_sizes);
     }
-
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        join_args[dpu][0].offset_outer = max_inner_size;
-        join_args[dpu][0].offset_inner = max_outer_size;
+    report_passes("inner_partition", inner_sizes, PART_FANOUT);
+    report_passes("outer_partition", outer_sizes, PART_FANOUT);
+    shuffle_plan plan_inner = plan_shuffle(inner_sizes, true, "inner");
+    shuffle_plan plan_outer = plan_shuffle(outer_sizes, true, "outer");
+
+    std::shared_ptr<arrow::Buffer> part_inner = shuffle_gather(system, plan_inner, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, inner_off);
+    std::shared_ptr<arrow::Buffer> part_outer = shuffle_gather(system, plan_outer, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, outer_off);
+
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        join_args[dpu][0].n_el_inner = plan_inner.counts[dpu];
+        join_args[dpu][0].n_el_outer = plan_outer.counts[dpu];
+        join_args[dpu][0].offset_outer = plan_inner.max_count;
+        join_args[dpu][0].offset_inner = plan_outer.max_count;
         join_args[dpu][0].kernel_sel = 1;
-
-        for (uint32_t i = 0; i < NR_BUCKETS+1; i++) {
-            inner_sizes[dpu][i] *= sizeof(key_ptr32);
-            outer_sizes[dpu][i] *= sizeof(key_ptr32);
-        }
     }
 
-    //Calculate offsets for copying to redistribution buffer
-    sg_xfer_context_2d sc_args_inner = {.partitions = part_inner, .offset = inner_sizes};
-    get_block_t get_block_info_inner = {.f = &get_cpy_ptr_2d, .args = &sc_args_inner, .args_size=(sizeof(sc_args_inner))};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, max_outer_size*sizeof(key_ptr32),
-                                max_inner_size*sizeof(key_ptr32), &get_block_info_inner, flag));
-
-    sg_xfer_context_2d sc_args_outer = {.partitions = part_outer, .offset = outer_sizes};
-    get_block_t get_block_info_outer = {.f = &get_cpy_ptr_2d, .args = &sc_args_outer, .args_size=(sizeof(sc_args_outer))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                max_outer_size*sizeof(key_ptr32), &get_block_info_outer, flag));
+    // The outer partitions are placed in front of the inner partitions
+    shuffle_scatter(system, plan_outer, {{part_outer, sizeof(key_ptr32), 0}}, DPU_MRAM_HEAP_POINTER_NAME);
+    shuffle_scatter(system, plan_inner, {{part_inner, sizeof(key_ptr32), uint32_t(plan_outer.max_count*sizeof(key_ptr32))}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
 
     dist_vec(system, join_args, 0, "join_args", DPU_XFER_DEFAULT);
 
@@ -82,10 +62,11 @@ std::vector<std::vector<join_arguments_t>> redistribute(dpu_set_t &system, uint3
 }
 
 std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
-    std::vector<std::vector<join_results_t>> join_res (NR_DPU, std::vector<join_results_t>(1));
+    std::vector<std::vector<join_results_t>> join_res (nr_dpus, std::vector<join_results_t>(1));
     arrow::ArrayVector results_chunks;
 
     get_vec(system, join_res, 0, "join_res", DPU_XFER_DEFAULT);
+    check_join_output(join_res);
 
     struct dpu_set_t dpu;
     uint32_t each_dpu;
@@ -97,10 +78,10 @@ std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
         }
     }
 
-    arrow::BufferVector buffers = alloc_buf_vec(max_join_size*sizeof(key_ptr32), NR_DPU);
+    arrow::BufferVector buffers = alloc_buf_vec(system, max_join_size*sizeof(key_ptr32));
     get_buf(system, buffers, 0, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> map_try = arrow::AllocateBuffer(NR_DPU*OUTER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> map_try = arrow::AllocateBuffer(nr_dpus*OUTER_SIZE*sizeof(uint32_t));
     if (!map_try.ok()) {
         std::cout << "Could not allocate map" << std::endl;
     }
@@ -108,7 +89,7 @@ std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
     uint32_t* map_data = (uint32_t*) map->mutable_data();
 
     #pragma omp parallel for
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
         key_ptr32* buffer_data = (key_ptr32*) buffers[dpu]->data();
         for (uint32_t i = 0; i < join_res[dpu][0].count; i++) {
             map_data[buffer_data[i].key] = buffer_data[i].ptr;
@@ -120,72 +101,69 @@ std::shared_ptr<arrow::Buffer> get_results(dpu_set_t &system) {
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, true);
     init_buffer();
+#if TRACE > 0
+    dpu_timeline timeline;
+#endif
     try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
-        std::chrono::steady_clock::time_point begin_init = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_load(system, "kernel_hjoin", NULL));
-        populate_mram(system);
-        std::chrono::steady_clock::time_point end_init = std::chrono::steady_clock::now();
-        std::cout << "Initial transfer elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_init - begin_init).count()
-              << " millisecs." << std::endl;
+        trace.begin("hash_join_sync", nr_dpus);
+
+        struct dpu_program_t *program;
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_hjoin", &program)); });
+        uint32_t filter_words = inner_bloom_words(program);
+        auto part_args = traced("to_dpu", [&]() { return populate_mram(system, filter_words); });
         
-        std::chrono::steady_clock::time_point begin_part = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-        std::chrono::steady_clock::time_point end_part = std::chrono::steady_clock::now();
-        std::cout << "Partition elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_part - begin_part).count()
-              << " millisecs." << std::endl;
+        traced("dpu_launch", [&]() { DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS)); });
+
+        // Filter the outer relation with the filter of the inner relation of all DPUs
+        if (filter_words > 0) {
+            traced("bloom_filter", [&]() { broadcast_bloom_filter(system, filter_words); });
+            for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+                part_args[dpu][0].kernel_sel = 2;
+            }
+            traced("to_dpu", [&]() { dist_vec(system, part_args, 0, "join_args", DPU_XFER_DEFAULT); });
+            traced("dpu_launch", [&]() { DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS)); });
+        }
 
 #if PERF > 0
         output_perf_part(system);
 #endif
+#if TRACE > 0
+        timeline.collect(system, "partition");
+#endif
 
-        std::chrono::steady_clock::time_point begin_dist = std::chrono::steady_clock::now();
         uint32_t part_off = 0;
         uint32_t match_off = part_off + INNER_SIZE*sizeof(key_ptr32);
         uint32_t part_size_off = match_off + OUTER_SIZE*sizeof(key_ptr32);
-        uint32_t match_size_off = part_size_off + (NR_BUCKETS+1)*sizeof(uint64_t);
+        uint32_t match_size_off = part_size_off + (nr_dpus+1)*sizeof(uint64_t);
 
-        auto join_args = redistribute(system, part_off, match_off, part_size_off, match_size_off);
-        std::chrono::steady_clock::time_point end_dist = std::chrono::steady_clock::now();
-        std::cout << "Redistribution elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_dist - begin_dist).count()
-              << " millisecs." << std::endl;
+        auto join_args = traced("shuffle", [&]() {
+            return redistribute(system, part_off, match_off, part_size_off, match_size_off, filter_words > 0);
+        });
         
-        std::chrono::steady_clock::time_point begin_join = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-        std::chrono::steady_clock::time_point end_join = std::chrono::steady_clock::now();
-                std::cout << "Join elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_join - begin_join).count()
-              << " millisecs." << std::endl;
-
-        std::chrono::steady_clock::time_point begin_gather = std::chrono::steady_clock::now();
-        auto results = get_results(system);
-        std::chrono::steady_clock::time_point end_gather = std::chrono::steady_clock::now();
-        std::cout << "Gather elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_gather - begin_gather).count()
-              << " millisecs." << std::endl;
-
+        traced("dpu_launch", [&]() { DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS)); });
+#if TRACE > 0
+        timeline.collect(system, "join");
+#endif
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        auto results = traced("from_dpu", [&]() { return get_results(system); });
+        report_join_partitions(system, join_args);
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         validate(results);
 
 #if PERF > 0
         output_perf_merge(system);
 #endif
+#if TRACE > 0
+        timeline.write();
+#endif
 
         //output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
@@ -12,11 +12,12 @@
 
 #include "datatype.h"
 #include "join.h"
+#include "hash_join.h"
 #include "transfer_helper.h"
+#include "shuffle.h"
+#include "bloom_filter.h"
+#include "dpu_timeline.h"
 
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 #ifndef INNER_SIZE
 #define INNER_SIZE 200000
 #endif
@@ -29,15 +30,19 @@
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 16
 #endif
+#ifndef BLOOM_FILTER
+#define BLOOM_FILTER 0
+#endif
 
-static constexpr uint32_t NR_BUCKETS = NR_DPU;
-static constexpr uint32_t TABLE_SIZE = 4096*256;
+// Radix partitioning of the kernels, NR_BUCKETS of hash_steps.c and BLOCK_SIZE of kernel_join.c
+static constexpr uint32_t PART_FANOUT = 32;
+static constexpr uint32_t PART_TABLE = 256;
 
 std::shared_ptr<arrow::Table> inner_table;
 std::shared_ptr<arrow::Table> outer_table;
 
 void init_buffer() {
-    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer((uint64_t) NR_DPU*INNER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer((uint64_t) nr_dpus*INNER_SIZE*sizeof(uint32_t));
     if (!inner_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -47,14 +52,14 @@ void init_buffer() {
     uint64_t inner_size = inner->size() / sizeof(uint32_t);
 
     #pragma omp parallel for
-    for (uint64_t i = 0; i < (uint64_t) NR_DPU*INNER_SIZE; i++) {
+    for (uint64_t i = 0; i < (uint64_t) nr_dpus*INNER_SIZE; i++) {
             inner_data[i] = i+1;
     }
 
     //std::default_random_engine gen(0);
     __gnu_parallel::random_shuffle(inner_data, inner_data+inner_size);
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> outer_try = arrow::AllocateBuffer((uint64_t) NR_DPU*OUTER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> outer_try = arrow::AllocateBuffer((uint64_t) nr_dpus*OUTER_SIZE*sizeof(uint32_t));
     if (!outer_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -69,17 +74,17 @@ void init_buffer() {
         seed += omp_get_thread_num();
     #endif
         std::default_random_engine gen(seed);
-        std::uniform_int_distribution<uint32_t> dist(1, NR_DPU*OUTER_RANGE*INNER_SIZE);
+        std::uniform_int_distribution<uint32_t> dist(1, nr_dpus*OUTER_RANGE*INNER_SIZE);
 
     #pragma omp for schedule(static)
-    for (uint64_t i = 0; i < (uint64_t) NR_DPU*OUTER_SIZE; i++) {
+    for (uint64_t i = 0; i < (uint64_t) nr_dpus*OUTER_SIZE; i++) {
             outer_data[i] = dist(gen);
         }
     }
 
     // Create the inner table
     auto schema = arrow::schema({arrow::field("key", arrow::uint32(), false)});
-    auto inner_key_data = arrow::ArrayData::Make(arrow::uint32(), NR_DPU*INNER_SIZE, {nullptr, inner});
+    auto inner_key_data = arrow::ArrayData::Make(arrow::uint32(), nr_dpus*INNER_SIZE, {nullptr, inner});
     auto inner_key_array = arrow::MakeArray(inner_key_data);
 
     arrow::ArrayVector inner_data_vec;
@@ -87,7 +92,7 @@ void init_buffer() {
     inner_table = arrow::Table::Make(schema, inner_data_vec);
 
     // Create the outer table
-    auto outer_key_data = arrow::ArrayData::Make(arrow::uint32(), NR_DPU*OUTER_SIZE, {nullptr, outer});
+    auto outer_key_data = arrow::ArrayData::Make(arrow::uint32(), nr_dpus*OUTER_SIZE, {nullptr, outer});
     auto outer_key_array = arrow::MakeArray(outer_key_data);
 
     arrow::ArrayVector outer_data_vec;
@@ -95,6 +100,78 @@ void init_buffer() {
     outer_table = arrow::Table::Make(schema, outer_data_vec);
 }
 
+/*
+Size the bloom filter of the inner relation. It is placed behind the buffers
+of the partitioning kernels, which are dead once the join kernel runs, so it
+may take all of the MRAM left behind them.
+
+@param program loaded join program
+
+@returns: number of words of the filter, 0 if filtering is disabled or does
+          not pay off, see bloom_words
+*/
+uint32_t inner_bloom_words(struct dpu_program_t *program) {
+#if BLOOM_FILTER == 1
+    struct dpu_symbol_t heap;
+    DPU_CHECK(dpu_get_symbol(program, DPU_MRAM_HEAP_POINTER_NAME, &heap));
+    // MRAM symbols are in the MRAM address space, the low bits are the offset in MRAM
+    uint64_t used = (heap.address & (MRAM_SIZE - 1)) + BLOOM_OFFSET(nr_dpus);
+    uint64_t max_words = used < MRAM_SIZE ? (MRAM_SIZE - used) / sizeof(uint64_t) : 0;
+
+    return bloom_words("the inner relation", (uint64_t) nr_dpus*INNER_SIZE, max_words,
+                       OUTER_SIZE*sizeof(key_ptr32));
+#else
+    return 0;
+#endif
+}
+
+/*
+OR the bloom filters of all DPUs and broadcast the global filter
+
+@param system set of dpus
+@param words number of words of the filters
+*/
+void broadcast_bloom_filter(dpu_set_t &system, uint32_t words) {
+    auto merged = merge_bloom_filters(system, DPU_MRAM_HEAP_POINTER_NAME, BLOOM_OFFSET(nr_dpus), words);
+    copy_buf(system, merged, BLOOM_OFFSET(nr_dpus), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+}
+
+/*
+Report how many outer elements passed the bloom filter
+
+@param outer_sizes partition sizes of the outer relation of each DPU, the last
+                   one is the number of partitioned elements
+*/
+void report_bloom_filter(const std::vector<std::vector<uint64_t>> &outer_sizes) {
+    uint64_t kept = 0;
+    for (uint32_t dpu = 0; dpu < outer_sizes.size(); dpu++) {
+        kept += outer_sizes[dpu].back();
+    }
+    uint64_t outer_n = (uint64_t) outer_sizes.size()*OUTER_SIZE;
+
+    std::cout << "Bloom filter kept " << kept << " of " << outer_n << " outer elements ("
+              << 100.0 * kept / outer_n << "%)" << std::endl;
+}
+
+/*
+Warn about DPUs whose join output was full, their matches beyond it are lost,
+or whose hash tables lost inner elements because their overflow area was full
+
+@param join_res results of the join kernel of each DPU
+*/
+void check_join_output(const std::vector<std::vector<join_results_t>> &join_res) {
+    for (uint32_t dpu = 0; dpu < join_res.size(); dpu++) {
+        if (join_res[dpu][0].matches > join_res[dpu][0].count) {
+            std::cout << "Join output of DPU " << dpu << " full: " << join_res[dpu][0].count
+                      << " of " << join_res[dpu][0].matches << " matches written" << std::endl;
+        }
+        if (join_res[dpu][0].dropped > 0) {
+            std::cout << "Hash tables of DPU " << dpu << " full: " << join_res[dpu][0].dropped
+                      << " inner elements dropped" << std::endl;
+        }
+    }
+}
+
 void validate(std::shared_ptr<arrow::Buffer> map) {
 
     bool error = false;
@@ -120,6 +197,48 @@ void validate(std::shared_ptr<arrow::Buffer> map) {
     }
 }
 
+/*
+Report the skew of the partitions of the join kernel, the partition sizes
+are only read from the DPUs when full histograms are dumped
+
+@param system set of dpus
+@param join_args arguments of the join kernel
+*/
+void report_join_partitions(dpu_set_t &system, const std::vector<std::vector<join_arguments_t>> &join_args) {
+    if (!dump_histograms()) {
+        return;
+    }
+
+    // Every DPU plans its partitions from its inner relation like the kernel
+    std::vector<std::vector<uint64_t>> part_sizes(nr_dpus);
+    uint32_t min_part = MAX_PART;
+    struct dpu_set_t dpu;
+    uint32_t each_dpu;
+    DPU_FOREACH(system, dpu, each_dpu) {
+        uint32_t part_n = plan_partitions(join_args[each_dpu][0].n_el_inner, PART_FILL, MAX_PART);
+        uint32_t table_size = part_n*PART_TABLE;
+        uint32_t region_size = std::max(table_size, join_args[each_dpu][0].n_el_outer);
+        min_part = std::min(min_part, part_n);
+
+        // The sizes follow the outer relation, the partitions and the hash table
+        uint32_t sizes_off = (join_args[each_dpu][0].offset_inner + region_size + table_size)*sizeof(key_ptr32);
+        part_sizes[each_dpu].resize(part_n+1);
+        DPU_ASSERT(dpu_copy_from(dpu, DPU_MRAM_HEAP_POINTER_NAME, sizes_off, part_sizes[each_dpu].data(),
+                                 (part_n+1)*sizeof(uint64_t)));
+    }
+
+    // Compare the DPUs at the partition count of the smallest plan
+    for (auto &sizes : part_sizes) {
+        uint32_t step = (sizes.size()-1) / min_part;
+        for (uint32_t part = 0; part <= min_part; part++) {
+            sizes[part] = sizes[part*step];
+        }
+        sizes.resize(min_part+1);
+    }
+
+    report_passes("outer_local", part_sizes, PART_FANOUT);
+}
+
 void output_perf_part(dpu_set_t &system) {
 #if PERF == 1
     std::ofstream file_inner_part_cycles("inner_hpart_cycles.csv", std::ofstream::app);
@@ -132,7 +251,7 @@ void output_perf_part(dpu_set_t &system) {
     file_inner_part_time << NR_TASKLETS;
     file_outer_part_time << NR_TASKLETS;
 
-    std::vector<std::vector<uint32_t>> clocks_sec(NR_DPU, std::vector<uint32_t>(1));
+    std::vector<std::vector<uint32_t>> clocks_sec(nr_dpus, std::vector<uint32_t>(1));
     get_vec(system, clocks_sec, 0, "CLOCKS_PER_SEC", DPU_XFER_DEFAULT);
 #else
     std::ofstream file_inner_part_inst("inner_hpart_inst.csv", std::ofstream::app);
@@ -142,10 +261,10 @@ void output_perf_part(dpu_set_t &system) {
     file_outer_part_inst << NR_TASKLETS;
 #endif
 
-    std::vector<std::vector<uint64_t>> cycles(NR_DPU, std::vector<uint64_t>(1));
+    std::vector<std::vector<uint64_t>> cycles(nr_dpus, std::vector<uint64_t>(1));
     get_vec(system, cycles, 0, "cycles_1", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_inner_part_cycles << ", " << cycles[dpu][0];
 
@@ -158,7 +277,7 @@ void output_perf_part(dpu_set_t &system) {
 
     get_vec(system, cycles, 0, "cycles_2", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_outer_part_cycles << ", " << cycles[dpu][0];
 
@@ -196,7 +315,7 @@ void output_perf_merge(dpu_set_t &system) {
     file_hpart_time << NR_TASKLETS;
     file_hmerge_time << NR_TASKLETS;
 
-    std::vector<std::vector<uint32_t>> clocks_sec(NR_DPU, std::vector<uint32_t>(1));
+    std::vector<std::vector<uint32_t>> clocks_sec(nr_dpus, std::vector<uint32_t>(1));
     get_vec(system, clocks_sec, 0, "CLOCKS_PER_SEC", DPU_XFER_DEFAULT);
 #else
     std::ofstream file_hash_inst("hash_inst.csv", std::ofstream::app);
@@ -208,10 +327,10 @@ void output_perf_merge(dpu_set_t &system) {
     file_hmerge_inst << NR_TASKLETS;
 #endif
 
-    std::vector<std::vector<uint64_t>> cycles(NR_DPU, std::vector<uint64_t>(1));
+    std::vector<std::vector<uint64_t>> cycles(nr_dpus, std::vector<uint64_t>(1));
     get_vec(system, cycles, 0, "cycles_1", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_hash_cycles << ", " << cycles[dpu][0];
 
@@ -224,7 +343,7 @@ void output_perf_merge(dpu_set_t &system) {
 
     get_vec(system, cycles, 0, "cycles_2", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_hpart_cycles << ", " << cycles[dpu][0];
 
@@ -237,7 +356,7 @@ void output_perf_merge(dpu_set_t &system) {
 
     get_vec(system, cycles, 0, "cycles_3", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_hmerge_cycles << ", " << cycles[dpu][0];
 
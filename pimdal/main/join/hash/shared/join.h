@@ -3,6 +3,17 @@
 
 #include <stdint.h>
 
+// Partitions of the join kernel, the hash tables of the partitions fit into MRAM
+#define MAX_PART 8192
+
+// MRAM of a DPU
+#define MRAM_SIZE (64 << 20)
+// Bytes of the heap of the partitioning kernels in front of the bloom filter of
+// the inner relation: both relations, their partition sizes and the pointers of
+// the inner relation or of the outer relation and its filtered copy
+#define BLOOM_OFFSET(dpu_n) ((INNER_SIZE + OUTER_SIZE + (INNER_SIZE > 2*OUTER_SIZE ? INNER_SIZE : 2*OUTER_SIZE)) \
+                             *sizeof(key_ptr32) + 2*((dpu_n)+1)*sizeof(uint64_t))
+
 typedef struct
 {
     uint32_t kernel_sel;
@@ -13,12 +24,16 @@ typedef struct
     uint32_t offset_inner;
     uint32_t hash_shift;
     uint32_t n_el_outer;
+    uint32_t dpu_n;
+    uint32_t filter_words; // Words of the bloom filter, 0 if the outer relation is not filtered
 } join_arguments_t;
 
 typedef struct
 {
     uint32_t count;
     uint32_t hash_shift;
+    uint32_t matches; // Matches found, more than count if the output was full
+    uint32_t dropped; // Inner elements lost because the overflow area of the tables was full
 } join_results_t;
 
 #endif
\ No newline at end of file
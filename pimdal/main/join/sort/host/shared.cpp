@@ -13,10 +13,8 @@
 #include "datatype.h"
 #include "join.h"
 #include "transfer_helper.h"
+#include "shuffle.h"
 
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 #ifndef INNER_SIZE
 #define INNER_SIZE 200000
 #endif
@@ -34,7 +32,7 @@ std::shared_ptr<arrow::Table> inner_table;
 std::shared_ptr<arrow::Table> outer_table;
 
 void init_buffer() {
-    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer((uint64_t) NR_DPU*INNER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> inner_try = arrow::AllocateBuffer((uint64_t) nr_dpus*INNER_SIZE*sizeof(uint32_t));
     if (!inner_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -44,14 +42,14 @@ void init_buffer() {
     uint64_t inner_size = inner->size() / sizeof(uint32_t);
 
     #pragma omp parallel for
-    for (uint64_t i = 0; i < (uint64_t) NR_DPU*INNER_SIZE; i++) {
+    for (uint64_t i = 0; i < (uint64_t) nr_dpus*INNER_SIZE; i++) {
             inner_data[i] = i+1;
     }
 
     //std::default_random_engine gen(0);
     __gnu_parallel::random_shuffle(inner_data, inner_data+inner_size);
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> outer_try = arrow::AllocateBuffer((uint64_t) NR_DPU*OUTER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> outer_try = arrow::AllocateBuffer((uint64_t) nr_dpus*OUTER_SIZE*sizeof(uint32_t));
     if (!outer_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -66,17 +64,17 @@ void init_buffer() {
         seed += omp_get_thread_num();
     #endif
         std::default_random_engine gen(seed);
-        std::uniform_int_distribution<uint32_t> dist(1, NR_DPU*OUTER_RANGE*INNER_SIZE);
+        std::uniform_int_distribution<uint32_t> dist(1, nr_dpus*OUTER_RANGE*INNER_SIZE);
 
     #pragma omp for schedule(static)
-    for (uint64_t i = 0; i < (uint64_t) NR_DPU*OUTER_SIZE; i++) {
+    for (uint64_t i = 0; i < (uint64_t) nr_dpus*OUTER_SIZE; i++) {
             outer_data[i] = dist(gen);
         }
     }
 
     // Create the inner table
     auto schema = arrow::schema({arrow::field("key", arrow::uint32(), false)});
-    auto inner_key_data = arrow::ArrayData::Make(arrow::uint32(), NR_DPU*INNER_SIZE, {nullptr, inner});
+    auto inner_key_data = arrow::ArrayData::Make(arrow::uint32(), nr_dpus*INNER_SIZE, {nullptr, inner});
     auto inner_key_array = arrow::MakeArray(inner_key_data);
 
     arrow::ArrayVector inner_data_vec;
@@ -84,7 +82,7 @@ void init_buffer() {
     inner_table = arrow::Table::Make(schema, inner_data_vec);
 
     // Create the outer table
-    auto outer_key_data = arrow::ArrayData::Make(arrow::uint32(), NR_DPU*OUTER_SIZE, {nullptr, outer});
+    auto outer_key_data = arrow::ArrayData::Make(arrow::uint32(), nr_dpus*OUTER_SIZE, {nullptr, outer});
     auto outer_key_array = arrow::MakeArray(outer_key_data);
 
     arrow::ArrayVector outer_data_vec;
@@ -129,7 +127,7 @@ void output_perf_part(dpu_set_t &system) {
     file_inner_part_time << NR_TASKLETS;
     file_outer_part_time << NR_TASKLETS;
 
-    std::vector<std::vector<uint32_t>> clocks_sec(NR_DPU, std::vector<uint32_t>(1));
+    std::vector<std::vector<uint32_t>> clocks_sec(nr_dpus, std::vector<uint32_t>(1));
     get_vec(system, clocks_sec, 0, "CLOCKS_PER_SEC", DPU_XFER_DEFAULT);
 #else
     std::ofstream file_inner_part_inst("inner_spart_inst.csv", std::ofstream::app);
@@ -139,10 +137,10 @@ void output_perf_part(dpu_set_t &system) {
     file_outer_part_inst << NR_TASKLETS;
 #endif
 
-    std::vector<std::vector<uint64_t>> cycles(NR_DPU, std::vector<uint64_t>(1));
+    std::vector<std::vector<uint64_t>> cycles(nr_dpus, std::vector<uint64_t>(1));
     get_vec(system, cycles, 0, "cycles_1", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_inner_part_cycles << ", " << cycles[dpu][0];
 
@@ -155,7 +153,7 @@ void output_perf_part(dpu_set_t &system) {
 
     get_vec(system, cycles, 0, "cycles_2", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_outer_part_cycles << ", " << cycles[dpu][0];
 
@@ -193,7 +191,7 @@ void output_perf_merge(dpu_set_t &system) {
     file_outer_sort_time << NR_TASKLETS;
     file_smerge_time << NR_TASKLETS;
 
-    std::vector<std::vector<uint32_t>> clocks_sec(NR_DPU, std::vector<uint32_t>(1));
+    std::vector<std::vector<uint32_t>> clocks_sec(nr_dpus, std::vector<uint32_t>(1));
     get_vec(system, clocks_sec, 0, "CLOCKS_PER_SEC", DPU_XFER_DEFAULT);
 #else
     std::ofstream file_inner_sort_inst("inner_sort_inst.csv", std::ofstream::app);
@@ -205,10 +203,10 @@ void output_perf_merge(dpu_set_t &system) {
     file_smerge_inst << NR_TASKLETS;
 #endif
 
-    std::vector<std::vector<uint64_t>> cycles(NR_DPU, std::vector<uint64_t>(1));
+    std::vector<std::vector<uint64_t>> cycles(nr_dpus, std::vector<uint64_t>(1));
     get_vec(system, cycles, 0, "cycles_1", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_inner_sort_cycles << ", " << cycles[dpu][0];
 
@@ -221,7 +219,7 @@ void output_perf_merge(dpu_set_t &system) {
 
     get_vec(system, cycles, 0, "cycles_2", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_outer_sort_cycles << ", " << cycles[dpu][0];
 
@@ -234,7 +232,7 @@ void output_perf_merge(dpu_set_t &system) {
 
     get_vec(system, cycles, 0, "cycles_3", DPU_XFER_DEFAULT);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_smerge_cycles << ", " << cycles[dpu][0];
 
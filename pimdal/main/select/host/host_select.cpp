@@ -18,6 +18,8 @@ void populate_mram(dpu_set_t &system) {
 dpu_error_t select_callback(struct dpu_set_t rank, 
     __attribute((unused)) uint32_t rank_id, void * args) {
 
+    trace_scope scope("from_dpu");
+
     std::vector<std::vector<select_results_t>> sel_res (64, std::vector<select_results_t>(1));
 
     struct dpu_set_t dpu;
@@ -46,6 +48,7 @@ dpu_error_t select_callback(struct dpu_set_t rank,
         DPU_ASSERT(dpu_prepare_xfer(dpu, buffers[each_dpu]->mutable_data()));
     }
     DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, BUFFER_SIZE*sizeof(key_ptr_t), max_sel_size*sizeof(int32_t), DPU_XFER_DEFAULT));
+    scope.add_bytes((uint64_t) buffers.size() * (sizeof(select_results_t) + max_sel_size*sizeof(int32_t)));
 
     DPU_FOREACH(rank, dpu, each_dpu) {
         uint32_t dpu_size = sel_res[each_dpu][0].count;
@@ -72,29 +75,27 @@ std::shared_ptr<arrow::ChunkedArray> concat() {
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     init_buffer();
     try {
-        DPU_ASSERT(dpu_load(system, "kernel_select", NULL));
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        trace.begin("select", nr_dpus);
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_select", NULL)); });
 
-        populate_mram(system);
+        // Asynchronous work is only queued here, the ranks run it while the
+        // host waits in dpu_sync
+        traced("to_dpu", [&]() { populate_mram(system); });
         DPU_ASSERT(dpu_launch(system, DPU_ASYNCHRONOUS));
 
         DPU_ASSERT(dpu_callback(system, select_callback, NULL, DPU_CALLBACK_ASYNC));
 
-        dpu_sync(system);
-        auto results = concat();
-
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        traced("dpu_launch", [&]() { dpu_sync(system); });
+        auto results = traced("host", [&]() { return concat(); });
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         validate(results);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
@@ -8,7 +8,7 @@ void populate_mram(dpu_set_t &system) {
 }
 
 std::shared_ptr<arrow::ChunkedArray> get_results(dpu_set_t &system) {
-    std::vector<std::vector<select_results_t>> sel_res (NR_DPU, std::vector<select_results_t>(1));
+    std::vector<std::vector<select_results_t>> sel_res (nr_dpus, std::vector<select_results_t>(1));
     arrow::ArrayVector results_chunks;
 
     get_vec(system, sel_res, 0, "dpu_results", DPU_XFER_DEFAULT);
@@ -23,7 +23,7 @@ std::shared_ptr<arrow::ChunkedArray> get_results(dpu_set_t &system) {
         }
     }
 
-    arrow::BufferVector buffers = alloc_buf_vec(max_sel_size*sizeof(int32_t), NR_DPU);
+    arrow::BufferVector buffers = alloc_buf_vec(system, max_sel_size*sizeof(int32_t));
     get_buf(system, buffers, BUFFER_SIZE*sizeof(key_ptr_t), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
     DPU_FOREACH(system, dpu, each_dpu) {
@@ -39,39 +39,19 @@ std::shared_ptr<arrow::ChunkedArray> get_results(dpu_set_t &system) {
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     init_buffer();
     try {
-        DPU_ASSERT(dpu_load(system, "kernel_select", NULL));
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
-        std::chrono::steady_clock::time_point begin_init = std::chrono::steady_clock::now();
-        populate_mram(system);
-        std::chrono::steady_clock::time_point end_init = std::chrono::steady_clock::now();
-        std::cout << "Initial transfer elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_init - begin_init).count()
-              << " millisecs." << std::endl;
-
-        std::chrono::steady_clock::time_point begin_select = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-        std::chrono::steady_clock::time_point end_select = std::chrono::steady_clock::now();
-                std::cout << "Select elapsed time: "
-                << std::chrono::duration_cast<std::chrono::milliseconds>(end_select - begin_select).count()
-                << " millisecs." << std::endl;
-
-        std::chrono::steady_clock::time_point begin_fin = std::chrono::steady_clock::now();
-        std::shared_ptr<arrow::ChunkedArray> results = get_results(system);
-        std::chrono::steady_clock::time_point end_fin = std::chrono::steady_clock::now();
-        std::cout << "Final transfer elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end_fin - begin_fin).count()
-              << " millisecs." << std::endl;
-        //output_int(results);
+        trace.begin("select_sync", nr_dpus);
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_select", NULL)); });
+
+        traced("to_dpu", [&]() { populate_mram(system); });
+        traced("dpu_launch", [&]() { DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS)); });
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        std::shared_ptr<arrow::ChunkedArray> results = traced("from_dpu", [&]() { return get_results(system); });
+        //output_int(results);
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         validate(results);
 
@@ -81,7 +61,7 @@ int main(void) {
 #endif
 
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
@@ -16,9 +16,6 @@
 #include "datatype.h"
 #include "select.h"
 
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 #ifndef BUFFER_SIZE
 #define BUFFER_SIZE 400000
 #endif
@@ -34,7 +31,7 @@ void init_buffer() {
 
     std::shared_ptr<arrow::Buffer> buffer;
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer((uint64_t) NR_DPU*BUFFER_SIZE*sizeof(int32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer((uint64_t) nr_dpus*BUFFER_SIZE*sizeof(int32_t));
     if (!buffer_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -60,7 +57,7 @@ void init_buffer() {
 
     auto schema = arrow::schema({arrow::field("key", arrow::int32(), false)});
 
-    auto key_data = arrow::ArrayData::Make(arrow::int32(), (uint64_t) NR_DPU*BUFFER_SIZE, {nullptr, buffer});
+    auto key_data = arrow::ArrayData::Make(arrow::int32(), (uint64_t) nr_dpus*BUFFER_SIZE, {nullptr, buffer});
     auto key_array = arrow::MakeArray(key_data);
 
     arrow::ArrayVector data_vec;
@@ -102,7 +99,7 @@ void validate(std::shared_ptr<arrow::ChunkedArray> results) {
 }
 
 void output_perf(dpu_set_t &system) {
-    std::vector<std::vector<uint64_t>> cycles(NR_DPU, std::vector<uint64_t>(1));
+    std::vector<std::vector<uint64_t>> cycles(nr_dpus, std::vector<uint64_t>(1));
     get_vec(system, cycles, 0, "cycles", DPU_XFER_DEFAULT);
 
 #if PERF == 1
@@ -112,7 +109,7 @@ void output_perf(dpu_set_t &system) {
     file_cycles << NR_TASKLETS;
     file_time << NR_TASKLETS;
 
-    std::vector<std::vector<uint32_t>> clocks_sec(NR_DPU, std::vector<uint32_t>(1));
+    std::vector<std::vector<uint32_t>> clocks_sec(nr_dpus, std::vector<uint32_t>(1));
     get_vec(system, clocks_sec, 0, "CLOCKS_PER_SEC", DPU_XFER_DEFAULT);
 #else
     std::ofstream file_inst("select_inst.csv", std::ofstream::app);
@@ -120,7 +117,7 @@ void output_perf(dpu_set_t &system) {
     file_inst << NR_TASKLETS;
 #endif
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_cycles << ", " << cycles[dpu][0];
 
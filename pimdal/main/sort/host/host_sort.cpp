@@ -5,7 +5,7 @@
 
 void populate_mram(dpu_set_t &system) {
 
-    kernel_arguments_t sort_args {.kernel_sel = 0, .nr_splits = NR_DPU, .range = uint32_t(-1)};
+    kernel_arguments_t sort_args {.kernel_sel = 0, .nr_splits = nr_dpus, .range = uint32_t(-1)};
     DPU_ASSERT(dpu_broadcast_to(system, "kernel_args", 0, (void*) &sort_args,
                                 sizeof(kernel_arguments_t), DPU_XFER_ASYNC));
 
@@ -19,7 +19,7 @@ std::shared_ptr<arrow::ChunkedArray> get_results(dpu_set_t &system, uint32_t max
     // Round up to 2
     max_size = max_size + (max_size & 1);
 
-    arrow::BufferVector buffers = alloc_buf_vec(max_size*sizeof(uint32_t), NR_DPU);
+    arrow::BufferVector buffers = alloc_buf_vec(system, max_size*sizeof(uint32_t));
 
     get_buf(system, buffers, 0, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
@@ -48,64 +48,47 @@ and copies data back to the DPUs.
 std::shared_ptr<arrow::ChunkedArray> redistribute(dpu_set_t &system, uint32_t part_off, uint32_t size_off,
                                                         uint32_t &part_max_size) {
 
-    std::vector<std::vector<kernel_arguments_t>> sort_args (NR_DPU, std::vector<kernel_arguments_t>(1));
-    arrow::BufferVector part = alloc_buf_vec(BUFFER_SIZE*sizeof(key_ptr32), NR_DPU);
+    std::vector<std::vector<kernel_arguments_t>> sort_args (nr_dpus, std::vector<kernel_arguments_t>(1));
 
-    std::vector<std::vector<uint64_t>> sizes(NR_DPU, std::vector<uint64_t>(NR_DPU));
-    get_vec(system, sizes, size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_ASYNC);
+    // Wait for the partitioning apart from the transfers
+    traced("dpu_launch", [&]() { DPU_ASSERT(dpu_sync(system)); });
+
+    std::vector<std::vector<uint64_t>> sizes(nr_dpus, std::vector<uint64_t>(nr_dpus));
+    traced("shuffle", [&]() { get_vec(system, sizes, size_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT); });
+    shuffle_plan plan = plan_shuffle(sizes, false, "sort");
 
     // Copy the partitioned data
-    get_buf(system, part, part_off, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-    uint32_t size = 0;
-    for (uint64_t i = 0; i < NR_DPU; i++) {
-        for (uint64_t src = 0; src < NR_DPU; src++) {
-            sort_args[i][0].nr_el += sizes[src][i];
-        }
-        
-        if (sort_args[i][0].nr_el > part_max_size) {
-            part_max_size = sort_args[i][0].nr_el;
-        }
-
-        sort_args[i][0].range = uint32_t(-1) / NR_DPU;
+    std::shared_ptr<arrow::Buffer> part = shuffle_gather(system, plan, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, part_off);
+    part_max_size = plan.max_count;
+
+    for (uint64_t i = 0; i < nr_dpus; i++) {
+        sort_args[i][0].nr_el = plan.counts[i];
+        sort_args[i][0].range = uint32_t(-1) / nr_dpus;
         sort_args[i][0].start = i*sort_args[i][0].range;
         sort_args[i][0].offset_outer = part_max_size;
         sort_args[i][0].kernel_sel = 1;
         sort_args[i][0].nr_splits = 64;
     }
 
-    std::vector<std::vector<uint64_t>> offset (NR_DPU, std::vector<uint64_t>(sizes[0].size()+1));
-
-    //Calculate offsets for copying to redistribution buffer
-    for (uint64_t i = 0; i < NR_DPU; i++) {
-        for (uint64_t j = 0; j < NR_DPU; j++) {
-            offset[i][j+1] = offset[i][j] + sizes[i][j] * sizeof(key_ptr32);
-        }
-    }
-
-    sg_xfer_context_2d sc_args = {.partitions = part, .offset = offset};
-    get_block_t get_block_info = {.f = get_cpy_ptr_2d, .args = &sc_args, .args_size = sizeof(sc_args)};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_ASYNC | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                part_max_size*sizeof(key_ptr32), &get_block_info, flag));
+    shuffle_scatter(system, plan, {{part, sizeof(key_ptr32), 0}}, DPU_MRAM_HEAP_POINTER_NAME);
 
     dist_vec(system, sort_args, 0, "kernel_args", DPU_XFER_ASYNC);
 
     DPU_ASSERT(dpu_launch(system, DPU_ASYNCHRONOUS));
+    traced("dpu_launch", [&]() { DPU_ASSERT(dpu_sync(system)); });
 
-    return get_results(system, part_max_size, sort_args);
+    return traced("from_dpu", [&]() { return get_results(system, part_max_size, sort_args); });
 }
 
 int main(void) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     init_buffer();
     try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        trace.begin("sort", nr_dpus);
 
-        DPU_ASSERT(dpu_load(system, "kernel_sort", NULL));
-        populate_mram(system);
+        traced("dpu_load", [&]() { DPU_ASSERT(dpu_load(system, "kernel_sort", NULL)); });
+        traced("to_dpu", [&]() { populate_mram(system); });
 
         DPU_ASSERT(dpu_launch(system, DPU_ASYNCHRONOUS));
 
@@ -114,15 +97,11 @@ int main(void) {
         uint32_t max_size = 0;
         auto results = redistribute(system, part_off, size_off, max_size);
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         validate(results);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
@@ -15,11 +15,9 @@
 
 #include "datatype.h"
 #include "transfer_helper.h"
+#include "shuffle.h"
 #include "args.h"
 
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 #ifndef BUFFER_SIZE
 #define BUFFER_SIZE 200000
 #endif
@@ -35,7 +33,7 @@ void init_buffer() {
 
     std::shared_ptr<arrow::Buffer> buffer;
 
-    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer((uint64_t) NR_DPU*BUFFER_SIZE*sizeof(uint32_t));
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer((uint64_t) nr_dpus*BUFFER_SIZE*sizeof(uint32_t));
     if (!buffer_try.ok()) {
         std::cout << "Could not allocate buffer!" << std::endl;
     }
@@ -61,7 +59,7 @@ void init_buffer() {
 
     auto schema = arrow::schema({arrow::field("key", arrow::uint32(), false)});
 
-    auto key_data = arrow::ArrayData::Make(arrow::uint32(), NR_DPU*BUFFER_SIZE, {nullptr, buffer});
+    auto key_data = arrow::ArrayData::Make(arrow::uint32(), nr_dpus*BUFFER_SIZE, {nullptr, buffer});
     auto key_array = arrow::MakeArray(key_data);
 
     arrow::ArrayVector data_vec;
@@ -106,7 +104,7 @@ void validate(std::shared_ptr<arrow::ChunkedArray> results) {
 }
 
 void output_perf(dpu_set_t &system, bool part) {
-    std::vector<std::vector<uint64_t>> cycles(NR_DPU, std::vector<uint64_t>(1));
+    std::vector<std::vector<uint64_t>> cycles(nr_dpus, std::vector<uint64_t>(1));
     get_vec(system, cycles, 0, "cycles", DPU_XFER_DEFAULT);
 
 #if PERF == 1
@@ -125,7 +123,7 @@ void output_perf(dpu_set_t &system, bool part) {
     file_cycles << NR_TASKLETS;
     file_time << NR_TASKLETS;
 
-    std::vector<std::vector<uint32_t>> clocks_sec(NR_DPU, std::vector<uint32_t>(1));
+    std::vector<std::vector<uint32_t>> clocks_sec(nr_dpus, std::vector<uint32_t>(1));
     get_vec(system, clocks_sec, 0, "CLOCKS_PER_SEC", DPU_XFER_DEFAULT);
 #else
     std::ofstream file_inst;
@@ -140,7 +138,7 @@ void output_perf(dpu_set_t &system, bool part) {
     file_inst << NR_TASKLETS;
 #endif
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
 #if PERF == 1
         file_cycles << ", " << cycles[dpu][0];
 
@@ -0,0 +1,90 @@
+# Multi-phase DPU programs for the TPC-H queries.
+#
+# Every phase of a query is a function main_<query>_<n> in kernel_<query>_<n>.c,
+# kernel_<query>.c holds the state shared by the phases and dispatches to the
+# phase written by the host to the phase symbol. Phases compiled with the same
+# library sources and definitions are linked into one program, so the host
+# only loads a new program when the definitions change.
+
+# Build a program holding a group of phases. A group that does not link, e.g.
+# because its code does not fit in IRAM, is split in halves until every part
+# links.
+#
+# add_phase_program(<query> PHASES <n>... SOURCES <library sources>...
+#                   DEFINITIONS <definitions>...)
+function(add_phase_program query)
+  cmake_parse_arguments(ARG "" "" "PHASES;SOURCES;DEFINITIONS" ${ARGN})
+
+  list(GET ARG_PHASES 0 first)
+  list(GET ARG_PHASES -1 last)
+  list(LENGTH ARG_PHASES nr_phases)
+  if (nr_phases EQUAL 1)
+    set(name kernel_${query}_${first})
+  else()
+    set(name kernel_${query}_${first}_${last})
+  endif()
+
+  set(sources ${CMAKE_CURRENT_SOURCE_DIR}/kernel_${query}.c)
+  set(definitions NR_TASKLETS=${NR_TASKLETS} HASH_TABULATION=${HASH_TABULATION} ${ARG_DEFINITIONS})
+  foreach(phase ${ARG_PHASES})
+    list(APPEND sources ${CMAKE_CURRENT_SOURCE_DIR}/kernel_${query}_${phase}.c)
+    list(APPEND definitions PHASE_${phase})
+  endforeach()
+  list(APPEND sources ${ARG_SOURCES})
+
+  if (nr_phases GREATER 1)
+    set(flags)
+    foreach(definition ${definitions})
+      list(APPEND flags -D${definition})
+    endforeach()
+    get_directory_property(include_dirs INCLUDE_DIRECTORIES)
+
+    # The definitions also go to the linker like for the program, NR_TASKLETS
+    # sizes the stacks of the tasklets
+    try_compile(links ${CMAKE_CURRENT_BINARY_DIR}/link_${name}
+                SOURCES ${sources}
+                COMPILE_DEFINITIONS ${flags}
+                LINK_OPTIONS ${flags}
+                CMAKE_FLAGS "-DINCLUDE_DIRECTORIES=${include_dirs}")
+
+    if (NOT links)
+      message(STATUS "${name} does not link, splitting its phases")
+      math(EXPR half "${nr_phases} / 2")
+      math(EXPR rest "${nr_phases} - ${half}")
+      list(SUBLIST ARG_PHASES 0 ${half} phases_low)
+      list(SUBLIST ARG_PHASES ${half} ${rest} phases_high)
+      add_phase_program(${query} PHASES ${phases_low} SOURCES ${ARG_SOURCES} DEFINITIONS ${ARG_DEFINITIONS})
+      add_phase_program(${query} PHASES ${phases_high} SOURCES ${ARG_SOURCES} DEFINITIONS ${ARG_DEFINITIONS})
+      return()
+    endif()
+  endif()
+
+  add_executable(${name} ${sources})
+  target_compile_definitions(${name} PUBLIC ${definitions})
+  set(options)
+  foreach(definition ${definitions})
+    list(APPEND options -D${definition})
+  endforeach()
+  target_link_options(${name} PUBLIC ${options})
+
+  foreach(phase ${ARG_PHASES})
+    set_property(GLOBAL PROPERTY PHASE_PROGRAM_${query}_${phase} ${name})
+  endforeach()
+endfunction()
+
+# Write phases.h for the host, mapping every phase of a query to its program
+#
+# write_phase_header(<query> <number of phases>)
+function(write_phase_header query nr_phases)
+  set(programs "\"\"")
+  foreach(phase RANGE 1 ${nr_phases})
+    get_property(program GLOBAL PROPERTY PHASE_PROGRAM_${query}_${phase})
+    set(programs "${programs}, \"${program}\"")
+  endforeach()
+
+  file(WRITE ${CMAKE_CURRENT_BINARY_DIR}/phases.h.in
+       "// Generated by write_phase_header, the DPU program of each phase of the query\n"
+       "#define NR_PHASES ${nr_phases}\n"
+       "static const char *phase_programs[NR_PHASES + 1] = {${programs}};\n")
+  configure_file(${CMAKE_CURRENT_BINARY_DIR}/phases.h.in ${CMAKE_CURRENT_BINARY_DIR}/phases.h COPYONLY)
+endfunction()
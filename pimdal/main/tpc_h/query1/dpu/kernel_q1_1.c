@@ -21,13 +21,8 @@ __host query_res_t dpu_results;
 
 sel_results_t sel_results;
 
-__mram_noinit_keep int64_t l_extendedprice[524288];
-__mram_noinit_keep int64_t l_discount[524288];
-__mram_noinit_keep int64_t l_quantity[524288];
-__mram_noinit_keep int64_t l_tax[524288];
-__mram_noinit_keep char l_returnflag[524288];
-__mram_noinit_keep char l_linestatus[524288];
-__mram_noinit_keep uint32_t l_shipdate[524288];
+// Columns packed by scatter_columns at the offsets in dpu_args.col_offset
+__mram_noinit_keep uint64_t columns[COLUMNS_SIZE/sizeof(uint64_t)];
 
 BARRIER_INIT(barrier, NR_TASKLETS);
 
@@ -198,6 +193,14 @@ bool pred_date(key_ptr_t date) {
 
 int main() {
 
+    uint32_t l_extendedprice = (uint32_t) columns + dpu_args.col_offset[0];
+    uint32_t l_discount = (uint32_t) columns + dpu_args.col_offset[1];
+    uint32_t l_quantity = (uint32_t) columns + dpu_args.col_offset[2];
+    uint32_t l_tax = (uint32_t) columns + dpu_args.col_offset[3];
+    uint32_t l_returnflag = (uint32_t) columns + dpu_args.col_offset[4];
+    uint32_t l_linestatus = (uint32_t) columns + dpu_args.col_offset[5];
+    uint32_t l_shipdate = (uint32_t) columns + dpu_args.col_offset[6];
+
     uint32_t tasklet_id = me();
 
     uint32_t size = 524288;
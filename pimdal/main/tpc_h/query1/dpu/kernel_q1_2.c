@@ -21,13 +21,8 @@ __host query_res_t dpu_results;
 
 aggr_results_t aggr_results;
 
-__mram_noinit_keep int64_t l_extendedprice[524288];
-__mram_noinit_keep int64_t l_discount[524288];
-__mram_noinit_keep int64_t l_quantity[524288];
-__mram_noinit_keep int64_t l_tax[524288];
-__mram_noinit_keep char l_returnflag[524288];
-__mram_noinit_keep char l_linestatus[524288];
-__mram_noinit_keep uint32_t l_shipdate[524288];
+// Columns packed by scatter_columns at the offsets in dpu_args.col_offset
+__mram_noinit_keep uint64_t columns[COLUMNS_SIZE/sizeof(uint64_t)];
 
 BARRIER_INIT(barrier, NR_TASKLETS);
 
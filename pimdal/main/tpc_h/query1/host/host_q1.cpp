@@ -1,8 +1,9 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
-#include <chrono>
 #include <fstream>
+#include <map>
+#include <mutex>
 
 #include <arrow/api.h>
 #include <arrow/acero/exec_plan.h>
@@ -12,10 +13,8 @@
 #include "param.h"
 #include "datatype.h"
 #include "transfer_helper.h"
-
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
+#include "catalog.h"
+#include "server.h"
 
 namespace ac = arrow::acero;
 namespace cp = arrow::compute;
@@ -23,161 +22,113 @@ namespace cp = arrow::compute;
 
 std::shared_ptr<arrow::Table> lineitem;
 
-void populate_mram(dpu_set_t &system) {
-    scatter_table(system, lineitem, "l_extendedprice", "l_extendedprice", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_discount", "l_discount", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_quantity", "l_quantity", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_tax", "l_tax", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_returnflag", "l_returnflag", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_linestatus", "l_linestatus", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_shipdate", "l_shipdate", 0, DPU_SG_XFER_DEFAULT);
-
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (lineitem->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].l_count = lineitem->num_rows() % (lineitem->num_rows()/NR_DPU + 1);
-            }
-        }
-
-        query_args[dpu][0].date = date_to_int("1998-09-02");
-    }
+void populate_mram(dpu_set_t &system, column_catalog &cat, const query_request &request) {
+    trace_scope scope("to_dpu");
 
-    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
-}
+    int32_t date = date_to_int(request_date(request, "date", "1998-09-02"));
 
-arrow::BufferVector collect(dpu_set_t &system, uint32_t offset, uint32_t type_size) {
-    std::vector<std::vector<query_res_t>> query_res {NR_DPU, std::vector<query_res_t>(1)};
+    std::vector<uint32_t> col_offset = scatter_resident(system, "lineitem", lineitem,
+                                                        {"l_extendedprice", "l_discount", "l_quantity", "l_tax", "l_returnflag", "l_linestatus", "l_shipdate"},
+                                                        "columns", 0, COLUMNS_SIZE, DPU_SG_XFER_ASYNC, cat);
 
-    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+    // The query may run on a group of ranks rather than all allocated DPUs
+    uint32_t n = get_nr_dpus(system);
+    std::vector<std::vector<query_args_t>> query_args {n, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < n; dpu++) {
+        query_args[dpu][0].l_count = split_length(lineitem->num_rows(), dpu, n);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
 
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    uint32_t max_sel_size = 0;
-    uint32_t total = 0;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t sel_size = query_res[each_dpu][0].count;
-        if (sel_size > max_sel_size) {
-            max_sel_size = sel_size;
-        }
-        total += sel_size;
+        query_args[dpu][0].date = date;
     }
-    std::cout << "Total count: " << total << std::endl;
-
-    uint32_t size_rounded = (max_sel_size*type_size + 7) & (-8);
-    arrow::BufferVector buffers = alloc_buf_vec(size_rounded, NR_DPU);
-    get_buf(system, buffers, offset, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
-    return buffers;
+    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-arrow::ArrayVector get_res_char(dpu_set_t &system, uint32_t offset, uint32_t count,
-                                 std::vector<std::vector<query_res_t>> query_res) {
-
-    uint32_t length = (count + 7) & (-8);
-    arrow::BufferVector buffers = alloc_buf_vec(length, NR_DPU);
-    get_buf(system, buffers, offset, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-
-    arrow::ArrayVector chunks;
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t dpu_size = query_res[each_dpu][0].count;
-        
-        auto array_data = arrow::ArrayData::Make(
-            arrow::fixed_size_binary(1),
-            dpu_size,
-            {nullptr, buffers[each_dpu]});
-        auto array = arrow::MakeArray(array_data);
-        chunks.push_back(array);
-    }
-
-    return chunks;
+// Result columns of a DPU, stored one after the other, 16 elements apart
+typedef struct dpu_groups {
+    char l_returnflag[16*sizeof(int64_t)];
+    char l_linestatus[16*sizeof(int64_t)];
+    int64_t sum_qty[16];
+    int64_t sum_base_price[16];
+    int64_t sum_disc_price[16];
+    int64_t sum_charge[16];
+    int64_t avg_disc[16];
+    int32_t count_order[16];
+} dpu_groups;
+
+typedef struct group_sums {
+    int64_t sum_qty;
+    int64_t sum_base_price;
+    int64_t sum_disc_price;
+    int64_t sum_charge;
+    int64_t avg_disc;
+    int32_t count_order;
+} group_sums;
+
+// State of a query shared by the callbacks of its ranks
+typedef struct query_state {
+    column_catalog *cat;
+    // Groups of the ranks that finished, merged as the ranks report in
+    std::map<std::pair<char, char>, group_sums> groups;
+    uint64_t total = 0;
+    std::mutex mutex;
+} query_state;
+
+/*
+Move a rank on to the second phase as soon as it finished the first one,
+the phases exchange no data between the ranks
+*/
+dpu_error_t phase_callback(struct dpu_set_t rank,
+    __attribute((unused)) uint32_t rank_id, void * args) {
+
+    query_state *state = (query_state*) args;
+    return guard_callback([&]() {
+        state->cat->load_rank(rank, "kernel_q1_2");
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(rank, DPU_SYNCHRONOUS)); });
+    });
 }
 
-arrow::ArrayVector get_res_32(dpu_set_t &system, uint32_t offset, uint32_t count,
-                               std::vector<std::vector<query_res_t>> query_res) {
-
-    uint32_t length = (count*sizeof(uint32_t) + 7) & (-8);
-    arrow::BufferVector buffers = alloc_buf_vec(length, NR_DPU);
-    get_buf(system, buffers, offset, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-
-    arrow::ArrayVector chunks;
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t dpu_size = query_res[each_dpu][0].count;
-        
-        auto array_data = arrow::ArrayData::Make(
-            arrow::int32(),
-            dpu_size,
-            {nullptr, buffers[each_dpu]});
-        auto array = arrow::MakeArray(array_data);
-        chunks.push_back(array);
-    }
-
-    return chunks;
+/*
+Collect the groups of the DPUs of a rank and merge them into the groups of
+the ranks that finished before
+*/
+dpu_error_t merge_callback(struct dpu_set_t rank,
+    __attribute((unused)) uint32_t rank_id, void * args) {
+
+    query_state *state = (query_state*) args;
+    return guard_callback([&]() {
+        trace_scope scope("from_dpu");
+
+        uint32_t rank_dpus = get_nr_dpus(rank);
+        std::vector<std::vector<query_res_t>> query_res {rank_dpus, std::vector<query_res_t>(1)};
+        get_vec(rank, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+
+        std::vector<std::vector<dpu_groups>> results {rank_dpus, std::vector<dpu_groups>(1)};
+        get_vec(rank, results, 524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+
+        // Groups can be modified by multiple threads simultaneously
+        const std::lock_guard<std::mutex> lock(state->mutex);
+        for (uint32_t dpu = 0; dpu < rank_dpus; dpu++) {
+            const dpu_groups &res = results[dpu][0];
+            for (uint32_t i = 0; i < query_res[dpu][0].count; i++) {
+                group_sums &group = state->groups[{res.l_returnflag[i], res.l_linestatus[i]}];
+                group.sum_qty += res.sum_qty[i];
+                group.sum_base_price += res.sum_base_price[i];
+                group.sum_disc_price += res.sum_disc_price[i];
+                group.sum_charge += res.sum_charge[i];
+                group.avg_disc += res.avg_disc[i];
+                group.count_order += res.count_order[i];
+            }
+            state->total += query_res[dpu][0].count;
+        }
+    });
 }
 
-arrow::ArrayVector get_res_64(dpu_set_t &system, uint32_t offset, uint32_t count,
-                               std::vector<std::vector<query_res_t>> query_res) {
-
-    uint32_t length = count*sizeof(int64_t);
-    arrow::BufferVector buffers = alloc_buf_vec(length, NR_DPU);
-    get_buf(system, buffers, offset, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-    arrow::ArrayVector chunks;
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t dpu_size = query_res[each_dpu][0].count;
-        
-        auto array_data = arrow::ArrayData::Make(
-            arrow::int64(),
-            dpu_size,
-            {nullptr, buffers[each_dpu]});
-        auto array = arrow::MakeArray(array_data);
-        chunks.push_back(array);
-    }
-
-    return chunks;
-}
+std::shared_ptr<arrow::Table> get_results(const query_state &state) {
+    trace_scope scope("host");
 
-std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
-    std::vector<std::vector<query_res_t>> query_res {NR_DPU, std::vector<query_res_t>(1)};
-
-    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
-
-    arrow::ArrayVector l_returnflag_chunks;
-    arrow::ArrayVector l_linestatus_chunks;
-    arrow::ArrayVector sum_qty_chunks;
-    arrow::ArrayVector sum_base_price_chunks;
-    arrow::ArrayVector sum_disc_price_chunks;
-    arrow::ArrayVector sum_charge_chunks;
-    arrow::ArrayVector avg_disc_chunks;
-    arrow::ArrayVector count_order_chunks;
-
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    uint32_t max_count = 0;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        //std::cout << "Size: " << gb_res[each_dpu][0].count << std::endl;
-        if (query_res[each_dpu][0].count > max_count) {
-            max_count = query_res[each_dpu][0].count;
-        }
-    }
+    std::cout << "Count: " << state.total << std::endl;
 
-    std::cout << "Count: " << max_count << std::endl;
-
-    arrow::ChunkedArrayVector data_vec;
     auto schema = arrow::schema({arrow::field("l_returnflag", arrow::fixed_size_binary(1), false),
                                  arrow::field("l_linestatus", arrow::fixed_size_binary(1), false),
                                  arrow::field("sum_qty", arrow::int64(), false),
@@ -187,50 +138,42 @@ std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
                                  arrow::field("avg_disc", arrow::int64(), false),
                                  arrow::field("count_order", arrow::int32(), false)});
 
-    uint32_t offset = 524288*sizeof(key_ptr32);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_char(system, offset, max_count, query_res)
-    ));
-
-    offset += 16*sizeof(int64_t);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_char(system, offset, max_count, query_res)
-    ));
-
-    offset += 16*sizeof(int64_t);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_64(system, offset, max_count, query_res)
-    ));
-
-    offset += 16*sizeof(int64_t);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_64(system, offset, max_count, query_res)
-    ));
-
-    offset += 16*sizeof(int64_t);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_64(system, offset, max_count, query_res)
-    ));
-
-    offset += 16*sizeof(int64_t);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_64(system, offset, max_count, query_res)
-    ));
-
-    offset += 16*sizeof(int64_t);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_64(system, offset, max_count, query_res)
-    ));
-
-    offset += 16*sizeof(int64_t);
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(
-        get_res_32(system, offset, max_count, query_res)
-    ));
+    uint64_t rows = state.groups.size();
+    arrow::BufferVector buffers;
+    for (auto & field : schema->fields()) {
+        arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try =
+            arrow::AllocateBuffer(rows*field->type()->layout().buffers[1].byte_width);
+        if (!buffer_try.ok()) {
+            std::cout << "Could not allocate buffer!" << std::endl;
+        }
+        buffers.push_back(*std::move(buffer_try));
+    }
+
+    uint64_t row = 0;
+    for (auto const &e : state.groups) {
+        buffers[0]->mutable_data()[row] = e.first.first;
+        buffers[1]->mutable_data()[row] = e.first.second;
+        ((int64_t*) buffers[2]->mutable_data())[row] = e.second.sum_qty;
+        ((int64_t*) buffers[3]->mutable_data())[row] = e.second.sum_base_price;
+        ((int64_t*) buffers[4]->mutable_data())[row] = e.second.sum_disc_price;
+        ((int64_t*) buffers[5]->mutable_data())[row] = e.second.sum_charge;
+        ((int64_t*) buffers[6]->mutable_data())[row] = e.second.avg_disc;
+        ((int32_t*) buffers[7]->mutable_data())[row] = e.second.count_order;
+        row++;
+    }
+
+    arrow::ChunkedArrayVector data_vec;
+    for (uint32_t col = 0; col < buffers.size(); col++) {
+        auto array_data = arrow::ArrayData::Make(schema->field(col)->type(), rows, {nullptr, buffers[col]});
+        data_vec.push_back(std::make_shared<arrow::ChunkedArray>(arrow::MakeArray(array_data)));
+    }
 
     return arrow::Table::Make(schema, data_vec);
 }
 
-std::shared_ptr<arrow::ChunkedArray> aggr_host(std::shared_ptr<arrow::Table> res) {
+std::shared_ptr<arrow::Table> aggr_host(std::shared_ptr<arrow::Table> res) {
+
+    trace_scope scope("host");
 
     auto aggregate_options =
     ac::AggregateNodeOptions{{{"hash_sum", nullptr, "sum_qty", "sum_qty"},
@@ -273,7 +216,36 @@ std::shared_ptr<arrow::ChunkedArray> aggr_host(std::shared_ptr<arrow::Table> res
     auto table = query.ValueOrDie();
     std::cout << table->ToString() << std::endl;
 
-    return table->GetColumnByName("revenue");
+    return table;
+}
+
+/*
+Run the query on the DPUs
+
+@param system set of dpus
+@param cat catalog of the dpus
+@param request parameters of the query, missing ones take the values of the
+               TPC-H validation run
+
+@returns: the aggregated groups
+*/
+std::shared_ptr<arrow::Table> run_query(dpu_set_t &system, column_catalog &cat, const query_request &request) {
+    query_state state;
+    state.cat = &cat;
+
+    cat.load(system, "kernel_q1_1");
+    populate_mram(system, cat, request);
+    DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+
+    // Every rank runs the second phase and reports its groups as soon as it is done
+    DPU_CHECK(dpu_callback(system, phase_callback, &state, DPU_CALLBACK_ASYNC));
+    DPU_CHECK(dpu_callback(system, merge_callback, &state, DPU_CALLBACK_ASYNC));
+
+    // Also reports the errors of the callbacks
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+    auto res = get_results(state);
+
+    return aggr_host(res);
 }
 
 void comp() {
@@ -342,37 +314,36 @@ void comp() {
     std::cout << table->ToString() << std::endl;
 }
 
-int main(void) {
+int main(int argc, char **argv) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     std::vector<int32_t> sel_cols = {0, 4, 5, 6, 7, 8, 9, 10};
     auto status = parquet_to_table("lineitem", lineitem, sel_cols);
     if (!status.ok()) {
         std::cout << status.message() << std::endl;
     }
-    try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-        DPU_ASSERT(dpu_load(system, "kernel_q1_1", NULL));
-        populate_mram(system);
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-        DPU_ASSERT(dpu_load(system, "kernel_q1_2", NULL));
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
 
-        auto res = get_results(system);
-        
-        aggr_host(res);
+    query_server server;
+    if (server.open(argc, argv)) {
+        // Requests run concurrently on groups of ranks just large enough to hold the columns
+        rank_scheduler scheduler(system, dpus_needed(lineitem->num_rows(), 38, COLUMNS_SIZE));
+        serve_queries(server, scheduler, "q1", {"date"},
+                      [](rank_group &group, const query_request &request) {
+                          return run_query(group.set, group.catalog, request);
+                      });
+        return 0;
+    }
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    try {
+        trace.begin("q1", nr_dpus);
+        run_query(system, catalog, query_request());
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         comp();
         output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
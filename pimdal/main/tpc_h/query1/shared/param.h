@@ -3,10 +3,14 @@
 
 #include <stdint.h>
 
+// Size of the columns symbol the lineitem columns are packed into
+#define COLUMNS_SIZE (38*524288)
+
 typedef struct
 {
     uint32_t l_count;
     int64_t date;
+    uint32_t col_offset[7];
 } query_args_t;
 
 typedef struct
@@ -0,0 +1,68 @@
+#include <defs.h>
+#include <barrier.h>
+#include <mram.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex.h>
+#include <mutex_pool.h>
+
+#include "datatype.h"
+#include "param.h"
+#include "kernel_q3.h"
+
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 4
+#endif
+
+#define NR_PHASES 5
+
+// Columns of the tables, see CUSTOMER_COLUMNS. All programs of the query
+// declare it as their first MRAM symbol so it has the same address in each
+__mram_noinit_keep uint64_t columns[COLUMNS_SIZE/sizeof(uint64_t)];
+_Static_assert(COLUMNS_SIZE <= MRAM_SIZE - HEAP_SIZE, "the columns overlap the heap of the phases");
+
+__host query_args_t dpu_args;
+__host query_res_t dpu_results;
+// Phase run by the next launch, set by the host
+__host uint32_t phase;
+
+sel_results_t sel_results;
+hash_arguments_t hash_args;
+filter_arguments_t filter_args;
+part_arguments_t part_args;
+match_arguments_t match_args;
+merge_arguments_t merge_args;
+merge_results_t merge_res;
+aggr_results_t proj_res;
+
+BARRIER_INIT(barrier, NR_TASKLETS);
+
+MUTEX_INIT(mutex);
+MUTEX_POOL_INIT(mutexes, 16);
+
+// The phases built into this program, selected with -DPHASE_<n>
+int (*phases[NR_PHASES + 1])(void) = {
+#ifdef PHASE_1
+    [1] = main_q3_1,
+#endif
+#ifdef PHASE_2
+    [2] = main_q3_2,
+#endif
+#ifdef PHASE_3
+    [3] = main_q3_3,
+#endif
+#ifdef PHASE_4
+    [4] = main_q3_4,
+#endif
+#ifdef PHASE_5
+    [5] = main_q3_5,
+#endif
+};
+
+int main(void) {
+    if (phase > NR_PHASES || phases[phase] == NULL) {
+        return 1;
+    }
+
+    return phases[phase]();
+}
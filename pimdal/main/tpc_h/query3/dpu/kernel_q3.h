@@ -0,0 +1,44 @@
+#ifndef _KERNEL_Q3_H_
+#define _KERNEL_Q3_H_
+
+#include <barrier.h>
+#include <mutex.h>
+#include <mutex_pool.h>
+
+#include "datatype.h"
+#include "param.h"
+#include "sel.h"
+#include "hash_join.h"
+#include "aggregate.h"
+#include "sort.h"
+
+/*
+State shared by the phases of the query, defined in kernel_q3.c. The phases
+of a program run one per launch and the WRAM is kept between launches, so
+every phase sets the arguments it uses before calling into the library.
+*/
+extern query_args_t dpu_args;
+extern query_res_t dpu_results;
+
+extern sel_results_t sel_results;
+extern hash_arguments_t hash_args;
+extern filter_arguments_t filter_args;
+extern part_arguments_t part_args;
+extern match_arguments_t match_args;
+extern merge_arguments_t merge_args;
+extern merge_results_t merge_res;
+extern aggr_results_t proj_res;
+
+extern __mram_ptr uint64_t columns[COLUMNS_SIZE/sizeof(uint64_t)];
+
+extern barrier_t barrier;
+extern const mutex_id_t mutex;
+extern struct mutex_pool mutexes;
+
+int main_q3_1(void);
+int main_q3_2(void);
+int main_q3_3(void);
+int main_q3_4(void);
+int main_q3_5(void);
+
+#endif
@@ -12,30 +12,14 @@
 #include "param.h"
 #include "sel.h"
 #include "hash_join.h"
+#include "kernel_q3.h"
 
 #define BLOCK_SIZE 64
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-sel_results_t sel_results;
-part_arguments_t part_args;
-
-__mram_noinit_keep uint32_t c_mktsegment[131072][16];
-__mram_noinit_keep uint32_t c_custkey[131072];
 
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
-
-void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -61,7 +45,7 @@ void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -91,7 +75,7 @@ void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void out_val(uint32_t in, uint32_t count) {
+static void out_val(uint32_t in, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -113,12 +97,15 @@ void out_val(uint32_t in, uint32_t count) {
     }
 }
 
-bool pred_c(key_ptr_t element) {
+static bool pred_c(key_ptr_t element) {
     bool res = (strstr(element.key, dpu_args.c_segment) != NULL);
     return res;
 }
 
-int main() {
+int main_q3_1() {
+
+    uint32_t c_custkey = (uint32_t) columns + dpu_args.col_offset[0];
+    uint32_t c_mktsegment = (uint32_t) columns + dpu_args.col_offset[1];
 
     uint32_t tasklet_id = me();
 
@@ -145,7 +132,7 @@ int main() {
         part_args.shift = 27;
         part_args.part_ptr = buffer_1;
         part_args.part_sizes = sizes;
-        part_args.part_n = NR_DPU;
+        part_args.part_n = dpu_args.dpu_n;
     }
     barrier_wait(&barrier);
 
@@ -12,31 +12,14 @@
 #include "param.h"
 #include "sel.h"
 #include "hash_join.h"
+#include "kernel_q3.h"
 
 #define BLOCK_SIZE 64
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-hash_arguments_t hash_args;
-filter_arguments_t filter_args;
-part_arguments_t part_args;
-match_arguments_t match_args;
-merge_arguments_t merge_args;
-merge_results_t merge_res;
 
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
-
-void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -59,7 +42,7 @@ void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -89,7 +72,7 @@ void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -119,7 +102,7 @@ void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void out_val(uint32_t in, uint32_t count) {
+static void out_val(uint32_t in, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -141,7 +124,7 @@ void out_val(uint32_t in, uint32_t count) {
     }
 }
 
-int main() {
+int main_q3_3() {
 
     uint32_t tasklet_id = me();
 
@@ -154,18 +137,26 @@ int main() {
     uint32_t buffer_1 = (uint32_t) (buf_o_shipprio + size*sizeof(key_ptr_t));
     uint32_t buffer_2 = (uint32_t) (buffer_1 + size*sizeof(key_ptr_t));
     uint32_t sizes_1 = (uint32_t) (buffer_2 + size*sizeof(key_ptr_t));
-    uint32_t sizes_2 = (uint32_t) (sizes_1 + (NR_DPU+1)*sizeof(uint64_t));
+    uint32_t sizes_2 = (uint32_t) (sizes_1 + (dpu_args.dpu_n+1)*sizeof(uint64_t));
+    // Overflow chains of the hash table behind the partition sizes of the join
+    uint32_t overflow = (uint32_t) (sizes_2 + (size/PART_TABLE+1)*sizeof(uint64_t));
 
     /*
     * o_orderdate < DATE
     */
 
+    // The partitions and their hash tables grow with the inner relation, the
+    // table has to fit into the buffer of its input
+    uint32_t part_n = plan_partitions(dpu_args.c_count, PART_FILL, size/PART_TABLE);
+
     if (tasklet_id == 0) {
         hash_args.in_ptr = buf_c_custkey;
         hash_args.size = dpu_args.c_count;
-        hash_args.shift = 13;
+        hash_args.shift = 0;
         hash_args.table_ptr = buffer_1;
-        hash_args.table_size = 4096;
+        hash_args.table_size = part_n*PART_TABLE;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -177,10 +168,10 @@ int main() {
     if (tasklet_id == 0) {
         part_args.in_ptr = buf_o_custkey;
         part_args.size = dpu_args.o_count;
-        part_args.shift = 13;
+        part_args.shift = 0;
         part_args.part_ptr = buffer_2;
         part_args.part_sizes = sizes_2;
-        part_args.part_n = 16;
+        part_args.part_n = part_n;
     }
     barrier_wait(&barrier);
 
@@ -193,7 +184,9 @@ int main() {
         merge_args.in_ptr = buffer_2;
         merge_args.out_ptr = buf_o_custkey;
         merge_args.part_sizes = sizes_2;
-        merge_args.part_n = 16;
+        merge_args.part_n = part_n;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -208,7 +201,7 @@ int main() {
         part_args.shift = 27;
         part_args.part_ptr = buf_c_custkey;
         part_args.part_sizes = sizes_1;
-        part_args.part_n = NR_DPU;
+        part_args.part_n = dpu_args.dpu_n;
     }
     barrier_wait(&barrier);
 
@@ -222,6 +215,7 @@ int main() {
     barrier_wait(&barrier);
 
     dpu_results.count = merge_res.out_n;
+    dpu_results.dropped = merge_res.dropped_n;
 
     return 0;
 }
\ No newline at end of file
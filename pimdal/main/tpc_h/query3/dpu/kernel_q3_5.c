@@ -13,6 +13,7 @@
 #include "hash_join.h"
 #include "aggregate.h"
 #include "sort.h"
+#include "kernel_q3.h"
 
 #ifndef BLOCK_SIZE
 #define BLOCK_SIZE 64
@@ -20,27 +21,8 @@
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-hash_arguments_t hash_args;
-filter_arguments_t filter_args;
-part_arguments_t part_args;
-merge_arguments_t merge_args;
-merge_results_t merge_res;
-
-aggr_results_t proj_res;
 
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
-
-void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -64,9 +46,9 @@ void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void create_outptr(uint32_t in, uint32_t out, uint32_t load_key, uint32_t load_date,
-                   uint32_t load_prio, uint32_t load_price, uint32_t load_discount,
-                   uint32_t count) {
+static void create_outptr(uint32_t in, uint32_t out, uint32_t load_key, uint32_t load_date,
+                          uint32_t load_prio, uint32_t load_price, uint32_t load_discount,
+                          uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -117,7 +99,7 @@ void create_outptr(uint32_t in, uint32_t out, uint32_t load_key, uint32_t load_d
     }
 }
 
-void load_out(uint32_t in, uint32_t out, uint32_t count) {
+static void load_out(uint32_t in, uint32_t out, uint32_t count) {
     
     mem_reset(); // Reset the heap
 
@@ -145,7 +127,7 @@ void load_out(uint32_t in, uint32_t out, uint32_t count) {
     mram_write(prio_cache, (__mram_ptr void*) (out + 48*sizeof(key_ptr32)), 10*sizeof(uint32_t));
 }
 
-void out_val(uint32_t in, uint32_t count) {
+static void out_val(uint32_t in, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -171,13 +153,13 @@ void out_val(uint32_t in, uint32_t count) {
 /*
     Aggregation function sum
 */
-key_ptr_t sum(key_ptr_t curr_val, key_ptr_t element) {
+static key_ptr_t sum(key_ptr_t curr_val, key_ptr_t element) {
     curr_val.key += element.key;
 
     return curr_val;
 }
 
-int main() {
+int main_q3_5() {
 
     uint32_t tasklet_id = me();
 
@@ -192,15 +174,28 @@ int main() {
     uint32_t buffer_2 = (uint32_t) (buffer_1 + size*sizeof(key_ptr32));
     uint32_t buffer_3 = (uint32_t) (buffer_2 + size*sizeof(key_ptr32));
     uint32_t sizes_1 = (uint32_t) (buffer_3 + size*sizeof(key_ptr32));
+    // Overflow chains of the hash table behind the partition sizes of the join
+    uint32_t overflow = (uint32_t) (sizes_1 + (size/PART_TABLE+1)*sizeof(uint64_t));
+    // Output of the aggregation, the size elements of key_ptr_t from buffer_2 on
+    // are its input and partitioning fills size*sizeof(key_ptr_t) bytes of both.
+    // The joined columns before buffer_1 are dead by then, so it reuses them and
+    // the heap ends with the input at buffer_2
+    uint32_t buffer_4 = buf_o_orderdate;
 
     create_ptr(buf_o_orderkey, buf_o_orderkey, dpu_args.o_count);
 
+    // The partitions and their hash tables grow with the inner relation, the
+    // table has to fit into the buffer of its input
+    uint32_t part_n = plan_partitions(dpu_args.o_count, PART_FILL, size/PART_TABLE);
+
     if (tasklet_id == 0) {
         hash_args.in_ptr = buf_o_orderkey;
         hash_args.size = dpu_args.o_count;
-        hash_args.shift = 13;
+        hash_args.shift = 0;
         hash_args.table_ptr = buffer_1;
-        hash_args.table_size = 16384;
+        hash_args.table_size = part_n*PART_TABLE;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -212,10 +207,10 @@ int main() {
     if (tasklet_id == 0) {
         part_args.in_ptr = buffer_3;
         part_args.size = dpu_args.l_count;
-        part_args.shift = 13;
+        part_args.shift = 0;
         part_args.part_ptr = buffer_2;
         part_args.part_sizes = sizes_1;
-        part_args.part_n = 64;
+        part_args.part_n = part_n;
     }
     barrier_wait(&barrier);
 
@@ -228,7 +223,9 @@ int main() {
         merge_args.in_ptr = buffer_2;
         merge_args.out_ptr = buf_o_orderkey;
         merge_args.part_sizes = sizes_1;
-        merge_args.part_n = 64;
+        merge_args.part_n = part_n;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -238,10 +235,10 @@ int main() {
     create_outptr(buf_o_orderkey, buffer_2, buf_l_orderkey, buf_o_orderdate, buf_o_shipprio,
                   buf_l_extendedprice, buf_l_discount, merge_res.out_n);
 
-    aggr_arguments_t proj_args = {.in = buffer_2, .out = buffer_1, .size = merge_res.out_n, .aggr = sum};
+    aggr_arguments_t proj_args = {.in = buffer_2, .out = buffer_4, .size = merge_res.out_n, .aggr = sum};
     group_kernel(&proj_args, &proj_res);
 
-    sort_arguments_t sort_args = {.in = buffer_1, 
+    sort_arguments_t sort_args = {.in = buffer_4, 
                                   .nr_splits = 16,
                                   .nr_elements = proj_res.t_count,
                                   .indices = 0, 
@@ -258,6 +255,7 @@ int main() {
     }
 
     dpu_results.count = 10;
+    dpu_results.dropped = merge_res.dropped_n;
 
     return 0;
 }
\ No newline at end of file
@@ -1,7 +1,6 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
-#include <chrono>
 #include <fstream>
 #include <cstring>
 
@@ -11,12 +10,12 @@
 #include "../../reader/read_table.cpp"
 
 #include "param.h"
+#include "phases.h"
 #include "datatype.h"
 #include "transfer_helper.h"
-
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
+#include "catalog.h"
+#include "shuffle.h"
+#include "server.h"
 
 namespace ac = arrow::acero;
 namespace cp = arrow::compute;
@@ -25,261 +24,131 @@ std::shared_ptr<arrow::Table> customer;
 std::shared_ptr<arrow::Table> orders;
 std::shared_ptr<arrow::Table> lineitem;
 
-void populate_mram_1(dpu_set_t &system) {
-    scatter_table(system, customer, "c_custkey", "c_custkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, customer, "c_mktsegment", "c_mktsegment", 0, DPU_SG_XFER_DEFAULT);
-
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (customer->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].c_count = customer->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-            query_args[dpu][0].c_count = customer->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].c_count = customer->num_rows() % (customer->num_rows()/NR_DPU + 1);
-            }
-        }
+std::vector<uint32_t> stage_mram_1(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-        strcpy(query_args[dpu][0].c_segment, "BUILDING");
-    }
-
-    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+    return scatter_resident(system, "customer", customer, {"c_custkey", "c_mktsegment"}, "columns",
+                            CUSTOMER_COLUMNS, ORDERS_COLUMNS - CUSTOMER_COLUMNS, DPU_SG_XFER_ASYNC);
 }
 
-void populate_mram_2(dpu_set_t &system) {
-    scatter_table(system, orders, "o_orderkey", "o_orderkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, orders, "o_custkey", "o_custkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, orders, "o_orderdate", "o_orderdate", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, orders, "o_shippriority", "o_shippriority", 0, DPU_SG_XFER_DEFAULT);
-
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (orders->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].o_count = orders->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].o_count = orders->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].o_count = orders->num_rows() % (orders->num_rows()/NR_DPU + 1);
-            }
-        }
-
-        query_args[dpu][0].o_date = date_to_int("1995-03-15");
-    }
+void populate_mram_1(dpu_set_t &system, std::vector<uint32_t> &col_offset, const query_request &request) {
+    trace_scope scope("to_dpu");
 
-    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
-}
+    std::string c_segment = request_string(request, "c_segment", "BUILDING", sizeof(query_args_t::c_segment));
 
-void populate_mram_3(dpu_set_t &system) {
-    scatter_table(system, lineitem, "l_extendedprice", "l_extendedprice", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_discount", "l_discount", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_orderkey", "l_orderkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_shipdate", "l_shipdate", 0, DPU_SG_XFER_DEFAULT);
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].c_count = split_length(customer->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
 
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (lineitem->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].l_count = lineitem->num_rows() % (lineitem->num_rows()/NR_DPU + 1);
-            }
-        }
-
-        query_args[dpu][0].l_date = date_to_int("1995-03-15");
+        strcpy(query_args[dpu][0].c_segment, c_segment.c_str());
     }
 
     dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-arrow::BufferVector collect(dpu_set_t &system, uint32_t offset, uint32_t type_size) {
-    std::vector<std::vector<query_res_t>> query_res {NR_DPU, std::vector<query_res_t>(1)};
-
-    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
-
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    uint32_t max_sel_size = 0;
-    uint32_t total = 0;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t sel_size = query_res[each_dpu][0].count;
-        if (sel_size > max_sel_size) {
-            max_sel_size = sel_size;
-        }
-        total += sel_size;
-    }
-    std::cout << "Total count: " << total << " max: " << max_sel_size << std::endl;
+std::vector<uint32_t> stage_mram_2(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-    uint32_t size_rounded = (max_sel_size*type_size + 7) & (-8);
-    arrow::BufferVector buffers = alloc_buf_vec(size_rounded, NR_DPU);
-    get_buf(system, buffers, offset, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-    return buffers;
+    return scatter_resident(system, "orders", orders, {"o_orderkey", "o_custkey", "o_orderdate", "o_shippriority"}, "columns",
+                            ORDERS_COLUMNS, LINEITEM_COLUMNS - ORDERS_COLUMNS, DPU_SG_XFER_ASYNC);
 }
 
-void distribute_1(dpu_set_t &system, std::vector<std::vector<uint64_t>> sizes_c,
-                  std::vector<std::vector<uint64_t>> sizes_o,
-                  arrow::BufferVector buf_c_custkey, arrow::BufferVector buf_o_custkey,
-                  arrow::BufferVector buf_o_orderkey, arrow::BufferVector buf_o_orderdate,
-                  arrow::BufferVector buf_o_shipprio) {
-    
-    std::vector<std::vector<query_args_t>> dpu_args (NR_DPU, std::vector<query_args_t>(1));
-    std::vector<std::vector<uint64_t>> off_data (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-
-    uint32_t max_inner_size = 0;
-    uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
-            dpu_args[dpu][0].c_count += sizes_c[src][dpu+1] - sizes_c[src][dpu];
-            dpu_args[dpu][0].o_count += sizes_o[src][dpu+1] - sizes_o[src][dpu];
-        }
+void populate_mram_2(dpu_set_t &system, std::vector<uint32_t> &col_offset, const query_request &request) {
+    trace_scope scope("to_dpu");
 
-        if (dpu_args[dpu][0].c_count > max_inner_size) {
-            max_inner_size = dpu_args[dpu][0].c_count;
-        }
+    int32_t o_date = date_to_int(request_date(request, "date", "1995-03-15"));
 
-        if (dpu_args[dpu][0].o_count > max_outer_size) {
-            max_outer_size = dpu_args[dpu][0].o_count;
-        }
-    }
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].o_count = split_length(orders->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t i = 0; i < NR_DPU+1; i++) {
-            off_data[dpu][i] = sizes_o[dpu][i] * sizeof(uint32_t);
-            sizes_c[dpu][i] *= sizeof(key_ptr32);
-            sizes_o[dpu][i] *= sizeof(key_ptr32);
-        }
+        query_args[dpu][0].o_date = o_date;
     }
 
-    // Distributing c_custkey
-    sg_xfer_context_2d sc_args_c = {.partitions = buf_c_custkey, .offset = sizes_c};
-    get_block_t get_block_info_c = {.f = &get_cpy_ptr_2d, .args = &sc_args_c, .args_size=(sizeof(sc_args_c))};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                max_inner_size*sizeof(key_ptr32), &get_block_info_c, flag));
-
-    // Distributing o_custkey
-    sg_xfer_context_2d sc_args_o = {.partitions = buf_o_custkey, .offset = sizes_o};
-    get_block_t get_block_info_o = {.f = &get_cpy_ptr_2d, .args = &sc_args_o, .args_size=(sizeof(sc_args_o))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(key_ptr32), &get_block_info_o, flag));
-
-    // Distributing o_orderkey
-    sg_xfer_context_2d sc_args_orderkey = {.partitions = buf_o_orderkey, .offset = off_data};
-    get_block_t get_block_info_orderkey = {.f = &get_cpy_ptr_2d, .args = &sc_args_orderkey, .args_size=(sizeof(sc_args_orderkey))};
+    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+}
 
-    uint32_t length = (max_outer_size*sizeof(uint32_t) + 7) & (-8);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32),
-                                length, &get_block_info_orderkey, flag));
+std::vector<uint32_t> stage_mram_3(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-    // Distributing o_orderdate
-    sg_xfer_context_2d sc_args_orderdate = {.partitions = buf_o_orderdate, .offset = off_data};
-    get_block_t get_block_info_orderdate = {.f = &get_cpy_ptr_2d, .args = &sc_args_orderdate, .args_size=(sizeof(sc_args_orderdate))};
+    return scatter_resident(system, "lineitem", lineitem, {"l_extendedprice", "l_discount", "l_orderkey", "l_shipdate"}, "columns",
+                            LINEITEM_COLUMNS, COLUMNS_SIZE - LINEITEM_COLUMNS, DPU_SG_XFER_ASYNC);
+}
 
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32),
-                                length, &get_block_info_orderdate, flag));
+void populate_mram_3(dpu_set_t &system, std::vector<uint32_t> &col_offset, const query_request &request) {
+    trace_scope scope("to_dpu");
 
-    // Distributing o_shipprio
-    sg_xfer_context_2d sc_args_shipprio = {.partitions = buf_o_shipprio, .offset = off_data};
-    get_block_t get_block_info_shipprio = {.f = &get_cpy_ptr_2d, .args = &sc_args_shipprio, .args_size=(sizeof(sc_args_shipprio))};
+    int32_t l_date = date_to_int(request_date(request, "date", "1995-03-15"));
 
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 4*524288*sizeof(key_ptr32),
-                                length, &get_block_info_shipprio, flag));
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].l_count = split_length(lineitem->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
 
-    dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+        query_args[dpu][0].l_date = l_date;
+    }
 
+    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-void distribute_2(dpu_set_t &system, std::vector<std::vector<uint64_t>> sizes_o,
-                  std::vector<std::vector<uint64_t>> sizes_l,
-                  arrow::BufferVector buf_o_orderkey, arrow::BufferVector buf_l_orderkey,
-                  arrow::BufferVector buf_o_orderdate, arrow::BufferVector buf_o_shipprio,
-                  arrow::BufferVector buf_l_extendedprice, arrow::BufferVector buf_l_discount) {
+void distribute_1(dpu_set_t &system, const shuffle_plan &plan_c, const shuffle_plan &plan_o,
+                  std::shared_ptr<arrow::Buffer> buf_c_custkey,
+                  std::shared_ptr<arrow::Buffer> buf_o_custkey,
+                  std::shared_ptr<arrow::Buffer> buf_o_orderkey,
+                  std::shared_ptr<arrow::Buffer> buf_o_orderdate,
+                  std::shared_ptr<arrow::Buffer> buf_o_shipprio) {
     
-    std::vector<std::vector<query_args_t>> dpu_args (NR_DPU, std::vector<query_args_t>(1));
-    std::vector<std::vector<uint64_t>> off_data_o (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-    std::vector<std::vector<uint64_t>> off_data_l (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-
-    uint32_t max_inner_size = 0;
-    uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
-            dpu_args[dpu][0].o_count += sizes_o[src][dpu+1] - sizes_o[src][dpu];
-            dpu_args[dpu][0].l_count += sizes_l[src][dpu+1] - sizes_l[src][dpu];
-        }
+    trace_scope scope("shuffle");
 
-        if (dpu_args[dpu][0].o_count > max_inner_size) {
-            max_inner_size = dpu_args[dpu][0].o_count;
-        }
-
-        if (dpu_args[dpu][0].l_count > max_outer_size) {
-            max_outer_size = dpu_args[dpu][0].l_count;
-        }
+    std::vector<std::vector<query_args_t>> dpu_args (nr_dpus, std::vector<query_args_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        dpu_args[dpu][0].dpu_n = nr_dpus;
+        dpu_args[dpu][0].c_count = plan_c.counts[dpu];
+        dpu_args[dpu][0].o_count = plan_o.counts[dpu];
     }
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t i = 0; i < NR_DPU+1; i++) {
-            off_data_o[dpu][i] = sizes_o[dpu][i] * sizeof(uint32_t);
-            off_data_l[dpu][i] = sizes_l[dpu][i] * sizeof(int64_t);
-            sizes_o[dpu][i] *= sizeof(key_ptr32);
-            sizes_l[dpu][i] *= sizeof(key_ptr32);
-        }
-    }
-
-    // Distributing o_orderkey
-    sg_xfer_context_2d sc_args_o = {.partitions = buf_o_orderkey, .offset = sizes_o};
-    get_block_t get_block_info_o = {.f = &get_cpy_ptr_2d, .args = &sc_args_o, .args_size=(sizeof(sc_args_o))};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                max_inner_size*sizeof(key_ptr32), &get_block_info_o, flag));
-
-    // Distributing l_orderkey
-    sg_xfer_context_2d sc_args_l = {.partitions = buf_l_orderkey, .offset = sizes_l};
-    get_block_t get_block_info_l = {.f = &get_cpy_ptr_2d, .args = &sc_args_l, .args_size=(sizeof(sc_args_l))};
+    shuffle_scatter(system, plan_c, {{buf_c_custkey, sizeof(key_ptr32), 0}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
+    shuffle_scatter(system, plan_o, {{buf_o_custkey, sizeof(key_ptr32), 524288*sizeof(key_ptr32)},
+                                     {buf_o_orderkey, sizeof(uint32_t), 2*524288*sizeof(key_ptr32)},
+                                     {buf_o_orderdate, sizeof(uint32_t), 3*524288*sizeof(key_ptr32)},
+                                     {buf_o_shipprio, sizeof(uint32_t), 4*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
 
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(key_ptr32), &get_block_info_l, flag));
-
-    // Distributing o_orderdate
-    sg_xfer_context_2d sc_args_orderdate = {.partitions = buf_o_orderdate, .offset = off_data_o};
-    get_block_t get_block_info_orderdate = {.f = &get_cpy_ptr_2d, .args = &sc_args_orderdate, .args_size=(sizeof(sc_args_orderdate))};
-
-    uint32_t length = (max_inner_size*sizeof(uint32_t) + 7) & (-8);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32),
-                                length, &get_block_info_orderdate, flag));
-
-    // Distributing o_shipprio
-    sg_xfer_context_2d sc_args_shipprio = {.partitions = buf_o_shipprio, .offset = off_data_o};
-    get_block_t get_block_info_shipprio = {.f = &get_cpy_ptr_2d, .args = &sc_args_shipprio, .args_size=(sizeof(sc_args_shipprio))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32),
-                                length, &get_block_info_shipprio, flag));
+    dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 
-    // Distributing l_extendedprice
-    sg_xfer_context_2d sc_args_extendedprice = {.partitions = buf_l_extendedprice, .offset = off_data_l};
-    get_block_t get_block_info_extendedprice = {.f = &get_cpy_ptr_2d, .args = &sc_args_extendedprice, .args_size=(sizeof(sc_args_extendedprice))};
+}
 
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 4*524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(int64_t), &get_block_info_extendedprice, flag));
+void distribute_2(dpu_set_t &system, const shuffle_plan &plan_o, const shuffle_plan &plan_l,
+                  std::shared_ptr<arrow::Buffer> buf_o_orderkey,
+                  std::shared_ptr<arrow::Buffer> buf_l_orderkey,
+                  std::shared_ptr<arrow::Buffer> buf_o_orderdate,
+                  std::shared_ptr<arrow::Buffer> buf_o_shipprio,
+                  std::shared_ptr<arrow::Buffer> buf_l_extendedprice,
+                  std::shared_ptr<arrow::Buffer> buf_l_discount) {
+    
+    trace_scope scope("shuffle");
 
-    // Distributing l_discount
-    sg_xfer_context_2d sc_args_discount = {.partitions = buf_l_discount, .offset = off_data_l};
-    get_block_t get_block_info_discount = {.f = &get_cpy_ptr_2d, .args = &sc_args_discount, .args_size=(sizeof(sc_args_discount))};
+    std::vector<std::vector<query_args_t>> dpu_args (nr_dpus, std::vector<query_args_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        dpu_args[dpu][0].dpu_n = nr_dpus;
+        dpu_args[dpu][0].o_count = plan_o.counts[dpu];
+        dpu_args[dpu][0].l_count = plan_l.counts[dpu];
+    }
 
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 5*524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(int64_t), &get_block_info_discount, flag));
+    shuffle_scatter(system, plan_o, {{buf_o_orderkey, sizeof(key_ptr32), 0},
+                                     {buf_o_orderdate, sizeof(uint32_t), 2*524288*sizeof(key_ptr32)},
+                                     {buf_o_shipprio, sizeof(uint32_t), 3*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
+    shuffle_scatter(system, plan_l, {{buf_l_orderkey, sizeof(key_ptr32), 524288*sizeof(key_ptr32)},
+                                     {buf_l_extendedprice, sizeof(int64_t), 4*524288*sizeof(key_ptr32)},
+                                     {buf_l_discount, sizeof(int64_t), 5*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
 
     dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 
@@ -287,16 +156,18 @@ void distribute_2(dpu_set_t &system, std::vector<std::vector<uint64_t>> sizes_o,
 
 std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
 
-    arrow::BufferVector buffers_key = alloc_buf_vec(16*sizeof(uint32_t), NR_DPU);
+    trace_scope scope("from_dpu");
+
+    arrow::BufferVector buffers_key = alloc_buf_vec(system, 16*sizeof(uint32_t));
     get_buf(system, buffers_key, 0, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
-    arrow::BufferVector buffers_rev = alloc_buf_vec(16*sizeof(int64_t), NR_DPU);
+    arrow::BufferVector buffers_rev = alloc_buf_vec(system, 16*sizeof(int64_t));
     get_buf(system, buffers_rev, 16*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
-    arrow::BufferVector buffers_date = alloc_buf_vec(16*sizeof(uint32_t), NR_DPU);
+    arrow::BufferVector buffers_date = alloc_buf_vec(system, 16*sizeof(uint32_t));
     get_buf(system, buffers_date, 32*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
-    arrow::BufferVector buffers_prio = alloc_buf_vec(16*sizeof(uint32_t), NR_DPU);
+    arrow::BufferVector buffers_prio = alloc_buf_vec(system, 16*sizeof(uint32_t));
     get_buf(system, buffers_prio, 48*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
 
     arrow::Result<std::unique_ptr<arrow::Buffer>> res_key_try = arrow::AllocateBuffer(10*sizeof(uint32_t));
@@ -315,11 +186,11 @@ std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
     std::shared_ptr<arrow::Buffer> res_prio = *std::move(res_prio_try);
     uint32_t* res_prio_data = (uint32_t*) res_prio->mutable_data();
 
-    uint32_t indices[NR_DPU] = {0};
+    std::vector<uint32_t> indices(nr_dpus, 0);
     for (uint32_t i = 0; i < 10; i++) {
         int64_t max_rev = 0;
         uint32_t max_dpu = 0;
-        for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
+        for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
             const int64_t* data = (const int64_t*) buffers_rev[dpu]->data();
             if (data[indices[dpu]] > max_rev) {
                 max_rev = data[indices[dpu]];
@@ -445,9 +316,111 @@ double comp() {
     return 0;
 }
 
-int main(void) {
+/*
+Fail the query if a join lost elements of its hash tables on a DPU, their
+matches would be missing from the result
+
+@param system set of dpus
+@param join name of the join in the error
+*/
+void check_join(dpu_set_t &system, const std::string &join) {
+    std::vector<std::vector<query_res_t>> query_res {nr_dpus, std::vector<query_res_t>(1)};
+    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        if (query_res[dpu][0].dropped > 0) {
+            throw std::runtime_error("Hash tables of the " + join + " join full on DPU " + std::to_string(dpu) +
+                                     ", " + std::to_string(query_res[dpu][0].dropped) + " elements dropped");
+        }
+    }
+}
+
+/*
+Run the query on the DPUs
+
+@param system set of dpus
+@param request parameters of the query, missing ones take the values of the
+               TPC-H validation run
+
+@returns: the ten orders with the highest revenue
+*/
+std::shared_ptr<arrow::Table> run_query(dpu_set_t &system, const query_request &request) {
+    catalog.load_phase(system, phase_programs[1], 1);
+    auto col_offset_1 = stage_mram_1(system);
+    populate_mram_1(system, col_offset_1, request);
+    DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+
+    // Each rank receives the orders columns as soon as its kernel is done
+    auto col_offset_2 = stage_mram_2(system);
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+
+    {
+        std::vector<std::vector<uint64_t>> sizes_c(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_c, 2*524288*sizeof(key_ptrtext), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_c = plan_shuffle(sizes_c, true, "customer");
+        auto buf_c_custkey = shuffle_gather(system, plan_c, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+
+        catalog.load_phase(system, phase_programs[2], 2);
+        populate_mram_2(system, col_offset_2, request);
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+        std::vector<std::vector<uint64_t>> sizes_o(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_o, 4*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_o = plan_shuffle(sizes_o, true, "orders");
+        auto buf_o_custkey = shuffle_gather(system, plan_o, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_o_orderkey = shuffle_gather(system, plan_o, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+        auto buf_o_orderdate = shuffle_gather(system, plan_o, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32));
+        auto buf_o_shipprio = shuffle_gather(system, plan_o, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[3], 3);
+        distribute_1(system, plan_c, plan_o, buf_c_custkey, buf_o_custkey,
+                    buf_o_orderkey, buf_o_orderdate, buf_o_shipprio);
+    }
+
+    {
+        DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+        auto col_offset_3 = stage_mram_3(system);
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+        check_join(system, "customer orders");
+
+        std::vector<std::vector<uint64_t>> sizes_o(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_o, 7*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_o = plan_shuffle(sizes_o, true, "orders");
+        auto buf_o_orderkey = shuffle_gather(system, plan_o, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_o_orderdate = shuffle_gather(system, plan_o, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+        auto buf_o_shipprio = shuffle_gather(system, plan_o, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[4], 4);
+        populate_mram_3(system, col_offset_3, request);
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+        std::vector<std::vector<uint64_t>> sizes_l(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_l, 3*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_l = plan_shuffle(sizes_l, true, "lineitem");
+        auto buf_l_orderkey = shuffle_gather(system, plan_l, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_l_extendedprice = shuffle_gather(system, plan_l, sizeof(int64_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+        auto buf_l_discount = shuffle_gather(system, plan_l, sizeof(int64_t), DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[5], 5);
+        distribute_2(system, plan_o, plan_l, buf_o_orderkey, buf_l_orderkey,
+                    buf_o_orderdate, buf_o_shipprio, buf_l_extendedprice, buf_l_discount);
+    }
+
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+    check_join(system, "orders lineitem");
+
+    return get_results(system);
+}
+
+int main(int argc, char **argv) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, true);
     std::vector<int32_t> c_cols = {0, 6};
     auto status = parquet_to_table("customer", customer, c_cols);
     if (!status.ok()) {
@@ -465,70 +438,24 @@ int main(void) {
     if (!status.ok()) {
         std::cout << status.message() << std::endl;
     }
-    try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-        {
-            DPU_ASSERT(dpu_load(system, "kernel_q3_1", NULL));
-            populate_mram_1(system);
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            {
-                std::vector<std::vector<uint64_t>> sizes_c(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_c, 2*524288*sizeof(key_ptrtext), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_c_custkey = collect(system, 0, sizeof(key_ptr32));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q3_2", NULL));
-                populate_mram_2(system);
-                DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-                std::vector<std::vector<uint64_t>> sizes_o(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_o, 4*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_o_custkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_o_orderkey = collect(system, 524288*sizeof(key_ptr32), sizeof(uint32_t));
-                auto buf_o_orderdate = collect(system, 2*524288*sizeof(key_ptr32), sizeof(uint32_t));
-                auto buf_o_shipprio = collect(system, 3*524288*sizeof(key_ptr32), sizeof(uint32_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q3_3", NULL));
-                distribute_1(system, sizes_c, sizes_o, buf_c_custkey, buf_o_custkey,
-                            buf_o_orderkey, buf_o_orderdate, buf_o_shipprio);
-            }
-
-            {
-                DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-                std::vector<std::vector<uint64_t>> sizes_o(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_o, 7*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_o_orderkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_o_orderdate = collect(system, 524288*sizeof(key_ptr32), sizeof(uint32_t));
-                auto buf_o_shipprio = collect(system, 2*524288*sizeof(key_ptr32), sizeof(uint32_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q3_4", NULL));
-                populate_mram_3(system);
-                DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-                std::vector<std::vector<uint64_t>> sizes_l(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_l, 3*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_l_orderkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_l_extendedprice = collect(system, 524288*sizeof(key_ptr32), sizeof(int64_t));
-                auto buf_l_discount = collect(system, 2*524288*sizeof(key_ptr32), sizeof(int64_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q3_5", NULL));
-                distribute_2(system, sizes_o, sizes_l, buf_o_orderkey, buf_l_orderkey,
-                            buf_o_orderdate, buf_o_shipprio, buf_l_extendedprice, buf_l_discount);
-            }
-
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
 
-            auto res = get_results(system);
-            std::cout << res->ToString() << std::endl;
-        }
+    query_server server;
+    if (server.open(argc, argv)) {
+        serve_queries(server, "q3", {"c_segment", "date"},
+                      [&system](const query_request &request) { return run_query(system, request); });
+        return 0;
+    }
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    try {
+        trace.begin("q3", nr_dpus);
+        auto res = run_query(system, query_request());
+        std::cout << res->ToString() << std::endl;
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         //output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
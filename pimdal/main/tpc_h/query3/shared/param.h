@@ -3,6 +3,23 @@
 
 #include <stdint.h>
 
+// Every table has its own region of the columns symbol, so its columns stay
+// resident across requests and the next table is staged while the current
+// kernel runs. A region holds the bytes of a row times the rows per DPU the
+// kernels take of the table
+#define CUSTOMER_ROWS 131072
+#define ORDERS_ROWS 131072
+#define LINEITEM_ROWS 524288
+#define CUSTOMER_COLUMNS 0
+#define ORDERS_COLUMNS (CUSTOMER_COLUMNS + 20*CUSTOMER_ROWS)
+#define LINEITEM_COLUMNS (ORDERS_COLUMNS + 16*ORDERS_ROWS)
+#define COLUMNS_SIZE (LINEITEM_COLUMNS + 24*LINEITEM_ROWS)
+
+// MRAM of a DPU and the largest heap of the phases, the ten buffers of phase 5
+// followed by the partition sizes and the overflow area of its hash table
+#define MRAM_SIZE (64 << 20)
+#define HEAP_SIZE (42 << 20)
+
 typedef struct
 {
     uint32_t l_count;
@@ -12,11 +29,13 @@ typedef struct
     uint32_t l_date;
     char c_segment[16];
     uint32_t dpu_n;
+    uint32_t col_offset[4];
 } query_args_t;
 
 typedef struct
 {
     uint32_t count;
+    uint32_t dropped; // Elements lost by the hash tables of the joins, the overflow area was full
 } query_res_t;
 
 #endif
\ No newline at end of file
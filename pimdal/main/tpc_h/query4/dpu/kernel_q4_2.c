@@ -16,9 +16,6 @@
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
 
 __host query_args_t dpu_args;
 __host query_res_t dpu_results;
@@ -29,9 +26,10 @@ merge_results_t merge_res;
 
 sel_results_t sel_results;
 
-__mram_noinit_keep uint32_t l_orderkey[524288];
-__mram_noinit_keep uint32_t l_commitdate[524288];
-__mram_noinit_keep uint32_t l_receiptdate[524288];
+// Columns of the phases, see STAGE_0 and STAGE_1. All kernels of the query
+// declare it as their first MRAM symbol so it has the same address in each
+__mram_noinit_keep uint64_t columns[STAGE_SIZE/sizeof(uint64_t)];
+_Static_assert(STAGE_SIZE <= MRAM_SIZE - HEAP_SIZE, "the columns overlap the heap of the phases");
 
 BARRIER_INIT(barrier, NR_TASKLETS);
 
@@ -107,6 +105,10 @@ bool pred_l(key_ptr_t element) {
 
 int main() {
 
+    uint32_t l_orderkey = (uint32_t) columns + dpu_args.col_offset[0];
+    uint32_t l_commitdate = (uint32_t) columns + dpu_args.col_offset[1];
+    uint32_t l_receiptdate = (uint32_t) columns + dpu_args.col_offset[2];
+
     uint32_t tasklet_id = me();
 
     uint32_t size = 524288;
@@ -129,7 +131,7 @@ int main() {
         part_args.shift = 27;
         part_args.part_ptr = buffer_1;
         part_args.part_sizes = sizes;
-        part_args.part_n = NR_DPU;
+        part_args.part_n = dpu_args.dpu_n;
     }
     barrier_wait(&barrier);
 
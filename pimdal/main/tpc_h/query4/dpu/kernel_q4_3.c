@@ -29,6 +29,11 @@ merge_results_t merge_res;
 
 aggr_results_t aggr_res;
 
+// Columns of the phases, see STAGE_0 and STAGE_1. All kernels of the query
+// declare it as their first MRAM symbol so it has the same address in each
+__mram_noinit_keep uint64_t columns[STAGE_SIZE/sizeof(uint64_t)];
+_Static_assert(STAGE_SIZE <= MRAM_SIZE - HEAP_SIZE, "the columns overlap the heap of the phases");
+
 BARRIER_INIT(barrier, NR_TASKLETS);
 
 MUTEX_INIT(mutex);
@@ -153,15 +158,23 @@ int main() {
     uint32_t part = (uint32_t) (buffer_4 + size*sizeof(key_ptr32));
     uint32_t table = (uint32_t) (part + size*sizeof(key_ptr32));
     uint32_t part_sizes = (uint32_t) (table + size*sizeof(key_ptr32));
+    // Overflow chains of the hash table behind the partition sizes of the join
+    uint32_t overflow = (uint32_t) (part_sizes + (size/PART_TABLE+1)*sizeof(uint64_t));
     
     create_ptr(buffer_1, buffer_4, dpu_args.o_count);
 
+    // The partitions and their hash tables grow with the inner relation, the
+    // table has to fit into the buffer of its input
+    uint32_t part_n = plan_partitions(dpu_args.o_count, PART_FILL, size/PART_TABLE);
+
     if (tasklet_id == 0) {
         hash_args.in_ptr = buffer_4;
         hash_args.size = dpu_args.o_count;
-        hash_args.shift = 13;
+        hash_args.shift = 0;
         hash_args.table_ptr = table;
-        hash_args.table_size = 8192;
+        hash_args.table_size = part_n*PART_TABLE;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -172,10 +185,10 @@ int main() {
     if (tasklet_id == 0) {
         part_args.in_ptr = buffer_2;
         part_args.part_ptr = part;
-        part_args.shift = 13;
+        part_args.shift = 0;
         part_args.part_sizes = part_sizes;
         part_args.size = dpu_args.l_count;
-        part_args.part_n = 32;
+        part_args.part_n = part_n;
     }
     barrier_wait(&barrier);
 
@@ -188,13 +201,17 @@ int main() {
         merge_args.in_ptr = part;
         merge_args.out_ptr = buffer_4;
         merge_args.part_sizes = part_sizes;
-        merge_args.part_n = 32;
+        merge_args.part_n = part_n;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
     merge_kernel(&merge_args, &merge_res);
     barrier_wait(&barrier);
 
+    dpu_results.dropped = merge_res.dropped_n;
+
     aggr_arguments_t aggr_args = {.in = buffer_4, .out = buffer_2, .size = merge_res.out_n, .aggr = unique};
     group_kernel(&aggr_args, &aggr_res);
 
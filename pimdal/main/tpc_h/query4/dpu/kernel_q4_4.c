@@ -29,6 +29,11 @@ merge_results_t merge_res;
 
 aggr_results_t aggr_res;
 
+// Columns of the phases, see STAGE_0 and STAGE_1. All kernels of the query
+// declare it as their first MRAM symbol so it has the same address in each
+__mram_noinit_keep uint64_t columns[STAGE_SIZE/sizeof(uint64_t)];
+_Static_assert(STAGE_SIZE <= MRAM_SIZE - HEAP_SIZE, "the columns overlap the heap of the phases");
+
 BARRIER_INIT(barrier, NR_TASKLETS);
 
 MUTEX_INIT(mutex);
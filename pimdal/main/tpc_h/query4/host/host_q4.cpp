@@ -1,7 +1,6 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
-#include <chrono>
 #include <fstream>
 #include <cstring>
 
@@ -13,10 +12,9 @@
 #include "param.h"
 #include "datatype.h"
 #include "transfer_helper.h"
-
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
+#include "catalog.h"
+#include "shuffle.h"
+#include "server.h"
 
 namespace ac = arrow::acero;
 namespace cp = arrow::compute;
@@ -25,190 +23,103 @@ namespace cp = arrow::compute;
 std::shared_ptr<arrow::Table> lineitem;
 std::shared_ptr<arrow::Table> orders;
 
-void populate_mram_1(dpu_set_t &system) {
-    scatter_table(system, orders, "o_orderkey", "o_orderkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, orders, "o_orderpriority", "o_orderpriority", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, orders, "o_orderdate", "o_orderdate", 0, DPU_SG_XFER_DEFAULT);
+std::vector<uint32_t> stage_mram_1(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (orders->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].o_count = orders->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].o_count = orders->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].o_count = orders->num_rows() % (orders->num_rows()/NR_DPU + 1);
-            }
-        }
-        
-        query_args[dpu][0].date_start = date_to_int("1993-07-01");
-        query_args[dpu][0].date_end = date_to_int("1993-10-01");
-    }
-
-    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+    return scatter_resident(system, "orders", orders, {"o_orderkey", "o_orderpriority", "o_orderdate"}, "columns",
+                            STAGE_0, STAGE_1 - STAGE_0, DPU_SG_XFER_ASYNC);
 }
 
-void populate_mram_2(dpu_set_t &system) {
-    scatter_table(system, lineitem, "l_orderkey", "l_orderkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_commitdate", "l_commitdate", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_receiptdate", "l_receiptdate", 0, DPU_SG_XFER_DEFAULT);
+void populate_mram_1(dpu_set_t &system, std::vector<uint32_t> &col_offset, const query_request &request) {
+    trace_scope scope("to_dpu");
 
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (lineitem->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].l_count = lineitem->num_rows() % (lineitem->num_rows()/NR_DPU + 1);
-            }
-        }
+    int32_t date_start = date_to_int(request_date(request, "date_start", "1993-07-01"));
+    int32_t date_end = date_to_int(request_date(request, "date_end", "1993-10-01"));
+
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].o_count = split_length(orders->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
+        
+        query_args[dpu][0].date_start = date_start;
+        query_args[dpu][0].date_end = date_end;
     }
 
     dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-arrow::BufferVector collect(dpu_set_t &system, uint32_t offset, uint32_t type_size) {
-    std::vector<std::vector<query_res_t>> query_res {NR_DPU, std::vector<query_res_t>(1)};
+std::vector<uint32_t> stage_mram_2(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+    return scatter_resident(system, "lineitem", lineitem, {"l_orderkey", "l_commitdate", "l_receiptdate"}, "columns",
+                            STAGE_1, STAGE_SIZE - STAGE_1, DPU_SG_XFER_ASYNC);
+}
 
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    uint32_t max_sel_size = 0;
-    uint32_t total = 0;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t sel_size = query_res[each_dpu][0].count;
-        if (sel_size > max_sel_size) {
-            max_sel_size = sel_size;
-        }
-        total += sel_size;
-    }
-    std::cout << "Total count: " << total << std::endl;
+void populate_mram_2(dpu_set_t &system, std::vector<uint32_t> &col_offset) {
+    trace_scope scope("to_dpu");
 
-    uint32_t size_rounded = (max_sel_size*type_size + 7) & (-8);
-    arrow::BufferVector buffers = alloc_buf_vec(size_rounded, NR_DPU);
-    get_buf(system, buffers, offset, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].l_count = split_length(lineitem->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
+    }
 
-    return buffers;
+    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-void distribute(dpu_set_t &system, std::vector<std::vector<uint64_t>> sizes_o,
-                std::vector<std::vector<uint64_t>> sizes_l,
-                arrow::BufferVector buf_o_key, arrow::BufferVector buf_l_key,
-                arrow::BufferVector buf_o_prio) {
+void distribute(dpu_set_t &system, const shuffle_plan &plan_o, const shuffle_plan &plan_l,
+                std::shared_ptr<arrow::Buffer> buf_o_key,
+                std::shared_ptr<arrow::Buffer> buf_l_key,
+                std::shared_ptr<arrow::Buffer> buf_o_prio) {
     
-    std::vector<std::vector<query_args_t>> dpu_args (NR_DPU, std::vector<query_args_t>(1));
-    std::vector<std::vector<uint64_t>> off_oprio (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-
-    uint32_t max_inner_size = 0;
-    uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
-            dpu_args[dpu][0].o_count += sizes_o[src][dpu+1] - sizes_o[src][dpu];
-            dpu_args[dpu][0].l_count += sizes_l[src][dpu+1] - sizes_l[src][dpu];
-        }
-
-        if (dpu_args[dpu][0].o_count > max_inner_size) {
-            max_inner_size = dpu_args[dpu][0].o_count;
-        }
-
-        if (dpu_args[dpu][0].l_count > max_outer_size) {
-            max_outer_size = dpu_args[dpu][0].l_count;
-        }
-
-    }
+    trace_scope scope("shuffle");
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t i = 0; i < NR_DPU+1; i++) {
-            off_oprio[dpu][i] = sizes_o[dpu][i] * 16;
-            sizes_o[dpu][i] *= sizeof(key_ptr32);
-            sizes_l[dpu][i] *= sizeof(key_ptr32);
-        }
+    std::vector<std::vector<query_args_t>> dpu_args (nr_dpus, std::vector<query_args_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        dpu_args[dpu][0].dpu_n = nr_dpus;
+        dpu_args[dpu][0].o_count = plan_o.counts[dpu];
+        dpu_args[dpu][0].l_count = plan_l.counts[dpu];
     }
 
-    // Distributing o_orderkey
-    sg_xfer_context_2d sc_args_o = {.partitions = buf_o_key, .offset = sizes_o};
-    get_block_t get_block_info_o = {.f = &get_cpy_ptr_2d, .args = &sc_args_o, .args_size=(sizeof(sc_args_o))};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                max_inner_size*sizeof(key_ptr32), &get_block_info_o, flag));
-
-    // Distributing l_orderkey
-    sg_xfer_context_2d sc_args_l = {.partitions = buf_l_key, .offset = sizes_l};
-    get_block_t get_block_info_l = {.f = &get_cpy_ptr_2d, .args = &sc_args_l, .args_size=(sizeof(sc_args_l))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(key_ptr32), &get_block_info_l, flag));
-
-    // Distributing o_orderpriority
-    sg_xfer_context_2d sc_args_oprio = {.partitions = buf_o_prio, .offset = off_oprio};
-    get_block_t get_block_info_oprio = {.f = &get_cpy_ptr_2d, .args = &sc_args_oprio, .args_size=(sizeof(sc_args_oprio))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32),
-                                max_inner_size*16, &get_block_info_oprio, flag));
+    shuffle_scatter(system, plan_o, {{buf_o_key, sizeof(key_ptr32), 0},
+                                     {buf_o_prio, 16, 2*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
+    shuffle_scatter(system, plan_l, {{buf_l_key, sizeof(key_ptr32), 524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
 
     dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 
 }
 
 std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
-    std::vector<std::vector<query_res_t>> query_res (NR_DPU, std::vector<query_res_t>(1));
-    arrow::ArrayVector key_chunks;
-    arrow::ArrayVector val_chunks;
+    trace_scope scope("from_dpu");
 
+    std::vector<std::vector<query_res_t>> query_res (nr_dpus, std::vector<query_res_t>(1));
     get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
 
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    uint32_t max_gb_size = 0;
-    uint32_t tot = 0;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        tot += query_res[each_dpu][0].count;
-        uint32_t gb_size = query_res[each_dpu][0].count + (query_res[each_dpu][0].count & 1);
-        //std::cout << "Size: " << gb_res[each_dpu][0].count << std::endl;
-        if (gb_size > max_gb_size) {
-            max_gb_size = gb_size;
-        }
+    std::vector<uint64_t> counts(nr_dpus);
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        counts[dpu] = query_res[dpu][0].count;
     }
 
-    arrow::BufferVector buffers_key = alloc_buf_vec(max_gb_size*16, NR_DPU);
-    get_buf(system, buffers_key, 0, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-    arrow::BufferVector buffers_val;
-    buffers_val = alloc_buf_vec(max_gb_size*sizeof(uint32_t), NR_DPU);
-    get_buf(system, buffers_val, 524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t dpu_size = query_res[each_dpu][0].count;
-        auto array_data_key = arrow::ArrayData::Make(arrow::fixed_size_binary(16), dpu_size, {nullptr, buffers_key[each_dpu]});
-        auto array_key = arrow::MakeArray(array_data_key);
-        key_chunks.push_back(array_key);
-
-        auto array_data_val = arrow::ArrayData::Make(arrow::uint32(), dpu_size, {nullptr, buffers_val[each_dpu]});
-        auto array_val = arrow::MakeArray(array_data_val);
-        val_chunks.push_back(array_val);
-    }
+    // Only the groups of each DPU are transferred, into one array per column
+    std::vector<uint64_t> prefix;
+    auto array_key = gather_array(system, arrow::fixed_size_binary(16), counts,
+                                  DPU_MRAM_HEAP_POINTER_NAME, 0, prefix);
+    auto array_val = gather_array(system, arrow::uint32(), counts,
+                                  DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32), prefix);
 
-    arrow::ChunkedArrayVector data_vec;
     auto schema = arrow::schema({arrow::field("o_orderpriority", arrow::fixed_size_binary(16), false),
                                  arrow::field("order_count", arrow::uint32(), false)});
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(key_chunks));
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(val_chunks));
 
-    auto results = arrow::Table::Make(schema, data_vec);
-
-    return results;
+    return arrow::Table::Make(schema, {array_key, array_val});
 }
 
 std::shared_ptr<arrow::Table> aggr_host(std::shared_ptr<arrow::Table> res) {
+    trace_scope scope("host");
+
     auto options = std::make_shared<arrow::compute::ScalarAggregateOptions>();
     std::shared_ptr<ac::AggregateNodeOptions> aggregate_options;
     aggregate_options = std::make_shared<ac::AggregateNodeOptions>(ac::AggregateNodeOptions{{{"hash_sum", options, "order_count"}},
@@ -284,9 +195,81 @@ double comp() {
     return 0;
 }
 
-int main(void) {
+/*
+Fail the query if a join lost elements of its hash tables on a DPU, their
+matches would be missing from the result
+
+@param system set of dpus
+@param join name of the join in the error
+*/
+void check_join(dpu_set_t &system, const std::string &join) {
+    std::vector<std::vector<query_res_t>> query_res {nr_dpus, std::vector<query_res_t>(1)};
+    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        if (query_res[dpu][0].dropped > 0) {
+            throw std::runtime_error("Hash tables of the " + join + " join full on DPU " + std::to_string(dpu) +
+                                     ", " + std::to_string(query_res[dpu][0].dropped) + " elements dropped");
+        }
+    }
+}
+
+/*
+Run the query on the DPUs
+
+@param system set of dpus
+@param request parameters of the query, missing ones take the values of the
+               TPC-H validation run
+
+@returns: the order count of each order priority
+*/
+std::shared_ptr<arrow::Table> run_query(dpu_set_t &system, const query_request &request) {
+    catalog.load(system, "kernel_q4_1");
+    auto col_offset_1 = stage_mram_1(system);
+    populate_mram_1(system, col_offset_1, request);
+    DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+
+    // Each rank receives the lineitem columns as soon as its kernel is done
+    auto col_offset_2 = stage_mram_2(system);
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+
+    {
+        std::vector<std::vector<uint64_t>> sizes_o(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_o, 2*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_o = plan_shuffle(sizes_o, true, "orders");
+        auto buf_o_orderkey = shuffle_gather(system, plan_o, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_o_orderprio = shuffle_gather(system, plan_o, 16, DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+
+        catalog.load(system, "kernel_q4_2");
+        populate_mram_2(system, col_offset_2);
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+        std::vector<std::vector<uint64_t>> sizes_l(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_l, 2*524288*sizeof(keyval_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_l = plan_shuffle(sizes_l, true, "lineitem");
+        auto buf_l_orderkey = shuffle_gather(system, plan_l, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+
+        catalog.load(system, "kernel_q4_3");
+        distribute(system, plan_o, plan_l, buf_o_orderkey, buf_l_orderkey, buf_o_orderprio);
+    }
+
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+    check_join(system, "orders lineitem");
+
+    catalog.load(system, "kernel_q4_4");
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+
+    auto res = get_results(system);
+
+    return aggr_host(res);
+}
+
+int main(int argc, char **argv) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, true);
     std::vector<int32_t> l_cols = {0, 11, 12};
     auto status = parquet_to_table("lineitem", lineitem, l_cols);
     if (!status.ok()) {
@@ -297,49 +280,24 @@ int main(void) {
     if (!status.ok()) {
         std::cout << status.message() << std::endl;
     }
-    try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-        {
-            DPU_ASSERT(dpu_load(system, "kernel_q4_1", NULL));
-            populate_mram_1(system);
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            {
-                std::vector<std::vector<uint64_t>> sizes_o(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_o, 2*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_o_orderkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_o_orderprio = collect(system, 524288*sizeof(key_ptr32), 16);
-
-                DPU_ASSERT(dpu_load(system, "kernel_q4_2", NULL));
-                populate_mram_2(system);
-                DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-                std::vector<std::vector<uint64_t>> sizes_l(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_l, 2*524288*sizeof(keyval_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_l_orderkey = collect(system, 0, sizeof(key_ptr32));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q4_3", NULL));
-                distribute(system, sizes_o, sizes_l, buf_o_orderkey, buf_l_orderkey, buf_o_orderprio);
-            }
-
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            DPU_ASSERT(dpu_load(system, "kernel_q4_4", NULL));
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            auto res = get_results(system);
-            aggr_host(res);
-        }
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    query_server server;
+    if (server.open(argc, argv)) {
+        serve_queries(server, "q4", {"date_start", "date_end"},
+                      [&system](const query_request &request) { return run_query(system, request); });
+        return 0;
+    }
+
+    try {
+        trace.begin("q4", nr_dpus);
+        run_query(system, query_request());
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         //comp();
         output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
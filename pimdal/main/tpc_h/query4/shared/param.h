@@ -3,6 +3,20 @@
 
 #include <stdint.h>
 
+// Consecutive phases load their columns into alternating regions of the
+// columns symbol, so the next phase is staged while the current kernel runs. A
+// region holds the bytes of a row times the rows per DPU the kernels take
+#define ORDERS_ROWS 524288
+#define LINEITEM_ROWS 524288
+#define STAGE_0 0
+#define STAGE_1 (STAGE_0 + 24*ORDERS_ROWS)
+#define STAGE_SIZE (STAGE_1 + 12*LINEITEM_ROWS)
+
+// MRAM of a DPU and the largest heap of the phases, the seven buffers of phase
+// 3 followed by the partition sizes and the overflow area of its hash table
+#define MRAM_SIZE (64 << 20)
+#define HEAP_SIZE (30 << 20)
+
 typedef struct
 {
     uint32_t l_count;
@@ -10,11 +24,13 @@ typedef struct
     uint32_t date_start;
     uint32_t date_end;
     uint32_t dpu_n;
+    uint32_t col_offset[3];
 } query_args_t;
 
 typedef struct
 {
     uint32_t count;
+    uint32_t dropped; // Elements lost by the hash tables of the joins, the overflow area was full
 } query_res_t;
 
 #endif
\ No newline at end of file
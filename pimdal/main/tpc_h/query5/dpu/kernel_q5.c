@@ -0,0 +1,90 @@
+#include <defs.h>
+#include <barrier.h>
+#include <mram.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex.h>
+#include <mutex_pool.h>
+
+#include "datatype.h"
+#include "param.h"
+#include "kernel_q5.h"
+
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 4
+#endif
+
+#define NR_PHASES 7
+
+// Columns of the tables, see CUSTOMER_COLUMNS. All programs of the query
+// declare it as their first MRAM symbol so it has the same address in each
+__mram_noinit_keep uint64_t columns[COLUMNS_SIZE/sizeof(uint64_t)];
+
+__mram_noinit_keep uint32_t r_regionkey[16];
+__mram_noinit_keep uint8_t r_name[16][32];
+__mram_noinit_keep uint32_t n_nationkey[32];
+__mram_noinit_keep uint32_t n_regionkey[32];
+__mram_noinit_keep uint8_t n_name[32][32];
+
+#if BLOOM_FILTER == 1
+// Bloom filter of the customers or orders, ORed over all DPUs by the host
+__mram_noinit uint64_t bloom_filter[BLOOM_MAX_WORDS];
+_Static_assert(COLUMNS_SIZE + BLOOM_MAX_WORDS*sizeof(uint64_t) <= MRAM_SIZE - HEAP_SIZE,
+               "the columns and the bloom filter overlap the heap of the phases");
+#else
+_Static_assert(COLUMNS_SIZE <= MRAM_SIZE - HEAP_SIZE, "the columns overlap the heap of the phases");
+#endif
+
+__host query_args_t dpu_args;
+__host query_res_t dpu_results;
+// Phase run by the next launch, set by the host
+__host uint32_t phase;
+
+sel_results_t sel_results;
+hash_arguments_t hash_args;
+filter_arguments_t filter_args;
+part_arguments_t part_args;
+match_arguments_t match_args;
+merge_arguments_t merge_args;
+merge_results_t merge_res;
+bloom_arguments_t bloom_args;
+merge_results_t semi_res;
+aggr_results_t aggr_res;
+
+BARRIER_INIT(barrier, NR_TASKLETS);
+
+MUTEX_INIT(mutex);
+MUTEX_POOL_INIT(mutexes, 16);
+
+// The phases built into this program, selected with -DPHASE_<n>
+int (*phases[NR_PHASES + 1])(void) = {
+#ifdef PHASE_1
+    [1] = main_q5_1,
+#endif
+#ifdef PHASE_2
+    [2] = main_q5_2,
+#endif
+#ifdef PHASE_3
+    [3] = main_q5_3,
+#endif
+#ifdef PHASE_4
+    [4] = main_q5_4,
+#endif
+#ifdef PHASE_5
+    [5] = main_q5_5,
+#endif
+#ifdef PHASE_6
+    [6] = main_q5_6,
+#endif
+#ifdef PHASE_7
+    [7] = main_q5_7,
+#endif
+};
+
+int main(void) {
+    if (phase > NR_PHASES || phases[phase] == NULL) {
+        return 1;
+    }
+
+    return phases[phase]();
+}
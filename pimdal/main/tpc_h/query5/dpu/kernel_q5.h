@@ -0,0 +1,63 @@
+#ifndef _KERNEL_Q5_H_
+#define _KERNEL_Q5_H_
+
+#include <barrier.h>
+#include <mutex.h>
+#include <mutex_pool.h>
+
+#include "datatype.h"
+#include "param.h"
+#include "sel.h"
+#include "hash_join.h"
+#include "aggregate.h"
+
+// Prune orders and lineitem with bloom filters of the customers and orders
+// before the shuffle
+#ifndef BLOOM_FILTER
+#define BLOOM_FILTER 0
+#endif
+
+/*
+State shared by the phases of the query, defined in kernel_q5.c. The phases
+of a program run one per launch and the WRAM is kept between launches, so
+every phase sets the arguments it uses before calling into the library.
+*/
+extern query_args_t dpu_args;
+extern query_res_t dpu_results;
+
+extern sel_results_t sel_results;
+extern hash_arguments_t hash_args;
+extern filter_arguments_t filter_args;
+extern part_arguments_t part_args;
+extern match_arguments_t match_args;
+extern merge_arguments_t merge_args;
+extern merge_results_t merge_res;
+extern bloom_arguments_t bloom_args;
+extern merge_results_t semi_res;
+extern aggr_results_t aggr_res;
+
+extern __mram_ptr uint64_t columns[COLUMNS_SIZE/sizeof(uint64_t)];
+
+extern __mram_ptr uint32_t r_regionkey[16];
+extern __mram_ptr uint8_t r_name[16][32];
+extern __mram_ptr uint32_t n_nationkey[32];
+extern __mram_ptr uint32_t n_regionkey[32];
+extern __mram_ptr uint8_t n_name[32][32];
+
+#if BLOOM_FILTER == 1
+extern __mram_ptr uint64_t bloom_filter[BLOOM_MAX_WORDS];
+#endif
+
+extern barrier_t barrier;
+extern const mutex_id_t mutex;
+extern struct mutex_pool mutexes;
+
+int main_q5_1(void);
+int main_q5_2(void);
+int main_q5_3(void);
+int main_q5_4(void);
+int main_q5_5(void);
+int main_q5_6(void);
+int main_q5_7(void);
+
+#endif
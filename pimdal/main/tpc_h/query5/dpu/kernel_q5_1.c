@@ -12,38 +12,14 @@
 #include "param.h"
 #include "sel.h"
 #include "hash_join.h"
+#include "kernel_q5.h"
 
 #define BLOCK_SIZE 64
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-sel_results_t sel_results;
-part_arguments_t part_args;
-hash_arguments_t hash_args;
-merge_arguments_t merge_args;
-merge_results_t merge_res;
-
-__mram_noinit_keep uint32_t r_regionkey[16];
-__mram_noinit_keep uint8_t r_name[16][32];
-__mram_noinit_keep uint32_t n_nationkey[32];
-__mram_noinit_keep uint32_t n_regionkey[32];
-__mram_noinit_keep uint8_t n_name[32][32];
-__mram_noinit_keep uint32_t c_custkey[131072];
-__mram_noinit_keep uint32_t c_nationkey[131072];
 
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
-
-void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -68,7 +44,7 @@ void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void create_ptr32(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr32(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -93,7 +69,7 @@ void create_ptr32(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -124,7 +100,7 @@ void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void load_nextptr(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_nextptr(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -154,7 +130,7 @@ void load_nextptr(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -184,7 +160,7 @@ void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void out_val(uint32_t in, uint32_t out, uint32_t count) {
+static void out_val(uint32_t in, uint32_t out, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -207,20 +183,28 @@ void out_val(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-bool pred_r(key_ptr_t element) {
+static bool pred_r(key_ptr_t element) {
     bool res = (strstr(element.key, dpu_args.r_region) != NULL);
     return res;
 }
 
-int main() {
+int main_q5_1() {
+
+    uint32_t c_nationkey = (uint32_t) columns + dpu_args.col_offset[0];
+    uint32_t c_custkey = (uint32_t) columns + dpu_args.col_offset[1];
 
     uint32_t tasklet_id = me();
 
+    // Only the few regions are text keys, every buffer holds at most the
+    // customers as key_ptr32, so the buffers stay within the MRAM behind the
+    // resident columns
     uint32_t size = 524288;
     uint32_t buffer_1 = (uint32_t) DPU_MRAM_HEAP_POINTER;
-    uint32_t buffer_2 = (uint32_t) (buffer_1 + size*sizeof(key_ptr_t));
-    uint32_t buffer_3 = (uint32_t) (buffer_2 + size*sizeof(key_ptr_t));
-    uint32_t sizes = (uint32_t) (buffer_3 + size*sizeof(key_ptr_t));
+    uint32_t buffer_2 = (uint32_t) (buffer_1 + size*sizeof(key_ptr32));
+    uint32_t buffer_3 = (uint32_t) (buffer_2 + size*sizeof(key_ptr32));
+    uint32_t sizes = (uint32_t) (buffer_3 + size*sizeof(key_ptr32));
+    // Overflow chains of the hash table behind the partition sizes of the join
+    uint32_t overflow = (uint32_t) (sizes + (1+1)*sizeof(uint64_t));
 
     create_ptr((uint32_t) r_name, buffer_1, dpu_args.r_count);
     barrier_wait(&barrier);
@@ -243,6 +227,8 @@ int main() {
         hash_args.shift = 14;
         hash_args.table_ptr = buffer_3;
         hash_args.table_size = 256;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -261,11 +247,14 @@ int main() {
         merge_args.out_ptr = buffer_2;
         merge_args.part_sizes = sizes;
         merge_args.part_n = 1;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
     merge_kernel(&merge_args, &merge_res);
     barrier_wait(&barrier);
+    uint32_t dropped = merge_res.dropped_n;
 
     /*
     * JOIN n_nationkey = c_nationkey
@@ -278,6 +267,8 @@ int main() {
         hash_args.shift = 14;
         hash_args.table_ptr = buffer_3;
         hash_args.table_size = 256;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -296,6 +287,8 @@ int main() {
         merge_args.out_ptr = buffer_2;
         merge_args.part_sizes = sizes;
         merge_args.part_n = 1;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -311,7 +304,7 @@ int main() {
         part_args.shift = 27;
         part_args.part_ptr = buffer_1;
         part_args.part_sizes = sizes;
-        part_args.part_n = NR_DPU;
+        part_args.part_n = dpu_args.dpu_n;
     }
     barrier_wait(&barrier);
 
@@ -320,8 +313,26 @@ int main() {
 
     // Load c_nationkey using partitioning
     load_out(buffer_1, buffer_2, (uint32_t) c_nationkey, merge_res.out_n);
+    barrier_wait(&barrier);
+
+#if BLOOM_FILTER == 1
+    // Bloom filter of c_custkey, prunes the orders in the next phase
+    if (dpu_args.filter_words > 0) {
+        if (tasklet_id == 0) {
+            bloom_args.in_ptr = buffer_3;
+            bloom_args.size = merge_res.out_n;
+            bloom_args.filter_ptr = (uint32_t) bloom_filter;
+            bloom_args.filter_words = dpu_args.filter_words;
+        }
+        barrier_wait(&barrier);
+
+        bloom_kernel(&bloom_args);
+        barrier_wait(&barrier);
+    }
+#endif
 
     dpu_results.count = merge_res.out_n;
+    dpu_results.dropped = dropped + merge_res.dropped_n;
 
     return 0;
 }
\ No newline at end of file
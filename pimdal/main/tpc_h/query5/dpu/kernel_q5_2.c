@@ -12,31 +12,14 @@
 #include "param.h"
 #include "sel.h"
 #include "hash_join.h"
+#include "kernel_q5.h"
 
 #define BLOCK_SIZE 64
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-sel_results_t sel_results;
-part_arguments_t part_args;
-
-__mram_noinit_keep uint32_t o_orderkey[131072];
-__mram_noinit_keep uint32_t o_custkey[131072];
-__mram_noinit_keep uint32_t o_orderdate[131072];
-
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
 
-void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -61,7 +44,7 @@ void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -90,7 +73,7 @@ void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -120,13 +103,17 @@ void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-bool pred_o(key_ptr_t element) {
+static bool pred_o(key_ptr_t element) {
     bool res = element.key >= dpu_args.date_start &&
         element.key < dpu_args.date_end;
     return res;
 }
 
-int main() {
+int main_q5_2() {
+
+    uint32_t o_orderkey = (uint32_t) columns + dpu_args.col_offset[0];
+    uint32_t o_custkey = (uint32_t) columns + dpu_args.col_offset[1];
+    uint32_t o_orderdate = (uint32_t) columns + dpu_args.col_offset[2];
 
     uint32_t tasklet_id = me();
 
@@ -149,14 +136,36 @@ int main() {
 
     // Partition o_custkey for JOIN
     load_next(buffer_1, buffer_2, (uint32_t) o_custkey, sel_results.t_count);
+    uint32_t count = sel_results.t_count;
+    uint32_t part_in = buffer_2;
+
+#if BLOOM_FILTER == 1
+    // Drop the orders of customers missing from the bloom filter of c_custkey
+    if (dpu_args.filter_words > 0) {
+        barrier_wait(&barrier);
+        if (tasklet_id == 0) {
+            bloom_args.in_ptr = buffer_2;
+            bloom_args.size = count;
+            bloom_args.out_ptr = buffer_3;
+            bloom_args.filter_ptr = (uint32_t) bloom_filter;
+            bloom_args.filter_words = dpu_args.filter_words;
+        }
+        barrier_wait(&barrier);
+
+        semi_kernel(&bloom_args, &semi_res);
+        barrier_wait(&barrier);
+        count = semi_res.out_n;
+        part_in = buffer_3;
+    }
+#endif
 
     if (tasklet_id == 0) {
-        part_args.in_ptr = buffer_2;
-        part_args.size = sel_results.t_count;
+        part_args.in_ptr = part_in;
+        part_args.size = count;
         part_args.shift = 27;
         part_args.part_ptr = buffer_1;
         part_args.part_sizes = sizes;
-        part_args.part_n = NR_DPU;
+        part_args.part_n = dpu_args.dpu_n;
     }
     barrier_wait(&barrier);
 
@@ -164,9 +173,9 @@ int main() {
     barrier_wait(&barrier);
 
     // Load o_orderkey using partitioning
-    load_out(buffer_1, buffer_2, (uint32_t) o_orderkey, sel_results.t_count);
+    load_out(buffer_1, buffer_2, (uint32_t) o_orderkey, count);
 
-    dpu_results.count = sel_results.t_count;
+    dpu_results.count = count;
 
     return 0;
 }
\ No newline at end of file
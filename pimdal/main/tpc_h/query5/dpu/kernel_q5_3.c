@@ -12,31 +12,14 @@
 #include "param.h"
 #include "sel.h"
 #include "hash_join.h"
+#include "kernel_q5.h"
 
 #define BLOCK_SIZE 64
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-hash_arguments_t hash_args;
-filter_arguments_t filter_args;
-part_arguments_t part_args;
-match_arguments_t match_args;
-merge_arguments_t merge_args;
-merge_results_t merge_res;
 
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
-
-void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -59,7 +42,7 @@ void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -88,7 +71,7 @@ void load_next(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -118,7 +101,7 @@ void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void out_val(uint32_t in, uint32_t count) {
+static void out_val(uint32_t in, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -140,7 +123,7 @@ void out_val(uint32_t in, uint32_t count) {
     }
 }
 
-int main() {
+int main_q5_3() {
 
     uint32_t tasklet_id = me();
 
@@ -152,18 +135,26 @@ int main() {
     uint32_t buffer_1 = (uint32_t) (buf_o_orderkey + size*sizeof(key_ptr_t));
     uint32_t buffer_2 = (uint32_t) (buffer_1 + size*sizeof(key_ptr_t));
     uint32_t sizes = (uint32_t) (buffer_2 + size*sizeof(key_ptr_t));
+    // Overflow chains of the hash table behind the partition sizes of the join
+    uint32_t overflow = (uint32_t) (sizes + (size/PART_TABLE+1)*sizeof(uint64_t));
 
     /*
     * JOIN c_custkey = o_custkey
     */
     create_ptr(buf_c_custkey, buf_c_custkey, dpu_args.c_count);
 
+    // The partitions and their hash tables grow with the inner relation, the
+    // table has to fit into the buffer of its input
+    uint32_t part_n = plan_partitions(dpu_args.c_count, PART_FILL, size/PART_TABLE);
+
     if (tasklet_id == 0) {
         hash_args.in_ptr = buf_c_custkey;
         hash_args.size = dpu_args.c_count;
-        hash_args.shift = 14;
+        hash_args.shift = 0;
         hash_args.table_ptr = buffer_1;
-        hash_args.table_size = 4096;
+        hash_args.table_size = part_n*PART_TABLE;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -175,10 +166,10 @@ int main() {
     if (tasklet_id == 0) {
         part_args.in_ptr = buf_o_custkey;
         part_args.size = dpu_args.o_count;
-        part_args.shift = 14;
+        part_args.shift = 0;
         part_args.part_ptr = buffer_2;
         part_args.part_sizes = sizes;
-        part_args.part_n = 16;
+        part_args.part_n = part_n;
     }
     barrier_wait(&barrier);
 
@@ -191,7 +182,9 @@ int main() {
         merge_args.in_ptr = buffer_2;
         merge_args.out_ptr = buf_c_custkey;
         merge_args.part_sizes = sizes;
-        merge_args.part_n = 16;
+        merge_args.part_n = part_n;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -207,7 +200,7 @@ int main() {
         part_args.shift = 27;
         part_args.part_ptr = buf_c_custkey;
         part_args.part_sizes = sizes;
-        part_args.part_n = NR_DPU;
+        part_args.part_n = dpu_args.dpu_n;
     }
     barrier_wait(&barrier);
 
@@ -216,8 +209,26 @@ int main() {
 
     // Load c_nationkey for further steps
     load_out(buf_c_custkey, buf_o_custkey, buf_c_nationkey, merge_res.out_n);
+    barrier_wait(&barrier);
+
+#if BLOOM_FILTER == 1
+    // Bloom filter of o_orderkey of the joined orders, prunes the lineitems in the next phase
+    if (dpu_args.filter_words > 0) {
+        if (tasklet_id == 0) {
+            bloom_args.in_ptr = buffer_1;
+            bloom_args.size = merge_res.out_n;
+            bloom_args.filter_ptr = (uint32_t) bloom_filter;
+            bloom_args.filter_words = dpu_args.filter_words;
+        }
+        barrier_wait(&barrier);
+
+        bloom_kernel(&bloom_args);
+        barrier_wait(&barrier);
+    }
+#endif
 
     dpu_results.count = merge_res.out_n;
+    dpu_results.dropped = merge_res.dropped_n;
 
     return 0;
 }
\ No newline at end of file
@@ -12,32 +12,14 @@
 #include "param.h"
 #include "sel.h"
 #include "hash_join.h"
+#include "kernel_q5.h"
 
 #define BLOCK_SIZE 64
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-sel_results_t sel_results;
-part_arguments_t part_args;
-
-__mram_noinit_keep uint32_t l_orderkey[524288];
-__mram_noinit_keep uint32_t l_suppkey[524288];
-__mram_noinit_keep int64_t l_extendedprice[524288];
-__mram_noinit_keep int64_t l_discount[524288];
-
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
 
-void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -62,7 +44,7 @@ void create_ptr(uint32_t in, uint32_t out, uint32_t count) {
     }
 }
 
-void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -92,7 +74,7 @@ void load_out(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void load_out64(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
+static void load_out64(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -118,7 +100,7 @@ void load_out64(uint32_t in, uint32_t out, uint32_t load, uint32_t count) {
     }
 }
 
-void out_val(uint32_t in, uint32_t count) {
+static void out_val(uint32_t in, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -138,7 +120,12 @@ void out_val(uint32_t in, uint32_t count) {
     }
 }
 
-int main() {
+int main_q5_4() {
+
+    uint32_t l_orderkey = (uint32_t) columns + dpu_args.col_offset[0];
+    uint32_t l_suppkey = (uint32_t) columns + dpu_args.col_offset[1];
+    uint32_t l_extendedprice = (uint32_t) columns + dpu_args.col_offset[2];
+    uint32_t l_discount = (uint32_t) columns + dpu_args.col_offset[3];
 
     uint32_t tasklet_id = me();
 
@@ -151,14 +138,36 @@ int main() {
 
     // Partition l_orderkey for JOIN
     create_ptr((uint32_t) l_orderkey, buffer_2, dpu_args.l_count);
+    uint32_t count = dpu_args.l_count;
+    uint32_t part_in = buffer_2;
+
+#if BLOOM_FILTER == 1
+    // Drop the lineitems of orders missing from the bloom filter of o_orderkey
+    if (dpu_args.filter_words > 0) {
+        barrier_wait(&barrier);
+        if (tasklet_id == 0) {
+            bloom_args.in_ptr = buffer_2;
+            bloom_args.size = count;
+            bloom_args.out_ptr = buffer_3;
+            bloom_args.filter_ptr = (uint32_t) bloom_filter;
+            bloom_args.filter_words = dpu_args.filter_words;
+        }
+        barrier_wait(&barrier);
+
+        semi_kernel(&bloom_args, &semi_res);
+        barrier_wait(&barrier);
+        count = semi_res.out_n;
+        part_in = buffer_3;
+    }
+#endif
 
     if (tasklet_id == 0) {
-        part_args.in_ptr = buffer_2;
-        part_args.size = dpu_args.l_count;
+        part_args.in_ptr = part_in;
+        part_args.size = count;
         part_args.shift = 27;
         part_args.part_ptr = buffer_1;
         part_args.part_sizes = sizes;
-        part_args.part_n = NR_DPU;
+        part_args.part_n = dpu_args.dpu_n;
     }
     barrier_wait(&barrier);
 
@@ -166,18 +175,18 @@ int main() {
     barrier_wait(&barrier);
 
     // Load l_suppkey using partitioning
-    load_out(buffer_1, buffer_2, (uint32_t) l_suppkey, dpu_args.l_count);
+    load_out(buffer_1, buffer_2, (uint32_t) l_suppkey, count);
     barrier_wait(&barrier);
 
     // Load l_extendedprice using partitioning
-    load_out64(buffer_1, buffer_3, (uint32_t) l_extendedprice, dpu_args.l_count);
+    load_out64(buffer_1, buffer_3, (uint32_t) l_extendedprice, count);
     barrier_wait(&barrier);
 
     // Load l_discount using partitioning
-    load_out64(buffer_1, buffer_4, (uint32_t) l_discount, dpu_args.l_count);
+    load_out64(buffer_1, buffer_4, (uint32_t) l_discount, count);
     barrier_wait(&barrier);
 
-    dpu_results.count = dpu_args.l_count;
+    dpu_results.count = count;
 
     return 0;
 }
\ No newline at end of file
@@ -12,32 +12,14 @@
 #include "param.h"
 #include "hash_join.h"
 #include "aggregate.h"
+#include "kernel_q5.h"
 
 #define BLOCK_SIZE 64
 #ifndef NR_TASKLETS
 #define NR_TASKLETS 4
 #endif
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
-__host query_args_t dpu_args;
-__host query_res_t dpu_results;
-
-aggr_results_t aggr_res;
-
-hash_arguments_t hash_args;
-part_arguments_t part_args;
-match_arguments_t match_args;
-merge_arguments_t merge_args;
-merge_results_t merge_res;
 
-BARRIER_INIT(barrier, NR_TASKLETS);
-
-MUTEX_INIT(mutex);
-MUTEX_POOL_INIT(mutexes, 16);
-
-void create_ptr(uint32_t in, uint32_t in_nationkey, uint32_t out, uint32_t count) {
+static void create_ptr(uint32_t in, uint32_t in_nationkey, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -65,8 +47,8 @@ void create_ptr(uint32_t in, uint32_t in_nationkey, uint32_t out, uint32_t count
     }
 }
 
-void load_next(uint32_t in, uint32_t load_nationkey, uint32_t load_price,
-               uint32_t load_discount, uint32_t out, uint32_t count) {
+static void load_next(uint32_t in, uint32_t load_nationkey, uint32_t load_price,
+                      uint32_t load_discount, uint32_t out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -105,7 +87,7 @@ void load_next(uint32_t in, uint32_t load_nationkey, uint32_t load_price,
     }
 }
 
-void load_out(uint32_t in, uint32_t key_out, uint32_t rev_out, uint32_t count) {
+static void load_out(uint32_t in, uint32_t key_out, uint32_t rev_out, uint32_t count) {
 
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
@@ -134,7 +116,7 @@ void load_out(uint32_t in, uint32_t key_out, uint32_t rev_out, uint32_t count) {
     }
 }
 
-void out_val(uint32_t in, uint32_t count) {
+static void out_val(uint32_t in, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -156,7 +138,7 @@ void out_val(uint32_t in, uint32_t count) {
     }
 }
 
-void out_val64(uint32_t in, uint32_t count) {
+static void out_val64(uint32_t in, uint32_t count) {
     uint32_t tasklet_id = me();
     if (tasklet_id == 0){
         mem_reset(); // Reset the heap
@@ -178,13 +160,13 @@ void out_val64(uint32_t in, uint32_t count) {
     }
 }
 
-key_ptr_t sum(key_ptr_t curr_val, key_ptr_t element) {
+static key_ptr_t sum(key_ptr_t curr_val, key_ptr_t element) {
     curr_val.revenue += element.revenue;
 
     return curr_val;
 }
 
-int main() {
+int main_q5_7() {
 
     uint32_t tasklet_id = me();
 
@@ -198,18 +180,26 @@ int main() {
     uint32_t buffer_1 = (uint32_t) (buf_l_discount + size*sizeof(key_ptr32));
     uint32_t buffer_2 = (uint32_t) (buffer_1 + size*sizeof(key_ptr32));
     uint32_t sizes = (uint32_t) (buffer_2 + size*sizeof(key_ptr32));
+    // Overflow chains of the hash table behind the partition sizes of the join
+    uint32_t overflow = (uint32_t) (sizes + (size/PART_TABLE+1)*sizeof(uint64_t));
 
     /*
     * JOIN s_suppkey, s_nationkey = l_supkkey, n_nationkey
     */
     create_ptr(buf_s_suppkey, buf_s_nationkey, buf_s_suppkey, dpu_args.s_count);
 
+    // The partitions and their hash tables grow with the inner relation, the
+    // table has to fit into the buffer of its input
+    uint32_t part_n = plan_partitions(dpu_args.s_count, PART_FILL, size/PART_TABLE);
+
     if (tasklet_id == 0) {
         hash_args.in_ptr = buf_s_suppkey;
         hash_args.size = dpu_args.s_count;
-        hash_args.shift = 14;
+        hash_args.shift = 0;
         hash_args.table_ptr = buffer_1;
-        hash_args.table_size = 1024;
+        hash_args.table_size = part_n*PART_TABLE;
+        hash_args.overflow_ptr = overflow;
+        hash_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -221,10 +211,10 @@ int main() {
     if (tasklet_id == 0) {
         part_args.in_ptr = buf_l_suppkey;
         part_args.size = dpu_args.l_count;
-        part_args.shift = 14;
+        part_args.shift = 0;
         part_args.part_ptr = buffer_2;
         part_args.part_sizes = sizes;
-        part_args.part_n = 4;
+        part_args.part_n = part_n;
     }
     barrier_wait(&barrier);
 
@@ -237,7 +227,9 @@ int main() {
         merge_args.in_ptr = buffer_2;
         merge_args.out_ptr = buf_s_suppkey;
         merge_args.part_sizes = sizes;
-        merge_args.part_n = 4;
+        merge_args.part_n = part_n;
+        merge_args.overflow_ptr = overflow;
+        merge_args.overflow_size = OVERFLOW_SIZE;
     }
     barrier_wait(&barrier);
 
@@ -258,6 +250,7 @@ int main() {
     load_out(buffer_1, buf_s_suppkey, buf_l_suppkey, aggr_res.t_count);
 
     dpu_results.count = aggr_res.t_count;
+    dpu_results.dropped = merge_res.dropped_n;
 
     return 0;
 }
\ No newline at end of file
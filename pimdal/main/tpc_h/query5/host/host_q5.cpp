@@ -1,7 +1,6 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
-#include <chrono>
 #include <fstream>
 #include <cstring>
 
@@ -11,11 +10,16 @@
 #include "../../reader/read_table.cpp"
 
 #include "param.h"
+#include "phases.h"
 #include "datatype.h"
 #include "transfer_helper.h"
+#include "catalog.h"
+#include "shuffle.h"
+#include "bloom_filter.h"
+#include "server.h"
 
-#ifndef NR_DPU
-#define NR_DPU 4
+#ifndef BLOOM_FILTER
+#define BLOOM_FILTER 0
 #endif
 
 namespace ac = arrow::acero;
@@ -28,434 +32,220 @@ std::shared_ptr<arrow::Table> supplier;
 std::shared_ptr<arrow::Table> nation;
 std::shared_ptr<arrow::Table> region;
 
-void populate_mram_1(dpu_set_t &system) {
-    copy_table(system, region, "r_regionkey", "r_regionkey", 0, DPU_XFER_DEFAULT);
-    copy_table(system, region, "r_name", "r_name", 0, DPU_XFER_DEFAULT);
-    copy_table(system, nation, "n_nationkey", "n_nationkey", 0, DPU_XFER_DEFAULT);
-    copy_table(system, nation, "n_regionkey", "n_regionkey", 0, DPU_XFER_DEFAULT);
-    copy_table(system, nation, "n_name", "n_name", 0, DPU_XFER_DEFAULT);
+std::vector<uint32_t> stage_mram_1(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-    scatter_table(system, customer, "c_nationkey", "c_nationkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, customer, "c_custkey", "c_custkey", 0, DPU_SG_XFER_DEFAULT);
+    return scatter_resident(system, "customer", customer, {"c_nationkey", "c_custkey"}, "columns",
+                            CUSTOMER_COLUMNS, ORDERS_COLUMNS - CUSTOMER_COLUMNS, DPU_SG_XFER_ASYNC);
+}
 
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (customer->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].c_count = customer->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].c_count = customer->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].c_count = customer->num_rows() % (customer->num_rows()/NR_DPU + 1);
-            }
-        }
+void populate_mram_1(dpu_set_t &system, std::vector<uint32_t> &col_offset, const query_request &request,
+                     uint32_t filter_words) {
+    trace_scope scope("to_dpu");
+
+    std::string r_region = request_string(request, "r_region", "ASIA", sizeof(query_args_t::r_region));
+
+    copy_resident(system, "region", region, "r_regionkey", "r_regionkey", 0, DPU_XFER_DEFAULT);
+    copy_resident(system, "region", region, "r_name", "r_name", 0, DPU_XFER_DEFAULT);
+    copy_resident(system, "nation", nation, "n_nationkey", "n_nationkey", 0, DPU_XFER_DEFAULT);
+    copy_resident(system, "nation", nation, "n_regionkey", "n_regionkey", 0, DPU_XFER_DEFAULT);
+    copy_resident(system, "nation", nation, "n_name", "n_name", 0, DPU_XFER_DEFAULT);
+
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].c_count = split_length(customer->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
+        query_args[dpu][0].filter_words = filter_words;
 
         query_args[dpu][0].r_count = region->num_rows();
         query_args[dpu][0].n_count = nation->num_rows();
 
-        strcpy(query_args[dpu][0].r_region, "ASIA");
+        strcpy(query_args[dpu][0].r_region, r_region.c_str());
     }
 
     dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-void populate_mram_2(dpu_set_t &system) {
-    scatter_table(system, orders, "o_orderkey", "o_orderkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, orders, "o_custkey", "o_custkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, orders, "o_orderdate", "o_orderdate", 0, DPU_SG_XFER_DEFAULT);
-
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (orders->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].o_count = orders->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].o_count = orders->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].o_count = orders->num_rows() % (orders->num_rows()/NR_DPU + 1);
-            }
-        }
+std::vector<uint32_t> stage_mram_2(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-        query_args[dpu][0].date_start = date_to_int("1994-01-01");
-        query_args[dpu][0].date_end = date_to_int("1995-01-01");
-    }
-
-    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+    return scatter_resident(system, "orders", orders, {"o_orderkey", "o_custkey", "o_orderdate"}, "columns",
+                            ORDERS_COLUMNS, LINEITEM_COLUMNS - ORDERS_COLUMNS, DPU_SG_XFER_ASYNC);
 }
 
-void populate_mram_3(dpu_set_t &system) {
-    scatter_table(system, lineitem, "l_orderkey", "l_orderkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_suppkey", "l_suppkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_extendedprice", "l_extendedprice", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_discount", "l_discount", 0, DPU_SG_XFER_DEFAULT);
+void populate_mram_2(dpu_set_t &system, std::vector<uint32_t> &col_offset, const query_request &request,
+                     uint32_t filter_words) {
+    trace_scope scope("to_dpu");
 
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (lineitem->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].l_count = lineitem->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].l_count = lineitem->num_rows() % (lineitem->num_rows()/NR_DPU + 1);
-            }
-        }
-    }
+    int32_t date_start = date_to_int(request_date(request, "date_start", "1994-01-01"));
+    int32_t date_end = date_to_int(request_date(request, "date_end", "1995-01-01"));
 
-    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
-}
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].o_count = split_length(orders->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
+        query_args[dpu][0].filter_words = filter_words;
 
-void populate_mram_4(dpu_set_t &system) {
-    scatter_table(system, supplier, "s_suppkey", "s_suppkey", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, supplier, "s_nationkey", "s_nationkey", 0, DPU_SG_XFER_DEFAULT);
-
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (supplier->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].s_count = supplier->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].s_count = supplier->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].s_count = supplier->num_rows() % (supplier->num_rows()/NR_DPU + 1);
-            }
-        }
+        query_args[dpu][0].date_start = date_start;
+        query_args[dpu][0].date_end = date_end;
     }
 
     dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-void distribute_1(dpu_set_t &system, std::vector<std::vector<uint64_t>> sizes_c,
-                  std::vector<std::vector<uint64_t>> sizes_o,
-                  arrow::BufferVector buf_c_custkey,
-                  arrow::BufferVector buf_o_custkey,
-                  arrow::BufferVector buf_c_nationkey,
-                  arrow::BufferVector buf_o_orderkey) {
-    
-    std::vector<std::vector<query_args_t>> dpu_args (NR_DPU, std::vector<query_args_t>(1));
-    std::vector<std::vector<uint64_t>> off_data (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-    std::vector<std::vector<uint64_t>> off_data_c (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-
-    uint32_t max_inner_size = 0;
-    uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
-            dpu_args[dpu][0].c_count += sizes_c[src][dpu+1] - sizes_c[src][dpu];
-            dpu_args[dpu][0].o_count += sizes_o[src][dpu+1] - sizes_o[src][dpu];
-        }
+std::vector<uint32_t> stage_mram_3(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-        if (dpu_args[dpu][0].c_count > max_inner_size) {
-            max_inner_size = dpu_args[dpu][0].c_count;
-        }
+    return scatter_resident(system, "lineitem", lineitem, {"l_orderkey", "l_suppkey", "l_extendedprice", "l_discount"}, "columns",
+                            LINEITEM_COLUMNS, SUPPLIER_COLUMNS - LINEITEM_COLUMNS, DPU_SG_XFER_ASYNC);
+}
 
-        if (dpu_args[dpu][0].o_count > max_outer_size) {
-            max_outer_size = dpu_args[dpu][0].o_count;
-        }
-    }
+void populate_mram_3(dpu_set_t &system, std::vector<uint32_t> &col_offset, uint32_t filter_words) {
+    trace_scope scope("to_dpu");
 
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t i = 0; i < NR_DPU+1; i++) {
-            off_data[dpu][i] = sizes_o[dpu][i] * sizeof(uint32_t);
-            off_data_c[dpu][i] = sizes_c[dpu][i] * sizeof(uint32_t);
-            sizes_c[dpu][i] *= sizeof(key_ptr32);
-            sizes_o[dpu][i] *= sizeof(key_ptr32);
-        }
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].l_count = split_length(lineitem->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
+        query_args[dpu][0].filter_words = filter_words;
     }
 
-    // Distributing c_custkey
-    sg_xfer_context_2d sc_args_c = {.partitions = buf_c_custkey, .offset = sizes_c};
-    get_block_t get_block_info_c = {.f = &get_cpy_ptr_2d, .args = &sc_args_c, .args_size=(sizeof(sc_args_c))};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                max_inner_size*sizeof(key_ptr32), &get_block_info_c, flag));
-
-    // Distributing o_custkey
-    sg_xfer_context_2d sc_args_o = {.partitions = buf_o_custkey, .offset = sizes_o};
-    get_block_t get_block_info_o = {.f = &get_cpy_ptr_2d, .args = &sc_args_o, .args_size=(sizeof(sc_args_o))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(key_ptr32), &get_block_info_o, flag));
-
-    // Distributing c_nationkey
-    sg_xfer_context_2d sc_args_nationkey = {.partitions = buf_c_nationkey, .offset = off_data_c};
-    get_block_t get_block_info_nationkey = {.f = &get_cpy_ptr_2d, .args = &sc_args_nationkey, .args_size=(sizeof(sc_args_nationkey))};
+    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+}
 
-    uint32_t length = (max_inner_size*sizeof(uint32_t) + 7) & (-8);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32),
-                                length, &get_block_info_nationkey, flag));
+std::vector<uint32_t> stage_mram_4(dpu_set_t &system) {
+    trace_scope scope("to_dpu");
 
-    // Distributing o_orderkey
-    sg_xfer_context_2d sc_args_orderkey = {.partitions = buf_o_orderkey, .offset = off_data};
-    get_block_t get_block_info_orderkey = {.f = &get_cpy_ptr_2d, .args = &sc_args_orderkey, .args_size=(sizeof(sc_args_orderkey))};
+    return scatter_resident(system, "supplier", supplier, {"s_suppkey", "s_nationkey"}, "columns",
+                            SUPPLIER_COLUMNS, COLUMNS_SIZE - SUPPLIER_COLUMNS, DPU_SG_XFER_ASYNC);
+}
 
-    length = (max_outer_size*sizeof(uint32_t) + 7) & (-8);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32),
-                                length, &get_block_info_orderkey, flag));
+void populate_mram_4(dpu_set_t &system, std::vector<uint32_t> &col_offset) {
+    trace_scope scope("to_dpu");
 
-    dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+    std::vector<std::vector<query_args_t>> query_args {nr_dpus, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        query_args[dpu][0].dpu_n = nr_dpus;
+        query_args[dpu][0].s_count = split_length(supplier->num_rows(), dpu, nr_dpus);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
+    }
 
+    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 }
 
-void distribute_2(dpu_set_t &system, std::vector<std::vector<uint64_t>> sizes_o,
-                  std::vector<std::vector<uint64_t>> sizes_l,
-                  arrow::BufferVector buf_o_orderkey,
-                  arrow::BufferVector buf_l_orderkey,
-                  arrow::BufferVector buf_o_nationkey,
-                  arrow::BufferVector buf_l_suppkey,
-                  arrow::BufferVector buf_l_extendedprice,
-                  arrow::BufferVector buf_l_discount) {
+void distribute_1(dpu_set_t &system, const shuffle_plan &plan_c, const shuffle_plan &plan_o,
+                  std::shared_ptr<arrow::Buffer> buf_c_custkey,
+                  std::shared_ptr<arrow::Buffer> buf_o_custkey,
+                  std::shared_ptr<arrow::Buffer> buf_c_nationkey,
+                  std::shared_ptr<arrow::Buffer> buf_o_orderkey,
+                  uint32_t filter_words) {
     
-    std::vector<std::vector<query_args_t>> dpu_args (NR_DPU, std::vector<query_args_t>(1));
-    std::vector<std::vector<uint64_t>> off_key_o (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-    std::vector<std::vector<uint64_t>> off_key (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-    std::vector<std::vector<uint64_t>> off_data (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-
-    uint32_t max_inner_size = 0;
-    uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
-            dpu_args[dpu][0].o_count += sizes_o[src][dpu+1] - sizes_o[src][dpu];
-            dpu_args[dpu][0].l_count += sizes_l[src][dpu+1] - sizes_l[src][dpu];
-        }
-
-        if (dpu_args[dpu][0].o_count > max_inner_size) {
-            max_inner_size = dpu_args[dpu][0].o_count;
-        }
-
-        if (dpu_args[dpu][0].l_count > max_outer_size) {
-            max_outer_size = dpu_args[dpu][0].l_count;
-        }
-    }
-
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t i = 0; i < NR_DPU+1; i++) {
-            off_key_o[dpu][i] = sizes_o[dpu][i] * sizeof(uint32_t);
-            off_data[dpu][i] = sizes_l[dpu][i] * sizeof(int64_t);
-            off_key[dpu][i] = sizes_l[dpu][i] * sizeof(uint32_t);
-            sizes_o[dpu][i] *= sizeof(key_ptr32);
-            sizes_l[dpu][i] *= sizeof(key_ptr32);
-        }
+    trace_scope scope("shuffle");
+
+    std::vector<std::vector<query_args_t>> dpu_args (nr_dpus, std::vector<query_args_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        dpu_args[dpu][0].dpu_n = nr_dpus;
+        dpu_args[dpu][0].c_count = plan_c.counts[dpu];
+        dpu_args[dpu][0].o_count = plan_o.counts[dpu];
+        dpu_args[dpu][0].filter_words = filter_words;
     }
 
-    // Distributing o_orderkey
-    sg_xfer_context_2d sc_args_o = {.partitions = buf_o_orderkey, .offset = sizes_o};
-    get_block_t get_block_info_o = {.f = &get_cpy_ptr_2d, .args = &sc_args_o, .args_size=(sizeof(sc_args_o))};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                max_inner_size*sizeof(key_ptr32), &get_block_info_o, flag));
-
-    // Distributing l_orderkey
-    sg_xfer_context_2d sc_args_l = {.partitions = buf_l_orderkey, .offset = sizes_l};
-    get_block_t get_block_info_l = {.f = &get_cpy_ptr_2d, .args = &sc_args_l, .args_size=(sizeof(sc_args_l))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(key_ptr32), &get_block_info_l, flag));
-
-    // Distributing o_nationkey
-    sg_xfer_context_2d sc_args_nationkey = {.partitions = buf_o_nationkey, .offset = off_key_o};
-    get_block_t get_block_info_nationkey = {.f = &get_cpy_ptr_2d, .args = &sc_args_nationkey, .args_size=(sizeof(sc_args_nationkey))};
-
-    uint32_t length = (max_inner_size + 1) & (-2);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32),
-                                length*sizeof(uint32_t), &get_block_info_nationkey, flag));
-
-    // Distributing l_suppkey
-    sg_xfer_context_2d sc_args_suppkey = {.partitions = buf_l_suppkey, .offset = off_key};
-    get_block_t get_block_info_suppkey = {.f = &get_cpy_ptr_2d, .args = &sc_args_suppkey, .args_size=(sizeof(sc_args_suppkey))};
-
-    length = (max_outer_size + 1) & (-2);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32),
-                                length*sizeof(uint32_t), &get_block_info_suppkey, flag));
-
-    // Distributing l_extendedprice
-    sg_xfer_context_2d sc_args_extendedprice = {.partitions = buf_l_extendedprice, .offset = off_data};
-    get_block_t get_block_info_extendedprice = {.f = &get_cpy_ptr_2d, .args = &sc_args_extendedprice, .args_size=(sizeof(sc_args_extendedprice))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 4*524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(int64_t), &get_block_info_extendedprice, flag));
-
-    // Distributing l_discount
-    sg_xfer_context_2d sc_args_discount = {.partitions = buf_l_discount, .offset = off_data};
-    get_block_t get_block_info_discount = {.f = &get_cpy_ptr_2d, .args = &sc_args_discount, .args_size=(sizeof(sc_args_discount))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 5*524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(int64_t), &get_block_info_discount, flag));
+    shuffle_scatter(system, plan_c, {{buf_c_custkey, sizeof(key_ptr32), 0},
+                                     {buf_c_nationkey, sizeof(uint32_t), 2*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
+    shuffle_scatter(system, plan_o, {{buf_o_custkey, sizeof(key_ptr32), 524288*sizeof(key_ptr32)},
+                                     {buf_o_orderkey, sizeof(uint32_t), 3*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
 
     dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 
 }
 
-void distribute_3(dpu_set_t &system, std::vector<std::vector<uint64_t>> sizes_s,
-                  std::vector<std::vector<uint64_t>> sizes_l,
-                  arrow::BufferVector buf_s_suppkey,
-                  arrow::BufferVector buf_l_suppkey,
-                  arrow::BufferVector buf_s_nationkey,
-                  arrow::BufferVector buf_l_nationkey,
-                  arrow::BufferVector buf_l_extendedprice,
-                  arrow::BufferVector buf_l_discount) {
+void distribute_2(dpu_set_t &system, const shuffle_plan &plan_o, const shuffle_plan &plan_l,
+                  std::shared_ptr<arrow::Buffer> buf_o_orderkey,
+                  std::shared_ptr<arrow::Buffer> buf_l_orderkey,
+                  std::shared_ptr<arrow::Buffer> buf_o_nationkey,
+                  std::shared_ptr<arrow::Buffer> buf_l_suppkey,
+                  std::shared_ptr<arrow::Buffer> buf_l_extendedprice,
+                  std::shared_ptr<arrow::Buffer> buf_l_discount) {
     
-    std::vector<std::vector<query_args_t>> dpu_args (NR_DPU, std::vector<query_args_t>(1));
-    std::vector<std::vector<uint64_t>> off_key_s (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-    std::vector<std::vector<uint64_t>> off_data (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-    std::vector<std::vector<uint64_t>> off_key (NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-
-    uint32_t max_inner_size = 0;
-    uint32_t max_outer_size = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t src = 0; src < NR_DPU; src++) {
-            dpu_args[dpu][0].s_count += sizes_s[src][dpu+1] - sizes_s[src][dpu];
-            dpu_args[dpu][0].l_count += sizes_l[src][dpu+1] - sizes_l[src][dpu];
-        }
+    trace_scope scope("shuffle");
 
-        if (dpu_args[dpu][0].s_count > max_inner_size) {
-            max_inner_size = dpu_args[dpu][0].s_count;
-        }
-
-        if (dpu_args[dpu][0].l_count > max_outer_size) {
-            max_outer_size = dpu_args[dpu][0].l_count;
-        }
-    }
-
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        for (uint32_t i = 0; i < NR_DPU+1; i++) {
-            off_key_s[dpu][i] = sizes_s[dpu][i] * sizeof(uint32_t);
-            off_data[dpu][i] = sizes_l[dpu][i] * sizeof(int64_t);
-            off_key[dpu][i] = sizes_l[dpu][i] * sizeof(uint32_t);
-            sizes_s[dpu][i] *= sizeof(key_ptr32);
-            sizes_l[dpu][i] *= sizeof(key_ptr32);
-        }
+    std::vector<std::vector<query_args_t>> dpu_args (nr_dpus, std::vector<query_args_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        dpu_args[dpu][0].dpu_n = nr_dpus;
+        dpu_args[dpu][0].o_count = plan_o.counts[dpu];
+        dpu_args[dpu][0].l_count = plan_l.counts[dpu];
     }
 
-    // Distributing s_suppkey
-    sg_xfer_context_2d sc_args_s = {.partitions = buf_s_suppkey, .offset = sizes_s};
-    get_block_t get_block_info_s = {.f = &get_cpy_ptr_2d, .args = &sc_args_s, .args_size=(sizeof(sc_args_s))};
-
-    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0,
-                                max_inner_size*sizeof(key_ptr32), &get_block_info_s, flag));
-
-    // Distributing l_suppkey
-    sg_xfer_context_2d sc_args_l = {.partitions = buf_l_suppkey, .offset = sizes_l};
-    get_block_t get_block_info_l = {.f = &get_cpy_ptr_2d, .args = &sc_args_l, .args_size=(sizeof(sc_args_l))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(key_ptr32), &get_block_info_l, flag));
-
-    // Distributing s_nationkey
-    sg_xfer_context_2d sc_args_s_nationkey = {.partitions = buf_s_nationkey, .offset = off_key_s};
-    get_block_t get_block_info_s_nationkey = {.f = &get_cpy_ptr_2d, .args = &sc_args_s_nationkey, .args_size=(sizeof(sc_args_s_nationkey))};
-
-    uint32_t length = (max_inner_size + 1) & (-2);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32),
-                                length*sizeof(uint32_t), &get_block_info_s_nationkey, flag));
-    
-    // Distributing l_nationkey
-    sg_xfer_context_2d sc_args_l_nationkey = {.partitions = buf_l_nationkey, .offset = off_key};
-    get_block_t get_block_info_l_nationkey = {.f = &get_cpy_ptr_2d, .args = &sc_args_l_nationkey, .args_size=(sizeof(sc_args_l_nationkey))};
-
-    length = (max_outer_size + 1) & (-2);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32),
-                                length*sizeof(uint32_t), &get_block_info_l_nationkey, flag));
-
-    // Distributing l_extendedprice
-    sg_xfer_context_2d sc_args_extendedprice = {.partitions = buf_l_extendedprice, .offset = off_data};
-    get_block_t get_block_info_extendedprice = {.f = &get_cpy_ptr_2d, .args = &sc_args_extendedprice, .args_size=(sizeof(sc_args_extendedprice))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 4*524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(int64_t), &get_block_info_extendedprice, flag));
-
-    // Distributing l_discount
-    sg_xfer_context_2d sc_args_discount = {.partitions = buf_l_discount, .offset = off_data};
-    get_block_t get_block_info_discount = {.f = &get_cpy_ptr_2d, .args = &sc_args_discount, .args_size=(sizeof(sc_args_discount))};
-
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 5*524288*sizeof(key_ptr32),
-                                max_outer_size*sizeof(int64_t), &get_block_info_discount, flag));
+    shuffle_scatter(system, plan_o, {{buf_o_orderkey, sizeof(key_ptr32), 0},
+                                     {buf_o_nationkey, sizeof(uint32_t), 2*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
+    shuffle_scatter(system, plan_l, {{buf_l_orderkey, sizeof(key_ptr32), 524288*sizeof(key_ptr32)},
+                                     {buf_l_suppkey, sizeof(uint32_t), 3*524288*sizeof(key_ptr32)},
+                                     {buf_l_extendedprice, sizeof(int64_t), 4*524288*sizeof(key_ptr32)},
+                                     {buf_l_discount, sizeof(int64_t), 5*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
 
     dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 
 }
 
-arrow::BufferVector collect(dpu_set_t &system, uint32_t offset, uint32_t type_size) {
-    std::vector<std::vector<query_res_t>> query_res {NR_DPU, std::vector<query_res_t>(1)};
-
-    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
-
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    uint32_t max_sel_size = 0;
-    uint64_t tot_count = 0;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t sel_size = query_res[each_dpu][0].count;
-        if (sel_size > max_sel_size) {
-            max_sel_size = sel_size;
-        }
+void distribute_3(dpu_set_t &system, const shuffle_plan &plan_s, const shuffle_plan &plan_l,
+                  std::shared_ptr<arrow::Buffer> buf_s_suppkey,
+                  std::shared_ptr<arrow::Buffer> buf_l_suppkey,
+                  std::shared_ptr<arrow::Buffer> buf_s_nationkey,
+                  std::shared_ptr<arrow::Buffer> buf_l_nationkey,
+                  std::shared_ptr<arrow::Buffer> buf_l_extendedprice,
+                  std::shared_ptr<arrow::Buffer> buf_l_discount) {
+    
+    trace_scope scope("shuffle");
 
-        tot_count += sel_size;
+    std::vector<std::vector<query_args_t>> dpu_args (nr_dpus, std::vector<query_args_t>(1));
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        dpu_args[dpu][0].dpu_n = nr_dpus;
+        dpu_args[dpu][0].s_count = plan_s.counts[dpu];
+        dpu_args[dpu][0].l_count = plan_l.counts[dpu];
     }
-    std::cout << "Max count: " << max_sel_size;
-    std::cout << " Total count: " << tot_count << std::endl; 
 
-    uint32_t size_rounded = (max_sel_size*type_size + 7) & (-8);
-    arrow::BufferVector buffers = alloc_buf_vec(size_rounded, NR_DPU);
-    get_buf(system, buffers, offset, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+    shuffle_scatter(system, plan_s, {{buf_s_suppkey, sizeof(key_ptr32), 0},
+                                     {buf_s_nationkey, sizeof(uint32_t), 2*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
+    shuffle_scatter(system, plan_l, {{buf_l_suppkey, sizeof(key_ptr32), 524288*sizeof(key_ptr32)},
+                                     {buf_l_nationkey, sizeof(uint32_t), 3*524288*sizeof(key_ptr32)},
+                                     {buf_l_extendedprice, sizeof(int64_t), 4*524288*sizeof(key_ptr32)},
+                                     {buf_l_discount, sizeof(int64_t), 5*524288*sizeof(key_ptr32)}},
+                    DPU_MRAM_HEAP_POINTER_NAME);
+
+    dist_vec(system, dpu_args, 0, "dpu_args", DPU_XFER_DEFAULT);
 
-    return buffers;
 }
 
 std::shared_ptr<arrow::Table> get_results(dpu_set_t &system) {
-    std::vector<std::vector<query_res_t>> query_res {NR_DPU, std::vector<query_res_t>(1)};
-    arrow::ArrayVector key_chunks;
-    arrow::ArrayVector rev_chunks;
+    trace_scope scope("from_dpu");
 
+    std::vector<std::vector<query_res_t>> query_res {nr_dpus, std::vector<query_res_t>(1)};
     get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
 
-    struct dpu_set_t dpu;
-    uint32_t each_dpu;
-    uint32_t max_size = 0;
-    uint32_t tot = 0;
-    DPU_FOREACH(system, dpu, each_dpu) {
-        tot += query_res[each_dpu][0].count;
-        //std::cout << "Size: " << query_res[each_dpu][0].count << std::endl;
-        if (query_res[each_dpu][0].count > max_size) {
-            max_size = query_res[each_dpu][0].count;
-        }
+    std::vector<uint64_t> counts(nr_dpus);
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        counts[dpu] = query_res[dpu][0].count;
     }
 
-    uint32_t length = (max_size*sizeof(uint32_t) + 7) & (-8);
-    arrow::BufferVector buffers_key = alloc_buf_vec(length, NR_DPU);
-    get_buf(system, buffers_key, 0, DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-    arrow::BufferVector buffers_rev = alloc_buf_vec(max_size*sizeof(int64_t), NR_DPU);
-    get_buf(system, buffers_rev, 524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-
-    DPU_FOREACH(system, dpu, each_dpu) {
-        uint32_t dpu_size = query_res[each_dpu][0].count;
-        auto array_data_key = arrow::ArrayData::Make(arrow::int32(), dpu_size, {nullptr, buffers_key[each_dpu]});
-        auto array_key = arrow::MakeArray(array_data_key);
-        key_chunks.push_back(array_key);
-
-        auto array_data_val = arrow::ArrayData::Make(arrow::int64(), dpu_size, {nullptr, buffers_rev[each_dpu]});
-        auto array_val = arrow::MakeArray(array_data_val);
-        rev_chunks.push_back(array_val);
-    }
+    // Only the groups of each DPU are transferred, into one array per column
+    std::vector<uint64_t> prefix;
+    auto array_key = gather_array(system, arrow::int32(), counts,
+                                  DPU_MRAM_HEAP_POINTER_NAME, 0, prefix);
+    auto array_rev = gather_array(system, arrow::int64(), counts,
+                                  DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32), prefix);
 
-    arrow::ChunkedArrayVector data_vec;
     auto schema = arrow::schema({arrow::field("n_nationkey", arrow::int32(), false),
                                  arrow::field("revenue", arrow::int64(), false)});
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(key_chunks));
-    data_vec.push_back(std::make_shared<arrow::ChunkedArray>(rev_chunks));
 
-    return arrow::Table::Make(schema, data_vec);
+    return arrow::Table::Make(schema, {array_key, array_rev});
 }
 
 std::shared_ptr<arrow::Table> aggr_host(std::shared_ptr<arrow::Table> res) {    
@@ -522,9 +312,224 @@ double comp() {
     return 0;
 }
 
-int main(void) {
+/*
+Size a bloom filter of the Q5 chain, see bloom_words
+
+@param name what the filter is built from, for the report
+@param n expected number of elements the filter is built from
+@param probed_rows rows of the table probing the filter
+@param row_bytes bytes of a probed row in the shuffle
+
+@returns: number of words of the filter, 0 if filtering is disabled or does
+          not pay off
+*/
+uint32_t chain_bloom_words(const std::string &name, uint64_t n, uint64_t probed_rows, uint64_t row_bytes) {
+#if BLOOM_FILTER == 1
+    return bloom_words(name, n, BLOOM_MAX_WORDS, probed_rows / nr_dpus * row_bytes);
+#else
+    return 0;
+#endif
+}
+
+/*
+Report how many rows of a table a bloom filter left to shuffle
+
+@param table name of the table
+@param sizes partition sizes of each DPU, the last one is the number of
+             partitioned rows
+@param rows rows of the table
+*/
+void report_bloom_filter(const std::string &table, const std::vector<std::vector<uint64_t>> &sizes, uint64_t rows) {
+    uint64_t kept = 0;
+    for (uint32_t dpu = 0; dpu < sizes.size(); dpu++) {
+        kept += sizes[dpu].back();
+    }
+
+    std::cout << "Bloom filter left " << kept << " of " << rows << " " << table << " rows to shuffle ("
+              << 100.0 * kept / rows << "%)" << std::endl;
+}
+
+/*
+Fail the query if a join lost elements of its hash tables on a DPU, their
+matches would be missing from the result
+
+@param system set of dpus
+@param join name of the join in the error
+*/
+void check_join(dpu_set_t &system, const std::string &join) {
+    std::vector<std::vector<query_res_t>> query_res {nr_dpus, std::vector<query_res_t>(1)};
+    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+
+    for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+        if (query_res[dpu][0].dropped > 0) {
+            throw std::runtime_error("Hash tables of the " + join + " join full on DPU " + std::to_string(dpu) +
+                                     ", " + std::to_string(query_res[dpu][0].dropped) + " elements dropped");
+        }
+    }
+}
+
+/*
+Run the query on the DPUs
+
+@param system set of dpus
+@param request parameters of the query, missing ones take the values of the
+               TPC-H validation run
+
+@returns: the revenue of each nation of the region
+*/
+std::shared_ptr<arrow::Table> run_query(dpu_set_t &system, const query_request &request) {
+    // The customers of the region prune the orders, the orders they placed
+    // prune the lineitems. The customers of a region are estimated from the
+    // customers of an average region.
+    uint32_t words_c = chain_bloom_words("the customers", customer->num_rows() / region->num_rows(),
+                                         orders->num_rows(), sizeof(key_ptr32) + sizeof(uint32_t));
+    uint32_t words_o = 0;
+
+    catalog.load_phase(system, phase_programs[1], 1);
+    auto col_offset_1 = stage_mram_1(system);
+    populate_mram_1(system, col_offset_1, request, words_c);
+    DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+
+    // Each rank receives the orders columns as soon as its kernel is done
+    auto col_offset_2 = stage_mram_2(system);
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+    check_join(system, "region nation customer");
+
+    {
+        // The global filter is broadcast once the program of the probing phase
+        // is loaded, its filter may be at another address
+        std::shared_ptr<arrow::Buffer> filter_c;
+        if (words_c > 0) {
+            filter_c = traced("bloom_filter", [&]() { return merge_bloom_filters(system, "bloom_filter", 0, words_c); });
+        }
+
+        std::vector<std::vector<uint64_t>> sizes_c(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_c, 3*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_c = plan_shuffle(sizes_c, true, "customer");
+        auto buf_c_custkey = shuffle_gather(system, plan_c, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_c_nationkey = shuffle_gather(system, plan_c, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[2], 2);
+        if (words_c > 0) {
+            traced("bloom_filter", [&]() { copy_buf(system, filter_c, 0, "bloom_filter", DPU_XFER_DEFAULT); });
+        }
+        populate_mram_2(system, col_offset_2, request, words_c);
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+        std::vector<std::vector<uint64_t>> sizes_o(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_o, 4*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        if (words_c > 0) {
+            report_bloom_filter("orders", sizes_o, orders->num_rows());
+        }
+
+        // The joined orders are at most the orders left after the selection
+        uint64_t orders_n = 0;
+        for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+            orders_n += sizes_o[dpu].back();
+        }
+        words_o = chain_bloom_words("the orders", orders_n, lineitem->num_rows(),
+                                    sizeof(key_ptr32) + sizeof(uint32_t) + 2*sizeof(int64_t));
+
+        shuffle_plan plan_o = plan_shuffle(sizes_o, true, "orders");
+        auto buf_o_custkey = shuffle_gather(system, plan_o, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_o_orderkey = shuffle_gather(system, plan_o, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[3], 3);
+        distribute_1(system, plan_c, plan_o, buf_c_custkey, buf_o_custkey,
+                    buf_c_nationkey, buf_o_orderkey, words_o);
+    }
+
+    DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+    auto col_offset_3 = stage_mram_3(system);
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+    check_join(system, "customer orders");
+
+    {
+        std::shared_ptr<arrow::Buffer> filter_o;
+        if (words_o > 0) {
+            filter_o = traced("bloom_filter", [&]() { return merge_bloom_filters(system, "bloom_filter", 0, words_o); });
+        }
+
+        std::vector<std::vector<uint64_t>> sizes_o(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_o, 6*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_o = plan_shuffle(sizes_o, true, "orders");
+        auto buf_o_orderkey = shuffle_gather(system, plan_o, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_o_nationkey = shuffle_gather(system, plan_o, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[4], 4);
+        if (words_o > 0) {
+            traced("bloom_filter", [&]() { copy_buf(system, filter_o, 0, "bloom_filter", DPU_XFER_DEFAULT); });
+        }
+        populate_mram_3(system, col_offset_3, words_o);
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+        std::vector<std::vector<uint64_t>> sizes_l(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_l, 4*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        if (words_o > 0) {
+            report_bloom_filter("lineitem", sizes_l, lineitem->num_rows());
+        }
+        shuffle_plan plan_l = plan_shuffle(sizes_l, true, "lineitem");
+        auto buf_l_orderkey = shuffle_gather(system, plan_l, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_l_suppkey = shuffle_gather(system, plan_l, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+        auto buf_l_extendedprice = shuffle_gather(system, plan_l, sizeof(int64_t), DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32));
+        auto buf_l_discount = shuffle_gather(system, plan_l, sizeof(int64_t), DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[5], 5);
+        distribute_2(system, plan_o, plan_l, buf_o_orderkey, buf_l_orderkey,
+                    buf_o_nationkey, buf_l_suppkey, buf_l_extendedprice,
+                    buf_l_discount);
+    }
+
+    DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+    auto col_offset_4 = stage_mram_4(system);
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+    check_join(system, "orders lineitem");
+
+    {
+        std::vector<std::vector<uint64_t>> sizes_l(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_l, 8*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_l = plan_shuffle(sizes_l, true, "lineitem");
+        auto buf_l_suppkey = shuffle_gather(system, plan_l, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_l_nationkey = shuffle_gather(system, plan_l, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+        auto buf_l_discount = shuffle_gather(system, plan_l, sizeof(int64_t), DPU_MRAM_HEAP_POINTER_NAME, 2*524288*sizeof(key_ptr32));
+        auto buf_l_extendedprice = shuffle_gather(system, plan_l, sizeof(int64_t), DPU_MRAM_HEAP_POINTER_NAME, 3*524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[6], 6);
+        populate_mram_4(system, col_offset_4);
+        traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+        std::vector<std::vector<uint64_t>> sizes_s(nr_dpus, std::vector<uint64_t>(nr_dpus+1));
+        traced("shuffle", [&]() {
+            get_vec(system, sizes_s, 2*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
+        });
+        shuffle_plan plan_s = plan_shuffle(sizes_s, true, "supplier");
+        auto buf_s_suppkey = shuffle_gather(system, plan_s, sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, 0);
+        auto buf_s_nationkey = shuffle_gather(system, plan_s, sizeof(uint32_t), DPU_MRAM_HEAP_POINTER_NAME, 524288*sizeof(key_ptr32));
+
+        catalog.load_phase(system, phase_programs[7], 7);
+        distribute_3(system, plan_s, plan_l, buf_s_suppkey, buf_l_suppkey,
+                        buf_s_nationkey, buf_l_nationkey,
+                        buf_l_extendedprice, buf_l_discount);
+    }
+
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_launch(system, DPU_SYNCHRONOUS)); });
+    check_join(system, "supplier lineitem");
+
+    auto res = get_results(system);
+
+    return aggr_host(res);
+}
+
+int main(int argc, char **argv) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, true);
 
     std::vector<int32_t> n_cols = {0, 1, 2};
     auto status = parquet_to_table("nation", nation, n_cols);
@@ -562,95 +567,23 @@ int main(void) {
         std::cout << status.message() << std::endl;
     }
 
-    try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-        {
-            DPU_ASSERT(dpu_load(system, "kernel_q5_1", NULL));
-            populate_mram_1(system);
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            {
-                std::vector<std::vector<uint64_t>> sizes_c(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_c, 3*524288*sizeof(key_ptrtext), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_c_custkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_c_nationkey = collect(system, 524288*sizeof(key_ptrtext), sizeof(uint32_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q5_2", NULL));
-                populate_mram_2(system);
-                DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-                std::vector<std::vector<uint64_t>> sizes_o(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_o, 4*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_o_custkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_o_orderkey = collect(system, 524288*sizeof(key_ptr32), sizeof(uint32_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q5_3", NULL));
-                distribute_1(system, sizes_c, sizes_o, buf_c_custkey, buf_o_custkey,
-                            buf_c_nationkey, buf_o_orderkey);
-            }
-
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            {
-                std::vector<std::vector<uint64_t>> sizes_o(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_o, 6*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_o_orderkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_o_nationkey = collect(system, 524288*sizeof(key_ptr32), sizeof(uint32_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q5_4", NULL));
-                populate_mram_3(system);
-                DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-                std::vector<std::vector<uint64_t>> sizes_l(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_l, 4*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_l_orderkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_l_suppkey = collect(system, 524288*sizeof(key_ptr32), sizeof(uint32_t));
-                auto buf_l_extendedprice = collect(system, 2*524288*sizeof(key_ptr32), sizeof(int64_t));
-                auto buf_l_discount = collect(system, 3*524288*sizeof(key_ptr32), sizeof(int64_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q5_5", NULL));
-                distribute_2(system, sizes_o, sizes_l, buf_o_orderkey, buf_l_orderkey,
-                            buf_o_nationkey, buf_l_suppkey, buf_l_extendedprice,
-                            buf_l_discount);
-            }
-
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            {
-                std::vector<std::vector<uint64_t>> sizes_l(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_l, 8*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_l_suppkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_l_nationkey = collect(system, 524288*sizeof(key_ptr32), sizeof(uint32_t));
-                auto buf_l_discount = collect(system, 2*524288*sizeof(key_ptr32), sizeof(int64_t));
-                auto buf_l_extendedprice = collect(system, 3*524288*sizeof(key_ptr32), sizeof(int64_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q5_6", NULL));
-                populate_mram_4(system);
-                DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-                std::vector<std::vector<uint64_t>> sizes_s(NR_DPU, std::vector<uint64_t>(NR_DPU+1));
-                get_vec(system, sizes_s, 2*524288*sizeof(key_ptr32), DPU_MRAM_HEAP_POINTER_NAME, DPU_XFER_DEFAULT);
-                auto buf_s_suppkey = collect(system, 0, sizeof(key_ptr32));
-                auto buf_s_nationkey = collect(system, 524288*sizeof(key_ptr32), sizeof(uint32_t));
-
-                DPU_ASSERT(dpu_load(system, "kernel_q5_7", NULL));
-                distribute_3(system, sizes_s, sizes_l, buf_s_suppkey, buf_l_suppkey,
-                                buf_s_nationkey, buf_l_nationkey,
-                                buf_l_extendedprice, buf_l_discount);
-            }
-
-            DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-
-            auto res = get_results(system);
-            aggr_host(res);
-        }
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    query_server server;
+    if (server.open(argc, argv)) {
+        serve_queries(server, "q5", {"r_region", "date_start", "date_end"},
+                      [&system](const query_request &request) { return run_query(system, request); });
+        return 0;
+    }
+
+    try {
+        trace.begin("q5", nr_dpus);
+        run_query(system, query_request());
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
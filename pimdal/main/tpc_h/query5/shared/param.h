@@ -3,6 +3,28 @@
 
 #include <stdint.h>
 
+// Every table has its own region of the columns symbol, so its columns stay
+// resident across requests and the next table is staged while the current
+// kernel runs. A region holds the bytes of a row times the rows per DPU the
+// kernels take of the table
+#define CUSTOMER_ROWS 131072
+#define ORDERS_ROWS 131072
+#define LINEITEM_ROWS 524288
+#define SUPPLIER_ROWS 131072
+#define CUSTOMER_COLUMNS 0
+#define ORDERS_COLUMNS (CUSTOMER_COLUMNS + 8*CUSTOMER_ROWS)
+#define LINEITEM_COLUMNS (ORDERS_COLUMNS + 12*ORDERS_ROWS)
+#define SUPPLIER_COLUMNS (LINEITEM_COLUMNS + 24*LINEITEM_ROWS)
+#define COLUMNS_SIZE (SUPPLIER_COLUMNS + 8*SUPPLIER_ROWS)
+
+// MRAM of a DPU and the largest heap of the phases, the buffers of phase 7
+#define MRAM_SIZE (64 << 20)
+#define HEAP_SIZE (36 << 20)
+
+// Words of the bloom filter of the customers or orders in MRAM, the largest
+// power of two fitting behind the columns in front of the heap, 8MB
+#define BLOOM_MAX_WORDS (1 << 20)
+
 typedef struct
 {
     uint32_t r_count;
@@ -15,11 +37,14 @@ typedef struct
     uint32_t date_end;
     char r_region[32];
     uint32_t dpu_n;
+    uint32_t col_offset[4];
+    uint32_t filter_words; // Words of the bloom filter built or probed by the phase, 0 if none
 } query_args_t;
 
 typedef struct
 {
     uint32_t count;
+    uint32_t dropped; // Elements lost by the hash tables of the joins, the overflow area was full
 } query_res_t;
 
 #endif
\ No newline at end of file
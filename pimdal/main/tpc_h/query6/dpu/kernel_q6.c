@@ -24,10 +24,8 @@ __host query_res_t dpu_results;
 sel_results_t sel_results;
 red_results_t red_results;
 
-__mram_noinit_keep int64_t l_extendedprice[524288];
-__mram_noinit_keep uint32_t l_shipdate[524288];
-__mram_noinit_keep int64_t l_discount[524288];
-__mram_noinit_keep int64_t l_quantity[524288];
+// Columns packed by scatter_columns at the offsets in dpu_args.col_offset
+__mram_noinit_keep uint64_t columns[COLUMNS_SIZE/sizeof(uint64_t)];
 
 BARRIER_INIT(barrier, NR_TASKLETS);
 MUTEX_INIT(mutex);
@@ -102,6 +100,11 @@ bool pred_quantity(key_ptr_t quantity) {
 
 int main() {
 
+    uint32_t l_quantity = (uint32_t) columns + dpu_args.col_offset[0];
+    uint32_t l_extendedprice = (uint32_t) columns + dpu_args.col_offset[1];
+    uint32_t l_discount = (uint32_t) columns + dpu_args.col_offset[2];
+    uint32_t l_shipdate = (uint32_t) columns + dpu_args.col_offset[3];
+
     uint32_t size = 524288;
     uint32_t buffer_1 = (uint32_t) DPU_MRAM_HEAP_POINTER;
     uint32_t buffer_2 = (uint32_t) (buffer_1 + size*sizeof(key_ptr_t));
@@ -1,19 +1,17 @@
 #include <iostream>
 #include <random>
 #include <algorithm>
-#include <chrono>
 #include <fstream>
+#include <mutex>
 
 #include <arrow/api.h>
 #include <arrow/acero/exec_plan.h>
 #include <arrow/dataset/api.h>
 #include "../../reader/read_table.cpp"
 
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
-
 #include "transfer_helper.h"
+#include "catalog.h"
+#include "server.h"
 
 #include "param.h"
 #include "datatype.h"
@@ -23,47 +21,102 @@ namespace cp = arrow::compute;
 
 extern std::shared_ptr<arrow::Table> lineitem;
 
-void populate_mram(dpu_set_t &system) {
-    scatter_table(system, lineitem, "l_quantity", "l_quantity", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_extendedprice", "l_extendedprice", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_discount", "l_discount", 0, DPU_SG_XFER_DEFAULT);
-    scatter_table(system, lineitem, "l_shipdate", "l_shipdate", 0, DPU_SG_XFER_DEFAULT);
+void populate_mram(dpu_set_t &system, column_catalog &cat, const query_request &request) {
+    trace_scope scope("to_dpu");
+
+    int32_t date_start = date_to_int(request_date(request, "date_start", "1994-01-01"));
+    int32_t date_end = date_to_int(request_date(request, "date_end", "1995-01-01"));
+    int64_t discount = request_int(request, "discount", 6);
+    int64_t quantity = request_int(request, "quantity", 24);
+
+    std::vector<uint32_t> col_offset = scatter_resident(system, "lineitem", lineitem,
+                                                        {"l_quantity", "l_extendedprice", "l_discount", "l_shipdate"},
+                                                        "columns", 0, COLUMNS_SIZE, DPU_SG_XFER_ASYNC, cat);
+
+    // The query may run on a group of ranks rather than all allocated DPUs
+    uint32_t n = get_nr_dpus(system);
+    std::vector<std::vector<query_args_t>> query_args {n, std::vector<query_args_t>(1)};
+    for (uint32_t dpu = 0; dpu < n; dpu++) {
+        query_args[dpu][0].size = split_length(lineitem->num_rows(), dpu, n);
+        std::copy(col_offset.begin(), col_offset.end(), query_args[dpu][0].col_offset);
+
+        query_args[dpu][0].date_start = date_start;
+        query_args[dpu][0].date_end = date_end;
+        query_args[dpu][0].discount = discount;
+        query_args[dpu][0].quantity = quantity;
+    }
 
-    std::vector<std::vector<query_args_t>> query_args {NR_DPU, std::vector<query_args_t>(1)};
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        if (lineitem->num_rows() % NR_DPU == 0) {
-            query_args[dpu][0].size = lineitem->num_rows()/NR_DPU;
-        }
-        else {
-            if (dpu < NR_DPU - 1) {
-                query_args[dpu][0].size = lineitem->num_rows()/NR_DPU + 1;
-            }
-            else {
-                query_args[dpu][0].size = lineitem->num_rows() % (lineitem->num_rows()/NR_DPU + 1);
-            }
+    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+}
+
+// Revenue of the ranks of a query that finished, summed as the ranks report in
+typedef struct revenue_sum {
+    int64_t revenue = 0;
+    std::mutex mutex;
+} revenue_sum;
+
+/*
+Collect the revenue of the DPUs of a rank as soon as the rank is done
+*/
+dpu_error_t revenue_callback(struct dpu_set_t rank,
+    __attribute((unused)) uint32_t rank_id, void * args) {
+
+    revenue_sum *sum = (revenue_sum*) args;
+    return guard_callback([&]() {
+        trace_scope scope("from_dpu");
+
+        uint32_t rank_dpus = get_nr_dpus(rank);
+        std::vector<std::vector<query_res_t>> query_res {rank_dpus, std::vector<query_res_t>(1)};
+        get_vec(rank, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+
+        int64_t rank_revenue = 0;
+        for (uint32_t dpu = 0; dpu < rank_dpus; dpu++) {
+            //std::cout << "Revenue dpu: " << query_res[dpu][0].revenue << std::endl;
+            rank_revenue += query_res[dpu][0].revenue;
         }
 
-        query_args[dpu][0].date_start = date_to_int("1994-01-01");
-        query_args[dpu][0].date_end = date_to_int("1995-01-01");
-        query_args[dpu][0].discount = 6;
-        query_args[dpu][0].quantity = 24;
-    }
+        // The revenue can be modified by multiple threads simultaneously
+        const std::lock_guard<std::mutex> lock(sum->mutex);
+        sum->revenue += rank_revenue;
+    });
+}
 
-    dist_vec(system, query_args, 0, "dpu_args", DPU_XFER_DEFAULT);
+double get_result(const revenue_sum &sum) {
+    return (double) sum.revenue / 10000;
 }
 
-double get_result(dpu_set_t &system) {
-    std::vector<std::vector<query_res_t>> query_res {NR_DPU, std::vector<query_res_t>(1)};
+/*
+Run the query on the DPUs
 
-    get_vec(system, query_res, 0, "dpu_results", DPU_XFER_DEFAULT);
+@param system set of dpus
+@param cat catalog of the dpus
+@param request parameters of the query, missing ones take the values of the
+               TPC-H validation run
 
-    double revenue = 0;
-    for (uint32_t dpu = 0; dpu < NR_DPU; dpu++) {
-        //std::cout << "Revenue dpu: " << query_res[dpu][0].revenue << std::endl;
-        revenue += query_res[dpu][0].revenue;
+@returns: a table with the revenue
+*/
+std::shared_ptr<arrow::Table> run_query(dpu_set_t &system, column_catalog &cat, const query_request &request) {
+    revenue_sum sum;
+
+    cat.load(system, "kernel_q6");
+    populate_mram(system, cat, request);
+    DPU_CHECK(dpu_launch(system, DPU_ASYNCHRONOUS));
+    DPU_CHECK(dpu_callback(system, revenue_callback, &sum, DPU_CALLBACK_ASYNC));
+
+    // Also reports the errors of the callback
+    traced("dpu_launch", [&]() { DPU_CHECK(dpu_sync(system)); });
+
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(sizeof(double));
+    if (!buffer_try.ok()) {
+        std::cout << "Could not allocate buffer!" << std::endl;
     }
+    std::shared_ptr<arrow::Buffer> buffer = *std::move(buffer_try);
+    *((double*) buffer->mutable_data()) = get_result(sum);
+
+    auto schema = arrow::schema({arrow::field("revenue", arrow::float64(), false)});
+    auto array_data = arrow::ArrayData::Make(arrow::float64(), 1, {nullptr, buffer});
 
-    return revenue / 10000;
+    return arrow::Table::Make(schema, {arrow::MakeArray(array_data)});
 }
 
 std::shared_ptr<arrow::ChunkedArray> comp() {
@@ -107,34 +160,39 @@ std::shared_ptr<arrow::ChunkedArray> comp() {
 
 std::shared_ptr<arrow::Table> lineitem;
 
-int main(void) {
+int main(int argc, char **argv) {
     dpu_set_t system;
-    DPU_ASSERT(dpu_alloc(NR_DPU, "sgXferEnable=true", &system));
+    alloc_dpus(system, false);
     std::vector<int32_t> sel_cols = {4, 5, 6, 10};
     auto status = parquet_to_table("lineitem", lineitem, sel_cols);
     if (!status.ok()) {
         std::cout << status.message() << std::endl;
     }
+
+    query_server server;
+    if (server.open(argc, argv)) {
+        // Requests run concurrently on groups of ranks just large enough to hold the columns
+        rank_scheduler scheduler(system, dpus_needed(lineitem->num_rows(), 28, COLUMNS_SIZE));
+        serve_queries(server, scheduler, "q6", {"date_start", "date_end", "discount", "quantity"},
+                      [](rank_group &group, const query_request &request) {
+                          return run_query(group.set, group.catalog, request);
+                      });
+        return 0;
+    }
+
     try {
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        trace.begin("q6", nr_dpus);
 
-        DPU_ASSERT(dpu_load(system, "kernel_q6", NULL));
-        populate_mram(system);
-        DPU_ASSERT(dpu_launch(system, DPU_SYNCHRONOUS));
-        double revenue = get_result(system);
+        auto res = run_query(system, catalog, query_request());
         std::cout.precision(11);
-        std::cout << "Revenue: " << revenue << std::endl;
-
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        std::cout << "Revenue: " << std::static_pointer_cast<arrow::DoubleArray>(res->column(0)->chunk(0))->Value(0) << std::endl;
 
-        std::cout << "Host elapsed time: "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
-              << " millisecs." << std::endl;
+        std::cout << "Host elapsed time: " << trace.end() << " millisecs." << std::endl;
 
         auto comparsion = comp();
         output_dpu(system);
     }
-    catch (const dpu::DpuError & e) {
+    catch (const std::runtime_error & e) {
         std::cerr << e.what() << std::endl;
     }
     
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+// Size of the columns symbol the lineitem columns are packed into
+#define COLUMNS_SIZE (28*524288)
+
 typedef struct
 {
     uint32_t size;
@@ -10,6 +13,7 @@ typedef struct
     int64_t date_end;
     int64_t discount;
     int64_t quantity;
+    uint32_t col_offset[4];
 } query_args_t;
 
 typedef struct
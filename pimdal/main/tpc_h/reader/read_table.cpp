@@ -32,4 +32,4 @@ arrow::Status parquet_to_table(std::string table_name,
     ARROW_RETURN_NOT_OK(arrow_reader->ReadTable(sel_col, &table));
 
     return arrow::Status::OK();
-}
\ No newline at end of file
+}
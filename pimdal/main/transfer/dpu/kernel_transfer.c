@@ -0,0 +1,9 @@
+#include <defs.h>
+
+/*
+The transfer benchmark only moves data between the host and the MRAM heap,
+the program is loaded to provide the heap symbol and never launched.
+*/
+int main() {
+    return 0;
+}
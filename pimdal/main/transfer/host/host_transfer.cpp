@@ -0,0 +1,317 @@
+#include <iostream>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <functional>
+
+#include <arrow/api.h>
+
+#include "transfer_helper.h"
+
+/*
+Bandwidth of the host <-> DPU transfer primitives of transfer_helper.h, swept
+over the payload size per DPU, the number of ranks, synchronous and
+asynchronous transfers and equal or skewed lengths per DPU.
+
+    host_transfer [--json] [--sizes 4096,65536,...] [--ranks 1,2,...] [--reps 5]
+
+The results are printed as CSV, or as one JSON object per line with --json.
+Set PIMDAL_NO_NUMA to measure without NUMA placement of the host buffers.
+*/
+
+typedef struct bench_config {
+    std::string primitive;
+    // parallel, scatter-gather or broadcast
+    std::string method;
+    std::string direction;
+    bool async;
+    bool skewed;
+    uint32_t nr_ranks;
+    uint64_t size;
+} bench_config;
+
+// Sizes of the payload per DPU in bytes
+std::vector<uint64_t> sizes = {4096, 16384, 65536, 262144, 1048576, 4194304};
+// Numbers of ranks to allocate, powers of two up to all ranks if empty
+std::vector<uint64_t> rank_counts;
+uint32_t reps = 5;
+bool json = false;
+
+// dist_vec copies the payload into vectors, it is meant for small arguments
+#define DIST_VEC_MAX_SIZE 65536
+
+std::vector<uint64_t> parse_list(const std::string &arg) {
+    std::vector<uint64_t> list;
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        list.push_back(std::stoull(item));
+    }
+
+    return list;
+}
+
+/*
+Bytes transferred to each DPU. Skewed lengths grow linearly from 1/8 of the
+size to the full size, so parallel transfers move up to 8 times the useful
+data of the smallest DPUs.
+
+@param n number of DPUs
+@param size payload size of the largest DPU
+@param skewed use skewed instead of equal lengths
+
+@returns: nr_dpus+1 byte offsets of the payload of each DPU
+*/
+std::vector<uint64_t> dpu_offsets(uint32_t n, uint64_t size, bool skewed) {
+    std::vector<uint64_t> offset(n + 1, 0);
+    for (uint32_t dpu = 0; dpu < n; dpu++) {
+        uint64_t length = skewed ? (size*(dpu % 8 + 1)/8 + 7) & (-8) : size;
+        offset[dpu + 1] = offset[dpu] + length;
+    }
+
+    return offset;
+}
+
+/*
+Allocate a host buffer holding the payload of every DPU, the payload of each
+rank is placed on the NUMA node of the rank.
+
+@param system dpus the buffer is transferred with
+@param offset byte offset of the payload of each DPU
+
+@returns: the buffer, touched to place its pages
+*/
+std::shared_ptr<arrow::Buffer> alloc_payload(dpu_set_t &system, const std::vector<uint64_t> &offset) {
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(offset.back(), numa_pool(-1));
+    if (!buffer_try.ok()) {
+        std::cout << "Could not allocate buffer!" << std::endl;
+    }
+    std::shared_ptr<arrow::Buffer> buffer = *std::move(buffer_try);
+
+    std::vector<rank_info> ranks = get_ranks(system);
+    for (auto &rank : ranks) {
+        bind_memory(buffer->mutable_data() + offset[rank.dpu_base],
+                    offset[rank.dpu_base + rank.nr_dpus] - offset[rank.dpu_base], rank.node);
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (uint32_t r = 0; r < ranks.size(); r++) {
+        numa_thread_scope pin(ranks[r].node);
+
+        uint64_t start = offset[ranks[r].dpu_base];
+        uint64_t end = offset[ranks[r].dpu_base + ranks[r].nr_dpus];
+        for (uint64_t i = start; i < end; i++) {
+            buffer->mutable_data()[i] = i;
+        }
+    }
+
+    return buffer;
+}
+
+/*
+Send a payload with a different length to each DPU with a scatter-gather
+transfer, the counterpart of collect_buf
+
+@param system dpus to send to
+@param buffer payload of all dpus
+@param offset byte offset of the payload of each DPU
+@param DstSymbol dpu destination symbol
+@param flag options for the transfer
+*/
+void scatter_buf(dpu_set_t &system, std::shared_ptr<arrow::Buffer> buffer, const std::vector<uint64_t> &offset,
+                 const std::string &DstSymbol, dpu_sg_xfer_flags_t flag) {
+
+    uint64_t max_length = 0;
+    for (uint32_t dpu = 0; dpu + 1 < offset.size(); dpu++) {
+        max_length = offset[dpu + 1] - offset[dpu] > max_length ? offset[dpu + 1] - offset[dpu] : max_length;
+    }
+
+    auto slot = sc_args_buf.acquire(sg_xfer_context_buf({.buffer = buffer, .offset = offset}), get_buf_ptr);
+
+    flag = dpu_sg_xfer_flags_t(flag | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
+    sc_args_buf.push(system, slot, DPU_XFER_TO_DPU, DstSymbol, 0, max_length, flag);
+}
+
+/*
+Time a transfer after one warm-up run and print its bandwidth
+
+@param system dpus the transfer runs on
+@param config parameters of the measurement
+@param bytes useful bytes moved by one transfer
+@param transfer function issuing the transfer
+*/
+void measure(dpu_set_t &system, const bench_config &config, uint64_t bytes, std::function<void()> transfer) {
+    transfer();
+    DPU_ASSERT(dpu_sync(system));
+
+    double total = 0;
+    double best = 0;
+    for (uint32_t rep = 0; rep < reps; rep++) {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        transfer();
+        DPU_ASSERT(dpu_sync(system));
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - begin).count();
+        total += seconds;
+        best = rep == 0 || seconds < best ? seconds : best;
+    }
+
+    double mean = total / reps;
+    double mean_gbps = bytes / mean / 1e9;
+    double best_gbps = bytes / best / 1e9;
+
+    if (json) {
+        std::cout << "{\"primitive\": \"" << config.primitive << "\", \"method\": \"" << config.method
+                  << "\", \"direction\": \"" << config.direction << "\", \"mode\": \""
+                  << (config.async ? "async" : "sync") << "\", \"lengths\": \""
+                  << (config.skewed ? "skewed" : "equal") << "\", \"numa\": " << (numa_enabled() ? "true" : "false")
+                  << ", \"nr_ranks\": " << config.nr_ranks << ", \"nr_dpus\": " << nr_dpus
+                  << ", \"size_dpu\": " << config.size << ", \"bytes\": " << bytes
+                  << ", \"mean_s\": " << mean << ", \"best_s\": " << best
+                  << ", \"mean_gbps\": " << mean_gbps << ", \"best_gbps\": " << best_gbps << "}" << std::endl;
+    } else {
+        std::cout << config.primitive << "," << config.method << "," << config.direction << ","
+                  << (config.async ? "async" : "sync") << "," << (config.skewed ? "skewed" : "equal") << ","
+                  << numa_enabled() << "," << config.nr_ranks << "," << nr_dpus << "," << config.size << ","
+                  << bytes << "," << mean << "," << best << "," << mean_gbps << "," << best_gbps << std::endl;
+    }
+}
+
+/*
+Measure all primitives for one payload size on the allocated DPUs
+
+@param system allocated dpus with the kernel loaded
+@param nr_ranks number of allocated ranks
+@param size payload size per DPU in bytes
+*/
+void sweep_size(dpu_set_t &system, uint32_t nr_ranks, uint64_t size) {
+    const std::string heap = DPU_MRAM_HEAP_POINTER_NAME;
+
+    for (bool skewed : {false, true}) {
+        std::vector<uint64_t> offset = dpu_offsets(nr_dpus, size, skewed);
+        uint64_t useful = offset.back();
+
+        // Parallel transfers move the same length to every DPU, they are
+        // padded to the largest DPU and the payload is laid out with a stride
+        std::vector<uint64_t> stride = dpu_offsets(nr_dpus, size, false);
+        std::shared_ptr<arrow::Buffer> source = alloc_payload(system, stride);
+        std::shared_ptr<arrow::Buffer> packed = alloc_payload(system, offset);
+        arrow::BufferVector buffers = alloc_buf_vec(system, size);
+
+        auto table = arrow::Table::Make(arrow::schema({arrow::field("payload", arrow::uint32(), false)}),
+                                        {arrow::MakeArray(arrow::ArrayData::Make(arrow::uint32(), source->size()/sizeof(uint32_t),
+                                                                                 {nullptr, source}))});
+        std::shared_ptr<arrow::Buffer> single = arrow::SliceBuffer(source, 0, size);
+
+        std::vector<std::vector<uint8_t>> vectors;
+        if (size <= DIST_VEC_MAX_SIZE) {
+            vectors.assign(nr_dpus, std::vector<uint8_t>(size));
+        }
+
+        for (bool async : {false, true}) {
+            dpu_xfer_flags_t flag = async ? DPU_XFER_ASYNC : DPU_XFER_DEFAULT;
+            dpu_sg_xfer_flags_t sg_flag = async ? DPU_SG_XFER_ASYNC : DPU_SG_XFER_DEFAULT;
+            bench_config config = {.primitive = "", .method = "", .direction = "", .async = async,
+                                   .skewed = skewed, .nr_ranks = nr_ranks, .size = size};
+
+            auto run = [&](const std::string &primitive, const std::string &method, const std::string &direction,
+                           uint64_t bytes, std::function<void()> transfer) {
+                config.primitive = primitive;
+                config.method = method;
+                config.direction = direction;
+                measure(system, config, bytes, transfer);
+            };
+
+            run("dist_buf", "parallel", "to_dpu", useful, [&]() {
+                dist_buf(system, source, 0, size, heap, flag);
+            });
+            if (!vectors.empty()) {
+                run("dist_vec", "parallel", "to_dpu", useful, [&]() {
+                    dist_vec(system, vectors, 0, heap, flag);
+                });
+            }
+            run("scatter_buf", "scatter-gather", "to_dpu", useful, [&]() {
+                scatter_buf(system, packed, offset, heap, sg_flag);
+            });
+            run("get_buf", "parallel", "from_dpu", useful, [&]() {
+                get_buf(system, buffers, 0, heap, flag);
+            });
+            run("collect_buf", "scatter-gather", "from_dpu", useful, [&]() {
+                collect_buf(system, packed, 0, heap, size, offset, sg_flag);
+            });
+
+            // Splitting a table and broadcasting always send equal lengths
+            if (!skewed) {
+                run("dist_table", "parallel", "to_dpu", useful, [&]() {
+                    dist_table<uint32_t>(system, table, "payload", heap, 0, flag);
+                });
+                run("scatter_table", "scatter-gather", "to_dpu", useful, [&]() {
+                    scatter_table(system, table, "payload", heap, 0, sg_flag);
+                });
+                // The payload is written to every DPU
+                run("copy_buf", "broadcast", "to_dpu", useful, [&]() {
+                    copy_buf(system, single, 0, heap, flag);
+                });
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int arg = 1; arg < argc; arg++) {
+        std::string name = argv[arg];
+        if (name == "--json") {
+            json = true;
+        } else if (name == "--sizes" && arg + 1 < argc) {
+            sizes = parse_list(argv[++arg]);
+        } else if (name == "--ranks" && arg + 1 < argc) {
+            rank_counts = parse_list(argv[++arg]);
+        } else if (name == "--reps" && arg + 1 < argc) {
+            reps = std::stoul(argv[++arg]);
+        } else {
+            std::cout << "Usage: host_transfer [--json] [--sizes 4096,65536] [--ranks 1,2] [--reps 5]" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        if (rank_counts.empty()) {
+            dpu_set_t all;
+            uint32_t max_ranks;
+            DPU_ASSERT(dpu_alloc(DPU_ALLOCATE_ALL, "sgXferEnable=true", &all));
+            DPU_ASSERT(dpu_get_nr_ranks(all, &max_ranks));
+            DPU_ASSERT(dpu_free(all));
+
+            for (uint32_t ranks = 1; ranks < max_ranks; ranks *= 2) {
+                rank_counts.push_back(ranks);
+            }
+            rank_counts.push_back(max_ranks);
+        }
+
+        if (!json) {
+            std::cout << "primitive,method,direction,mode,lengths,numa,nr_ranks,nr_dpus,size_dpu,bytes,"
+                      << "mean_s,best_s,mean_gbps,best_gbps" << std::endl;
+        }
+
+        for (uint32_t nr_ranks : rank_counts) {
+            dpu_set_t system;
+            DPU_ASSERT(dpu_alloc_ranks(nr_ranks, "sgXferEnable=true", &system));
+            nr_dpus = get_nr_dpus(system);
+            DPU_ASSERT(dpu_load(system, "kernel_transfer", NULL));
+
+            for (uint64_t size : sizes) {
+                sweep_size(system, nr_ranks, size);
+            }
+
+            DPU_ASSERT(dpu_free(system));
+        }
+    }
+    catch (const std::runtime_error & e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <dpu>
+
+#include <arrow/api.h>
+#include <omp.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "transfer_helper.h"
+
+// Bits of a bloom filter per element, smaller filters prune too little to pay off
+static constexpr uint64_t BLOOM_BITS = 8;
+static constexpr uint64_t BLOOM_MIN_BITS = 4;
+
+/*
+Size a bloom filter built on every DPU and ORed by the host, a power of two
+words large enough for BLOOM_BITS per element of all DPUs. The filter is
+skipped if it cannot hold BLOOM_MIN_BITS per element, either because the MRAM
+left on a DPU is too small or because gathering and broadcasting it would move
+more bytes per DPU than the probed rows it prunes move in the shuffle. The
+path taken is reported.
+
+@param name what the filter is built from, for the report
+@param n expected number of elements the filter is built from
+@param max_words words of MRAM left for the filter on each DPU
+@param prunable_bytes bytes per DPU of the probed rows in the shuffle
+
+@returns: number of words of the filter, 0 if it is skipped
+*/
+uint32_t bloom_words(const std::string &name, uint64_t n, uint64_t max_words, uint64_t prunable_bytes) {
+    if (n == 0) {
+        std::cout << "Bloom filter of " << name << " skipped, no elements" << std::endl;
+        return 0;
+    }
+
+    // Every DPU gathers and receives the whole filter, every pruned row saves
+    // its bytes in the gather and the scatter of the shuffle
+    uint64_t transfer_words = prunable_bytes / sizeof(uint64_t);
+    uint64_t limit = max_words < transfer_words ? max_words : transfer_words;
+
+    uint64_t words = 1;
+    while (words*64 < n*BLOOM_BITS && words*2 <= limit) {
+        words *= 2;
+    }
+
+    if (words*64 < n*BLOOM_MIN_BITS || words > limit) {
+        uint64_t fit = words > limit ? 0 : words;
+        std::cout << "Bloom filter of " << name << " skipped, " << (double) fit*64 / n
+                  << " bits per element fit " << (limit == max_words ? "the MRAM" : "the shuffle savings")
+                  << std::endl;
+        return 0;
+    }
+
+    std::cout << "Bloom filter of " << name << ": " << words << " words, "
+              << (double) words*64 / n << " bits per element" << std::endl;
+    return words;
+}
+
+/*
+OR the bloom filters built by all DPUs, rank by rank so that the host only
+holds the filters of one rank at a time
+
+@param system set of dpus
+@param symbol dpu symbol of the filters
+@param offset offset of the filters from the symbol
+@param words number of words of the filters
+
+@returns: the global filter
+*/
+std::shared_ptr<arrow::Buffer> merge_bloom_filters(dpu_set_t &system, const std::string &symbol,
+                                                   uint32_t offset, uint32_t words) {
+    arrow::Result<std::unique_ptr<arrow::Buffer>> merged_try = arrow::AllocateBuffer(words*sizeof(uint64_t));
+    if (!merged_try.ok()) {
+        throw std::runtime_error("Could not allocate the bloom filter");
+    }
+    std::shared_ptr<arrow::Buffer> merged = *std::move(merged_try);
+    uint64_t* merged_data = (uint64_t*) merged->mutable_data();
+    std::memset(merged_data, 0, words*sizeof(uint64_t));
+
+    std::vector<std::vector<uint64_t>> filters;
+    for (rank_info &rank : get_ranks(system)) {
+        filters.assign(rank.nr_dpus, std::vector<uint64_t>(words));
+        get_vec(rank.rank, filters, offset, symbol, DPU_XFER_DEFAULT);
+
+        #pragma omp parallel for
+        for (uint32_t word = 0; word < words; word++) {
+            uint64_t bits = merged_data[word];
+            for (uint32_t dpu = 0; dpu < rank.nr_dpus; dpu++) {
+                bits |= filters[dpu][word];
+            }
+            merged_data[word] = bits;
+        }
+    }
+
+    return merged;
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <dpu>
+
+#include <arrow/api.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+
+#include "transfer_helper.h"
+
+/*
+A column resident in MRAM. Split columns hold split_length(rows, dpu, nr_dpus)
+rows on each DPU, broadcast columns hold all rows on every DPU.
+*/
+typedef struct resident_column {
+    std::string symbol;
+    // Offset of the column from the symbol and bytes reserved on each DPU
+    uint32_t offset;
+    uint32_t length;
+    std::shared_ptr<arrow::DataType> type;
+    uint64_t rows;
+    uint32_t nr_dpus;
+    bool broadcast;
+} resident_column;
+
+/*
+Catalog of the table columns resident in MRAM. Transfers through the catalog
+are skipped when the column is already in place, so a process answering many
+queries over the same tables only pays the load once. Only MRAM symbols that
+are not initialized by the loader (__mram_noinit) keep their content when a
+new program is loaded, and programs have to be loaded with load() so that
+columns are dropped when their symbol moves.
+*/
+class column_catalog {
+public:
+    /*
+    Load a program on the DPUs and drop the columns whose symbol is missing
+    or at another address in the new program
+
+    @param system dpus to load the program on
+    @param binary path of the DPU binary
+    */
+    void load(dpu_set_t &system, const std::string &binary) {
+        trace_scope scope("dpu_load");
+        DPU_CHECK(dpu_load(system, binary.c_str(), &program));
+        loaded = binary;
+
+        drop_moved();
+    }
+
+    /*
+    Load a program on a single rank, so that a rank callback can move its rank
+    on to the next phase without waiting for the other ranks. Can be called
+    from the callbacks of several ranks at once, the set has to be synchronized
+    before the catalog is used again for the whole set.
+
+    @param rank rank to load the program on
+    @param binary path of the DPU binary
+    */
+    void load_rank(dpu_set_t &rank, const std::string &binary) {
+        trace_scope scope("dpu_load");
+        struct dpu_program_t *rank_program;
+        DPU_CHECK(dpu_load(rank, binary.c_str(), &rank_program));
+
+        // The first rank to load the program checks the columns against it
+        const std::lock_guard<std::mutex> lock(rank_mutex);
+        if (binary != loaded) {
+            program = rank_program;
+            loaded = binary;
+            drop_moved();
+        }
+    }
+
+    /*
+    Select the phase run by the next launch of a multi-phase program. The
+    program is only loaded if it is not already on the DPUs, consecutive
+    phases of the same program keep the WRAM and MRAM of the previous phase.
+
+    @param system dpus to run the phase on
+    @param binary path of the DPU binary holding the phase
+    @param phase index of the phase in the program
+    */
+    void load_phase(dpu_set_t &system, const std::string &binary, uint32_t phase) {
+        if (binary != loaded) {
+            load(system, binary);
+        }
+
+        DPU_CHECK(dpu_broadcast_to(system, "phase", 0, &phase, sizeof(phase), DPU_XFER_DEFAULT));
+    }
+
+    /*
+    Look up a resident column
+
+    @param table name of the table
+    @param column name of the column
+
+    @returns: the column or nullptr if it is not resident
+    */
+    const resident_column* find(const std::string &table, const std::string &column) const {
+        auto it = columns.find({table, column});
+        if (it == columns.end()) {
+            return nullptr;
+        }
+
+        return &it->second;
+    }
+
+    /*
+    Record a column written to MRAM, columns it overwrites are dropped. Nothing
+    is recorded if the program was not loaded through the catalog.
+
+    @param table name of the table
+    @param column name of the column
+    @param entry location of the column
+    */
+    void insert(const std::string &table, const std::string &column, const resident_column &entry) {
+        evict(entry.symbol, entry.offset, entry.length);
+
+        if (program == nullptr) {
+            return;
+        }
+
+        if (symbols.find(entry.symbol) == symbols.end()) {
+            struct dpu_symbol_t symbol;
+            if (dpu_get_symbol(program, entry.symbol.c_str(), &symbol) != DPU_OK) {
+                return;
+            }
+            symbols[entry.symbol] = symbol.address;
+        }
+
+        columns[{table, column}] = entry;
+    }
+
+    /*
+    Drop the columns overlapping a range of a symbol
+
+    @param symbol dpu symbol
+    @param offset start of the range from the symbol
+    @param length length of the range
+    */
+    void evict(const std::string &symbol, uint64_t offset, uint64_t length) {
+        for (auto it = columns.begin(); it != columns.end();) {
+            const resident_column &entry = it->second;
+            if (entry.symbol == symbol && entry.offset < offset + length &&
+                offset < (uint64_t) entry.offset + entry.length) {
+                it = columns.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    /*
+    Drop all columns, e.g. after the DPUs were reallocated
+    */
+    void clear() {
+        columns.clear();
+        symbols.clear();
+        loaded.clear();
+    }
+
+private:
+    /*
+    Drop the columns whose symbol is missing or at another address in the
+    loaded program
+    */
+    void drop_moved() {
+        for (auto it = symbols.begin(); it != symbols.end();) {
+            struct dpu_symbol_t symbol;
+            if (dpu_get_symbol(program, it->first.c_str(), &symbol) != DPU_OK ||
+                symbol.address != it->second) {
+                evict(it->first, 0, UINT32_MAX);
+                it = symbols.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    std::map<std::pair<std::string, std::string>, resident_column> columns;
+    // Address of the symbols holding resident columns in the loaded program
+    std::map<std::string, uint64_t> symbols;
+    struct dpu_program_t *program = nullptr;
+    // Binary of the program loaded on the DPUs
+    std::string loaded;
+    std::mutex rank_mutex;
+};
+
+column_catalog catalog;
+
+/*
+Make columns of a table resident in a region of a symbol, split evenly between
+the DPUs. Columns already resident in the region are reused, missing columns
+are scattered behind them if they fit, otherwise all columns are scattered
+again from the start of the region. Throws std::runtime_error before any
+transfer if the columns are larger than the region.
+
+@param system dpus to send to
+@param name name of the table in the catalog
+@param table arrow Table holding the columns
+@param columns names of the columns
+@param DstSymbol dpu destination symbol
+@param offset start of the region from the symbol
+@param size size of the region
+@param flag options for the transfer
+@param cat catalog of the dpus, e.g. of a group of ranks
+
+@returns: the offset of each column from the symbol
+*/
+std::vector<uint32_t> scatter_resident(dpu_set_t &system, const std::string &name, std::shared_ptr<arrow::Table> table,
+                                       std::vector<std::string> columns, const std::string &DstSymbol,
+                                       uint32_t offset, uint32_t size, dpu_sg_xfer_flags_t flag,
+                                       column_catalog &cat = catalog) {
+
+    uint32_t n = get_nr_dpus(system);
+    uint64_t rows = table->num_rows();
+
+    std::vector<uint32_t> col_offset(columns.size());
+    std::vector<uint32_t> col_length(columns.size());
+    std::vector<std::string> missing;
+    uint64_t place = offset;
+    uint64_t missing_length = 0;
+    uint64_t total_length = 0;
+    for (uint32_t col = 0; col < columns.size(); col++) {
+        uint32_t type_size = table->GetColumnByName(columns[col])->type()->layout().buffers[1].byte_width;
+        col_length[col] = (split_size(rows, n)*type_size + 7) & (-8);
+        total_length += col_length[col];
+
+        const resident_column *entry = cat.find(name, columns[col]);
+        if (entry != nullptr && !entry->broadcast && entry->symbol == DstSymbol && entry->rows == rows &&
+            entry->nr_dpus == n && entry->offset >= offset && entry->offset + entry->length <= offset + size) {
+            col_offset[col] = entry->offset;
+            place = entry->offset + entry->length > place ? entry->offset + entry->length : place;
+        } else {
+            missing.push_back(columns[col]);
+            missing_length += col_length[col];
+        }
+    }
+
+    if (missing.empty()) {
+        return col_offset;
+    }
+
+    // Nothing is sent if the columns can never fit, the region would overflow into the next one
+    if (total_length > size) {
+        throw std::runtime_error("Columns of " + name + " do not fit the region");
+    }
+
+    // Scatter all columns again if the missing ones do not fit behind the reused ones
+    if (place + missing_length > (uint64_t) offset + size) {
+        missing = columns;
+        place = offset;
+    }
+
+    std::vector<uint32_t> missing_offset = scatter_columns(system, table, missing, DstSymbol, place, flag);
+    for (uint32_t i = 0; i < missing.size(); i++) {
+        uint32_t col = std::find(columns.begin(), columns.end(), missing[i]) - columns.begin();
+        col_offset[col] = place + missing_offset[i];
+
+        resident_column entry = {.symbol = DstSymbol, .offset = col_offset[col], .length = col_length[col],
+                                 .type = table->GetColumnByName(missing[i])->type(), .rows = rows,
+                                 .nr_dpus = n, .broadcast = false};
+        cat.insert(name, missing[i], entry);
+    }
+
+    return col_offset;
+}
+
+/*
+Make a column of a table resident on every DPU, it is only broadcast if it is
+not already in place.
+
+@param system dpus to send to
+@param name name of the table in the catalog
+@param table arrow Table holding the column
+@param column name of the column
+@param DstSymbol dpu destination symbol
+@param offset offset from the dpu destination symbol
+@param flag options for the transfer
+@param cat catalog of the dpus, e.g. of a group of ranks
+*/
+void copy_resident(dpu_set_t &system, const std::string &name, std::shared_ptr<arrow::Table> table,
+                   std::string column, const std::string &DstSymbol, uint32_t offset,
+                   dpu_xfer_flags_t flag, column_catalog &cat = catalog) {
+
+    uint64_t rows = table->num_rows();
+    uint32_t n = get_nr_dpus(system);
+
+    const resident_column *entry = cat.find(name, column);
+    if (entry != nullptr && entry->broadcast && entry->symbol == DstSymbol && entry->offset == offset &&
+        entry->rows == rows && entry->nr_dpus == n) {
+        return;
+    }
+
+    copy_table(system, table, column, DstSymbol, offset, flag);
+
+    auto type = table->GetColumnByName(column)->type();
+    uint32_t length = (rows*type->layout().buffers[1].byte_width + 7) & (-8);
+    cat.insert(name, column, resident_column({.symbol = DstSymbol, .offset = offset, .length = length,
+                                                  .type = type, .rows = rows, .nr_dpus = n, .broadcast = true}));
+}
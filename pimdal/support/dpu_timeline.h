@@ -0,0 +1,136 @@
+#pragma once
+
+#include <dpu>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "timeline_event.h"
+#include "transfer_helper.h"
+
+#ifndef NR_TASKLETS
+#define NR_TASKLETS 16
+#endif
+
+// Names of the phases in timeline_event.h
+const char *timeline_phase_names[NR_PHASES] = {"partition", "histogram", "build", "probe", "barrier",
+                                            "bloom", "semi"};
+
+/*
+Timelines of the phases of every tasklet of every DPU, collected from the
+DPU programs built with TRACE after each launch. Every launch is placed on
+the timeline so that it ends when it is collected, in host time since the
+first launch. The timelines are written in the Chrome trace event format,
+one process per DPU and one thread per tasklet.
+*/
+class dpu_timeline {
+public:
+    /*
+    Collect the events of the last launch of all DPUs
+
+    @param system set of dpus
+    @param launch name of the launch
+    */
+    void collect(dpu_set_t &system, const std::string &launch) {
+        auto now = std::chrono::steady_clock::now();
+        if (launches.empty()) {
+            start = now;
+        }
+
+        std::vector<std::vector<uint32_t>> clocks_sec(nr_dpus, std::vector<uint32_t>(1));
+        get_vec(system, clocks_sec, 0, "CLOCKS_PER_SEC", DPU_XFER_DEFAULT);
+        std::vector<std::vector<uint64_t>> counts(nr_dpus, std::vector<uint64_t>(NR_TASKLETS));
+        get_vec(system, counts, 0, "timeline_count", DPU_XFER_DEFAULT);
+        std::vector<std::vector<uint64_t>> dropped(nr_dpus, std::vector<uint64_t>(NR_TASKLETS));
+        get_vec(system, dropped, 0, "timeline_dropped", DPU_XFER_DEFAULT);
+        std::vector<std::vector<timeline_event_t>> ring(nr_dpus, std::vector<timeline_event_t>(NR_TASKLETS*TIMELINE_EVENTS));
+        get_vec(system, ring, 0, "timeline_events", DPU_XFER_DEFAULT);
+
+        double cycles_us = clocks_sec[0][0] / 1e6;
+        uint64_t max_end = 0;
+        uint64_t nr_dropped = 0;
+        uint64_t nr_overwritten = 0;
+
+        for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+            for (uint32_t tasklet = 0; tasklet < NR_TASKLETS; tasklet++) {
+                uint64_t count = counts[dpu][tasklet];
+                uint64_t first = count > TIMELINE_EVENTS ? count - TIMELINE_EVENTS : 0;
+                nr_overwritten += first;
+                nr_dropped += dropped[dpu][tasklet];
+
+                for (uint64_t i = first; i < count; i++) {
+                    const timeline_event_t &e = ring[dpu][tasklet*TIMELINE_EVENTS + i % TIMELINE_EVENTS];
+                    events.push_back({(uint32_t) launches.size(), dpu, tasklet, e});
+                    max_end = std::max(max_end, e.end);
+                }
+            }
+        }
+
+        // The launch ended just before it was collected, but not before the previous one
+        double end_us = std::chrono::duration<double, std::micro>(now - start).count();
+        double begin_us = std::max(end_us - max_end / cycles_us, last_end_us);
+        launches.push_back({launch, begin_us, cycles_us});
+        last_end_us = begin_us + max_end / cycles_us;
+
+        if (nr_dropped > 0 || nr_overwritten > 0) {
+            std::cout << "Timeline of " << launch << ": " << nr_dropped << " repeated and "
+                      << nr_overwritten << " overwritten events not recorded" << std::endl;
+        }
+    }
+
+    /*
+    Write the collected timelines as Chrome trace event JSON, to the file in
+    the PIMDAL_TIMELINE environment variable or to dpu_timeline.json
+
+    @returns: the path of the written file
+    */
+    std::string write() {
+        const char *env_path = std::getenv("PIMDAL_TIMELINE");
+        std::string path = env_path != nullptr && env_path[0] != '\0' ? env_path : "dpu_timeline.json";
+
+        std::ofstream file(path);
+        file << "{\"traceEvents\": [\n";
+        for (uint32_t dpu = 0; dpu < nr_dpus; dpu++) {
+            file << (dpu == 0 ? "" : ",\n") << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << dpu
+                 << ", \"args\": {\"name\": \"DPU " << dpu << "\"}}";
+        }
+
+        for (auto const &t : events) {
+            const launch_info &launch = launches[t.launch];
+            file << ",\n{\"name\": \"" << timeline_phase_names[t.event.phase]
+                 << "\", \"cat\": \"" << launch.name << "\", \"ph\": \"X\", \"pid\": " << t.dpu
+                 << ", \"tid\": " << t.tasklet
+                 << ", \"ts\": " << launch.begin_us + t.event.begin / launch.cycles_us
+                 << ", \"dur\": " << (t.event.end - t.event.begin) / launch.cycles_us << "}";
+        }
+        file << "\n], \"displayTimeUnit\": \"ns\"}" << std::endl;
+
+        std::cout << "DPU timeline written to " << path << std::endl;
+
+        return path;
+    }
+
+private:
+    typedef struct launch_info {
+        std::string name;
+        double begin_us;
+        double cycles_us;
+    } launch_info;
+
+    typedef struct tasklet_event {
+        uint32_t launch;
+        uint32_t dpu;
+        uint32_t tasklet;
+        timeline_event_t event;
+    } tasklet_event;
+
+    std::vector<launch_info> launches;
+    std::vector<tasklet_event> events;
+    std::chrono::steady_clock::time_point start;
+    double last_end_us = 0;
+};
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <dpu>
+#include <dpu_management.h>
+
+#include <arrow/api.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Memory policy of mbind, from linux/mempolicy.h
+#define NUMA_MPOL_PREFERRED 1
+
+// Allocations from this size on are mapped directly and placed on the node
+#define NUMA_POOL_THRESHOLD (1 << 20)
+#define NUMA_HUGEPAGE_SIZE (2 << 20)
+
+/*
+A rank of a set of DPUs with the NUMA node it is attached to. Transfers on
+different ranks are independent and can be issued from separate host threads.
+*/
+typedef struct rank_info {
+    dpu_set_t rank;
+    uint32_t dpu_base;
+    uint32_t nr_dpus;
+    int node;
+} rank_info;
+
+/*
+Check if the host buffers and threads are placed on the NUMA node of the
+ranks, it can be turned off by setting PIMDAL_NO_NUMA in the environment
+to compare against the default placement.
+
+@returns: true if NUMA placement is enabled
+*/
+bool numa_enabled() {
+    static bool enabled = std::getenv("PIMDAL_NO_NUMA") == nullptr;
+
+    return enabled;
+}
+
+/*
+Get the NUMA node a rank is attached to
+
+@param rank a rank from DPU_RANK_FOREACH
+
+@returns: the node or -1 if it is unknown
+*/
+int rank_numa_node(dpu_set_t rank) {
+    if (rank.kind != DPU_SET_RANKS || rank.list.nr_ranks != 1) {
+        return -1;
+    }
+
+    return dpu_get_rank_numa_node(rank.list.ranks[0]);
+}
+
+/*
+Split a set of DPUs into its ranks
+
+@param system set of dpus
+
+@returns: the ranks with the index of their first DPU in the set
+*/
+std::vector<rank_info> get_ranks(dpu_set_t &system) {
+    std::vector<rank_info> ranks;
+
+    dpu_set_t rank;
+    uint32_t dpu_base = 0;
+    DPU_RANK_FOREACH(system, rank) {
+        uint32_t rank_dpus;
+        DPU_ASSERT(dpu_get_nr_dpus(rank, &rank_dpus));
+        ranks.push_back(rank_info({.rank = rank, .dpu_base = dpu_base, .nr_dpus = rank_dpus,
+                                   .node = rank_numa_node(rank)}));
+        dpu_base += rank_dpus;
+    }
+
+    return ranks;
+}
+
+/*
+Prefer a NUMA node for the pages of a memory range that were not touched yet.
+The range is shrunk to whole hugepages so that neighbouring ranges placed on
+other nodes are not affected.
+
+@param data start of the range
+@param length length of the range in bytes
+@param node NUMA node to place the pages on
+*/
+void bind_memory(void *data, uint64_t length, int node) {
+    if (node < 0 || !numa_enabled()) {
+        return;
+    }
+
+    uintptr_t start = ((uintptr_t) data + NUMA_HUGEPAGE_SIZE - 1) & ~((uintptr_t) NUMA_HUGEPAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t) data + length) & ~((uintptr_t) NUMA_HUGEPAGE_SIZE - 1);
+    if (end <= start) {
+        return;
+    }
+
+    unsigned long mask[4] = {0};
+    if (node >= (int) sizeof(mask)*8) {
+        return;
+    }
+    mask[node / 64] = 1UL << (node % 64);
+
+    syscall(SYS_mbind, start, end - start, NUMA_MPOL_PREFERRED, mask, sizeof(mask)*8 + 1, 0);
+}
+
+/*
+Arrow memory pool placing its buffers on a NUMA node. Large buffers are
+mapped with hugepages when some are reserved, otherwise transparent hugepages
+are requested, small buffers come from the default pool.
+*/
+class numa_memory_pool : public arrow::MemoryPool {
+public:
+    explicit numa_memory_pool(int node) : node(node) {}
+
+    arrow::Status Allocate(int64_t size, int64_t alignment, uint8_t **out) override {
+        if (size < NUMA_POOL_THRESHOLD) {
+            return arrow::default_memory_pool()->Allocate(size, alignment, out);
+        }
+
+        uint64_t length = map_length(size);
+        void *data = MAP_FAILED;
+        if (hugetlb) {
+            data = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            // Do not try again once the reserved hugepages are exhausted
+            if (data == MAP_FAILED) {
+                hugetlb = false;
+            }
+        }
+        if (data == MAP_FAILED) {
+            data = map_aligned(length);
+            if (data == MAP_FAILED) {
+                return arrow::Status::OutOfMemory("Could not map ", size, " bytes");
+            }
+            madvise(data, length, MADV_HUGEPAGE);
+        }
+
+        // The pages are placed when they are first touched, the mapping is
+        // aligned to hugepages so bind_memory covers all of it
+        bind_memory(data, length, node);
+
+        *out = reinterpret_cast<uint8_t*>(data);
+        account(size);
+
+        return arrow::Status::OK();
+    }
+
+    arrow::Status Reallocate(int64_t old_size, int64_t new_size, int64_t alignment, uint8_t **ptr) override {
+        if (old_size < NUMA_POOL_THRESHOLD && new_size < NUMA_POOL_THRESHOLD) {
+            return arrow::default_memory_pool()->Reallocate(old_size, new_size, alignment, ptr);
+        }
+
+        uint8_t *data;
+        ARROW_RETURN_NOT_OK(Allocate(new_size, alignment, &data));
+        std::memcpy(data, *ptr, old_size < new_size ? old_size : new_size);
+        Free(*ptr, old_size, alignment);
+        *ptr = data;
+
+        return arrow::Status::OK();
+    }
+
+    void Free(uint8_t *buffer, int64_t size, int64_t alignment) override {
+        if (size < NUMA_POOL_THRESHOLD) {
+            arrow::default_memory_pool()->Free(buffer, size, alignment);
+            return;
+        }
+
+        munmap(buffer, map_length(size));
+        allocated -= size;
+    }
+
+    int64_t bytes_allocated() const override {
+        return allocated.load();
+    }
+
+    int64_t max_memory() const override {
+        return max_allocated.load();
+    }
+
+    int64_t total_bytes_allocated() const {
+        return total_allocated.load();
+    }
+
+    int64_t num_allocations() const {
+        return nr_allocations.load();
+    }
+
+    std::string backend_name() const override {
+        return "numa";
+    }
+
+private:
+    static uint64_t map_length(int64_t size) {
+        return ((uint64_t) size + NUMA_HUGEPAGE_SIZE - 1) & ~((uint64_t) NUMA_HUGEPAGE_SIZE - 1);
+    }
+
+    /*
+    Map anonymous memory starting at a hugepage boundary, mmap only aligns to
+    small pages. One more hugepage is mapped and the unaligned ends are
+    unmapped again.
+
+    @param length length of the mapping, a multiple of the hugepage size
+
+    @returns: the mapping or MAP_FAILED
+    */
+    static void* map_aligned(uint64_t length) {
+        uint64_t padded = length + NUMA_HUGEPAGE_SIZE;
+        void *data = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            return MAP_FAILED;
+        }
+
+        uintptr_t start = (uintptr_t) data;
+        uintptr_t aligned = (start + NUMA_HUGEPAGE_SIZE - 1) & ~((uintptr_t) NUMA_HUGEPAGE_SIZE - 1);
+        if (aligned > start) {
+            munmap(data, aligned - start);
+        }
+        if (start + padded > aligned + length) {
+            munmap((void*) (aligned + length), start + padded - (aligned + length));
+        }
+
+        return (void*) aligned;
+    }
+
+    void account(int64_t size) {
+        int64_t current = allocated += size;
+        total_allocated += size;
+        nr_allocations++;
+
+        int64_t max = max_allocated.load();
+        while (current > max && !max_allocated.compare_exchange_weak(max, current)) {}
+    }
+
+    int node;
+    std::atomic<bool> hugetlb{true};
+    std::atomic<int64_t> allocated{0};
+    std::atomic<int64_t> max_allocated{0};
+    std::atomic<int64_t> total_allocated{0};
+    std::atomic<int64_t> nr_allocations{0};
+};
+
+/*
+Get the memory pool of a NUMA node, the pools are created on first use and
+live until the end of the program.
+
+@param node NUMA node, -1 if it is unknown
+
+@returns: the pool of the node or the default pool
+*/
+arrow::MemoryPool* numa_pool(int node) {
+    static std::map<int, std::unique_ptr<numa_memory_pool>> pools;
+    static std::mutex mutex;
+
+    if (!numa_enabled()) {
+        return arrow::default_memory_pool();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<numa_memory_pool> &pool = pools[node];
+    if (!pool) {
+        pool.reset(new numa_memory_pool(node));
+    }
+
+    return pool.get();
+}
+
+/*
+Get the CPUs of a NUMA node
+
+@param node NUMA node
+@param cpus set filled with the CPUs of the node
+
+@returns: false if the CPUs of the node are unknown
+*/
+bool node_cpus(int node, cpu_set_t &cpus) {
+    CPU_ZERO(&cpus);
+
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(file, list)) {
+        return false;
+    }
+
+    // The list is formatted like 0-15,32-47
+    std::stringstream ranges(list);
+    std::string range;
+    bool found = false;
+    while (std::getline(ranges, range, ',')) {
+        uint32_t first, last;
+        size_t dash = range.find('-');
+        first = std::stoul(range.substr(0, dash));
+        last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+
+        for (uint32_t cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &cpus);
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/*
+Pin the calling thread to the CPUs of a NUMA node while the object lives, the
+previous affinity is restored when it is destroyed. The threads of the OpenMP
+loops over the ranks are pinned to the node of the rank they work on.
+*/
+class numa_thread_scope {
+public:
+    explicit numa_thread_scope(int node) {
+        if (node < 0 || !numa_enabled()) {
+            return;
+        }
+
+        cpu_set_t cpus;
+        if (!node_cpus(node, cpus)) {
+            return;
+        }
+
+        pinned = pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) == 0 &&
+                 pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+    }
+
+    ~numa_thread_scope() {
+        if (pinned) {
+            pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+        }
+    }
+
+    numa_thread_scope(const numa_thread_scope&) = delete;
+    numa_thread_scope& operator=(const numa_thread_scope&) = delete;
+
+private:
+    cpu_set_t previous;
+    bool pinned = false;
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <dpu>
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdexcept>
+
+#include "numa.h"
+#include "catalog.h"
+
+/*
+A group of consecutive ranks of the allocated set. Queries running on
+different groups run concurrently, every group holds its own copy of the
+resident columns split between its DPUs.
+*/
+typedef struct rank_group {
+    // Set of the ranks of the group
+    dpu_set_t set;
+    uint32_t first_rank;
+    uint32_t nr_ranks;
+    uint32_t nr_dpus;
+    // NUMA node of the first rank of the group
+    int node;
+    column_catalog catalog;
+} rank_group;
+
+/*
+Number of DPUs needed to keep the columns of a table resident in a region of
+MRAM
+
+@param rows number of rows of the table
+@param row_size bytes of the resident columns of a row
+@param region_size bytes of the region on each DPU
+
+@returns: the number of DPUs
+*/
+uint32_t dpus_needed(uint64_t rows, uint32_t row_size, uint32_t region_size) {
+    // Every DPU holds a multiple of 8 rows, see split_length
+    uint64_t dpu_rows = (region_size / row_size) & (-8);
+
+    return (rows + dpu_rows - 1) / dpu_rows;
+}
+
+/*
+Scheduler running queries concurrently on disjoint groups of ranks. The ranks
+of the allocated set are split into groups of consecutive ranks holding as
+many DPUs as the data of a query needs, a worker thread per group runs the
+submitted queries on its group one after the other.
+*/
+class rank_scheduler {
+public:
+    /*
+    Split the ranks of a set into groups, ranks left over after the last
+    complete group are added to it
+
+    @param system allocated set of dpus, has to outlive the scheduler
+    @param group_dpus minimal number of DPUs of a group
+    */
+    rank_scheduler(dpu_set_t &system, uint32_t group_dpus) {
+        if (system.kind != DPU_SET_RANKS) {
+            throw std::invalid_argument("Only a set of ranks can be split into groups");
+        }
+
+        std::vector<rank_info> ranks = get_ranks(system);
+        for (uint32_t r = 0; r < ranks.size(); r++) {
+            if (ranks[r].rank.kind != DPU_SET_RANKS || ranks[r].rank.list.ranks != &system.list.ranks[r]) {
+                throw std::runtime_error("Ranks of the set are not in the order of its rank list");
+            }
+        }
+
+        uint32_t first = 0;
+        while (first < ranks.size()) {
+            uint32_t last = first;
+            uint32_t group_size = 0;
+            while (last < ranks.size() && group_size < group_dpus) {
+                group_size += ranks[last].nr_dpus;
+                last++;
+            }
+
+            if (group_size < group_dpus && !groups.empty()) {
+                rank_group &group = *groups.back();
+                group.nr_ranks += last - first;
+                group.set = rank_range(system, group.first_rank, group.nr_ranks);
+                group.nr_dpus += group_size;
+            } else {
+                std::unique_ptr<rank_group> group(new rank_group());
+                group->set = rank_range(system, first, last - first);
+                group->first_rank = first;
+                group->nr_ranks = last - first;
+                group->nr_dpus = group_size;
+                group->node = ranks[first].node;
+                groups.push_back(std::move(group));
+            }
+
+            first = last;
+        }
+
+        if (groups.size() == 1 && groups[0]->nr_dpus < group_dpus) {
+            std::cout << "Only " << groups[0]->nr_dpus << " of " << group_dpus << " DPUs available!" << std::endl;
+        }
+
+        for (auto &group : groups) {
+            workers.emplace_back(&rank_scheduler::work, this, group.get());
+        }
+    }
+
+    ~rank_scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        task_ready.notify_all();
+
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    /*
+    Queue a query, it runs on the next group that becomes free
+
+    @param task runs the query on a group
+    */
+    void submit(std::function<void(rank_group&)> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        task_ready.notify_one();
+    }
+
+    /*
+    Wait until all queued queries are done
+    */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [this]() { return tasks.empty() && running == 0; });
+    }
+
+    /*
+    Number of groups
+
+    @returns: the number of queries that can run at once
+    */
+    uint32_t nr_groups() const {
+        return groups.size();
+    }
+
+private:
+    /*
+    Set of consecutive ranks of a set, sharing the rank list of the set
+
+    @param system set of ranks
+    @param first index of the first rank in the set
+    @param nr_ranks number of ranks
+
+    @returns: the set of the ranks
+    */
+    static dpu_set_t rank_range(dpu_set_t &system, uint32_t first, uint32_t nr_ranks) {
+        dpu_set_t set = system;
+        set.list.ranks = system.list.ranks + first;
+        set.list.nr_ranks = nr_ranks;
+
+        return set;
+    }
+
+    void work(rank_group *group) {
+        // Host buffers of the queries of the group are allocated close to its ranks
+        numa_thread_scope scope(group->node);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            task_ready.wait(lock, [this]() { return stop || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+
+            std::function<void(rank_group&)> task = std::move(tasks.front());
+            tasks.pop_front();
+            running++;
+
+            lock.unlock();
+            // A failed query must neither end the worker nor keep wait() waiting for it
+            try {
+                task(*group);
+            }
+            catch (const std::exception &e) {
+                std::cerr << "Query on ranks " << group->first_rank << " to "
+                          << group->first_rank + group->nr_ranks - 1 << " failed: " << e.what() << std::endl;
+            }
+            lock.lock();
+
+            running--;
+            if (tasks.empty() && running == 0) {
+                all_done.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<rank_group>> groups;
+    std::vector<std::thread> workers;
+
+    std::deque<std::function<void(rank_group&)>> tasks;
+    uint32_t running = 0;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+};
@@ -0,0 +1,544 @@
+#pragma once
+
+#include <dpu>
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "scheduler.h"
+
+/*
+Connection a request arrived on, the file descriptor is closed once the client
+left and the replies of all its requests are sent
+*/
+class query_connection {
+public:
+    query_connection(int fd, bool owned) : fd(fd), owned(owned) {}
+
+    ~query_connection() {
+        if (owned) {
+            close(fd);
+        }
+    }
+
+    const int fd;
+    // Replies of concurrent queries are written one at a time
+    std::mutex mutex;
+
+private:
+    const bool owned;
+};
+
+/*
+A query request, one line of text with the query id followed by name=value
+parameters, e.g. "q6 date_start=1994-01-01 discount=6"
+*/
+typedef struct query_request {
+    std::string query;
+    std::map<std::string, std::string> params;
+    // Text of the request, returned with the result
+    std::string line;
+    std::shared_ptr<query_connection> connection;
+} query_request;
+
+/*
+Get a parameter of a request
+
+@param request query request
+@param name name of the parameter
+@param fallback value used when the request does not set the parameter
+
+@returns: the value of the parameter
+*/
+std::string request_param(const query_request &request, const std::string &name, const std::string &fallback) {
+    auto it = request.params.find(name);
+    if (it == request.params.end()) {
+        return fallback;
+    }
+
+    return it->second;
+}
+
+/*
+Get an integer parameter of a request, throws std::invalid_argument if the
+value is not a number
+
+@param request query request
+@param name name of the parameter
+@param fallback value used when the request does not set the parameter
+
+@returns: the value of the parameter
+*/
+int64_t request_int(const query_request &request, const std::string &name, int64_t fallback) {
+    auto it = request.params.find(name);
+    if (it == request.params.end()) {
+        return fallback;
+    }
+
+    size_t end = 0;
+    int64_t value = 0;
+    try {
+        value = std::stoll(it->second, &end);
+    }
+    catch (const std::logic_error &) {
+        end = 0;
+    }
+    if (end == 0 || end != it->second.size()) {
+        throw std::invalid_argument(name);
+    }
+
+    return value;
+}
+
+/*
+Get a date parameter of a request, throws std::invalid_argument if the value
+is not a date in the format YYYY-MM-DD
+
+@param request query request
+@param name name of the parameter
+@param fallback value used when the request does not set the parameter
+
+@returns: the value of the parameter
+*/
+std::string request_date(const query_request &request, const std::string &name, const std::string &fallback) {
+    std::string value = request_param(request, name, fallback);
+
+    struct tm date = {};
+    const char *end = strptime(value.c_str(), "%Y-%m-%d", &date);
+    if (end == nullptr || *end != '\0') {
+        throw std::invalid_argument(name);
+    }
+
+    return value;
+}
+
+/*
+Get a string parameter of a request that is copied to a fixed size field of
+the DPU arguments, throws std::invalid_argument if it does not fit
+
+@param request query request
+@param name name of the parameter
+@param fallback value used when the request does not set the parameter
+@param size size of the field including the terminating null
+
+@returns: the value of the parameter
+*/
+std::string request_string(const query_request &request, const std::string &name, const std::string &fallback,
+                           size_t size) {
+    std::string value = request_param(request, name, fallback);
+    if (value.size() >= size) {
+        throw std::invalid_argument(name);
+    }
+
+    return value;
+}
+
+/*
+Parse a request line
+
+@param line text of the request
+@param request parsed request
+
+@returns: false if the line holds no query id or a malformed parameter
+*/
+bool parse_request(const std::string &line, query_request &request) {
+    std::istringstream stream(line);
+    request.query.clear();
+    request.params.clear();
+    request.line = line;
+
+    if (!(stream >> request.query)) {
+        return false;
+    }
+
+    std::string param;
+    while (stream >> param) {
+        size_t split = param.find('=');
+        if (split == std::string::npos || split == 0) {
+            return false;
+        }
+        request.params[param.substr(0, split)] = param.substr(split + 1);
+    }
+
+    return true;
+}
+
+/*
+Arrow output stream writing to a file descriptor that stays open when the
+stream is closed, so every reply can be written as its own IPC stream
+*/
+class fd_output_stream : public arrow::io::OutputStream {
+public:
+    explicit fd_output_stream(int fd) : fd(fd) {}
+
+    arrow::Status Close() override {
+        is_closed = true;
+        return arrow::Status::OK();
+    }
+
+    bool closed() const override {
+        return is_closed;
+    }
+
+    arrow::Result<int64_t> Tell() const override {
+        return position;
+    }
+
+    arrow::Status Write(const void *data, int64_t nbytes) override {
+        const uint8_t *bytes = (const uint8_t*) data;
+        while (nbytes > 0) {
+            ssize_t written = ::write(fd, bytes, nbytes);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return arrow::Status::IOError("Could not write reply: ", std::strerror(errno));
+            }
+            bytes += written;
+            nbytes -= written;
+            position += written;
+        }
+
+        return arrow::Status::OK();
+    }
+
+    using arrow::io::OutputStream::Write;
+
+private:
+    int fd;
+    int64_t position = 0;
+    bool is_closed = false;
+};
+
+/*
+Long-running query server. Requests are read one per line from stdin or from
+the clients of a local Unix socket, one client at a time, and every result is
+written back as an Arrow IPC stream. The DPUs stay allocated and the tables
+resident between requests, so a request only pays for its kernels and the
+result transfer. The request line is attached to the schema metadata of its
+result under the key "request", as concurrent queries may answer out of order.
+
+In stdin mode the results are written to stdout, the logs of the host and the
+DPUs are moved to stderr so they do not corrupt the result streams.
+*/
+class query_server {
+public:
+    ~query_server() {
+        if (listener >= 0) {
+            close(listener);
+            unlink(socket_path.c_str());
+        }
+    }
+
+    /*
+    Start the server if the command line asks for it, with --server for stdin
+    or --socket <path> for a Unix socket
+
+    @param argc number of arguments
+    @param argv command line arguments
+
+    @returns: true if the server was started
+    */
+    bool open(int argc, char **argv) {
+        bool serve = false;
+        for (int arg = 1; arg < argc; arg++) {
+            std::string name = argv[arg];
+            if (name == "--server") {
+                serve = true;
+            } else if (name == "--socket" && arg + 1 < argc) {
+                socket_path = argv[++arg];
+                serve = true;
+            } else {
+                std::cout << "Unknown argument " << name << std::endl;
+            }
+        }
+
+        if (!serve) {
+            return false;
+        }
+
+        if (socket_path.empty()) {
+            // Keep stdout for the results and send everything else to stderr
+            std::cout.flush();
+            fflush(stdout);
+            int out = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+            client = std::make_shared<query_connection>(out, false);
+            return out >= 0;
+        }
+
+        // A client disconnecting during a reply must not stop the server
+        signal(SIGPIPE, SIG_IGN);
+
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            std::cout << "Socket path too long!" << std::endl;
+            return false;
+        }
+        std::strcpy(addr.sun_path, socket_path.c_str());
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socket_path.c_str());
+        if (listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+            listen(listener, 1) != 0) {
+            std::cout << "Could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        std::cout << "Listening on " << socket_path << std::endl;
+        return true;
+    }
+
+    /*
+    Wait for the next request, requests that cannot be parsed are answered
+    with an error
+
+    @param request next request
+
+    @returns: false when stdin is closed or the socket fails
+    */
+    bool next(query_request &request) {
+        std::string line;
+        while (read_line(line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            bool parsed = parse_request(line, request);
+            request.connection = client;
+            if (parsed) {
+                return true;
+            }
+            reply_error(request, "Malformed request: " + line);
+        }
+
+        return false;
+    }
+
+    /*
+    Send a result as an Arrow IPC stream on the connection of its request
+
+    @param request request the result answers
+    @param table result of the query
+    */
+    void reply(const query_request &request, std::shared_ptr<arrow::Table> table) {
+        auto metadata = table->schema()->metadata() ? table->schema()->metadata()->Copy()
+                                                    : std::make_shared<arrow::KeyValueMetadata>();
+        metadata->Append("request", request.line);
+        table = table->ReplaceSchemaMetadata(metadata);
+
+        const std::lock_guard<std::mutex> lock(request.connection->mutex);
+        fd_output_stream stream(request.connection->fd);
+        auto writer_try = arrow::ipc::MakeStreamWriter(&stream, table->schema());
+        if (!writer_try.ok()) {
+            std::cout << writer_try.status().ToString() << std::endl;
+            return;
+        }
+        auto writer = *writer_try;
+
+        arrow::Status status = writer->WriteTable(*table);
+        if (status.ok()) {
+            status = writer->Close();
+        }
+        if (!status.ok()) {
+            std::cout << status.ToString() << std::endl;
+        }
+    }
+
+    /*
+    Send an error as a table with a single row in the column "error"
+
+    @param request request the error answers
+    @param message description of the error
+    */
+    void reply_error(const query_request &request, const std::string &message) {
+        std::cout << message << std::endl;
+
+        arrow::StringBuilder builder;
+        std::shared_ptr<arrow::Array> array;
+        if (!builder.Append(message).ok() || !builder.Finish(&array).ok()) {
+            return;
+        }
+
+        auto schema = arrow::schema({arrow::field("error", arrow::utf8(), false)});
+        reply(request, arrow::Table::Make(schema, {array}));
+    }
+
+private:
+    /*
+    Read the next line of the current client, waiting for a new client when
+    the current one disconnects
+    */
+    bool read_line(std::string &line) {
+        if (listener < 0) {
+            return (bool) std::getline(std::cin, line);
+        }
+
+        line.clear();
+        while (true) {
+            if (client == nullptr) {
+                int fd = accept(listener, nullptr, nullptr);
+                if (fd < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    std::cout << "Could not accept client: " << std::strerror(errno) << std::endl;
+                    return false;
+                }
+                client = std::make_shared<query_connection>(fd, true);
+                pending.clear();
+            }
+
+            size_t end = pending.find('\n');
+            if (end != std::string::npos) {
+                line = pending.substr(0, end);
+                pending.erase(0, end + 1);
+                return true;
+            }
+
+            char buffer[4096];
+            ssize_t length = read(client->fd, buffer, sizeof(buffer));
+            if (length < 0 && errno == EINTR) {
+                continue;
+            }
+            if (length <= 0) {
+                // Closed once the replies still running for the client are sent
+                client = nullptr;
+                continue;
+            }
+            pending.append(buffer, length);
+        }
+    }
+
+    std::string socket_path;
+    int listener = -1;
+    // Connection of the current client, or stdout in stdin mode
+    std::shared_ptr<query_connection> client;
+    // Bytes received from the client after the last complete line
+    std::string pending;
+};
+
+/*
+Check that a request is for the query of the server and only sets its
+parameters, otherwise answer it with an error
+
+@param server started query server
+@param request request to check
+@param query id of the query
+@param params names of the parameters of the query
+
+@returns: true if the request can run
+*/
+bool check_request(query_server &server, const query_request &request, const std::string &query,
+                   const std::vector<std::string> &params) {
+
+    if (request.query != query) {
+        server.reply_error(request, "Unknown query " + request.query + ", this server runs " + query);
+        return false;
+    }
+
+    for (auto const &param : request.params) {
+        if (std::find(params.begin(), params.end(), param.first) == params.end()) {
+            server.reply_error(request, "Unknown parameter " + param.first + " for " + query);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+Run a query for a request and send its result, queries with malformed
+parameters, tables not fitting the MRAM, failing on the DPUs or on the host are
+answered with an error
+
+@param server started query server
+@param request request to answer
+@param run runs the query for the request and returns its result
+*/
+void answer_request(query_server &server, const query_request &request,
+                    std::function<std::shared_ptr<arrow::Table>()> run) {
+    try {
+        server.reply(request, run());
+    }
+    catch (const std::invalid_argument &e) {
+        server.reply_error(request, "Invalid parameter " + std::string(e.what()) + " for " + request.query);
+    }
+    catch (const std::runtime_error &e) {
+        server.reply_error(request, e.what());
+    }
+    // E.g. std::bad_alloc for a large result, the server keeps answering the others
+    catch (const std::exception &e) {
+        server.reply_error(request, "Internal error " + std::string(e.what()) + " for " + request.query);
+    }
+}
+
+/*
+Answer the requests of a server for one query, one at a time on all DPUs,
+until the server stops. The phases of every request are traced as a run.
+
+@param server started query server
+@param query id of the query
+@param params names of the parameters of the query
+@param run runs the query for a request and returns its result
+*/
+void serve_queries(query_server &server, const std::string &query, const std::vector<std::string> &params,
+                   std::function<std::shared_ptr<arrow::Table>(const query_request&)> run) {
+
+    query_request request;
+    while (server.next(request)) {
+        if (check_request(server, request, query, params)) {
+            trace.begin(request.query, nr_dpus);
+            answer_request(server, request, [&run, &request]() { return run(request); });
+            // Results may be sent on stdout, only a trace file is written
+            trace.end(false);
+        }
+    }
+}
+
+/*
+Answer the requests of a server for one query until the server stops, every
+request runs on the next free group of ranks so that requests run
+concurrently on disjoint ranks. The requests are not traced, their phases
+would overlap in the trace.
+
+@param server started query server
+@param scheduler groups of ranks the queries run on
+@param query id of the query
+@param params names of the parameters of the query
+@param run runs the query for a request on a group and returns its result
+*/
+void serve_queries(query_server &server, rank_scheduler &scheduler, const std::string &query,
+                   const std::vector<std::string> &params,
+                   std::function<std::shared_ptr<arrow::Table>(rank_group&, const query_request&)> run) {
+
+    query_request request;
+    while (server.next(request)) {
+        if (check_request(server, request, query, params)) {
+            scheduler.submit([&server, run, request](rank_group &group) {
+                answer_request(server, request, [&run, &request, &group]() { return run(group, request); });
+            });
+        }
+    }
+
+    scheduler.wait();
+}
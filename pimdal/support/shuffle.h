@@ -0,0 +1,264 @@
+#pragma once
+
+#include <dpu>
+
+#include <arrow/api.h>
+#include <omp.h>
+
+#include "transfer_helper.h"
+#include "skew.h"
+
+/*
+All-to-all shuffle of partitioned columns between the DPUs. Every source DPU
+holds its rows ordered by destination DPU, starting at the beginning of the
+region, all columns of a table share the same partitioning, so the offsets are
+computed once per table and reused for every payload column.
+*/
+typedef struct shuffle_plan {
+    // Element offset of the partition for each destination on each source DPU,
+    // [src][dst] with nr_dpus+1 entries per source
+    std::vector<std::vector<uint64_t>> offset;
+    // Element offset of the partition from each source in the data of each
+    // destination DPU, [dst][src] with nr_dpus+1 entries per destination
+    std::vector<std::vector<uint64_t>> dst_offset;
+    // Number of elements each destination DPU receives
+    std::vector<uint64_t> counts;
+    uint64_t max_count;
+} shuffle_plan;
+
+// A payload column, gathered in destination order by shuffle_gather
+typedef struct shuffle_column {
+    std::shared_ptr<arrow::Buffer> data;
+    uint32_t type_size;
+    // Offset of the column from the destination symbol
+    uint32_t offset;
+} shuffle_column;
+
+typedef struct sg_xfer_context_shuffle {
+    uint8_t *data;
+    const shuffle_plan *plan;
+    const std::vector<uint64_t> *dst_base;
+    uint8_t *padding;
+    uint32_t type_size;
+    uint32_t dpu_base;
+} sg_xfer_context_shuffle;
+
+/*
+Build the offsets of a shuffle from the partition sizes of every source DPU.
+The number of elements each destination receives is reported to the trace,
+see skew.h.
+
+@param sizes partition sizes read from the DPUs, one row per source DPU
+@param cumulative the rows hold nr_dpus+1 running offsets instead of nr_dpus sizes
+@param name name of the shuffled table in the trace
+
+@returns: the offsets and the per destination counts of the shuffle
+*/
+shuffle_plan plan_shuffle(const std::vector<std::vector<uint64_t>> &sizes, bool cumulative,
+                          const std::string &name) {
+    uint32_t n = sizes.size();
+
+    shuffle_plan plan;
+    plan.offset.assign(n, std::vector<uint64_t>(n + 1, 0));
+    plan.dst_offset.assign(n, std::vector<uint64_t>(n + 1, 0));
+    plan.counts.assign(n, 0);
+    plan.max_count = 0;
+
+    for (uint32_t src = 0; src < n; src++) {
+        if (cumulative) {
+            plan.offset[src].assign(sizes[src].begin(), sizes[src].begin() + n + 1);
+        } else {
+            for (uint32_t dst = 0; dst < n; dst++) {
+                plan.offset[src][dst + 1] = plan.offset[src][dst] + sizes[src][dst];
+            }
+        }
+    }
+
+    for (uint32_t dst = 0; dst < n; dst++) {
+        for (uint32_t src = 0; src < n; src++) {
+            plan.dst_offset[dst][src + 1] = plan.dst_offset[dst][src]
+                                          + plan.offset[src][dst + 1] - plan.offset[src][dst];
+        }
+        plan.counts[dst] = plan.dst_offset[dst][n];
+
+        if (plan.counts[dst] > plan.max_count) {
+            plan.max_count = plan.counts[dst];
+        }
+    }
+    report_sizes(name, plan.counts);
+
+    return plan;
+}
+
+/*
+Byte offset of the data of each destination DPU in a gathered column, the
+data of each destination is padded to 8 bytes.
+
+@param plan offsets of the shuffle
+@param type_size size of an element in bytes
+
+@returns: nr_dpus+1 byte offsets
+*/
+std::vector<uint64_t> shuffle_layout(const shuffle_plan &plan, uint32_t type_size) {
+    std::vector<uint64_t> dst_base(plan.counts.size() + 1, 0);
+    for (uint32_t dst = 0; dst < plan.counts.size(); dst++) {
+        dst_base[dst + 1] = dst_base[dst] + ((plan.counts[dst]*type_size + 7) & (-8));
+    }
+
+    return dst_base;
+}
+
+static bool get_gather_ptr(struct sg_block_info *out, uint32_t dpu_index, uint32_t block_index,
+                           void *args) {
+
+    sg_xfer_context_shuffle *sc_args = reinterpret_cast<sg_xfer_context_shuffle*>(args);
+
+    uint32_t src = sc_args->dpu_base + dpu_index;
+    uint32_t n = sc_args->plan->counts.size();
+    const std::vector<uint64_t> &offset = sc_args->plan->offset[src];
+
+    // One block for each destination DPU
+    if (block_index < n) {
+        uint32_t dst = block_index;
+        out->length = (offset[dst + 1] - offset[dst])*sc_args->type_size;
+        out->addr = sc_args->data + (*sc_args->dst_base)[dst]
+                  + sc_args->plan->dst_offset[dst][src]*sc_args->type_size;
+        return true;
+    }
+
+    // The padding of the source to 8 bytes is discarded
+    if (block_index == n) {
+        uint64_t length = offset[n]*sc_args->type_size;
+        out->length = ((length + 7) & (-8)) - length;
+        out->addr = sc_args->padding;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+Copy a partitioned column from every source DPU to the host, each rank is
+read by a thread pinned to its NUMA node. Only the filled part of each source
+is transferred, padded to 8 bytes, and every partition is written directly to
+its place in the data of its destination DPU.
+
+@param system dpus to gather from
+@param plan offsets of the shuffle
+@param type_size size of an element in bytes
+@param SrcSymbol dpu source symbol
+@param offset offset from the dpu source symbol
+
+@returns: the column in destination order, laid out as given by shuffle_layout
+*/
+std::shared_ptr<arrow::Buffer> shuffle_gather(dpu_set_t &system, const shuffle_plan &plan, uint32_t type_size,
+                                              const std::string &SrcSymbol, uint32_t offset) {
+
+    trace_scope scope("shuffle");
+
+    std::vector<rank_info> ranks = get_ranks(system);
+    std::vector<uint64_t> dst_base = shuffle_layout(plan, type_size);
+    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
+
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(dst_base.back(), numa_pool(-1));
+    if (!buffer_try.ok()) {
+        std::cout << "Could not allocate buffer!" << std::endl;
+    }
+    std::shared_ptr<arrow::Buffer> buffer = *std::move(buffer_try);
+
+    // The data of each destination is placed on the node of its rank, where
+    // shuffle_scatter reads it
+    for (auto &rank : ranks) {
+        bind_memory(buffer->mutable_data() + dst_base[rank.dpu_base],
+                    dst_base[rank.dpu_base + rank.nr_dpus] - dst_base[rank.dpu_base], rank.node);
+    }
+
+    // Exceptions cannot leave the parallel loop, the errors of the ranks are checked after it
+    std::vector<dpu_error_t> errors(ranks.size(), DPU_OK);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (uint32_t r = 0; r < ranks.size(); r++) {
+        numa_thread_scope pin(ranks[r].node);
+
+        uint64_t max_length = 0;
+        for (uint32_t dpu = 0; dpu < ranks[r].nr_dpus; dpu++) {
+            uint64_t length = (plan.offset[ranks[r].dpu_base + dpu].back()*type_size + 7) & (-8);
+            max_length = length > max_length ? length : max_length;
+        }
+
+        if (max_length == 0) {
+            continue;
+        }
+
+        uint8_t padding[8];
+        sg_xfer_context_shuffle sc_args = {.data = buffer->mutable_data(), .plan = &plan, .dst_base = &dst_base,
+                                           .padding = padding, .type_size = type_size, .dpu_base = ranks[r].dpu_base};
+        get_block_t get_block_info = {.f = &get_gather_ptr, .args = &sc_args, .args_size = sizeof(sc_args)};
+
+        errors[r] = dpu_push_sg_xfer(ranks[r].rank, DPU_XFER_FROM_DPU, SrcSymbol.c_str(), offset,
+                                     max_length, &get_block_info, flag);
+    }
+    for (dpu_error_t error : errors) {
+        dpu_check(error, "dpu_push_sg_xfer from " + SrcSymbol);
+    }
+    trace_bytes("shuffle", dst_base.back());
+
+    return buffer;
+}
+
+/*
+Send the gathered columns to their destination DPU. Each rank is handled by
+its own host thread, pinned to the NUMA node of the rank, and receives all
+columns before the next rank is started on that thread.
+
+@param system dpus to scatter to
+@param plan offsets of the shuffle
+@param columns payload columns gathered with shuffle_gather
+@param DstSymbol dpu destination symbol
+*/
+void shuffle_scatter(dpu_set_t &system, const shuffle_plan &plan, const std::vector<shuffle_column> &columns,
+                     const std::string &DstSymbol) {
+
+    trace_scope scope("shuffle");
+
+    std::vector<rank_info> ranks = get_ranks(system);
+    dpu_sg_xfer_flags_t flag = dpu_sg_xfer_flags_t(DPU_SG_XFER_DEFAULT | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
+
+    // Exceptions cannot leave the parallel loop, the errors of the ranks are checked after it
+    std::vector<dpu_error_t> errors(ranks.size(), DPU_OK);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (uint32_t r = 0; r < ranks.size(); r++) {
+        numa_thread_scope pin(ranks[r].node);
+
+        for (auto &column : columns) {
+            std::vector<uint64_t> dst_base = shuffle_layout(plan, column.type_size);
+
+            // The data of the destinations of this rank, a single block per DPU
+            std::vector<uint64_t> rank_base(dst_base.begin() + ranks[r].dpu_base,
+                                            dst_base.begin() + ranks[r].dpu_base + ranks[r].nr_dpus + 1);
+            uint64_t max_length = 0;
+            for (uint32_t dpu = 0; dpu < ranks[r].nr_dpus; dpu++) {
+                uint64_t length = rank_base[dpu + 1] - rank_base[dpu];
+                max_length = length > max_length ? length : max_length;
+            }
+
+            if (max_length == 0 || errors[r] != DPU_OK) {
+                continue;
+            }
+
+            sg_xfer_context_buf sc_args = {.buffer = column.data, .offset = rank_base};
+            get_block_t get_block_info = {.f = &get_buf_ptr, .args = &sc_args, .args_size = sizeof(sc_args)};
+
+            errors[r] = dpu_push_sg_xfer(ranks[r].rank, DPU_XFER_TO_DPU, DstSymbol.c_str(), column.offset,
+                                         max_length, &get_block_info, flag);
+        }
+    }
+    for (dpu_error_t error : errors) {
+        dpu_check(error, "dpu_push_sg_xfer to " + DstSymbol);
+    }
+
+    for (auto &column : columns) {
+        trace_bytes("shuffle", shuffle_layout(plan, column.type_size).back());
+    }
+}
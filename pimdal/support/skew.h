@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+/*
+Distribution of a set of partition sizes
+
+@param sizes number of elements of each partition
+
+@returns: the minimum, maximum, mean and standard deviation of the sizes
+*/
+size_stats compute_size_stats(const std::vector<uint64_t> &sizes) {
+    size_stats stats;
+    stats.n = sizes.size();
+    if (sizes.empty()) {
+        return stats;
+    }
+
+    stats.min = *std::min_element(sizes.begin(), sizes.end());
+    stats.max = *std::max_element(sizes.begin(), sizes.end());
+
+    double sum = 0;
+    for (uint64_t size : sizes) {
+        sum += size;
+    }
+    stats.mean = sum / sizes.size();
+
+    double sum_sq = 0;
+    for (uint64_t size : sizes) {
+        sum_sq += (size - stats.mean) * (size - stats.mean);
+    }
+    stats.stddev = std::sqrt(sum_sq / sizes.size());
+
+    return stats;
+}
+
+/*
+Check if full histograms are dumped, hosts read partition sizes they do not
+need otherwise only in this case
+
+@returns: true if PIMDAL_HISTOGRAMS is set
+*/
+bool dump_histograms() {
+    const char *path = std::getenv("PIMDAL_HISTOGRAMS");
+    return path != nullptr && path[0] != '\0';
+}
+
+/*
+Add the distribution of a set of partition sizes to the trace of the current
+run. With the PIMDAL_HISTOGRAMS environment variable set to a file, all sizes
+are appended to it as one JSON line.
+
+@param name name of the partitions
+@param sizes number of elements of each partition
+*/
+void report_sizes(const std::string &name, const std::vector<uint64_t> &sizes) {
+    std::string unique = trace.add_skew(name, compute_size_stats(sizes));
+
+    if (!dump_histograms()) {
+        return;
+    }
+
+    std::ofstream file(std::getenv("PIMDAL_HISTOGRAMS"), std::ofstream::app);
+    file << "{\"run\": \"" << trace.name() << "\", \"name\": \"" << unique << "\", \"sizes\": [";
+    for (uint64_t i = 0; i < sizes.size(); i++) {
+        file << (i == 0 ? "" : ", ") << sizes[i];
+    }
+    file << "]}" << std::endl;
+}
+
+/*
+Report the partition sizes after every pass of a multi-pass radix
+partitioning. Each pass splits every partition into fanout partitions, so the
+partitions of a pass are consecutive groups of the final partitions.
+
+@param name name of the partitioning, the passes are reported as name_pass1...
+@param offsets nr_parts+1 running offsets of the final partitions on each DPU
+@param fanout partitions created from a partition in a pass
+*/
+void report_passes(const std::string &name, const std::vector<std::vector<uint64_t>> &offsets, uint32_t fanout) {
+    if (offsets.empty() || offsets[0].size() < 2) {
+        return;
+    }
+    uint64_t nr_parts = offsets[0].size() - 1;
+
+    uint32_t pass = 1;
+    for (uint64_t pass_parts = std::min<uint64_t>(fanout, nr_parts); ; pass++) {
+        uint64_t step = nr_parts / pass_parts;
+
+        std::vector<uint64_t> sizes;
+        sizes.reserve(offsets.size() * pass_parts);
+        for (auto const &dpu_offsets : offsets) {
+            for (uint64_t part = 0; part < pass_parts; part++) {
+                sizes.push_back(dpu_offsets[(part + 1) * step] - dpu_offsets[part * step]);
+            }
+        }
+        report_sizes(name + "_pass" + std::to_string(pass), sizes);
+
+        if (pass_parts == nr_parts) {
+            break;
+        }
+        pass_parts = std::min<uint64_t>(pass_parts * fanout, nr_parts);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef _TIMELINE_EVENT_H_
+#define _TIMELINE_EVENT_H_
+
+#include <stdint.h>
+
+// Events kept per tasklet in MRAM, older events are overwritten
+#define TIMELINE_EVENTS 256
+// Events recorded per phase and tasklet in a launch, later ones are only counted
+#define TIMELINE_PHASE_EVENTS 32
+// Maximal number of open phases of a tasklet
+#define TIMELINE_DEPTH 4
+
+// Phases of the DPU kernels, names in dpu_timeline.h
+typedef enum {
+    PHASE_PARTITION,
+    PHASE_HISTOGRAM,
+    PHASE_BUILD,
+    PHASE_PROBE,
+    PHASE_BARRIER,
+    PHASE_BLOOM,
+    PHASE_SEMI,
+    NR_PHASES
+} timeline_phase_t;
+
+// Begin and end of a phase in cycles since the start of the launch
+typedef struct {
+    uint32_t phase;
+    uint32_t depth;
+    uint64_t begin;
+    uint64_t end;
+} timeline_event_t;
+
+#endif
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+Time and bytes accumulated by the scopes of one phase of a run
+*/
+typedef struct trace_phase {
+    double ms = 0;
+    uint64_t bytes = 0;
+    uint32_t scopes = 0;
+} trace_phase;
+
+/*
+Distribution of the sizes of a set of partitions
+*/
+typedef struct size_stats {
+    uint64_t n = 0;
+    uint64_t min = 0;
+    uint64_t max = 0;
+    double mean = 0;
+    double stddev = 0;
+} size_stats;
+
+/*
+Breakdown of the host time of a run into named phases. The phases used by
+the benchmarks are
+
+    to_dpu      CPU to DPU transfers
+    dpu_load    loading DPU programs
+    dpu_launch  DPU kernels, including waiting for asynchronous work
+    from_dpu    DPU to CPU transfers
+    shuffle     exchanges between the DPUs through the host
+    host        host post-processing of the DPU results
+
+Scopes add their time to a phase and the transfer helpers add the bytes they
+move. Scopes running at the same time on several threads, e.g. the callbacks
+of the ranks, overlap, so the phases do not have to add up to the total.
+The line of a run also holds the skew of the partitions it reported, see
+skew.h. Every run is written as one JSON line to stdout, or appended to the
+file in the PIMDAL_TRACE environment variable.
+*/
+class host_trace {
+public:
+    /*
+    Start a new run, dropping the phases of the previous one
+
+    @param name name of the benchmark or query
+    @param dpus number of DPUs the run uses
+    */
+    void begin(const std::string &name, uint32_t dpus) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        run = name;
+        nr_dpus = dpus;
+        phases.clear();
+        skew.clear();
+        skew_order.clear();
+        start = std::chrono::steady_clock::now();
+    }
+
+    /*
+    Add time and bytes to a phase of the current run
+
+    @param phase name of the phase
+    @param ms time in milliseconds
+    @param bytes bytes moved
+    @param scopes number of scopes the time was measured in
+    */
+    void add(const std::string &phase, double ms, uint64_t bytes, uint32_t scopes) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        trace_phase &p = phases[phase];
+        p.ms += ms;
+        p.bytes += bytes;
+        p.scopes += scopes;
+    }
+
+    /*
+    Add the size distribution of a set of partitions to the current run
+
+    @param name name of the partitions, a suffix is added if the run already
+                has partitions of this name
+    @param stats distribution of the sizes
+
+    @returns: the name the partitions are reported under
+    */
+    std::string add_skew(const std::string &name, const size_stats &stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::string unique = name;
+        for (uint32_t i = 2; skew.count(unique) > 0; i++) {
+            unique = name + "_" + std::to_string(i);
+        }
+        skew[unique] = stats;
+        skew_order.push_back(unique);
+
+        return unique;
+    }
+
+    /*
+    Name of the current run
+    */
+    std::string name() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return run;
+    }
+
+    /*
+    Finish the current run and write its phases as a JSON line
+
+    @param to_stdout write the line to stdout if PIMDAL_TRACE is not set,
+                     false where stdout carries results, e.g. in server mode
+
+    @returns: the total time of the run in milliseconds
+    */
+    double end(bool to_stdout = true) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        const char *path = std::getenv("PIMDAL_TRACE");
+        std::ofstream file;
+        if (path != nullptr && path[0] != '\0') {
+            file.open(path, std::ofstream::app);
+        } else if (!to_stdout) {
+            return total;
+        }
+        std::ostream &out = file.is_open() ? file : std::cout;
+
+        out << "{\"run\": \"" << run << "\", \"nr_dpus\": " << nr_dpus << ", \"total_ms\": " << total
+            << ", \"phases\": {";
+        bool first = true;
+        for (auto const &e : phases) {
+            out << (first ? "" : ", ") << "\"" << e.first << "\": {\"ms\": " << e.second.ms
+                << ", \"bytes\": " << e.second.bytes << ", \"scopes\": " << e.second.scopes << "}";
+            first = false;
+        }
+        out << "}";
+        if (!skew.empty()) {
+            out << ", \"skew\": {";
+            first = true;
+            for (auto const &name : skew_order) {
+                const size_stats &s = skew[name];
+                out << (first ? "" : ", ") << "\"" << name << "\": {\"n\": " << s.n << ", \"min\": " << s.min
+                    << ", \"max\": " << s.max << ", \"mean\": " << s.mean << ", \"stddev\": " << s.stddev << "}";
+                first = false;
+            }
+            out << "}";
+        }
+        out << "}" << std::endl;
+
+        return total;
+    }
+
+private:
+    std::string run;
+    uint32_t nr_dpus = 0;
+    std::map<std::string, trace_phase> phases;
+    std::map<std::string, size_stats> skew;
+    // Partitions in the order they were reported
+    std::vector<std::string> skew_order;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::mutex mutex;
+};
+
+host_trace trace;
+
+class trace_scope;
+
+// Innermost open scope of the thread, receives the bytes of the transfers
+thread_local trace_scope *current_scope = nullptr;
+
+/*
+Measure the time until the end of the enclosing block as part of a phase.
+Transfers of the same thread while the scope is open count towards its
+phase, e.g. the transfers of a shuffle. A scope nested in a scope of the same
+phase only adds its bytes, so the time is not counted twice.
+*/
+class trace_scope {
+public:
+    /*
+    @param phase name of the phase
+    */
+    trace_scope(const std::string &phase) : phase(phase), outer(current_scope),
+                                            begin(std::chrono::steady_clock::now()) {
+        nested = outer != nullptr && outer->phase == phase;
+        current_scope = this;
+    }
+
+    ~trace_scope() {
+        current_scope = outer;
+
+        if (nested) {
+            outer->add_bytes(bytes);
+            return;
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        trace.add(phase, ms, bytes, 1);
+    }
+
+    void add_bytes(uint64_t n) {
+        bytes += n;
+    }
+
+private:
+    const std::string phase;
+    trace_scope *outer;
+    std::chrono::steady_clock::time_point begin;
+    uint64_t bytes = 0;
+    bool nested;
+};
+
+/*
+Count the bytes of a transfer towards the open scope of the thread, or
+towards a default phase outside of any scope
+
+@param phase phase of the transfer outside of a scope
+@param bytes bytes moved
+*/
+void trace_bytes(const std::string &phase, uint64_t bytes) {
+    if (current_scope != nullptr) {
+        current_scope->add_bytes(bytes);
+    } else {
+        trace.add(phase, 0, bytes, 0);
+    }
+}
+
+/*
+Run a function as a scope of a phase
+
+@param phase name of the phase
+@param f function to run
+
+@returns: the result of the function
+*/
+template <typename F>
+auto traced(const std::string &phase, F f) -> decltype(f()) {
+    trace_scope scope(phase);
+    return f();
+}
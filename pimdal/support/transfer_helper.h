@@ -1,25 +1,286 @@
+#pragma once
+
 #include <dpu>
 
 #include <arrow/api.h>
 #include <iostream>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "numa.h"
+#include "trace.h"
 
-#ifndef NR_DPU
-#define NR_DPU 4
-#endif
+/*
+Failed call to the DPU runtime. Unlike DPU_ASSERT, which exits the process,
+the error is thrown so that the query server can answer the request with it
+and keep serving.
+*/
+class dpu_call_error : public std::runtime_error {
+public:
+    dpu_call_error(dpu_error_t error, const std::string &call)
+        : std::runtime_error(call + " failed: " + describe(error)), error(error) {}
+
+    const dpu_error_t error;
+
+private:
+    static std::string describe(dpu_error_t error) {
+        char *str = dpu_error_to_string(error);
+        std::string description = str;
+        free(str);
+        return description;
+    }
+};
+
+/*
+Throw a dpu_call_error if a call to the DPU runtime failed
+
+@param error result of the call
+@param call the call, for the message of the error
+*/
+void dpu_check(dpu_error_t error, const std::string &call) {
+    if (error != DPU_OK) {
+        throw dpu_call_error(error, call);
+    }
+}
+
+#define DPU_CHECK(statement) dpu_check((statement), #statement)
+
+/*
+Run the body of a rank callback. Exceptions cannot leave the callback threads
+of the SDK, so a failing call is returned to the SDK instead and reported by
+the dpu_sync of the set.
+
+@param body work of the callback
+
+@returns: DPU_OK or the error of the failed call
+*/
+dpu_error_t guard_callback(const std::function<void()> &body) {
+    try {
+        body();
+    }
+    catch (const dpu_call_error &e) {
+        std::cerr << e.what() << std::endl;
+        return e.error;
+    }
+    catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return DPU_ERR_INTERNAL;
+    }
+
+    return DPU_OK;
+}
 
 typedef struct sg_xfer_context_table {
-    std::shared_ptr<arrow::Array> column;
+    std::shared_ptr<arrow::ChunkedArray> column;
     uint32_t type_size;
+    uint32_t nr_dpus;
 } sg_xfer_context_table;
 
+typedef struct sg_xfer_context_columns {
+    std::vector<std::shared_ptr<arrow::ChunkedArray>> columns;
+    std::vector<uint32_t> type_size;
+    std::vector<uint32_t> col_offset;
+    std::shared_ptr<arrow::Buffer> padding;
+    uint32_t nr_dpus;
+} sg_xfer_context_columns;
+
 typedef struct sg_xfer_context_buf {
     std::shared_ptr<arrow::Buffer> buffer;
     std::vector<uint64_t> offset;
 } sg_xfer_context_buf;
 
-std::vector<sg_xfer_context_table> sc_args_table;
-std::vector<sg_xfer_context_buf> sc_args_buf;
-std::vector<get_block_t> get_block_info;
+/*
+Pool of scatter-gather transfer contexts. The SDK keeps a pointer to the
+context until the transfer completes, so the contexts live in a deque whose
+elements never move and are only recycled once their transfer is done.
+Synchronous transfers release their context when the push returns,
+asynchronous ones through a callback queued behind the transfer.
+*/
+template <typename T>
+class xfer_pool {
+public:
+    typedef struct slot_t {
+        T args;
+        get_block_t block;
+        xfer_pool<T> *pool;
+    } slot_t;
+
+    /*
+    Get an unused context with a stable address
+
+    @param args arguments of the transfer
+    @param f function returning the blocks of the transfer
+
+    @returns: the context to pass to dpu_push_sg_xfer
+    */
+    slot_t* acquire(T args, bool (*f)(struct sg_block_info*, uint32_t, uint32_t, void*)) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        slot_t *slot;
+        if (free_slots.empty()) {
+            slots.emplace_back();
+            slot = &slots.back();
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+
+        slot->args = args;
+        slot->block = get_block_t({.f = f, .args = &slot->args, .args_size = sizeof(T)});
+        slot->pool = this;
+
+        return slot;
+    }
+
+    /*
+    Return a context to the pool once its transfer has completed
+
+    @param slot context to recycle
+    */
+    void release(slot_t *slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Drop the references to the transferred data
+        slot->args = T();
+        free_slots.push_back(slot);
+    }
+
+    /*
+    Push a scatter-gather transfer and recycle its context when it completes
+
+    @param system dpus to transfer with
+    @param slot context acquired from the pool
+    @param xfer direction of the transfer
+    @param symbol dpu symbol
+    @param offset offset from the dpu symbol
+    @param length maximum length transferred to each dpu
+    @param flag options for the transfer
+    */
+    void push(dpu_set_t system, slot_t *slot, dpu_xfer_t xfer, const std::string &symbol,
+              uint32_t offset, uint32_t length, dpu_sg_xfer_flags_t flag) {
+        dpu_error_t error = dpu_push_sg_xfer(system, xfer, symbol.c_str(), offset,
+                                             length, &slot->block, flag);
+        if (error != DPU_OK) {
+            release(slot);
+            dpu_check(error, "dpu_push_sg_xfer");
+        }
+
+        if (flag & DPU_SG_XFER_ASYNC) {
+            DPU_CHECK(dpu_callback(system, release_callback, slot,
+                                   dpu_callback_flags_t(DPU_CALLBACK_ASYNC | DPU_CALLBACK_SINGLE_CALL)));
+        } else {
+            release(slot);
+        }
+    }
+
+private:
+    static dpu_error_t release_callback(struct dpu_set_t rank, uint32_t rank_id, void *arg) {
+        slot_t *slot = reinterpret_cast<slot_t*>(arg);
+        slot->pool->release(slot);
+
+        return DPU_OK;
+    }
+
+    std::deque<slot_t> slots;
+    std::vector<slot_t*> free_slots;
+    std::mutex mutex;
+};
+
+xfer_pool<sg_xfer_context_table> sc_args_table;
+xfer_pool<sg_xfer_context_columns> sc_args_columns;
+xfer_pool<sg_xfer_context_buf> sc_args_buf;
+
+// Number of DPUs in the allocated set, set by alloc_dpus
+uint32_t nr_dpus = 0;
+
+/*
+Get the number of DPUs in a set
+
+@param system set of dpus
+
+@returns: the number of DPUs in the set
+*/
+uint32_t get_nr_dpus(dpu_set_t system) {
+    uint32_t n;
+    DPU_CHECK(dpu_get_nr_dpus(system, &n));
+    return n;
+}
+
+/*
+Allocate the DPUs and record their number in nr_dpus. All available DPUs are
+allocated unless the NR_DPUS environment variable requests a specific number.
+
+@param system allocated set of dpus
+@param pow2 round the number of DPUs down to a power of two, as required when
+            the DPUs partition their data between each other
+
+@returns: the number of allocated DPUs
+*/
+uint32_t alloc_dpus(dpu_set_t &system, bool pow2) {
+    uint32_t nr_alloc = DPU_ALLOCATE_ALL;
+    const char* env_dpus = std::getenv("NR_DPUS");
+    if (env_dpus != nullptr) {
+        nr_alloc = std::strtoul(env_dpus, nullptr, 10);
+    }
+
+    DPU_ASSERT(dpu_alloc(nr_alloc, "sgXferEnable=true", &system));
+    nr_dpus = get_nr_dpus(system);
+
+    if (pow2 && (nr_dpus & (nr_dpus - 1)) != 0) {
+        uint32_t nr_pow2 = 1;
+        while (2*nr_pow2 <= nr_dpus) {
+            nr_pow2 *= 2;
+        }
+        DPU_ASSERT(dpu_free(system));
+        DPU_ASSERT(dpu_alloc(nr_pow2, "sgXferEnable=true", &system));
+        nr_dpus = get_nr_dpus(system);
+    }
+
+    std::cout << "Allocated DPUs: " << nr_dpus << std::endl;
+
+    return nr_dpus;
+}
+
+/*
+Number of rows of a column assigned to each DPU when it is split evenly.
+
+@param rows total number of rows
+@param n number of DPUs
+
+@returns: the rows per DPU, the last DPUs may receive fewer
+*/
+uint64_t split_size(uint64_t rows, uint32_t n) {
+    return (rows + n - 1) / n;
+}
+
+/*
+First row of a column assigned to a DPU when it is split evenly.
+
+@param rows total number of rows
+@param dpu index of the DPU
+@param n number of DPUs
+*/
+uint64_t split_start(uint64_t rows, uint32_t dpu, uint32_t n) {
+    uint64_t start = dpu * split_size(rows, n);
+    return start < rows ? start : rows;
+}
+
+/*
+Number of rows of a column assigned to a DPU when it is split evenly.
+
+@param rows total number of rows
+@param dpu index of the DPU
+@param n number of DPUs
+*/
+uint64_t split_length(uint64_t rows, uint32_t dpu, uint32_t n) {
+    uint64_t start = split_start(rows, dpu, n);
+    uint64_t length = split_size(rows, n);
+    return start + length < rows ? length : rows - start;
+}
 
 /*
 Print vector
@@ -89,47 +350,148 @@ void dist_buf(dpu_set_t &system, std::shared_ptr<arrow::Buffer> &buffer, uint32_
     unsigned dpuIdx;
     DPU_FOREACH (system, dpu, dpuIdx) {
         std::shared_ptr<arrow::Buffer> slice = arrow::SliceBuffer(buffer, (uint64_t) dpuIdx*size_dpu, size_dpu);
-        DPU_ASSERT(dpu_prepare_xfer(dpu, (void *)slice->data()));
+        DPU_CHECK(dpu_prepare_xfer(dpu, (void *)slice->data()));
     }
-    DPU_ASSERT(dpu_push_xfer(system, DPU_XFER_TO_DPU, DstSymbol.c_str(), offset, size_dpu, flag));
+    DPU_CHECK(dpu_push_xfer(system, DPU_XFER_TO_DPU, DstSymbol.c_str(), offset, size_dpu, flag));
+    trace_bytes("to_dpu", (uint64_t) size_dpu * get_nr_dpus(system));
 }
 
 void copy_buf(dpu_set_t &system, std::shared_ptr<arrow::Buffer> &buffer, uint32_t offset, const std::string &DstSymbol, dpu_xfer_flags_t flag) {
     uint32_t size = buffer->size();
-    DPU_ASSERT(dpu_broadcast_to(system, DstSymbol.c_str(), offset, (void*) buffer->mutable_data(), size, flag));
+    DPU_CHECK(dpu_broadcast_to(system, DstSymbol.c_str(), offset, (void*) buffer->mutable_data(), size, flag));
+    trace_bytes("to_dpu", (uint64_t) size * get_nr_dpus(system));
 }
 
-bool get_table_ptr (struct sg_block_info *out, uint32_t dpu_index,
-                              uint32_t block_index, void *args) {
+/*
+Count the blocks a range of rows of a chunked column consists of, one for
+each chunk the range spans.
 
-    if (block_index >= 1) {
-        return false;
+@param column arrow ChunkedArray holding the rows
+@param start first row of the range
+@param length number of rows in the range
+*/
+uint32_t chunk_blocks(const std::shared_ptr<arrow::ChunkedArray> &column, uint64_t start, uint64_t length) {
+    uint32_t blocks = 0;
+    uint64_t chunk_start = 0;
+    for (auto & chunk : column->chunks()) {
+        uint64_t chunk_end = chunk_start + chunk->length();
+        if (chunk_start >= start + length) {
+            break;
+        }
+        if (chunk_end > start && chunk->length() > 0) {
+            blocks++;
+        }
+        chunk_start = chunk_end;
     }
 
-    sg_xfer_context_table *sc_args = reinterpret_cast<sg_xfer_context_table*>(args);
-    auto array = sc_args->column;
-
-    uint64_t start;
-    uint64_t length;
-    if (array->length() % NR_DPU == 0) {
-        start = dpu_index * (array->length()/NR_DPU);
-        length = array->length()/NR_DPU;
-    }
-    else {
-        start = dpu_index * (array->length()/NR_DPU + 1);
-        if (dpu_index < NR_DPU - 1) {
-            length = array->length()/NR_DPU + 1;
+    return blocks;
+}
+
+/*
+Get one block of a range of rows of a chunked column.
+
+@param out block to fill
+@param column arrow ChunkedArray holding the rows
+@param type_size size of one element
+@param start first row of the range
+@param length number of rows in the range
+@param block index of the block within the range
+
+@returns: false if the range consists of fewer blocks
+*/
+bool get_chunk_block(struct sg_block_info *out, const std::shared_ptr<arrow::ChunkedArray> &column,
+                     uint32_t type_size, uint64_t start, uint64_t length, uint32_t block) {
+    uint32_t blocks = 0;
+    uint64_t chunk_start = 0;
+    for (auto & chunk : column->chunks()) {
+        uint64_t chunk_end = chunk_start + chunk->length();
+        if (chunk_start >= start + length) {
+            break;
         }
-        else {
-            length = array->length() % (array->length()/NR_DPU + 1);
+        if (chunk_end > start && chunk->length() > 0) {
+            if (blocks == block) {
+                uint64_t first = start > chunk_start ? start : chunk_start;
+                uint64_t last = start + length < chunk_end ? start + length : chunk_end;
+
+                out->length = (last - first) * type_size;
+                out->addr = (uint8_t*) chunk->data()->GetValues<uint8_t>(1, (chunk->offset() + first - chunk_start) * type_size);
+                return true;
+            }
+            blocks++;
         }
+        chunk_start = chunk_end;
     }
 
-    out->length = length * sc_args->type_size;
-    out->addr = (uint8_t*) array->data()->GetMutableValues<uint8_t>(1, start*sc_args->type_size);
-    //printf("Addr %u %u: %p %u\n", dpu_index, block_index, out->addr, out->length);
+    return false;
+}
 
-    return true;
+/*
+Copy all chunks of a column into one contiguous buffer.
+
+@param column arrow ChunkedArray to copy
+@param type_size size of one element
+@param size size of the buffer to allocate, at least the size of the column
+
+@returns: the allocated buffer
+*/
+std::shared_ptr<arrow::Buffer> concat_chunks(const std::shared_ptr<arrow::ChunkedArray> &column,
+                                             uint32_t type_size, uint64_t size) {
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(size);
+    if (!buffer_try.ok()) {
+        std::cout << "Could not allocate buffer!" << std::endl;
+    }
+    std::shared_ptr<arrow::Buffer> buffer = *std::move(buffer_try);
+
+    uint64_t pos = 0;
+    for (auto & chunk : column->chunks()) {
+        std::memcpy(buffer->mutable_data() + pos,
+                    chunk->data()->GetValues<uint8_t>(1, chunk->offset() * type_size),
+                    chunk->length() * type_size);
+        pos += chunk->length() * type_size;
+    }
+
+    return buffer;
+}
+
+bool get_table_ptr (struct sg_block_info *out, uint32_t dpu_index,
+                              uint32_t block_index, void *args) {
+
+    sg_xfer_context_table *sc_args = reinterpret_cast<sg_xfer_context_table*>(args);
+    auto column = sc_args->column;
+
+    uint64_t start = split_start(column->length(), dpu_index, sc_args->nr_dpus);
+    uint64_t length = split_length(column->length(), dpu_index, sc_args->nr_dpus);
+
+    if (length == 0) {
+        return false;
+    }
+
+    // The rows of a DPU can span several chunks
+    return get_chunk_block(out, column, sc_args->type_size, start, length, block_index);
+}
+
+/*
+Split a chunked column between all DPUs using scatter transfers.
+
+@param system dpus to send to
+@param column arrow ChunkedArray to distribute
+@param DstSymbol dpu destination symbol
+@param offset offset from the dpu destination symbol
+@param flag options for the transfer
+*/
+void scatter_chunked(dpu_set_t system, std::shared_ptr<arrow::ChunkedArray> column,
+                     const std::string &DstSymbol, uint32_t offset, dpu_sg_xfer_flags_t flag) {
+
+    uint32_t type_size = column->type()->layout().buffers[1].byte_width;
+    uint32_t n = get_nr_dpus(system);
+
+    auto slot = sc_args_table.acquire(sg_xfer_context_table({.column = column, .type_size = type_size, .nr_dpus = n}), get_table_ptr);
+
+    uint32_t length = (split_size(column->length(), n) * type_size + 7) & (-8);
+
+    flag = dpu_sg_xfer_flags_t(flag | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
+    sc_args_table.push(system, slot, DPU_XFER_TO_DPU, DstSymbol, offset, length, flag);
+    trace_bytes("to_dpu", (uint64_t) column->length() * type_size);
 }
 
 /*
@@ -146,19 +508,101 @@ void scatter_table(dpu_set_t system, std::shared_ptr<arrow::Table> table,
                 std::string column, const std::string &DstSymbol, uint32_t offset,
                 dpu_sg_xfer_flags_t flag) {
 
-    auto col_data = table->GetColumnByName(column)->chunk(0);
+    scatter_chunked(system, table->GetColumnByName(column), DstSymbol, offset, flag);
+}
 
-    auto dtype = col_data->type();
-    uint32_t type_size = dtype->layout().buffers[1].byte_width;
-    
-    sc_args_table.push_back(sg_xfer_context_table({.column = col_data, .type_size = type_size}));
-    get_block_info.push_back(get_block_t({.f = get_table_ptr, .args = &sc_args_table.back(), .args_size = sizeof(sg_xfer_context_table)}));
+bool get_columns_ptr (struct sg_block_info *out, uint32_t dpu_index,
+                      uint32_t block_index, void *args) {
+
+    sg_xfer_context_columns *sc_args = reinterpret_cast<sg_xfer_context_columns*>(args);
+
+    // Each column is followed by a padding block up to the start of the next
+    // column, empty blocks are skipped
+    uint32_t block = 0;
+    uint64_t dst = 0;
+    for (uint32_t col = 0; col < sc_args->columns.size(); col++) {
+        auto column = sc_args->columns[col];
+        uint32_t type_size = sc_args->type_size[col];
+
+        if (dst < sc_args->col_offset[col]) {
+            if (block == block_index) {
+                out->length = sc_args->col_offset[col] - dst;
+                out->addr = sc_args->padding->mutable_data();
+                return true;
+            }
+            block++;
+        }
 
-    uint32_t length = ((col_data->length()/NR_DPU + 1) * type_size + 7) & (-8);
+        uint64_t start = split_start(column->length(), dpu_index, sc_args->nr_dpus);
+        uint64_t length = split_length(column->length(), dpu_index, sc_args->nr_dpus);
+        dst = sc_args->col_offset[col] + length * type_size;
+
+        uint32_t blocks = chunk_blocks(column, start, length);
+        if (block_index < block + blocks) {
+            return get_chunk_block(out, column, type_size, start, length, block_index - block);
+        }
+        block += blocks;
+    }
+
+    return false;
+}
+
+/*
+Split several columns of a table between all DPUs using a single scatter transfer.
+The columns are packed one after the other into the destination symbol, each
+starting at an 8 byte aligned offset that is the same on every DPU.
+
+@param system dpus to send to
+@param table arrow Table to distribute
+@param columns names of the columns to distribute
+@param DstSymbol dpu destination symbol
+@param offset offset from the dpu destination symbol
+@param flag options for the transfer
+
+@returns: the offset of each column from the dpu destination symbol
+*/
+std::vector<uint32_t> scatter_columns(dpu_set_t system, std::shared_ptr<arrow::Table> table,
+                std::vector<std::string> columns, const std::string &DstSymbol, uint32_t offset,
+                dpu_sg_xfer_flags_t flag) {
+
+    uint32_t n = get_nr_dpus(system);
+    sg_xfer_context_columns sc_args;
+    sc_args.nr_dpus = n;
+
+    uint32_t length = 0;
+    uint32_t max_size = 0;
+    uint64_t bytes = 0;
+    for (auto & column : columns) {
+        auto col_data = table->GetColumnByName(column);
+        uint32_t type_size = col_data->type()->layout().buffers[1].byte_width;
+        uint32_t size = (split_size(col_data->length(), n) * type_size + 7) & (-8);
+        bytes += (uint64_t) col_data->length() * type_size;
+
+        sc_args.columns.push_back(col_data);
+        sc_args.type_size.push_back(type_size);
+        sc_args.col_offset.push_back(length);
+
+        length += size;
+        max_size = size > max_size ? size : max_size;
+    }
+
+    // Source of the gaps left by DPUs holding fewer rows
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(max_size);
+    if (!buffer_try.ok()) {
+        std::cout << "Could not allocate buffer!" << std::endl;
+    }
+    sc_args.padding = *std::move(buffer_try);
+    std::memset(sc_args.padding->mutable_data(), 0, max_size);
+
+    std::vector<uint32_t> col_offset = sc_args.col_offset;
+
+    auto slot = sc_args_columns.acquire(sc_args, get_columns_ptr);
 
     flag = dpu_sg_xfer_flags_t(flag | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_TO_DPU, DstSymbol.c_str(), offset,
-                                length, &get_block_info.back(), flag));
+    sc_args_columns.push(system, slot, DPU_XFER_TO_DPU, DstSymbol, offset, length, flag);
+    trace_bytes("to_dpu", bytes);
+
+    return col_offset;
 }
 
 /*
@@ -175,25 +619,29 @@ void copy_table(dpu_set_t &system, std::shared_ptr<arrow::Table> table,
                 std::string column, const std::string &DstSymbol, uint32_t offset,
                 dpu_xfer_flags_t flag) {
     
-    auto col_array = table->GetColumnByName(column)->chunk(0);
+    auto col_array = table->GetColumnByName(column);
 
     auto dtype = col_array->type();
     uint32_t type_size = dtype->layout().buffers[1].byte_width;
 
     uint32_t length = col_array->length() * type_size;
-    uint8_t* data = col_array->data()->GetMutableValues<uint8_t>(1, 0);
 
-    // Copy the data to a new buffer for padding
+    // Copy the chunks to a new buffer for padding
     uint32_t length_pad = (length + 7) & (-8);
-    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(length_pad);
-    std::shared_ptr<arrow::Buffer> buffer = *std::move(buffer_try);
-
-    std::memcpy(buffer->mutable_data(), data, length);
+    std::shared_ptr<arrow::Buffer> buffer = concat_chunks(col_array, type_size, length_pad);
 
-    DPU_ASSERT(dpu_broadcast_to(system, DstSymbol.c_str(), offset, (void*) buffer->mutable_data(), length_pad, flag));
+    DPU_CHECK(dpu_broadcast_to(system, DstSymbol.c_str(), offset, (void*) buffer->mutable_data(), length_pad, flag));
+    trace_bytes("to_dpu", (uint64_t) length_pad * get_nr_dpus(system));
 }
 
 
+// Callback freeing the copies of dist_table once its transfer completed
+static dpu_error_t free_buffers(struct dpu_set_t rank, uint32_t rank_id, void *arg) {
+    delete reinterpret_cast<arrow::BufferVector*>(arg);
+
+    return DPU_OK;
+}
+
 /*
 Split the column of a table between all DPUs using parallel transfers.
 
@@ -209,30 +657,88 @@ void dist_table(dpu_set_t system, std::shared_ptr<arrow::Table> table,
                 std::string column, const std::string &DstSymbol, uint32_t offset,
                 dpu_xfer_flags_t flag) {
     // Detect buffer size in bytes
-    auto col_data = table->GetColumnByName(column)->chunk(0);
+    auto col_data = table->GetColumnByName(column);
     auto dtype = col_data->type();
 
-    uint64_t length = (col_data->length() / NR_DPU);
+    uint64_t length = (col_data->length() / get_nr_dpus(system));
+    if (length == 0) {
+        return;
+    }
+
+    // Slices spanning several chunks are copied to a contiguous buffer that
+    // has to live until the transfer completes
+    arrow::BufferVector *copies = new arrow::BufferVector();
 
     struct dpu_set_t dpu;
     unsigned dpuIdx;
     DPU_FOREACH (system, dpu, dpuIdx) {
-        std::shared_ptr<arrow::Array> slice = col_data->Slice((uint64_t) dpuIdx * length, length);
+        std::shared_ptr<arrow::ChunkedArray> slice = col_data->Slice((uint64_t) dpuIdx * length, length);
+
+        const T* data;
+        if (slice->num_chunks() == 1) {
+            data = slice->chunk(0)->data()->GetValues<T>(1);
+        } else {
+            copies->push_back(concat_chunks(slice, sizeof(T), length*sizeof(T)));
+            data = reinterpret_cast<const T*>(copies->back()->data());
+        }
 
-        DPU_ASSERT(dpu_prepare_xfer(dpu, (void *)slice->data()->GetValues<T>(1)));
+        dpu_error_t error = dpu_prepare_xfer(dpu, (void *)data);
+        if (error != DPU_OK) {
+            delete copies;
+            dpu_check(error, "dpu_prepare_xfer");
+        }
+    }
+    dpu_error_t error = dpu_push_xfer(system, DPU_XFER_TO_DPU, DstSymbol.c_str(), offset, length*sizeof(T), flag);
+    if (error != DPU_OK) {
+        delete copies;
+        dpu_check(error, "dpu_push_xfer");
     }
-    DPU_ASSERT(dpu_push_xfer(system, DPU_XFER_TO_DPU, DstSymbol.c_str(), offset, length*sizeof(T), flag));
+    trace_bytes("to_dpu", length * sizeof(T) * get_nr_dpus(system));
 
+    if (flag & DPU_XFER_ASYNC) {
+        DPU_CHECK(dpu_callback(system, free_buffers, copies,
+                               dpu_callback_flags_t(DPU_CALLBACK_ASYNC | DPU_CALLBACK_SINGLE_CALL)));
+    } else {
+        delete copies;
+    }
 }
 
+/*
+Copy the same range from all DPUs to one buffer for each DPU. Every rank is
+prepared and transferred by a thread pinned to the NUMA node of the rank.
+
+@param system dpus to copy from
+@param buffer buffers of the dpus, e.g. from alloc_buf_vec
+@param offset offset from the dpu source symbol
+@param SrcSymbol dpu source symbol
+@param flag options for the transfer
+*/
 void get_buf(dpu_set_t &system, arrow::BufferVector &buffer, uint32_t offset, const std::string &SrcSymbol, dpu_xfer_flags_t flag) {
-    struct dpu_set_t dpu;
-    unsigned dpuIdx;
+    std::vector<rank_info> ranks = get_ranks(system);
     unsigned size = buffer[0]->size();
-    DPU_FOREACH (system, dpu, dpuIdx) {
-        DPU_ASSERT(dpu_prepare_xfer(dpu, (void*)buffer[dpuIdx]->data()));
+    // Exceptions cannot leave the parallel loop, the errors of the ranks are checked after it
+    std::vector<dpu_error_t> errors(ranks.size(), DPU_OK);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (uint32_t r = 0; r < ranks.size(); r++) {
+        numa_thread_scope pin(ranks[r].node);
+
+        struct dpu_set_t dpu;
+        unsigned dpuIdx;
+        DPU_FOREACH (ranks[r].rank, dpu, dpuIdx) {
+            if (errors[r] == DPU_OK) {
+                errors[r] = dpu_prepare_xfer(dpu, (void*)buffer[ranks[r].dpu_base + dpuIdx]->data());
+            }
+        }
+        if (errors[r] == DPU_OK) {
+            errors[r] = dpu_push_xfer(ranks[r].rank, DPU_XFER_FROM_DPU, SrcSymbol.c_str(), offset, size, flag);
+        }
     }
-    DPU_ASSERT(dpu_push_xfer(system, DPU_XFER_FROM_DPU, SrcSymbol.c_str(), offset, size, flag));
+    for (dpu_error_t error : errors) {
+        dpu_check(error, "dpu_push_xfer from " + SrcSymbol);
+    }
+    // Counted on the calling thread, the threads of the ranks are outside of its scope
+    trace_bytes("from_dpu", (uint64_t) size * buffer.size());
 }
 
 bool get_buf_ptr (struct sg_block_info *out, uint32_t dpu_index,
@@ -253,12 +759,62 @@ bool get_buf_ptr (struct sg_block_info *out, uint32_t dpu_index,
 void collect_buf(dpu_set_t &system, std::shared_ptr<arrow::Buffer> buffer, uint32_t offset, const std::string &SrcSymbol,
                  uint32_t length, std::vector<uint64_t> buf_offset, dpu_sg_xfer_flags_t flag) {
     
-    sc_args_buf.push_back(sg_xfer_context_buf({.buffer = buffer, .offset = buf_offset}));
-    get_block_info.push_back(get_block_t({.f = get_buf_ptr, .args = &sc_args_buf.back(), .args_size = sizeof(sg_xfer_context_buf)}));
+    auto slot = sc_args_buf.acquire(sg_xfer_context_buf({.buffer = buffer, .offset = buf_offset}), get_buf_ptr);
 
     flag = dpu_sg_xfer_flags_t(flag | DPU_SG_XFER_DISABLE_LENGTH_CHECK);
-    DPU_ASSERT(dpu_push_sg_xfer(system, DPU_XFER_FROM_DPU, SrcSymbol.c_str(), offset,
-                                length, &get_block_info.back(), flag));
+    sc_args_buf.push(system, slot, DPU_XFER_FROM_DPU, SrcSymbol, offset, length, flag);
+    trace_bytes("from_dpu", buf_offset.back() - buf_offset.front());
+}
+
+/*
+Gather a column that is split between the DPUs into one contiguous buffer.
+Only the valid elements of each DPU are transferred, each DPU is padded to
+8 bytes for the transfer and the padding is removed afterwards.
+
+@param system dpus to gather from
+@param type arrow type of the elements
+@param counts number of elements on each dpu
+@param SrcSymbol dpu source symbol
+@param offset offset from the dpu source symbol
+@param prefix filled with the index of the first element of each dpu, followed
+              by the total number of elements
+
+@returns: a single-chunk array with the elements of all DPUs in DPU order
+*/
+std::shared_ptr<arrow::Array> gather_array(dpu_set_t &system, std::shared_ptr<arrow::DataType> type,
+                                           const std::vector<uint64_t> &counts, const std::string &SrcSymbol,
+                                           uint32_t offset, std::vector<uint64_t> &prefix) {
+
+    uint32_t type_size = type->layout().buffers[1].byte_width;
+
+    prefix.assign(counts.size() + 1, 0);
+    std::vector<uint64_t> buf_offset(counts.size() + 1, 0);
+    uint64_t max_length = 0;
+    for (uint32_t dpu = 0; dpu < counts.size(); dpu++) {
+        uint64_t length = (counts[dpu]*type_size + 7) & (-8);
+        prefix[dpu + 1] = prefix[dpu] + counts[dpu];
+        buf_offset[dpu + 1] = buf_offset[dpu] + length;
+        max_length = length > max_length ? length : max_length;
+    }
+
+    arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(buf_offset.back());
+    if (!buffer_try.ok()) {
+        std::cout << "Could not allocate buffer!" << std::endl;
+    }
+    std::shared_ptr<arrow::Buffer> buffer = *std::move(buffer_try);
+
+    collect_buf(system, buffer, offset, SrcSymbol, max_length, buf_offset, DPU_SG_XFER_DEFAULT);
+
+    // Close the gaps left by the padding
+    uint8_t* data = buffer->mutable_data();
+    for (uint32_t dpu = 1; dpu < counts.size(); dpu++) {
+        if (buf_offset[dpu] != prefix[dpu]*type_size) {
+            std::memmove(data + prefix[dpu]*type_size, data + buf_offset[dpu], counts[dpu]*type_size);
+        }
+    }
+
+    auto array_data = arrow::ArrayData::Make(type, prefix.back(), {nullptr, buffer});
+    return arrow::MakeArray(array_data);
 }
 
 template <typename T>
@@ -267,9 +823,10 @@ void dist_vec(dpu_set_t &system, std::vector<std::vector<T>> &buffer, uint32_t o
     unsigned dpuIdx;
     unsigned size = buffer[0].size();
     DPU_FOREACH (system, dpu, dpuIdx) {
-        DPU_ASSERT(dpu_prepare_xfer(dpu, (void*)buffer[dpuIdx].data()));
+        DPU_CHECK(dpu_prepare_xfer(dpu, (void*)buffer[dpuIdx].data()));
     }
-    DPU_ASSERT(dpu_push_xfer(system, DPU_XFER_TO_DPU, DstSymbol.c_str(), offset, size*sizeof(T), flag));
+    DPU_CHECK(dpu_push_xfer(system, DPU_XFER_TO_DPU, DstSymbol.c_str(), offset, size*sizeof(T), flag));
+    trace_bytes("to_dpu", size * sizeof(T) * buffer.size());
 }
 
 template <typename T>
@@ -277,9 +834,10 @@ void get_vec(dpu_set_t &system, std::vector<std::vector<T>> &buffer, uint32_t of
     struct dpu_set_t dpu;
     unsigned dpuIdx;
     DPU_FOREACH (system, dpu, dpuIdx) {
-        DPU_ASSERT(dpu_prepare_xfer(dpu, (void*)buffer[dpuIdx].data()));
+        DPU_CHECK(dpu_prepare_xfer(dpu, (void*)buffer[dpuIdx].data()));
     }
-    DPU_ASSERT(dpu_push_xfer(system, DPU_XFER_FROM_DPU, Src.c_str(), offset, buffer[0].size()*sizeof(T), flag));
+    DPU_CHECK(dpu_push_xfer(system, DPU_XFER_FROM_DPU, Src.c_str(), offset, buffer[0].size()*sizeof(T), flag));
+    trace_bytes("from_dpu", buffer[0].size() * sizeof(T) * buffer.size());
 }
 
 typedef struct sg_xfer_context_2d {
@@ -290,12 +848,13 @@ typedef struct sg_xfer_context_2d {
 static bool get_cpy_ptr_2d(struct sg_block_info *out, uint32_t dpu_index, uint32_t block_index,
                  void *args) {
 
-    if (block_index >= NR_DPU) {
+    sg_xfer_context_2d *sc_args = reinterpret_cast<sg_xfer_context_2d*>(args);
+
+    // One block from each source DPU
+    if (block_index >= (sc_args->partitions).size()) {
         return false;
     }
 
-    sg_xfer_context_2d *sc_args = reinterpret_cast<sg_xfer_context_2d*>(args);
-
     out->length = (sc_args->offset)[block_index][dpu_index + 1] - (sc_args->offset)[block_index][dpu_index];
     out->addr = (sc_args->partitions)[block_index]->mutable_data() + (sc_args->offset)[block_index][dpu_index];
     //printf("Addr %u %u: %p %u\n", dpu_index, block_index, out->addr, out->length);
@@ -325,22 +884,26 @@ static bool get_cpy_ptr_1d(struct sg_block_info *out, uint32_t dpu_index, uint32
 }
 
 /*
-Allocate a vector of arrow::Buffers
+Allocate a vector of arrow::Buffers, one for each DPU, on the NUMA node of
+the rank of the DPU
 
+@param system dpus the buffers are transferred with
 @param size the size of each individual buffer
-@param len the number of buffers
 
 @returns: the allocated vector of buffers
 */
-arrow::BufferVector alloc_buf_vec(uint64_t size, uint64_t len) {
+arrow::BufferVector alloc_buf_vec(dpu_set_t &system, uint64_t size) {
     arrow::BufferVector buffer_vec;
-    for (uint32_t i = 0; i < len; i++) {
-        arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(size);
-        if (!buffer_try.ok()) {
-            std::cout << "Could not allocate buffer!" << std::endl;
+    for (auto &rank : get_ranks(system)) {
+        arrow::MemoryPool *pool = numa_pool(rank.node);
+        for (uint32_t i = 0; i < rank.nr_dpus; i++) {
+            arrow::Result<std::unique_ptr<arrow::Buffer>> buffer_try = arrow::AllocateBuffer(size, pool);
+            if (!buffer_try.ok()) {
+                std::cout << "Could not allocate buffer!" << std::endl;
+            }
+            std::shared_ptr<arrow::Buffer> part_dpu = *std::move(buffer_try);
+            buffer_vec.push_back(part_dpu);
         }
-        std::shared_ptr<arrow::Buffer> part_dpu = *std::move(buffer_try);
-        buffer_vec.push_back(part_dpu);
     }
 
     return buffer_vec;